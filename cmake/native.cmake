@@ -0,0 +1,146 @@
+# SPDX-License-Identifier: MIT
+#
+# Copyright (c) 2020 Roy Spliet, University of Cambridge
+#
+#Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# Ahead-of-time compilation of the kernels for the CLAXON_NATIVE backend, see
+# include/lib/native.h.
+#
+# claxon_native_program(<name> SOURCES <file.cl>... [DEFINES <def>...]
+#                       [FLAGS <flag>...])
+#   Compile one variant of a program, as built by clBuildProgram from the
+#   prelude and the given sources with -D <def> for each define. FLAGS are
+#   passed to clang, e.g. -cl-std=CL2.0. Paths are relative to the source root.
+#
+# claxon_native_link(<target> <name>...)
+#   Link program variants into an executable.
+
+include(CMakeParseArguments)
+
+find_program(CLAXON_CLANG NAMES clang)
+if (NOT CLAXON_CLANG)
+  message(FATAL_ERROR "CLAXON_NATIVE requires clang to compile the kernels")
+endif()
+if (NOT CMAKE_OBJCOPY)
+  message(FATAL_ERROR "CLAXON_NATIVE requires objcopy")
+endif()
+
+set(CLAXON_NATIVE_CFLAGS "-O2" CACHE STRING
+    "Flags for compiling kernels natively, e.g. -O3 -march=native")
+
+# Extensions match what the native device reports, plus fp64 for the double
+# overloads in clc.h
+set(exts -all +cl_khr_fp64 +cl_khr_byte_addressable_store
+    +cl_khr_global_int32_base_atomics +cl_khr_global_int32_extended_atomics
+    +cl_khr_local_int32_base_atomics +cl_khr_local_int32_extended_atomics)
+string(REPLACE ";" "," exts "${exts}")
+set(CLAXON_NATIVE_CLFLAGS -x cl -cl-std=CL1.2 -cl-no-stdinc
+    -Xclang -cl-ext=${exts})
+
+set(CLAXON_NATIVE_DIR ${CMAKE_CURRENT_BINARY_DIR}/native)
+file(MAKE_DIRECTORY ${CLAXON_NATIVE_DIR})
+
+# Kernels include headers from all over the tree
+file(GLOB_RECURSE CLAXON_NATIVE_DEPENDS
+    ${PROJECT_SOURCE_DIR}/src/*.h ${PROJECT_SOURCE_DIR}/src/*.cl)
+
+add_executable(claxon_native_gen src/lib/native/native_gen.c)
+
+function(claxon_native_program name)
+  cmake_parse_arguments(NP "" "" "SOURCES;DEFINES;FLAGS" ${ARGN})
+
+  set(dir ${CLAXON_NATIVE_DIR})
+  set(srcs src/lib/prelude.cl ${NP_SOURCES})
+  set(defs ${NP_DEFINES})
+  if (CLAXON_INSTRUMENT)
+    list(APPEND defs CLAXON_INSTRUMENT)
+  endif()
+
+  set(def_flags "")
+  foreach(def ${defs})
+    list(APPEND def_flags -D${def})
+  endforeach()
+
+  separate_arguments(cflags UNIX_COMMAND "${CLAXON_NATIVE_CFLAGS}")
+
+  # Concatenate the sources like clCreateProgramWithSource does. Only rewrite
+  # the wrapper when it changes, to not rebuild on every configure.
+  set(wrapper "")
+  foreach(src ${srcs})
+    set(wrapper "${wrapper}#include \"${src}\"\n")
+  endforeach()
+  set(old "")
+  if (EXISTS ${dir}/${name}.cl)
+    file(READ ${dir}/${name}.cl old)
+  endif()
+  if (NOT old STREQUAL wrapper)
+    file(WRITE ${dir}/${name}.cl "${wrapper}")
+  endif()
+
+  # C99 inline functions have no external definition, force them inline
+  add_custom_command(OUTPUT ${dir}/${name}.i
+    COMMAND ${CLAXON_CLANG} ${CLAXON_NATIVE_CLFLAGS} ${NP_FLAGS} -E
+        -I ${PROJECT_SOURCE_DIR}
+        -include ${PROJECT_SOURCE_DIR}/src/lib/native/clc.h
+        "-Dinline=__inline__ __attribute__((always_inline))"
+        ${def_flags} -o ${dir}/${name}.i ${dir}/${name}.cl
+    DEPENDS ${dir}/${name}.cl ${CLAXON_NATIVE_DEPENDS}
+    COMMENT "Preprocessing native kernels ${name}"
+    VERBATIM)
+
+  add_custom_command(OUTPUT ${dir}/${name}_dispatch.cl ${dir}/${name}_reg.c
+    COMMAND claxon_native_gen -n ${name} -i ${dir}/${name}.i
+        -o ${dir}/${name}_dispatch.cl -r ${dir}/${name}_reg.c
+        -D "${defs}" ${srcs}
+    WORKING_DIRECTORY ${PROJECT_SOURCE_DIR}
+    DEPENDS claxon_native_gen ${dir}/${name}.i ${CLAXON_NATIVE_DEPENDS}
+    COMMENT "Generating native dispatch for ${name}"
+    VERBATIM)
+
+  # Variants define the same kernels, keep only the entry points global
+  add_custom_command(OUTPUT ${dir}/${name}.o
+    COMMAND ${CLAXON_CLANG} ${CLAXON_NATIVE_CLFLAGS} ${NP_FLAGS} ${cflags}
+        -fPIC -c -o ${dir}/${name}_full.o ${dir}/${name}_dispatch.cl
+    COMMAND ${CMAKE_OBJCOPY}
+        --keep-global-symbol=claxon_native_dispatch_${name}
+        --keep-global-symbol=claxon_native_sizes_${name}
+        ${dir}/${name}_full.o ${dir}/${name}.o
+    DEPENDS ${dir}/${name}_dispatch.cl ${dir}/${name}.i
+    COMMENT "Compiling native kernels ${name}"
+    VERBATIM)
+
+  # Executables share the outputs, build them once
+  add_custom_target(native_${name}
+    DEPENDS ${dir}/${name}.o ${dir}/${name}_reg.c)
+  set_property(GLOBAL APPEND PROPERTY CLAXON_NATIVE_PROGRAMS ${name})
+endfunction()
+
+function(claxon_native_link target)
+  foreach(name ${ARGN})
+    set_source_files_properties(${CLAXON_NATIVE_DIR}/${name}.o
+        PROPERTIES EXTERNAL_OBJECT TRUE GENERATED TRUE)
+    set_source_files_properties(${CLAXON_NATIVE_DIR}/${name}_reg.c
+        PROPERTIES GENERATED TRUE)
+    target_sources(${target} PRIVATE ${CLAXON_NATIVE_DIR}/${name}.o
+        ${CLAXON_NATIVE_DIR}/${name}_reg.c)
+    add_dependencies(${target} native_${name})
+  endforeach()
+endfunction()
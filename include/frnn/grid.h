@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FRNN_GRID_H
+#define FRNN_GRID_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Uniform 3D grid over a set of points, with points sorted by cell.
+ *
+ * Points are stored as struct-of-arrays, x[elems] y[elems] z[elems]. A point
+ * lands in cell floor(p * scale) along every axis, cell indices are
+ * linearised as x + (y * dim) + (z * dim * dim).
+ */
+struct grid {
+	/** Cells per dimension */
+	cl_uint dim;
+	/** Cells per unit of the input coordinates */
+	cl_float scale;
+	/** Clamp points outside the grid to the edge cells instead of
+	 * dropping them */
+	bool clamp;
+
+	/** Number of cells, dim^3 */
+	size_t cells;
+	/** Number of points that landed in the grid */
+	size_t elems;
+	/** Number of points per cell, cl_uint[cells] */
+	cl_mem cell_elems;
+	/** Offset of the first point of each cell in the sorted buffer,
+	 * idx_t[cells] */
+	cl_mem cell_start;
+};
+
+/**
+ * Set up a grid description. No device resources are allocated.
+ *
+ * @param g Grid to initialise
+ * @param dim Number of cells per dimension
+ * @param scale Cells per unit of the input coordinates
+ * @param clamp True to clamp outlying points to the edge cells, false to drop
+ * 	them from the sorted output.
+ */
+void grid_init(struct grid *g, cl_uint dim, cl_float scale, bool clamp);
+
+/**
+ * Bin points into the grid and sort them by cell.
+ *
+ * Counts the points per cell using work-group private histograms in local
+ * memory, scans the counts into cell offsets and scatters the points into a
+ * new buffer. Fills in cell_elems, cell_start and elems of g.
+ * @param ctx OpenCL context
+ * @param q Command queue
+ * @param g Grid, set up with grid_init
+ * @param elems Number of input points
+ * @param in Input points, float[3][elems]
+ * @param time_ns If non-NULL, print the time of each stage and add their
+ * 	total to this counter.
+ * @return Sorted points, float[3][g->elems], NULL on failure.
+ */
+cl_mem grid_build(cl_context ctx, cl_command_queue q, struct grid *g,
+		size_t elems, cl_mem in, cl_ulong *time_ns);
+
+/**
+ * Release the cell ranges of a grid built with grid_build.
+ *
+ * @param g Grid
+ */
+void grid_release(struct grid *g);
+
+#endif /* FRNN_GRID_H */
@@ -23,8 +23,17 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <lib/opencl.h>
 
 size_t prefix_sum_elems_ceil(cl_context ctx, size_t elems, size_t *wgs);
 cl_mem prefix_sum(cl_context ctx, cl_command_queue q, cl_mem in, size_t elems,
 		cl_ulong *time);
+
+/* Build the prefix sum program once, for repeated prefix_sum_prg calls */
+cl_program prefix_sum_compile(cl_context ctx);
+cl_mem prefix_sum_prg(cl_context ctx, cl_command_queue q, cl_program prg,
+		cl_mem in, size_t elems, cl_ulong *time);
+
+/* Print the time of every pass, on by default */
+void prefix_sum_verbose(bool enable);
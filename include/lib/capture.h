@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_CAPTURE_H
+#define LIB_CAPTURE_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/*
+ * Kernel launch capture, selected with the -X option.
+ *
+ * lib/opencl.h routes clSetKernelArg, clSetKernelArgSVMPointer,
+ * clEnqueueNDRangeKernel and clReleaseKernel through the wrappers below.
+ * When capturing, a launch is recorded with the sources and build options of
+ * its program, its NDRange, its argument values, and the contents of every
+ * buffer argument before and after the launch. src/clreplay re-executes
+ * recorded launches in isolation.
+ *
+ * File layout, in host byte order. Strings are a uint32 length followed by
+ * the characters, blobs a uint64 length followed by the bytes:
+ *   "CLXCAP01"
+ *   Records, each a uint32 CAPTURE_REC_* type followed by
+ *   - PROGRAM: uint32 id, uint32 sources, (string name, blob text) per
+ *     source, string build options
+ *   - LAUNCH: uint32 program id, string kernel, uint32 dimensions,
+ *     uint64 global offset[3], global size[3], local size[3] (0 if NULL),
+ *     uint32 buffers, (blob before, uint32 changed, blob after if changed)
+ *     per buffer, uint32 arguments, (uint32 CAPTURE_ARG_* kind, uint64 size,
+ *     then the value bytes for values, or a uint32 buffer index for buffers)
+ *     per argument
+ */
+
+#define CAPTURE_MAGIC		"CLXCAP01"
+
+#define CAPTURE_REC_PROGRAM	1
+#define CAPTURE_REC_LAUNCH	2
+
+/** Argument passed by value */
+#define CAPTURE_ARG_VALUE	0
+/** Buffer argument, refers to one of the launch's buffers */
+#define CAPTURE_ARG_BUFFER	1
+/** __local argument, only the size is recorded */
+#define CAPTURE_ARG_LOCAL	2
+/** NULL buffer */
+#define CAPTURE_ARG_NULL	3
+
+/**
+ * Enable capture, selected with the -X option.
+ *
+ * The file is created when the first launch is recorded. Forked variants,
+ * e.g. with -u each, write to <file>.<pid>.
+ * @param file Path of the capture file
+ * @param limit Launches to record per kernel, 0 for all.
+ */
+void opencl_capture_enable(const char *file, unsigned int limit);
+
+/**
+ * Whether capture is enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_capture_enabled(void);
+
+/**
+ * Remember the sources and build options of a program for capture.
+ *
+ * Called by opencl_compile_program_opts. Does nothing unless enabled.
+ * @param prg Program
+ * @param n Number of sources
+ * @param names Source file names
+ * @param sources Source texts
+ * @param options Build options
+ */
+void opencl_capture_program(cl_program prg, cl_uint n, const char **names,
+		const char **sources, const char *options);
+
+/**
+ * Close the capture file and print how many launches were recorded. Called
+ * by opencl_teardown.
+ */
+void opencl_capture_report(void);
+
+/**
+ * Record kernel arguments as they are set, even when not capturing. Required
+ * by opencl_capture_clone_kernel.
+ */
+void opencl_capture_track_args(void);
+
+/**
+ * Create a new kernel object for the same kernel, with the same arguments.
+ *
+ * Arguments must have been set after opencl_capture_track_args.
+ * @param kernel Kernel to clone
+ * @return New kernel, NULL on failure.
+ */
+cl_kernel opencl_capture_clone_kernel(cl_kernel kernel);
+
+/**
+ * Find the buffer arguments of a kernel.
+ *
+ * Arguments must have been set after opencl_capture_track_args, and the
+ * program built with -cl-kernel-arg-info.
+ * @param kernel Kernel
+ * @param n_args Number of arguments of the kernel
+ * @param mems Per argument the buffer, NULL for other arguments
+ * @return 0 on success, -1 if not all arguments are known.
+ */
+int opencl_capture_buffer_args(cl_kernel kernel, cl_uint n_args,
+		cl_mem *mems);
+
+/** clSetKernelArg, recording the argument when capturing. */
+cl_int opencl_capture_set_kernel_arg(cl_kernel kernel, cl_uint idx,
+		size_t size, const void *value);
+
+/** clSetKernelArgSVMPointer. Launches with SVM arguments are not recorded,
+ * the data they point to cannot be snapshot. */
+cl_int opencl_capture_set_kernel_arg_svm(cl_kernel kernel, cl_uint idx,
+		const void *ptr);
+
+/** clReleaseKernel, forgetting everything recorded about the kernel. The
+ * kernels of this repository are never retained, every release destroys the
+ * kernel. */
+cl_int opencl_capture_release_kernel(cl_kernel kernel);
+
+/** clEnqueueNDRangeKernel, recording the launch when capturing. */
+cl_int opencl_capture_enqueue_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local, cl_uint n_events, const cl_event *events,
+		cl_event *event);
+
+#endif /* LIB_CAPTURE_H */
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_CMDBUF_H
+#define LIB_CMDBUF_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/*
+ * Command sequences recorded once and replayed every iteration, selected with
+ * the -B option.
+ *
+ * The first iteration runs directly, while every command is also recorded.
+ * With cl_khr_command_buffer the recording is a command-buffer, replayed
+ * with a single clEnqueueCommandBufferKHR. Otherwise each kernel command gets
+ * its own kernel object with its arguments set up front, such that replay
+ * only enqueues. Without -B, all calls run the commands directly.
+ *
+ * Typical use:
+ *	cb = opencl_cmdbuf_create(q, "name");
+ *	for each iteration:
+ *		ret = opencl_cmdbuf_replay(cb, &time);
+ *		if (ret > 0)
+ *			continue;
+ *		opencl_cmdbuf_kernel(cb, q, ...) etc. in place of clEnqueue*
+ *		opencl_cmdbuf_end(cb);
+ *	opencl_cmdbuf_release(cb);
+ */
+
+/** Recorded command sequence */
+struct opencl_cmdbuf;
+
+/**
+ * Enable recording, selected with the -B option.
+ *
+ * @param mode "auto" to use cl_khr_command_buffer if available, "prebuilt" to
+ * 	always use per-command kernel objects.
+ * @return 0 on success, -EINVAL for an unknown mode.
+ */
+int opencl_cmdbuf_enable(const char *mode);
+
+/**
+ * Whether recording is enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_cmdbuf_enabled(void);
+
+/**
+ * Start a command sequence.
+ *
+ * @param q In-order command queue the sequence runs on, the same queue must
+ * 	be passed to the commands
+ * @param name Name in the report. Must remain valid until teardown.
+ * @return Sequence, NULL if recording is disabled or failed. NULL is valid
+ * 	for all other opencl_cmdbuf_* functions, which then run commands
+ * 	directly.
+ */
+struct opencl_cmdbuf *opencl_cmdbuf_create(cl_command_queue q,
+		const char *name);
+
+/**
+ * Replay the sequence if it was recorded, and wait for it to complete.
+ *
+ * @param cb Sequence
+ * @param time Device execution time of the whole sequence in nanoseconds
+ * @return 1 if replayed, 0 if the caller must run the commands, negative on
+ * 	error.
+ */
+int opencl_cmdbuf_replay(struct opencl_cmdbuf *cb, cl_ulong *time);
+
+/**
+ * clEnqueueNDRangeKernel, recording the launch with its current arguments.
+ * Arguments may be changed between recorded launches.
+ */
+cl_int opencl_cmdbuf_kernel(struct opencl_cmdbuf *cb, cl_command_queue q,
+		cl_kernel kernel, cl_uint dim, const size_t *offset,
+		const size_t *global, const size_t *local, cl_event *event);
+
+/** clEnqueueCopyBuffer, recording the copy. */
+cl_int opencl_cmdbuf_copy(struct opencl_cmdbuf *cb, cl_command_queue q,
+		cl_mem src, cl_mem dst, size_t src_offset, size_t dst_offset,
+		size_t size);
+
+/** clEnqueueFillBuffer, recording the fill. */
+cl_int opencl_cmdbuf_fill(struct opencl_cmdbuf *cb, cl_command_queue q,
+		cl_mem buf, const void *pattern, size_t pattern_size,
+		size_t offset, size_t size);
+
+/**
+ * Finish recording. Subsequent opencl_cmdbuf_replay calls replay.
+ *
+ * On failure the sequence falls back to running directly.
+ * @param cb Sequence
+ * @return CL_SUCCESS, or the error that prevented recording.
+ */
+cl_int opencl_cmdbuf_end(struct opencl_cmdbuf *cb);
+
+/**
+ * Release the recording. Statistics are kept for the report.
+ *
+ * @param cb Sequence
+ */
+void opencl_cmdbuf_release(struct opencl_cmdbuf *cb);
+
+/**
+ * Print the host time spent submitting each sequence directly and when
+ * replayed. Called by opencl_teardown.
+ */
+void opencl_cmdbuf_report(void);
+
+#endif /* LIB_CMDBUF_H */
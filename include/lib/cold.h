@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_COLD_H
+#define LIB_COLD_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/*
+ * Cold-start accounting. Every kernel launch that returns an event is noted
+ * by the enqueue wrapper in lib/capture.c, and opencl_exec_time attributes
+ * the measured time to the first or the steady-state launches of that
+ * kernel. opencl_teardown prints both side by side.
+ */
+
+/**
+ * Enable cold launches, selected with the -Z option.
+ *
+ * @param launches Number of cold launches per kernel
+ */
+void opencl_cold_enable(unsigned int launches);
+
+/**
+ * Whether cold launches are enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_cold_enabled(void);
+
+/**
+ * Note a kernel launch, called by the enqueue wrapper.
+ *
+ * @param kernel Kernel
+ * @param event Event of the launch
+ */
+void opencl_cold_launched(cl_kernel kernel, cl_event event);
+
+/**
+ * Forget a kernel that is being released, called by the release wrapper.
+ * Its timings are kept, a new kernel reusing the handle starts anew.
+ *
+ * @param kernel Kernel
+ */
+void opencl_cold_released(cl_kernel kernel);
+
+/**
+ * Attribute the execution time of a launch to its kernel, called by
+ * opencl_exec_time. Ignored for events of other commands.
+ *
+ * @param event Event of the launch
+ * @param start Start of the launch in ns
+ * @param end End of the launch in ns
+ */
+void opencl_cold_account(cl_event event, cl_ulong start, cl_ulong end);
+
+/**
+ * Launch a kernel on a fresh kernel object with fresh copies of its buffers,
+ * after evicting host and device caches, and print the execution time and
+ * latency of these cold launches next to the steady state.
+ *
+ * Does nothing unless enabled. Only host caches and device caches that a
+ * large buffer copy passes through are evicted.
+ * @param q Command queue
+ * @param kernel Kernel
+ * @param dim Number of work dimensions
+ * @param offset Global work offset, may be NULL
+ * @param global Global work size
+ * @param local Local work size, may be NULL
+ */
+void opencl_cold_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local);
+
+/** Print first-launch and steady-state times per kernel name. Kernels
+ * created more than once report the mean of their first launches. */
+void opencl_cold_report(void);
+
+/**
+ * Mean execution time of a timed kernel, steady state if available. Kernels
+ * remain available after opencl_cold_report.
+ *
+ * @param i Index of the kernel, from 0
+ * @param name Location to store the kernel name
+ * @param mean Location to store the mean execution time in ns
+ * @return true if the kernel exists, false if i is past the last kernel.
+ */
+bool opencl_cold_kernel_time(unsigned int i, const char **name,
+		double *mean);
+
+#endif /* LIB_COLD_H */
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_COMPILE_H
+#define LIB_COMPILE_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Enable compile-time measurements, selected with the -J option.
+ *
+ * Also asks the known OpenCL implementations not to cache binaries across
+ * runs, so must be called before the context is created.
+ * @param builds Number of builds per program
+ */
+void opencl_compile_enable(unsigned int builds);
+
+/**
+ * Whether compile-time measurements are enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_compile_enabled(void);
+
+/**
+ * Build a program repeatedly and print the build time, the compile
+ * throughput, the binary size and the resource usage of its kernels.
+ *
+ * Does nothing unless enabled. Every build gets a unique -D option, such that
+ * in-memory and persistent compiler caches cannot be hit.
+ * @param ctx Context
+ * @param n Number of sources
+ * @param sources Source texts
+ * @param options Build options
+ * @param label Name of the program in the report
+ * @return 0 on success, -1 if a build failed.
+ */
+int opencl_compile_bench(cl_context ctx, cl_uint n, const char **sources,
+		const char *options, const char *label);
+
+#endif /* LIB_COMPILE_H */
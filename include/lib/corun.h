@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_CORUN_H
+#define LIB_CORUN_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/** Memory access pattern of a host co-runner */
+typedef enum {
+	OPENCL_CORUN_READ = 0,
+	OPENCL_CORUN_WRITE,
+	OPENCL_CORUN_RANDOM,
+	OPENCL_CORUN_THRASH,
+	OPENCL_CORUN_COUNT,
+} clCorunKind;
+
+/**
+ * Enable co-runner slowdown curves, selected with the -K option.
+ *
+ * @param spec <kind>[:<threads>[:<MB/s>]], kind being read, write, random or
+ * 	thrash. Threads defaults to all but one CPU, the bandwidth per thread
+ * 	to 0 for unthrottled.
+ * @return 0 on success, -EINVAL if the spec is malformed.
+ */
+int opencl_corun_enable(char *spec);
+
+/**
+ * Whether co-runner slowdown curves are enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_corun_enabled(void);
+
+/**
+ * Time a kernel with 0 up to the configured number of host co-runner threads
+ * hammering memory, and print its slowdown at every step.
+ *
+ * Does nothing unless enabled. Every step runs the kernel for at least the
+ * configured number of iterations and 100 ms, one launch at a time.
+ * @param q Command queue
+ * @param kernel Kernel
+ * @param dim Number of work dimensions
+ * @param offset Global work offset, may be NULL
+ * @param global Global work size
+ * @param local Local work size, may be NULL
+ */
+void opencl_corun_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local);
+
+#endif /* LIB_CORUN_H */
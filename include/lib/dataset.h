@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_DATASET_H
+#define LIB_DATASET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Handle for a dataset that is being loaded on a worker thread.
+ *
+ * Obtained from one of the dataset_load_* functions, consumed by
+ * dataset_wait. The target buffer must not be touched before dataset_wait
+ * returns.
+ */
+struct dataset;
+
+/**
+ * Asynchronously read n 32-bit words from a binary file into a buffer.
+ *
+ * Equivalent to bin_file_read, but returns immediately.
+ * @param file path and name of file to read words from
+ * @param n Number of words to read
+ * @param buf pointer to location where newly allocated buffer pointer must
+ * 	be stored
+ * @return Handle to wait on, NULL if the worker could not be started.
+ */
+struct dataset *dataset_load_bin(char *file, size_t n, void **buf);
+
+/**
+ * Asynchronously read all floats from a CSV file.
+ *
+ * Equivalent to csv_file_read_float, but returns immediately.
+ * @param file path and name of file to read words from
+ * @param buf pointer to location where newly allocated buffer pointer must
+ * 	be stored
+ * @return Handle to wait on, NULL if the worker could not be started.
+ */
+struct dataset *dataset_load_csv_float(char *file, float **buf);
+
+/**
+ * Asynchronously read all n-tuples of floats from a CSV file.
+ *
+ * Equivalent to csv_file_read_float_n, but returns immediately.
+ * @param file path and name of file to read words from
+ * @param n Number of entries in a tuple.
+ * @param buf pointer to location where newly allocated buffer pointer must
+ * 	be stored
+ * @return Handle to wait on, NULL if the worker could not be started.
+ */
+struct dataset *dataset_load_csv_float_n(char *file, int n, float ***buf);
+
+/**
+ * Block until a dataset has been loaded, then release the handle.
+ *
+ * @param ds Handle returned by one of the dataset_load_* functions.
+ * @return For binary files 0 on success, non-zero on failure. For CSV files
+ * 	the number of elements or tuples read, negative on failure.
+ */
+int64_t dataset_wait(struct dataset *ds);
+
+/**
+ * Block until all outstanding datasets have been loaded.
+ *
+ * Handles remain valid and must still be passed to dataset_wait. Worker
+ * threads are reaped, so it is safe to fork() after this call.
+ */
+void dataset_quiesce(void);
+
+/**
+ * Print how long the datasets took to load, and how much of that time was
+ * hidden behind context creation and program compilation.
+ */
+void dataset_report(void);
+
+#endif /* LIB_DATASET_H */
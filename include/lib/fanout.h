@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_FANOUT_H
+#define LIB_FANOUT_H
+
+/**
+ * Run the remainder of the benchmark once per variant, each in a separate
+ * process.
+ *
+ * Variants run one after the other. In each child process, setup is called
+ * with the variant index, after which fanout_run returns and the benchmark
+ * carries on as usual. The parent waits for every child to exit, prints a
+ * table of the kernel time and output error each of them reported and exits.
+ * It never returns. Outstanding dataset loads are completed before forking.
+ * @param title Header of the variant column in the summary
+ * @param variants Number of variants
+ * @param labels Name of each variant
+ * @param setup Callback configuring the library for the given variant
+ */
+void fanout_run(const char *title, unsigned int variants, const char **labels,
+		void (*setup)(unsigned int variant));
+
+/**
+ * Run the remainder of the benchmark once per variant, first in isolation and
+ * then all variants concurrently.
+ *
+ * Like fanout_run, but after running each variant on its own all variants are
+ * started at the same time. The concurrent children wait for each other in
+ * fanout_barrier before launching their first kernel. The summary reports
+ * the throughput of each variant in both phases and the resulting scaling
+ * efficiency.
+ * @param title Header of the variant column in the summary
+ * @param variants Number of variants
+ * @param labels Name of each variant
+ * @param setup Callback configuring the library for the given variant
+ */
+void fanout_run_scaling(const char *title, unsigned int variants,
+		const char **labels, void (*setup)(unsigned int variant));
+
+/**
+ * Wait until every concurrent child of fanout_run_scaling is ready to launch
+ * kernels.
+ *
+ * Called by the kernel enqueue wrapper before each launch, returns
+ * immediately after the first call and outside of concurrent children.
+ */
+void fanout_barrier(void);
+
+/**
+ * Run the remainder of the benchmark once per variant and report the variants
+ * that trade off speed against accuracy best.
+ *
+ * Like fanout_run, but after the summary prints for each kernel the Pareto
+ * front of its mean execution time versus the maximum relative output error
+ * of the variant. Errors are per variant, as outputs are not attributed to
+ * kernels. Variants that failed are left out.
+ * @param title Header of the variant column in the summary
+ * @param variants Number of variants
+ * @param labels Name of each variant
+ * @param descs Description of each variant, printed with the front
+ * @param setup Callback configuring the library for the given variant
+ */
+void fanout_run_pareto(const char *title, unsigned int variants,
+		const char **labels, const char **descs,
+		void (*setup)(unsigned int variant));
+
+#endif /* LIB_FANOUT_H */
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_INSTR_H
+#define LIB_INSTR_H
+
+#include "lib/opencl.h"
+
+/*
+ * Per work-item workload counters.
+ *
+ * Only available when built with the CLAXON_INSTRUMENT CMake option, which
+ * also passes -D CLAXON_INSTRUMENT to every kernel. Otherwise these functions
+ * are empty and kernels compile without their counter parameter, see
+ * INSTR_PARAM in src/lib/prelude.cl.
+ */
+
+/** Counters of one instrumented kernel */
+struct instr;
+
+#if defined(CLAXON_INSTRUMENT)
+
+/**
+ * Allocate counters for an instrumented kernel.
+ *
+ * @param ctx OpenCL context
+ * @param kernel Kernel name, used for reporting
+ * @param counters Comma-separated counter names, in the order of the counter
+ * 	indices passed to INSTR_ADD
+ * @param items Number of work-items launched, the product of all global
+ * 	work sizes
+ * @return Counter handle, NULL on failure.
+ */
+struct instr *instr_create(cl_context ctx, const char *kernel,
+		const char *counters, size_t items);
+
+/**
+ * Zero the counters and bind them to the kernel's INSTR_PARAM argument.
+ *
+ * Counters accumulate over all launches until the next call.
+ * @param in Counter handle
+ * @param q Command queue
+ * @param k Instrumented kernel
+ * @param arg Index of the INSTR_PARAM argument, the kernel's last.
+ * @return CL_SUCCESS, or an error code if in is NULL or cannot be bound.
+ */
+cl_int instr_set_arg(struct instr *in, cl_command_queue q, cl_kernel k,
+		cl_uint arg);
+
+/**
+ * Print mean, maximum, divergence within work-groups and a histogram of each
+ * counter per work-item and launch.
+ *
+ * @param in Counter handle
+ * @param q Command queue
+ * @param launches Number of launches since instr_set_arg
+ */
+void instr_report(struct instr *in, cl_command_queue q,
+		unsigned int launches);
+
+/**
+ * Release counters.
+ *
+ * @param in Counter handle, may be NULL.
+ */
+void instr_release(struct instr *in);
+
+#else
+
+static inline struct instr *
+instr_create(cl_context ctx, const char *kernel, const char *counters,
+		size_t items)
+{
+	return NULL;
+}
+
+static inline cl_int
+instr_set_arg(struct instr *in, cl_command_queue q, cl_kernel k,
+		cl_uint arg)
+{
+	return CL_SUCCESS;
+}
+
+static inline void
+instr_report(struct instr *in, cl_command_queue q, unsigned int launches)
+{
+}
+
+static inline void
+instr_release(struct instr *in)
+{
+}
+
+#endif /* CLAXON_INSTRUMENT */
+
+#endif /* LIB_INSTR_H */
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_LATENCY_H
+#define LIB_LATENCY_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Enable latency distribution measurements, selected with the -W option.
+ *
+ * @param runs Number of synchronised launches per kernel
+ * @param csv Path of a CSV file to export the histograms to, may be NULL.
+ */
+void opencl_latency_enable(unsigned int runs, const char *csv);
+
+/**
+ * Pin the measuring thread to a CPU while measuring latencies (-A).
+ *
+ * @param cpu CPU index
+ */
+void opencl_latency_pin(int cpu);
+
+/**
+ * Run the measuring thread with the highest SCHED_FIFO priority while
+ * measuring latencies (-F). Needs CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+ */
+void opencl_latency_fifo(void);
+
+/**
+ * Whether latency measurements are enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_latency_enabled(void);
+
+/**
+ * Launch a kernel repeatedly, waiting for each launch to complete, and print
+ * the distribution of its execution and response times.
+ *
+ * Does nothing unless enabled. Execution times come from event profiling,
+ * response times from the host clock between enqueue and completion. Both
+ * are recorded in log-linear histograms with under 1% relative error, the
+ * minimum and maximum are exact. Execution times above the Tukey far-out
+ * fence, Q3 + 3 * IQR but at least 1% above Q3, are flagged as outliers with
+ * their run numbers.
+ * @param q Command queue
+ * @param kernel Kernel
+ * @param dim Number of work dimensions
+ * @param offset Global work offset, may be NULL
+ * @param global Global work size
+ * @param local Local work size, may be NULL
+ */
+void opencl_latency_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local);
+
+/** Close the histogram CSV file, if any. */
+void opencl_latency_report(void);
+
+#endif /* LIB_LATENCY_H */
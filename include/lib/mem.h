@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_MEM_H
+#define LIB_MEM_H
+
+#include <stddef.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Create a buffer and account for its size.
+ *
+ * Drop-in replacement for clCreateBuffer. Live bytes, peak bytes and the
+ * number of allocations are tracked per stage, see opencl_mem_stage.
+ * @param ctx OpenCL context
+ * @param flags Memory flags
+ * @param size Size of the buffer in bytes
+ * @param host_ptr Host pointer, as for clCreateBuffer
+ * @param error Error code, may be NULL
+ * @return The buffer, NULL on failure.
+ */
+cl_mem opencl_create_buffer(cl_context ctx, cl_mem_flags flags, size_t size,
+		void *host_ptr, cl_int *error);
+
+/**
+ * Release a buffer created with opencl_create_buffer.
+ *
+ * Drop-in replacement for clReleaseMemObject.
+ * @param buf Buffer
+ * @return Return value of clReleaseMemObject.
+ */
+cl_int opencl_release_buffer(cl_mem buf);
+
+/**
+ * Account for an allocation made through other means, e.g. SVM.
+ *
+ * @param key Handle or pointer identifying the allocation
+ * @param size Size of the allocation in bytes
+ */
+void opencl_mem_track(const void *key, size_t size);
+
+/**
+ * Stop accounting for an allocation registered with opencl_mem_track.
+ *
+ * @param key Handle or pointer identifying the allocation
+ */
+void opencl_mem_untrack(const void *key);
+
+/**
+ * Attribute subsequent allocations to a named stage.
+ *
+ * Allocations made before the first call are attributed to "main". Returning
+ * to a stage by name continues its statistics.
+ * @param name Name of the stage. Must remain valid until teardown.
+ */
+void opencl_mem_stage(const char *name);
+
+/**
+ * Return the peak number of device bytes allocated at any one time.
+ *
+ * @param allocs If non-NULL, set to the total number of allocations.
+ * @return Peak size of live allocations in bytes.
+ */
+size_t opencl_mem_peak(unsigned int *allocs);
+
+/**
+ * Print the per-stage allocation statistics. Called by opencl_teardown.
+ */
+void opencl_mem_report(void);
+
+#endif /* LIB_MEM_H */
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_NATIVE_H
+#define LIB_NATIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Native execution of the kernels on the host CPU.
+ *
+ * With the CLAXON_NATIVE CMake option the suite links against
+ * src/lib/native/native.c instead of an OpenCL ICD. Each program variant is
+ * compiled ahead of time by clang's OpenCL C front-end for the host, with the
+ * builtins supplied by src/lib/native/clc.h. native_gen describes every such
+ * variant with the structures below, and registers it before main() runs.
+ * clBuildProgram then picks the variant whose sources and -D options match.
+ */
+
+/** Kernel calls barrier(), directly or through a helper. Work-items run as
+ * fibers that yield at each barrier. */
+#define NATIVE_KERNEL_BARRIER	(1 << 0)
+/** Kernel declares __local variables, which the host compiler allocates
+ * statically. Work-groups must not run concurrently. */
+#define NATIVE_KERNEL_SERIAL	(1 << 1)
+
+/** Kinds of kernel arguments, one character per argument */
+#define NATIVE_ARG_GLOBAL	'g'
+#define NATIVE_ARG_LOCAL	'l'
+#define NATIVE_ARG_VALUE	'v'
+
+/** Kernel in a natively compiled program */
+struct native_kernel_desc {
+	/** Kernel function name */
+	const char *name;
+	/** Argument kinds, NATIVE_ARG_* */
+	const char *args;
+	/** NATIVE_KERNEL_* flags */
+	unsigned int flags;
+};
+
+/** Natively compiled program variant */
+struct native_program_desc {
+	/** Variant name given to claxon_native_program() */
+	const char *name;
+	/** Sorted, space separated -D options the variant was built with */
+	const char *defines;
+	/** Number of source files, including the prelude */
+	unsigned int n_sources;
+	/** native_hash() of each source file, in order */
+	const uint64_t *sources;
+	/** Number of kernels */
+	unsigned int n_kernels;
+	const struct native_kernel_desc *kernels;
+	/** Run kernel k for the current work-item. args[i] points to the value
+	 * of argument i, for pointers the pointer itself. */
+	void (*dispatch)(unsigned int k, void **args);
+	/** Store the size of each argument of kernel k in sz */
+	void (*sizes)(unsigned int k, size_t *sz);
+};
+
+/**
+ * Make a program variant available to clBuildProgram.
+ *
+ * Called from the constructors generated by native_gen.
+ * @param desc Program description, must remain valid.
+ */
+void native_program_register(const struct native_program_desc *desc);
+
+/**
+ * FNV-1a hash of a kernel source, used to match the sources passed to
+ * clCreateProgramWithSource to the files a variant was compiled from.
+ * @param buf Source text
+ * @param len Length of buf in bytes
+ * @return 64-bit hash.
+ */
+static inline uint64_t
+native_hash(const char *buf, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char) buf[i];
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+/** Maximum number of -D options told apart by native_defines() */
+#define NATIVE_DEFINES_MAX	64
+
+/**
+ * Extract the -D options from a build option string, sorted and separated by
+ * single spaces, such that equivalent option strings compare equal.
+ * CLAXON_BUILD_NONCE, which only defeats compiler caches, is left out.
+ * @param opts Build options, e.g. "-I . -D A -DB=1"
+ * @param out Buffer for the normalised defines, "A B=1"
+ * @param len Size of out in bytes
+ * @return 0 on success, -1 if the defines do not fit.
+ */
+static inline int
+native_defines(const char *opts, char *out, size_t len)
+{
+	const char *def[NATIVE_DEFINES_MAX];
+	size_t def_len[NATIVE_DEFINES_MAX];
+	const char *tmp;
+	size_t l, tmp_len, pos = 0;
+	unsigned int n = 0, i, j;
+	int cmp;
+
+	while (opts && *opts) {
+		opts += strspn(opts, " ");
+		if (opts[0] != '-' || opts[1] != 'D') {
+			opts += strcspn(opts, " ");
+			continue;
+		}
+
+		opts += 2;
+		opts += strspn(opts, " ");
+		l = strcspn(opts, " ");
+		if (l == 0)
+			continue;
+		if (!strncmp(opts, "CLAXON_BUILD_NONCE", 18)) {
+			opts += l;
+			continue;
+		}
+		if (n == NATIVE_DEFINES_MAX)
+			return -1;
+
+		/* Insertion sort, there are only a handful */
+		for (i = n; i > 0; i--) {
+			tmp = def[i - 1];
+			tmp_len = def_len[i - 1];
+			cmp = memcmp(tmp, opts, tmp_len < l ? tmp_len : l);
+			if (cmp < 0 || (cmp == 0 && tmp_len <= l))
+				break;
+			def[i] = tmp;
+			def_len[i] = tmp_len;
+		}
+		def[i] = opts;
+		def_len[i] = l;
+		n++;
+		opts += l;
+	}
+
+	for (j = 0; j < n; j++) {
+		if (pos + (j ? 1 : 0) + def_len[j] >= len)
+			return -1;
+		if (j)
+			out[pos++] = ' ';
+		memcpy(&out[pos], def[j], def_len[j]);
+		pos += def_len[j];
+	}
+	if (len == 0)
+		return -1;
+	out[pos] = '\0';
+
+	return 0;
+}
+
+#endif /* LIB_NATIVE_H */
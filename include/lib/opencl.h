@@ -25,8 +25,11 @@
 #ifndef LIB_OPENCL_H
 #define LIB_OPENCL_H
 
-/* We're targeting Clover amongst other APIs */
+/* We're targeting Clover amongst other APIs. Translation units using newer
+ * API features may define a higher target before inclusion. */
+#ifndef CL_TARGET_OPENCL_VERSION
 #define CL_TARGET_OPENCL_VERSION 120
+#endif
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <CL/opencl.h>
 
@@ -34,13 +37,28 @@
 
 /** Command line options parsed by opencl_parse_option. Concatenate to your
  * own optargs to make use of library-provided options. */
-#define OPENCL_OPTS "P:d:I:c"
+#define OPENCL_OPTS "P:d:I:cp:s:u:x:R:X:B:T:W:A:FK:L:Z:J:O:E:"
 
 typedef enum {
 	OPENCL_ERROR_ABS,
 	OPENCL_ERROR_FRAC,
 } clErrorMarginType;
 
+/** Floating point precision of the real type in kernels, selected with -p */
+typedef enum {
+	OPENCL_PRECISION_HALF = 0,
+	OPENCL_PRECISION_SINGLE,
+	OPENCL_PRECISION_DOUBLE,
+	OPENCL_PRECISION_COUNT,
+} clPrecision;
+
+/** Width of the idx_t type in kernels, selected with -x */
+typedef enum {
+	OPENCL_INDEX_AUTO = 0,
+	OPENCL_INDEX_32,
+	OPENCL_INDEX_64,
+} clIndexWidth;
+
 /**
  * Return true iff the user requested for the output buffer(s) to be validated
  * @return true iff output buffers should be compared.
@@ -55,10 +73,141 @@ bool opencl_compare_output(void);
  */
 unsigned int opencl_get_iterations(void);
 
+/**
+ * Declare that this benchmark's kernels and host buffers use the real type.
+ *
+ * Must be called before opencl_create_context. Without it, requesting a
+ * precision other than single precision is an error.
+ */
+void opencl_real_enable(void);
+
+/**
+ * Return the precision kernels are compiled for.
+ * @return The precision of the real type.
+ */
+clPrecision opencl_precision(void);
+
+/**
+ * Return the size of a single real value in device buffers.
+ * @return Size of real in bytes.
+ */
+size_t opencl_real_size(void);
+
+/**
+ * Convert an array of floats to the current real type.
+ *
+ * @param dst Destination buffer, elems * opencl_real_size() bytes large
+ * @param src Single precision source values
+ * @param elems Number of elements to convert
+ */
+void opencl_real_from_float(void *dst, const float *src, size_t elems);
+
+/**
+ * Convert an array of the current real type to floats.
+ *
+ * @param dst Single precision destination buffer
+ * @param src Source values, elems * opencl_real_size() bytes large
+ * @param elems Number of elements to convert
+ */
+void opencl_real_to_float(float *dst, const void *src, size_t elems);
+
+/**
+ * Upload an array of floats into a buffer of reals.
+ *
+ * Converts to the current precision on the host. The write is blocking.
+ * @param q Command queue
+ * @param buf Destination buffer, at least elems reals large
+ * @param elems Number of elements to upload
+ * @param src Single precision source values
+ * @return CL_SUCCESS on success, error code otherwise.
+ */
+cl_int opencl_write_real(cl_command_queue q, cl_mem buf, size_t elems,
+		const float *src);
+
+/**
+ * Set a real kernel argument from a single precision value.
+ *
+ * @param kernel Kernel
+ * @param idx Argument index
+ * @param val Value, converted to the current precision
+ * @return Return value of clSetKernelArg.
+ */
+cl_int opencl_set_kernel_arg_real(cl_kernel kernel, cl_uint idx, float val);
+
+/**
+ * Declare that this benchmark's kernels use idx_t for element indices.
+ *
+ * Must be called before opencl_create_context. Without it, selecting an index
+ * width is an error.
+ */
+void opencl_index_enable(void);
+
+/**
+ * Select the index width required for an input of elems elements.
+ *
+ * Programs are compiled with 32-bit indices unless 64-bit indices were forced
+ * with -x. In auto mode, 64-bit indices are selected iff elems does not fit
+ * 32 bits. Programs compiled before this call must be recompiled if the width
+ * changed.
+ * @param elems Number of elements the kernels must be able to index
+ * @return 1 if the width changed, 0 if not, negative if the forced width
+ * 	cannot index elems elements.
+ */
+int opencl_index_select(size_t elems);
+
+/**
+ * Return the size of a single idx_t value in device buffers.
+ * @return Size of idx_t in bytes.
+ */
+size_t opencl_index_size(void);
+
+/**
+ * Set an idx_t kernel argument.
+ *
+ * @param kernel Kernel
+ * @param idx Argument index
+ * @param val Value, truncated to 32 bits for 32-bit indices
+ * @return Return value of clSetKernelArg.
+ */
+cl_int opencl_set_kernel_arg_idx(cl_kernel kernel, cl_uint idx, size_t val);
+
+/**
+ * Upload an array of 32-bit indices into a buffer of idx_t.
+ *
+ * Widens to 64 bits on the host if required. The write is blocking.
+ * @param q Command queue
+ * @param buf Destination buffer, at least elems idx_t large
+ * @param elems Number of elements to upload
+ * @param src Source values
+ * @return CL_SUCCESS on success, error code otherwise.
+ */
+cl_int opencl_write_idx(cl_command_queue q, cl_mem buf, size_t elems,
+		const cl_int *src);
+
+/**
+ * Read the i-th element of a host copy of an idx_t buffer.
+ *
+ * @param buf Host copy of the buffer
+ * @param i Element to read
+ * @return The element, sign-extended.
+ */
+cl_long opencl_index_get(const void *buf, size_t i);
+
+/**
+ * Print the resource usage of a kernel.
+ *
+ * Reports the maximum work-group size, private and local memory use. These
+ * are the closest portable indicators of register pressure.
+ * @param kernel Kernel
+ */
+void opencl_kernel_resources(cl_kernel kernel);
+
 /**
  * Create an OpenCL context for the platform and device specified by the P and
  * d optargs.
  *
+ * If a partition was requested with the s optarg, the device is split into
+ * sub-devices and the context is created for the one selected with u.
  * If need be, one can manually call opencl_parse_option with the 'P' and 'd'
  * characters to hard-code values.
  * @return OpenCL context
@@ -89,6 +238,41 @@ cl_command_queue opencl_create_cmdqueue(cl_context ctx);
 cl_program opencl_compile_program(cl_context ctx, cl_uint source_cnt,
 		const char **source_files);
 
+/**
+ * Compile an OpenCL program from one or more source files, passing extra
+ * build options.
+ *
+ * Like opencl_compile_program, appending options to the default options.
+ * @param ctx OpenCL context
+ * @param source_cnt Number of entries in the source file list
+ * @param source_files List of source file paths/names to compile
+ * @param options Additional build options, e.g. "-cl-std=CL2.0", or NULL.
+ * @return The compiled program, or  NULL if compilation failed.
+ */
+cl_program opencl_compile_program_opts(cl_context ctx, cl_uint source_cnt,
+		const char **source_files, const char *options);
+
+/**
+ * Return the device the context was created for.
+ * @return The device, NULL before opencl_create_context was called.
+ */
+cl_device_id opencl_get_device(void);
+
+/**
+ * Run the optional extra measurements of a kernel: -T, -W, -K, -L and -Z.
+ *
+ * The kernel runs with its current arguments, so call this after the output
+ * was validated.
+ * @param q Command queue
+ * @param kernel Kernel
+ * @param dim Number of work dimensions
+ * @param offset Global work offset, may be NULL
+ * @param global Global work size
+ * @param local Local work size, may be NULL
+ */
+void opencl_kernel_measure(cl_command_queue q, cl_kernel kernel, cl_uint dim,
+		const size_t *offset, const size_t *global, const size_t *local);
+
 /**
  * Destroy the context, command queue and program
  *
@@ -103,11 +287,38 @@ void opencl_teardown(cl_context *ctx, cl_command_queue *q,  cl_program *prg);
  * Obtain the execution time of a kernel run
  *
  * Provided an event handler pointer was passed to the kernel execution call.
+ * The first launch of each kernel is reported apart from the others at
+ * teardown, see lib/cold.h.
  * @param time Time event taken from the OpenCL kernel execute invocation.
  * @return Time of execution in nanoseconds.
  */
 cl_ulong opencl_exec_time(cl_event time);
 
+/**
+ * Return the accumulated execution time of all kernel runs.
+ *
+ * Sums all times returned by opencl_exec_time.
+ * @param kernels If non-NULL, set to the number of runs included in the sum.
+ * @return Total execution time in nanoseconds.
+ */
+cl_ulong opencl_total_exec_time(unsigned int *kernels);
+
+/**
+ * Return the largest error encountered by the opencl_compare_out_* functions.
+ *
+ * @param abs Largest absolute error.
+ * @param rel Largest error relative to the reference value.
+ * @return false iff no output was compared.
+ */
+bool opencl_max_error(double *abs, double *rel);
+
+/**
+ * Test whether the device supports an OpenCL extension.
+ * @param ext Name of the extension.
+ * @return true iff the extension is in the device's extension string.
+ */
+bool opencl_device_has_extension(const char *ext);
+
 /** Queries the device for the maximum number of work-items in a work-group.
  * @return the maximum number of work-items in a work-group.
  */
@@ -120,6 +331,14 @@ size_t opencl_max_workgroup_size();
  */
 int opencl_parse_option(int c, char *optarg);
 
+/**
+ * Download a buffer of reals and write it to a CSV file as floats.
+ *
+ * @param q Command queue
+ * @param out Buffer containing output values
+ * @param file CSV file to write
+ * @param elems Number of elements to write
+ */
 void opencl_download_float_csv(cl_command_queue q, cl_mem out, char *file,
 		size_t elems);
 
@@ -154,4 +373,15 @@ int opencl_compare_out_bin(cl_command_queue q, cl_mem out, char *file,
 /** Print the library's parameter usage guidelines to stdout. */
 void opencl_usage();
 
+/* Kernel arguments, launches and releases go through lib/capture.c, see -X.
+ * The wrappers themselves define OPENCL_CAPTURE_IMPL. */
+#ifndef OPENCL_CAPTURE_IMPL
+#define clSetKernelArg			opencl_capture_set_kernel_arg
+#define clSetKernelArgSVMPointer	opencl_capture_set_kernel_arg_svm
+#define clEnqueueNDRangeKernel		opencl_capture_enqueue_kernel
+#define clReleaseKernel			opencl_capture_release_kernel
+#endif
+
+#include "lib/capture.h"
+
 #endif /* LIB_OPENCL_H */
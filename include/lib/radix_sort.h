@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_RADIX_SORT_H
+#define LIB_RADIX_SORT_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/** Compiled radix sort for one key width and payload */
+struct radix_sort;
+
+/**
+ * Compile a radix sort.
+ *
+ * Keys are unsigned integers, values are cl_uint. At most 2^32 - 1 elements
+ * can be sorted. The kernels are built for the index width selected at the
+ * time of the call.
+ * @param ctx OpenCL context
+ * @param key64 True for cl_ulong keys, false for cl_uint keys
+ * @param values True to move a value along with each key
+ * @return Sort handle, NULL on failure.
+ */
+struct radix_sort *radix_sort_create(cl_context ctx, bool key64,
+		bool values);
+
+/**
+ * Stable sort of keys, and values if enabled, in place.
+ *
+ * @param r Sort handle
+ * @param q Command queue
+ * @param keys Keys to sort
+ * @param values Values to permute along with keys, ignored if the sort was
+ * 	created without values.
+ * @param elems Number of keys
+ * @param key_bits Number of low-order key bits to sort on, 0 for all
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int radix_sort_run(struct radix_sort *r, cl_command_queue q, cl_mem keys,
+		cl_mem values, size_t elems, unsigned int key_bits,
+		cl_ulong *time_ns);
+
+/**
+ * Stable sort of each segment of keys, and values if enabled, in place.
+ *
+ * Only supported for 32-bit keys. Segment s spans the elements
+ * [seg_offsets[s], seg_offsets[s + 1]), the last segment ends at elems.
+ * @param r Sort handle, created with 32-bit keys
+ * @param q Command queue
+ * @param keys Keys to sort
+ * @param values Values to permute along with keys, ignored if the sort was
+ * 	created without values.
+ * @param seg_offsets Start offset of every segment, cl_uint[segs],
+ * 	ascending, seg_offsets[0] must be 0.
+ * @param segs Number of segments
+ * @param elems Number of keys
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int radix_sort_segments(struct radix_sort *r, cl_command_queue q,
+		cl_mem keys, cl_mem values, cl_mem seg_offsets, size_t segs,
+		size_t elems, cl_ulong *time_ns);
+
+/**
+ * Run the optional extra measurements of opencl_kernel_measure on the
+ * kernels of the last radix_sort_run or radix_sort_segments call.
+ *
+ * The in-place digit scan is left out. So is the scatter when an odd number
+ * of passes copied the sorted keys over its input.
+ * @param r Sort handle
+ * @param q Command queue
+ */
+void radix_sort_measure(struct radix_sort *r, cl_command_queue q);
+
+/**
+ * Release a radix sort and its scratch buffers.
+ *
+ * @param r Sort handle
+ */
+void radix_sort_release(struct radix_sort *r);
+
+#endif /* LIB_RADIX_SORT_H */
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_REDUCE_H
+#define LIB_REDUCE_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/** Reduction operator */
+typedef enum {
+	REDUCE_SUM = 0,
+	REDUCE_MIN,
+	REDUCE_MAX,
+	REDUCE_ARGMAX,
+	REDUCE_OPS,
+} clReduceOp;
+
+/** Element type of the reduced buffer */
+typedef enum {
+	REDUCE_FLOAT = 0,
+	REDUCE_INT,
+	REDUCE_TYPES,
+} clReduceType;
+
+/**
+ * Result of a reduction, as laid out in device memory.
+ *
+ * Only argmax results carry an index, the index of the maximum relative to
+ * the start of its segment. Other operators store the bare value, so
+ * per-segment results of those are tightly packed cl_float or cl_int.
+ */
+struct reduce_result {
+	union {
+		cl_float f;
+		cl_int i;
+	} val;
+	cl_uint idx;
+};
+
+/** Compiled reduction for one operator and element type */
+struct reduce;
+
+/**
+ * Compile a reduction.
+ *
+ * The kernels are built for the index width selected at the time of the
+ * call, recreate the reduction after opencl_index_select changes it.
+ * @param ctx OpenCL context
+ * @param op Reduction operator
+ * @param type Element type
+ * @param subgroups Reduce within sub-groups first, ignored if the device
+ * 	does not support cl_khr_subgroups.
+ * @return Reduction handle, NULL on failure.
+ */
+struct reduce *reduce_create(cl_context ctx, clReduceOp op,
+		clReduceType type, bool subgroups);
+
+/**
+ * Size of one per-segment result in device memory.
+ *
+ * @param r Reduction handle
+ * @return sizeof(cl_float) or sizeof(cl_int), or 8 bytes for argmax.
+ */
+size_t reduce_result_size(struct reduce *r);
+
+/**
+ * Reduce a buffer to a scalar.
+ *
+ * @param r Reduction handle
+ * @param q Command queue
+ * @param in Input buffer
+ * @param elems Number of elements in in
+ * @param res Pointer to store the result in
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int reduce_run(struct reduce *r, cl_command_queue q, cl_mem in,
+		size_t elems, struct reduce_result *res, cl_ulong *time_ns);
+
+/**
+ * Reduce consecutive segments of a buffer independently.
+ *
+ * @param r Reduction handle
+ * @param q Command queue
+ * @param in Input buffer, segs * seg_elems elements
+ * @param seg_elems Number of elements per segment
+ * @param segs Number of segments
+ * @param out Output buffer, segs * reduce_result_size(r) bytes
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int reduce_segments(struct reduce *r, cl_command_queue q, cl_mem in,
+		size_t seg_elems, size_t segs, cl_mem out, cl_ulong *time_ns);
+
+/**
+ * Run the optional extra measurements of opencl_kernel_measure on the
+ * kernels of the last reduce_run or reduce_segments call.
+ *
+ * @param r Reduction handle
+ * @param q Command queue
+ */
+void reduce_measure(struct reduce *r, cl_command_queue q);
+
+/**
+ * Release a reduction and its scratch buffers.
+ *
+ * @param r Reduction handle
+ */
+void reduce_release(struct reduce *r);
+
+#endif /* LIB_REDUCE_H */
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_ROOFLINE_H
+#define LIB_ROOFLINE_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Enable roofline reporting, selected with the -R option.
+ *
+ * @param csv Path of the CSV file to export to, NULL to only print.
+ */
+void opencl_roofline_enable(const char *csv);
+
+/**
+ * Whether roofline reporting is enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_roofline_enabled(void);
+
+/**
+ * Account a kernel launch against an analytic model of its work.
+ *
+ * Does nothing unless roofline reporting is enabled. Launches are aggregated
+ * by name.
+ * @param name Name of the kernel. Must remain valid until teardown.
+ * @param flops Floating point operations performed by the launch
+ * @param bytes Compulsory DRAM traffic of the launch in bytes, assuming every
+ * 	input is read and every output written exactly once
+ * @param time_ns Execution time of the launch, as from opencl_exec_time
+ */
+void opencl_roofline_kernel(const char *name, double flops, double bytes,
+		cl_ulong time_ns);
+
+/**
+ * Measure peak arithmetic throughput and memory bandwidth of the device, then
+ * print achieved rates, arithmetic intensity and fraction of the roofline
+ * for each kernel. Called by opencl_teardown.
+ *
+ * @param ctx OpenCL context
+ * @param q Command queue
+ */
+void opencl_roofline_report(cl_context ctx, cl_command_queue q);
+
+#endif /* LIB_ROOFLINE_H */
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_SMALLMAT_H
+#define LIB_SMALLMAT_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/*
+ * Batched small dense matrix operations.
+ *
+ * All buffers hold float batches as struct of arrays: element k of matrix n
+ * is stored at index k * batch + n. Symmetric matrices are packed, storing
+ * the upper triangle row by row, 6 elements for 3x3 and 21 for 6x6. Matrices
+ * that cannot be inverted or solved produce NaN results.
+ *
+ * Kernels running on a single matrix from within another OpenCL program can
+ * include src/lib/smallmat_device.h directly.
+ */
+
+/** Compiled small matrix kernels */
+struct smallmat;
+
+/**
+ * Compile the small matrix kernels.
+ *
+ * The kernels are built for the index width selected at the time of the
+ * call, recreate the handle after opencl_index_select changes it.
+ * @param ctx OpenCL context
+ * @return Handle, NULL on failure.
+ */
+struct smallmat *smallmat_create(cl_context ctx);
+
+/**
+ * Invert a batch of 3x3 matrices.
+ *
+ * @param s Small matrix handle
+ * @param q Command queue
+ * @param batch Number of matrices
+ * @param in Input buffer, 9 elements per matrix, or 6 if sym is set
+ * @param out Output buffer, 9 elements per matrix
+ * @param sym Input matrices are packed symmetric
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int smallmat_inv3(struct smallmat *s, cl_command_queue q, size_t batch,
+		cl_mem in, cl_mem out, bool sym, cl_ulong *time_ns);
+
+/**
+ * Solve a batch of symmetric positive-definite 6x6 systems a x = b through
+ * Cholesky factorisation.
+ *
+ * @param s Small matrix handle
+ * @param q Command queue
+ * @param batch Number of systems
+ * @param a Packed symmetric matrices, 21 elements per system
+ * @param b Right-hand sides, 6 elements per system
+ * @param x Solutions, 6 elements per system
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int smallmat_solve6(struct smallmat *s, cl_command_queue q, size_t batch,
+		cl_mem a, cl_mem b, cl_mem x, cl_ulong *time_ns);
+
+/**
+ * Eigendecomposition of a batch of symmetric 3x3 matrices.
+ *
+ * @param s Small matrix handle
+ * @param q Command queue
+ * @param batch Number of matrices
+ * @param a Packed symmetric matrices, 6 elements per matrix
+ * @param w Eigenvalues in ascending order, 3 elements per matrix
+ * @param v Row-major matrices of eigenvectors, one per column, 9 elements per
+ * 	matrix
+ * @param time_ns If non-NULL, add the kernel execution time to this counter.
+ * @return 0 on success, -1 on failure.
+ */
+int smallmat_eig3(struct smallmat *s, cl_command_queue q, size_t batch,
+		cl_mem a, cl_mem w, cl_mem v, cl_ulong *time_ns);
+
+/**
+ * Run the optional extra measurements of opencl_kernel_measure on every
+ * kernel launched so far, with the arguments of its last launch.
+ *
+ * @param s Small matrix handle
+ * @param q Command queue
+ */
+void smallmat_measure(struct smallmat *s, cl_command_queue q);
+
+/**
+ * Release the small matrix kernels.
+ *
+ * @param s Small matrix handle
+ */
+void smallmat_release(struct smallmat *s);
+
+#endif /* LIB_SMALLMAT_H */
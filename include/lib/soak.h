@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_SOAK_H
+#define LIB_SOAK_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Enable soak runs, selected with the -L option.
+ *
+ * @param spec <seconds>[:<window seconds>[:<file>]], the window defaulting
+ * 	to one second. Per-window samples are exported to file as CSV.
+ * @return 0 on success, -EINVAL if the spec is malformed.
+ */
+int opencl_soak_enable(char *spec);
+
+/**
+ * Whether soak runs are enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_soak_enabled(void);
+
+/**
+ * Launch a kernel back to back for the configured duration, sampling its
+ * throughput, the CPU frequencies and the thermal zone temperatures every
+ * window. Print the throughput drift, the steady state and the time until
+ * the kernel throttled.
+ *
+ * Does nothing unless enabled. Throughput counts as throttled once a window
+ * falls 5% below the best window so far.
+ * @param q Command queue
+ * @param kernel Kernel
+ * @param dim Number of work dimensions
+ * @param offset Global work offset, may be NULL
+ * @param global Global work size
+ * @param local Local work size, may be NULL
+ */
+void opencl_soak_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local);
+
+/** Close the soak CSV file, if any. */
+void opencl_soak_report(void);
+
+#endif /* LIB_SOAK_H */
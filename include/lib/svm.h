@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_SVM_H
+#define LIB_SVM_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/** Shared virtual memory support level of the device */
+typedef enum {
+	OPENCL_SVM_NONE = 0,
+	OPENCL_SVM_COARSE,
+	OPENCL_SVM_FINE,
+} clSvmGranularity;
+
+/**
+ * Query the finest SVM granularity supported by the device.
+ *
+ * Requires an OpenCL 2.0 device. Call after opencl_create_context.
+ * @return Finest supported buffer granularity, OPENCL_SVM_NONE if SVM is not
+ * 	supported.
+ */
+clSvmGranularity opencl_svm_caps(void);
+
+/**
+ * Allocate a shared virtual memory buffer.
+ *
+ * @param ctx OpenCL context
+ * @param size Size of the allocation in bytes
+ * @param gran Granularity of the buffer, must be supported by the device
+ * @return Pointer valid on host and device, NULL on failure.
+ */
+void *opencl_svm_alloc(cl_context ctx, size_t size, clSvmGranularity gran);
+
+/**
+ * Free a buffer allocated with opencl_svm_alloc.
+ *
+ * @param ctx OpenCL context
+ * @param ptr Pointer returned by opencl_svm_alloc
+ */
+void opencl_svm_free(cl_context ctx, void *ptr);
+
+/**
+ * Pass an SVM pointer as kernel argument.
+ *
+ * @param kernel Kernel
+ * @param idx Argument index
+ * @param ptr Pointer into an SVM allocation
+ * @return Return value of clSetKernelArgSVMPointer.
+ */
+cl_int opencl_svm_set_kernel_arg(cl_kernel kernel, cl_uint idx,
+		const void *ptr);
+
+/**
+ * Map an SVM buffer for host access. Blocking.
+ *
+ * Required for coarse-grained buffers before the host touches them, harmless
+ * for fine-grained buffers.
+ * @param q Command queue
+ * @param ptr Pointer to the SVM allocation
+ * @param size Size of the region to map in bytes
+ * @param write True if the host will write to the region
+ * @return CL_SUCCESS on success, error code otherwise.
+ */
+cl_int opencl_svm_map(cl_command_queue q, void *ptr, size_t size, bool write);
+
+/**
+ * Unmap an SVM buffer previously mapped with opencl_svm_map.
+ *
+ * @param q Command queue
+ * @param ptr Pointer to the SVM allocation
+ * @return CL_SUCCESS on success, error code otherwise.
+ */
+cl_int opencl_svm_unmap(cl_command_queue q, void *ptr);
+
+#endif /* LIB_SVM_H */
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_SWEEP_H
+#define LIB_SWEEP_H
+
+#include <stdbool.h>
+
+/*
+ * Build option sweeps, selected with -O and -E. The benchmark runs once per
+ * combination of options, each in its own process, and the options are
+ * appended to those of every program it builds. The parent reports per
+ * kernel the combinations on the Pareto front of kernel time versus maximum
+ * output error, which requires -c.
+ */
+
+/**
+ * Set the build options that are toggled independently, each combination of
+ * them is run (-O).
+ *
+ * @param list Comma separated options, or "default" for
+ * 	-cl-fast-relaxed-math, -cl-mad-enable, -cl-no-signed-zeros and
+ * 	-cl-denorms-are-zero. Modified in place.
+ * @return 0 on success, -EINVAL if there are too many options.
+ */
+int opencl_sweep_flags(char *list);
+
+/**
+ * Set mutually exclusive build options, e.g. -cl-std variants or vendor
+ * flags (-E). Every combination of -O options is run without any of them and
+ * with each of them in turn.
+ *
+ * @param list Comma separated options, modified in place.
+ * @return 0 on success, -EINVAL if there are too many options.
+ */
+int opencl_sweep_alternatives(char *list);
+
+/**
+ * Whether a sweep was requested and has not started yet.
+ *
+ * @return true if opencl_sweep_run must be called.
+ */
+bool opencl_sweep_pending(void);
+
+/**
+ * Run the remainder of the benchmark once per combination of build options.
+ *
+ * Returns in the child process of each combination, see fanout_run. The
+ * parent prints the Pareto fronts and exits.
+ */
+void opencl_sweep_run(void);
+
+/**
+ * Build options of the combination this process runs.
+ *
+ * @return Options, each preceded by a space, "" outside of sweeps.
+ */
+const char *opencl_sweep_options(void);
+
+#endif /* LIB_SWEEP_H */
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIB_THROUGHPUT_H
+#define LIB_THROUGHPUT_H
+
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+
+/**
+ * Enable throughput measurements, selected with the -T option.
+ *
+ * @param launches Number of launches enqueued back to back per kernel
+ * @param callback Collect launch times from clSetEventCallback as launches
+ * 	complete, rather than querying all events after the last one.
+ */
+void opencl_throughput_enable(unsigned int launches, bool callback);
+
+/**
+ * Whether throughput measurements are enabled.
+ *
+ * @return true if enabled.
+ */
+bool opencl_throughput_enabled(void);
+
+/**
+ * Enqueue a kernel back to back without synchronising in between, then print
+ * the sustained kernels/s and work-items/s.
+ *
+ * Does nothing unless enabled. The kernel runs with its current arguments,
+ * so call this after the output was validated.
+ * @param q Command queue
+ * @param kernel Kernel
+ * @param dim Number of work dimensions
+ * @param offset Global work offset, may be NULL
+ * @param global Global work size
+ * @param local Local work size, may be NULL
+ */
+void opencl_throughput_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local);
+
+#endif /* LIB_THROUGHPUT_H */
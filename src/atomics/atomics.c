@@ -0,0 +1,423 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+
+enum atomics_variant {
+	ATOMICS_CAS = 0,
+	ATOMICS_NATIVE,
+	ATOMICS_INT,
+	ATOMICS_LOCAL,
+	ATOMICS_VARIANTS,
+};
+
+static const char *variant_kernels[ATOMICS_VARIANTS] = {
+	[ATOMICS_CAS] = "atomics_cas",
+	[ATOMICS_NATIVE] = "atomics_native",
+	[ATOMICS_INT] = "atomics_int",
+	[ATOMICS_LOCAL] = "atomics_local",
+};
+
+static const char *variant_names[ATOMICS_VARIANTS] = {
+	[ATOMICS_CAS] = "CAS",
+	[ATOMICS_NATIVE] = "Native",
+	[ATOMICS_INT] = "Int",
+	[ATOMICS_LOCAL] = "Local",
+};
+
+#define ATOMICS_MAX_STEPS 32
+
+void usage(char *prg)
+{
+	printf("%s\n", prg);
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-n <items>\t Number of work-items, default 1048576\n");
+	printf("\t-o <ops>\t Atomic additions per work-item, default 16\n");
+	printf("\t-a <addrs>\t Highest number of addresses to sweep up to,\n"
+	       "\t\t\t default: one per work-item\n");
+	opencl_usage();
+}
+
+/**
+ * Number of additions each address receives. Work-item n adds to address
+ * (n + i) % addrs in operation i, so the addresses that work-items beyond
+ * the last whole multiple of addrs start at receive a few more.
+ * @param expect Per address the expected number of additions
+ * @return The highest number of additions of any address, 0 on failure.
+ */
+static uint64_t
+atomics_expect(uint64_t *expect, size_t items, cl_uint addrs, cl_uint ops)
+{
+	const uint64_t rem = items % addrs;
+	const cl_uint span = ops % addrs;
+	int64_t *diff;
+	int64_t run = 0;
+	uint64_t max = 0;
+	cl_uint a, r;
+
+	for (a = 0; a < addrs; a++)
+		expect[a] = (uint64_t) ops * (items / addrs) +
+				(uint64_t) (ops / addrs) * rem;
+
+	diff = calloc(addrs + 1, sizeof(int64_t));
+	if (!diff)
+		return 0;
+
+	/* Residue r < rem has one more work-item, which adds once to each of
+	 * the span addresses following r on top of the whole cycles */
+	for (r = 0; r < rem && span; r++) {
+		diff[r]++;
+		if (r + span <= addrs) {
+			diff[r + span]--;
+		} else {
+			diff[addrs]--;
+			diff[0]++;
+			diff[r + span - addrs]--;
+		}
+	}
+
+	for (a = 0; a < addrs; a++) {
+		run += diff[a];
+		expect[a] += run;
+		if (expect[a] > max)
+			max = expect[a];
+	}
+	free(diff);
+
+	return max;
+}
+
+/**
+ * Run one variant at one contention level.
+ * @param valid Cleared if output validation is enabled and fails.
+ * @return Average execution time in ns, 0 on failure.
+ */
+static cl_ulong
+atomics_run(cl_command_queue q, cl_kernel kernel, enum atomics_variant v,
+		cl_mem dst, size_t items, size_t ldim, cl_uint addrs,
+		cl_uint ops, bool *valid)
+{
+	cl_int error;
+	cl_event time;
+	cl_ulong time_total = 0ul;
+	const cl_uint mask = addrs - 1;
+	const cl_int zero = 0;
+	unsigned int i;
+	int32_t *out;
+	uint64_t *expect;
+	uint64_t sum, max;
+	float fsum;
+
+	error  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst);
+	error |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &mask);
+	error |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &ops);
+	if (v == ATOMICS_LOCAL)
+		error |= clSetKernelArg(kernel, 3, addrs * sizeof(cl_float),
+				NULL);
+	if (error != CL_SUCCESS) {
+		printf("One of the arguments could not be set: %d.\n", error);
+		return 0;
+	}
+
+	for (i = 0; i < opencl_get_iterations(); i++) {
+		clEnqueueFillBuffer(q, dst, &zero, sizeof(cl_int), 0,
+				addrs * sizeof(cl_int), 0, NULL, NULL);
+
+		error = clEnqueueNDRangeKernel(q, kernel, 1, NULL, &items,
+				&ldim, 0, NULL, &time);
+		if (error != CL_SUCCESS) {
+			printf("Could not enqueue kernel execution: %d\n",
+					error);
+			return 0;
+		}
+		clFinish(q);
+
+		time_total += opencl_exec_time(time);
+		clReleaseEvent(time);
+	}
+
+	if (!opencl_compare_output())
+		return time_total / opencl_get_iterations();
+
+	out = malloc(addrs * sizeof(int32_t));
+	expect = malloc(addrs * sizeof(uint64_t));
+	if (!out || !expect) {
+		printf("Could not allocate output buffer\n");
+		free(out);
+		free(expect);
+		return 0;
+	}
+
+	clEnqueueReadBuffer(q, dst, CL_TRUE, 0, addrs * sizeof(int32_t), out,
+			0, NULL, NULL);
+
+	/* Floats count exactly up to 2^24, skip the check beyond that */
+	max = atomics_expect(expect, items, addrs, ops);
+	if (!max || (v != ATOMICS_INT && max > (1ul << 24))) {
+		free(out);
+		free(expect);
+		return time_total / opencl_get_iterations();
+	}
+
+	sum = 0;
+	for (i = 0; i < addrs; i++) {
+		if (v == ATOMICS_INT) {
+			sum = out[i];
+		} else {
+			fsum = ((float *) out)[i];
+			sum = (uint64_t) fsum;
+		}
+
+		if (sum != expect[i]) {
+			printf("%s: address %u holds %"PRIu64", expected "
+					"%"PRIu64"\n", variant_names[v], i,
+					sum, expect[i]);
+			*valid = false;
+			break;
+		}
+	}
+	free(expect);
+	free(out);
+
+	return time_total / opencl_get_iterations();
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	size_t items = 1 << 20;
+	size_t ldim;
+	cl_uint ops = 16;
+	cl_uint max_addrs = 0;
+	cl_uint addrs;
+	unsigned int steps, s;
+	enum atomics_variant v;
+	cl_ulong t;
+	cl_ulong local_mem;
+	bool valid = true;
+	double mops[ATOMICS_MAX_STEPS][ATOMICS_VARIANTS];
+	cl_uint step_addrs[ATOMICS_MAX_STEPS];
+	double peak;
+	const char *opts = NULL;
+
+	cl_context ctx;
+	cl_command_queue q;
+	cl_program prg;
+	cl_kernel kernels[ATOMICS_VARIANTS];
+	cl_mem dst;
+	cl_int error;
+
+	while ((c = getopt (argc, argv, "?n:o:a:"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case 'n':
+			items = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			max_addrs = strtoul(optarg, NULL, 0);
+			break;
+		case '?':
+			usage(argv[0]);
+			return 0;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (items == 0 || ops == 0) {
+		printf("Error: need at least one work-item and operation\n");
+		usage(argv[0]);
+		return -1;
+	}
+
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	/* Native float atomics are exposed through OpenCL C 3.0 features */
+	if (opencl_device_has_extension("cl_ext_float_atomics"))
+		opts = "-cl-std=CL3.0";
+
+	const char *programs = {
+		"src/atomics/atomics.cl"
+	};
+	prg = opencl_compile_program_opts(ctx, 1, &programs, opts);
+	if (!prg)
+		return -1;
+
+	for (v = 0; v < ATOMICS_VARIANTS; v++) {
+		kernels[v] = clCreateKernel(prg, variant_kernels[v], &error);
+		if (error != CL_SUCCESS) {
+			printf("Kernel %s not available, skipping\n",
+					variant_kernels[v]);
+			kernels[v] = NULL;
+		}
+	}
+
+	if (!kernels[ATOMICS_CAS] || !kernels[ATOMICS_INT] ||
+	    !kernels[ATOMICS_LOCAL]) {
+		printf("Could not create kernels\n");
+		return -1;
+	}
+
+	error = clGetDeviceInfo(opencl_get_device(), CL_DEVICE_LOCAL_MEM_SIZE,
+			sizeof(cl_ulong), &local_mem, NULL);
+	if (error != CL_SUCCESS) {
+		printf("Could not query local memory size\n");
+		return -1;
+	}
+
+	/* Round the number of work-items up to a whole work-group */
+	ldim = opencl_max_workgroup_size();
+	if (ldim > 256)
+		ldim = 256;
+	items = ((items + ldim - 1) / ldim) * ldim;
+
+	if (max_addrs == 0 || max_addrs > items)
+		max_addrs = items;
+
+	/* One work-group per address at the low end, one address per
+	 * work-item at the high end. Powers of two, stepping by 4x. */
+	steps = 0;
+	for (addrs = 1; addrs <= max_addrs && steps < ATOMICS_MAX_STEPS;
+			addrs <<= 2)
+		step_addrs[steps++] = addrs;
+
+	dst = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			step_addrs[steps - 1] * sizeof(cl_int), NULL, &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create out buffer\n");
+		return -1;
+	}
+
+	printf("%zu work-items, %u ops each, work-group size %zu\n", items,
+			ops, ldim);
+
+	ret = 0;
+	for (s = 0; s < steps; s++) {
+		for (v = 0; v < ATOMICS_VARIANTS; v++) {
+			mops[s][v] = 0.;
+
+			if (!kernels[v])
+				continue;
+
+			if (v == ATOMICS_LOCAL &&
+			    step_addrs[s] * sizeof(cl_float) > local_mem)
+				continue;
+
+			t = atomics_run(q, kernels[v], v, dst, items, ldim,
+					step_addrs[s], ops, &valid);
+			if (t == 0) {
+				ret = -1;
+				continue;
+			}
+
+			mops[s][v] = ((double) items * ops * 1e3) / t;
+		}
+	}
+
+	if (opencl_compare_output()) {
+		if (valid) {
+			printf("Output valid\n");
+		} else {
+			printf("Output invalid\n");
+			ret = -1;
+		}
+	}
+
+	printf("%10s %12s", "Addresses", "Items/addr");
+	for (v = 0; v < ATOMICS_VARIANTS; v++)
+		printf(" %10s", variant_names[v]);
+	printf("  (Mops/s)\n");
+
+	for (s = 0; s < steps; s++) {
+		printf("%10u %12zu", step_addrs[s], items / step_addrs[s]);
+		for (v = 0; v < ATOMICS_VARIANTS; v++) {
+			if (mops[s][v] == 0.)
+				printf(" %10s", "-");
+			else
+				printf(" %10.1f", mops[s][v]);
+		}
+		printf("\n");
+	}
+
+	/* Report the point below which each variant stops scaling, defined as
+	 * the highest contention at which it still reaches half its peak */
+	for (v = 0; v < ATOMICS_VARIANTS; v++) {
+		peak = 0.;
+		for (s = 0; s < steps; s++) {
+			if (mops[s][v] > peak)
+				peak = mops[s][v];
+		}
+
+		if (peak == 0.) {
+			printf("%s: not available\n", variant_names[v]);
+			continue;
+		}
+
+		for (s = 0; s < steps; s++) {
+			if (mops[s][v] >= peak / 2.)
+				break;
+		}
+
+		printf("%s: peak %.1f Mops/s, >= 50%% of peak from %u "
+				"addresses\n", variant_names[v], peak,
+				step_addrs[s]);
+	}
+
+	/* Tear down */
+	opencl_release_buffer(dst);
+	for (v = 0; v < ATOMICS_VARIANTS; v++) {
+		if (kernels[v])
+			clReleaseKernel(kernels[v]);
+	}
+
+	opencl_teardown(&ctx, &q, &prg);
+
+	return ret;
+}
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Atomic add throughput under varying contention. Every work-item performs ops
+ * additions, spread over addrs (power-of-two) addresses.
+ */
+
+/* Float add through a compare-and-swap loop, as used by ndt and srad */
+inline void
+atomic_add_cas(volatile float __global *ptr, float val)
+{
+	volatile int __global *iptr = (volatile int __global *) ptr;
+	union {
+		int i;
+		float f;
+	} oldval, newval;
+
+	do {
+		oldval.i = *iptr;
+		newval.f = oldval.f + val;
+	} while (atomic_cmpxchg(iptr, oldval.i, newval.i) != oldval.i);
+}
+
+inline void
+atomic_add_cas_local(volatile float __local *ptr, float val)
+{
+	volatile int __local *iptr = (volatile int __local *) ptr;
+	union {
+		int i;
+		float f;
+	} oldval, newval;
+
+	do {
+		oldval.i = *iptr;
+		newval.f = oldval.f + val;
+	} while (atomic_cmpxchg(iptr, oldval.i, newval.i) != oldval.i);
+}
+
+/* Launch in 1D */
+__kernel void
+atomics_cas(volatile float __global *dst, unsigned int mask,
+		unsigned int ops)
+{
+	unsigned int n = get_global_id(0);
+	unsigned int i;
+
+	for (i = 0; i < ops; i++)
+		atomic_add_cas(&dst[(n + i) & mask], 1.f);
+}
+
+/* Native float atomics, either through cl_ext_float_atomics or the NVIDIA
+ * PTX instruction. Only built if one of them is available. */
+#if defined(__opencl_c_ext_fp32_global_atomic_add)
+#define ATOMICS_NATIVE
+inline void
+atomic_add_native(volatile float __global *ptr, float val)
+{
+	atomic_fetch_add_explicit((volatile __global atomic_float *) ptr, val,
+			memory_order_relaxed, memory_scope_device);
+}
+#elif defined(NV_SM_20)
+#define ATOMICS_NATIVE
+inline void
+atomic_add_native(volatile float __global *ptr, float val)
+{
+	float oldval;
+
+	asm volatile ("atom.global.add.f32 %0, [%1], %2;" :
+			"=f"(oldval) : "l"(ptr), "f"(val));
+}
+#endif
+
+#ifdef ATOMICS_NATIVE
+/* Launch in 1D */
+__kernel void
+atomics_native(volatile float __global *dst, unsigned int mask,
+		unsigned int ops)
+{
+	unsigned int n = get_global_id(0);
+	unsigned int i;
+
+	for (i = 0; i < ops; i++)
+		atomic_add_native(&dst[(n + i) & mask], 1.f);
+}
+#endif
+
+/* Launch in 1D */
+__kernel void
+atomics_int(volatile int __global *dst, unsigned int mask, unsigned int ops)
+{
+	unsigned int n = get_global_id(0);
+	unsigned int i;
+
+	for (i = 0; i < ops; i++)
+		atomic_add(&dst[(n + i) & mask], 1);
+}
+
+/* Launch in 1D. Accumulate in local memory first, then flush each address
+ * once per work-group. lsum must hold mask + 1 floats. */
+__kernel void
+atomics_local(volatile float __global *dst, unsigned int mask,
+		unsigned int ops, volatile float __local *lsum)
+{
+	unsigned int n = get_global_id(0);
+	unsigned int lx = get_local_id(0);
+	unsigned int i;
+
+	for (i = lx; i <= mask; i += get_local_size(0))
+		lsum[i] = 0.f;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (i = 0; i < ops; i++)
+		atomic_add_cas_local(&lsum[(n + i) & mask], 1.f);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (i = lx; i <= mask; i += get_local_size(0)) {
+		if (lsum[i] != 0.f)
+			atomic_add_cas(&dst[i], lsum[i]);
+	}
+}
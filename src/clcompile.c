@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "lib/opencl.h"
+#include "lib/compile.h"
+
+/* Builds per program unless -J says otherwise */
+#define COMPILE_BUILDS 10
+/* Maximum number of -o option sets */
+#define COMPILE_OPTS_MAX 16
+
+void usage(char *prg)
+{
+	printf("%s [options] <file.cl>...\n", prg);
+	printf("Measures build time, binary size and kernel resources\n");
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-o <options>\t Build options to compare, repeat for more "
+			"sets\n");
+	opencl_usage();
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	int i, j, n_opts = 0;
+	const char *opts[COMPILE_OPTS_MAX];
+
+	cl_context ctx;
+	cl_command_queue q;
+	cl_program prg;
+
+	while ((c = getopt (argc, argv, "?o:"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case '?':
+			usage(argv[0]);
+			return 0;
+		case 'o':
+			if (n_opts == COMPILE_OPTS_MAX) {
+				usage(argv[0]);
+				return -1;
+			}
+			opts[n_opts++] = optarg;
+			break;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (!n_opts)
+		opts[n_opts++] = NULL;
+
+	/* Before the context, the implementation reads its cache settings */
+	if (!opencl_compile_enabled())
+		opencl_compile_enable(COMPILE_BUILDS);
+
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	/* Every successful build is timed by the -J hook */
+	ret = 0;
+	for (i = optind; i < argc; i++) {
+		for (j = 0; j < n_opts; j++) {
+			prg = opencl_compile_program_opts(ctx, 1,
+					(const char **) &argv[i], opts[j]);
+			if (!prg) {
+				fprintf(stderr, "Could not build %s\n",
+						argv[i]);
+				ret = -1;
+				continue;
+			}
+			clReleaseProgram(prg);
+		}
+	}
+
+	opencl_teardown(&ctx, &q, NULL);
+
+	return ret;
+}
@@ -0,0 +1,671 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/opencl.h"
+
+/* Relative error tolerated on outputs that do not match bit-for-bit */
+#define REPLAY_REL_ERROR 1e-5f
+
+struct replay_program {
+	uint32_t id;
+	uint32_t n;
+	const char **sources;
+	size_t *lengths;
+	char *options;
+	cl_program prg;
+	struct replay_program *next;
+};
+
+struct replay_buf {
+	size_t size;
+	const void *before;
+	/** Expected contents after the launch, NULL if unchanged */
+	const void *after;
+	cl_mem mem;
+};
+
+struct replay_arg {
+	uint32_t kind;
+	size_t size;
+	const void *value;
+	uint32_t buf;
+};
+
+struct replay_launch {
+	struct replay_program *prg;
+	char *kernel;
+	cl_uint dim;
+	size_t offset[3];
+	size_t global[3];
+	size_t local[3];
+	uint32_t n_bufs;
+	struct replay_buf *bufs;
+	uint32_t n_args;
+	struct replay_arg *args;
+	struct replay_launch *next;
+};
+
+/** Bounds-checked cursor into the mapped capture file */
+struct replay_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool error;
+};
+
+void usage(char *prg)
+{
+	printf("%s [options] <capture file>\n", prg);
+	printf("Re-executes kernel launches captured with -X\n");
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-l\t\t List captured launches\n");
+	printf("\t-n <launch>\t Replay only this launch, default all\n");
+	opencl_usage();
+}
+
+static const void *
+replay_bytes(struct replay_reader *r, uint64_t len)
+{
+	const void *p = r->p;
+
+	if (r->error || len > (uint64_t) (r->end - r->p)) {
+		r->error = true;
+		return NULL;
+	}
+
+	r->p += len;
+	return p;
+}
+
+static uint32_t
+replay_u32(struct replay_reader *r)
+{
+	const void *p = replay_bytes(r, sizeof(uint32_t));
+	uint32_t val = 0;
+
+	if (p)
+		memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static uint64_t
+replay_u64(struct replay_reader *r)
+{
+	const void *p = replay_bytes(r, sizeof(uint64_t));
+	uint64_t val = 0;
+
+	if (p)
+		memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static char *
+replay_str(struct replay_reader *r)
+{
+	uint32_t len = replay_u32(r);
+	const char *p = replay_bytes(r, len);
+	char *str;
+
+	if (!p)
+		return NULL;
+
+	str = malloc(len + 1);
+	if (!str) {
+		r->error = true;
+		return NULL;
+	}
+	memcpy(str, p, len);
+	str[len] = '\0';
+
+	return str;
+}
+
+static const void *
+replay_blob(struct replay_reader *r, size_t *size)
+{
+	*size = replay_u64(r);
+	return replay_bytes(r, *size);
+}
+
+static struct replay_program *
+replay_read_program(struct replay_reader *r)
+{
+	struct replay_program *p;
+	char *name;
+	uint32_t i;
+
+	p = calloc(1, sizeof(struct replay_program));
+	if (!p)
+		return NULL;
+
+	p->id = replay_u32(r);
+	p->n = replay_u32(r);
+	if (r->error || p->n == 0)
+		goto error;
+
+	p->sources = calloc(p->n, sizeof(char *));
+	p->lengths = calloc(p->n, sizeof(size_t));
+	if (!p->sources || !p->lengths)
+		goto error;
+
+	/* Source names are for information only, sources are not re-read */
+	for (i = 0; i < p->n; i++) {
+		name = replay_str(r);
+		free(name);
+		p->sources[i] = replay_blob(r, &p->lengths[i]);
+	}
+	p->options = replay_str(r);
+	if (r->error)
+		goto error;
+
+	return p;
+
+error:
+	free(p->sources);
+	free(p->lengths);
+	free(p);
+	return NULL;
+}
+
+static struct replay_launch *
+replay_read_launch(struct replay_reader *r, struct replay_program *prgs)
+{
+	struct replay_launch *l;
+	struct replay_arg *arg;
+	uint32_t id, i;
+
+	l = calloc(1, sizeof(struct replay_launch));
+	if (!l)
+		return NULL;
+
+	id = replay_u32(r);
+	for (l->prg = prgs; l->prg; l->prg = l->prg->next) {
+		if (l->prg->id == id)
+			break;
+	}
+
+	l->kernel = replay_str(r);
+	l->dim = replay_u32(r);
+	for (i = 0; i < 3; i++)
+		l->offset[i] = replay_u64(r);
+	for (i = 0; i < 3; i++)
+		l->global[i] = replay_u64(r);
+	for (i = 0; i < 3; i++)
+		l->local[i] = replay_u64(r);
+
+	l->n_bufs = replay_u32(r);
+	if (r->error || !l->prg || l->dim < 1 || l->dim > 3)
+		goto error;
+
+	l->bufs = calloc(l->n_bufs + 1, sizeof(struct replay_buf));
+	if (!l->bufs)
+		goto error;
+
+	for (i = 0; i < l->n_bufs; i++) {
+		l->bufs[i].before = replay_blob(r, &l->bufs[i].size);
+		if (replay_u32(r))
+			l->bufs[i].after = replay_blob(r, &l->bufs[i].size);
+	}
+
+	l->n_args = replay_u32(r);
+	if (r->error)
+		goto error;
+
+	l->args = calloc(l->n_args + 1, sizeof(struct replay_arg));
+	if (!l->args)
+		goto error;
+
+	for (i = 0; i < l->n_args; i++) {
+		arg = &l->args[i];
+		arg->kind = replay_u32(r);
+		arg->size = replay_u64(r);
+		if (arg->kind == CAPTURE_ARG_VALUE)
+			arg->value = replay_bytes(r, arg->size);
+		else if (arg->kind == CAPTURE_ARG_BUFFER)
+			arg->buf = replay_u32(r);
+
+		if (arg->kind == CAPTURE_ARG_BUFFER && arg->buf >= l->n_bufs)
+			r->error = true;
+	}
+	if (r->error)
+		goto error;
+
+	return l;
+
+error:
+	free(l->kernel);
+	free(l->bufs);
+	free(l->args);
+	free(l);
+	return NULL;
+}
+
+/**
+ * Parse a capture file. Sources, snapshots and argument values point into the
+ * mapped file.
+ * @return Number of launches read, negative on failure.
+ */
+static int
+replay_parse(const void *data, size_t size, struct replay_program **prgs,
+		struct replay_launch **launches)
+{
+	struct replay_reader r = {data, (const uint8_t *) data + size, false};
+	struct replay_launch **tail = launches;
+	struct replay_program *p;
+	const void *magic;
+	int n = 0;
+
+	*prgs = NULL;
+	*launches = NULL;
+
+	magic = replay_bytes(&r, strlen(CAPTURE_MAGIC));
+	if (!magic || memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)))
+		return -EINVAL;
+
+	while (r.p < r.end) {
+		switch (replay_u32(&r)) {
+		case CAPTURE_REC_PROGRAM:
+			p = replay_read_program(&r);
+			if (!p)
+				return -EINVAL;
+			p->next = *prgs;
+			*prgs = p;
+			break;
+		case CAPTURE_REC_LAUNCH:
+			*tail = replay_read_launch(&r, *prgs);
+			if (!*tail)
+				return -EINVAL;
+			tail = &(*tail)->next;
+			n++;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return n;
+}
+
+static void
+replay_list(struct replay_launch *l)
+{
+	size_t bytes, out;
+	uint32_t j;
+	int i = 0;
+
+	printf("%-5s %-24s %-20s %-14s %s\n", "Index", "Kernel", "Global",
+			"Local", "Buffers");
+	for (; l; l = l->next, i++) {
+		bytes = 0;
+		out = 0;
+		for (j = 0; j < l->n_bufs; j++) {
+			bytes += l->bufs[j].size;
+			if (l->bufs[j].after)
+				out++;
+		}
+
+		printf("%-5i %-24s %6zu,%6zu,%6zu %4zu,%4zu,%4zu %u (%zu "
+				"written), %zu bytes\n", i, l->kernel,
+				l->global[0], l->global[1], l->global[2],
+				l->local[0], l->local[1], l->local[2],
+				l->n_bufs, out, bytes);
+	}
+}
+
+static cl_int
+replay_build(cl_context ctx, struct replay_program *p)
+{
+	cl_device_id dev = opencl_get_device();
+	size_t log_size;
+	cl_int error;
+	char *log;
+
+	if (p->prg)
+		return CL_SUCCESS;
+
+	p->prg = clCreateProgramWithSource(ctx, p->n, p->sources, p->lengths,
+			&error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create program: %d\n", error);
+		return error;
+	}
+
+	error = clBuildProgram(p->prg, 1, &dev, p->options, NULL, NULL);
+	if (error == CL_SUCCESS)
+		return CL_SUCCESS;
+
+	printf("Could not build program %u with \"%s\": %d\n", p->id,
+			p->options, error);
+	clGetProgramBuildInfo(p->prg, dev, CL_PROGRAM_BUILD_LOG, 0, NULL,
+			&log_size);
+	log = malloc(log_size + 1);
+	if (log) {
+		clGetProgramBuildInfo(p->prg, dev, CL_PROGRAM_BUILD_LOG,
+				log_size, log, NULL);
+		log[log_size] = '\0';
+		printf("%s", log);
+		free(log);
+	}
+	clReleaseProgram(p->prg);
+	p->prg = NULL;
+
+	return error;
+}
+
+static cl_int
+replay_restore(cl_command_queue q, struct replay_launch *l)
+{
+	cl_int error = CL_SUCCESS;
+	uint32_t i;
+
+	for (i = 0; i < l->n_bufs && error == CL_SUCCESS; i++)
+		error = clEnqueueWriteBuffer(q, l->bufs[i].mem, CL_FALSE, 0,
+				l->bufs[i].size, l->bufs[i].before, 0, NULL,
+				NULL);
+
+	return error;
+}
+
+/** Compare a buffer word by word, tolerating rounding on float words
+ * @return Number of mismatching words */
+static size_t
+replay_compare(const void *ref, const void *out, size_t size)
+{
+	const uint32_t *r = ref, *o = out;
+	size_t i, words = size / sizeof(uint32_t);
+	size_t mismatch = 0;
+	float fr, fo;
+
+	for (i = 0; i < words; i++) {
+		if (r[i] == o[i])
+			continue;
+
+		memcpy(&fr, &r[i], sizeof(float));
+		memcpy(&fo, &o[i], sizeof(float));
+		if (!(fabsf(fo - fr) <= REPLAY_REL_ERROR * fabsf(fr)))
+			mismatch++;
+	}
+
+	if (memcmp((const uint32_t *) ref + words, (const uint32_t *) out +
+			words, size % sizeof(uint32_t)))
+		mismatch++;
+
+	return mismatch;
+}
+
+static int
+replay_validate(cl_command_queue q, struct replay_launch *l)
+{
+	size_t mismatch = 0;
+	const void *ref;
+	cl_int error;
+	uint32_t i;
+	void *out;
+
+	for (i = 0; i < l->n_bufs; i++) {
+		ref = l->bufs[i].after ? l->bufs[i].after : l->bufs[i].before;
+
+		out = malloc(l->bufs[i].size);
+		if (!out)
+			return -ENOMEM;
+
+		error = clEnqueueReadBuffer(q, l->bufs[i].mem, CL_TRUE, 0,
+				l->bufs[i].size, out, 0, NULL, NULL);
+		if (error != CL_SUCCESS) {
+			free(out);
+			return -EIO;
+		}
+
+		mismatch += replay_compare(ref, out, l->bufs[i].size);
+		free(out);
+	}
+
+	if (mismatch) {
+		printf("Output invalid: %zu mismatching words\n", mismatch);
+		return -1;
+	}
+
+	printf("Output valid\n");
+	return 0;
+}
+
+static int
+replay_launch(cl_context ctx, cl_command_queue q, struct replay_launch *l,
+		int idx)
+{
+	struct replay_arg *arg;
+	cl_kernel kernel = NULL;
+	cl_mem mem = NULL;
+	cl_int error;
+	cl_event time;
+	cl_ulong time_diff, time_avg = 0l;
+	unsigned int it;
+	int ret = -1;
+	uint32_t i;
+
+	printf("Launch %i: %s\n", idx, l->kernel);
+
+	if (replay_build(ctx, l->prg) != CL_SUCCESS)
+		return -1;
+
+	kernel = clCreateKernel(l->prg->prg, l->kernel, &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create kernel: %d\n", error);
+		return -1;
+	}
+
+	for (i = 0; i < l->n_bufs; i++) {
+		l->bufs[i].mem = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+				l->bufs[i].size, NULL, &error);
+		if (error != CL_SUCCESS) {
+			printf("Could not create buffer %u: %d\n", i, error);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < l->n_args; i++) {
+		arg = &l->args[i];
+		switch (arg->kind) {
+		case CAPTURE_ARG_BUFFER:
+			error = clSetKernelArg(kernel, i, sizeof(cl_mem),
+					&l->bufs[arg->buf].mem);
+			break;
+		case CAPTURE_ARG_LOCAL:
+			error = clSetKernelArg(kernel, i, arg->size, NULL);
+			break;
+		case CAPTURE_ARG_NULL:
+			error = clSetKernelArg(kernel, i, sizeof(cl_mem), &mem);
+			break;
+		default:
+			error = clSetKernelArg(kernel, i, arg->size,
+					arg->value);
+			break;
+		}
+
+		if (error != CL_SUCCESS) {
+			printf("Could not set argument %u: %d\n", i, error);
+			goto out;
+		}
+	}
+
+	/* Inputs are restored before every run, only the kernel is timed */
+	for (it = 0; it < opencl_get_iterations(); it++) {
+		error = replay_restore(q, l);
+		if (error != CL_SUCCESS) {
+			printf("Could not enqueue buffer write: %d\n", error);
+			goto out;
+		}
+
+		error = clEnqueueNDRangeKernel(q, kernel, l->dim, l->offset,
+				l->global, l->local[0] ? l->local : NULL, 0,
+				NULL, &time);
+		if (error != CL_SUCCESS) {
+			printf("Could not enqueue kernel execution: %d\n",
+					error);
+			goto out;
+		}
+		clFinish(q);
+
+		time_diff = opencl_exec_time(time);
+		time_avg += time_diff;
+		clReleaseEvent(time);
+
+		if (it == 0 && opencl_compare_output() &&
+		    replay_validate(q, l))
+			goto out;
+	}
+
+	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
+			time_avg / opencl_get_iterations());
+	ret = 0;
+
+out:
+	for (i = 0; i < l->n_bufs; i++) {
+		if (l->bufs[i].mem)
+			clReleaseMemObject(l->bufs[i].mem);
+		l->bufs[i].mem = NULL;
+	}
+	clReleaseKernel(kernel);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	int i, n, select = -1;
+	bool list = false;
+	int fd;
+	struct stat st;
+	void *data;
+
+	cl_context ctx;
+	cl_command_queue q;
+	struct replay_program *prgs, *p;
+	struct replay_launch *launches, *l;
+
+	while ((c = getopt (argc, argv, "?ln:"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case '?':
+			usage(argv[0]);
+			return 0;
+		case 'l':
+			list = true;
+			break;
+		case 'n':
+			ret = sscanf(optarg, "%i", &select);
+			if (ret != 1 || select < 0) {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "Could not open %s\n", argv[optind]);
+		return -1;
+	}
+
+	/* Snapshots can be large, map rather than read them */
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s\n", argv[optind]);
+		return -1;
+	}
+
+	n = replay_parse(data, st.st_size, &prgs, &launches);
+	if (n < 0) {
+		fprintf(stderr, "%s is not a valid capture\n", argv[optind]);
+		return -1;
+	}
+
+	if (list) {
+		replay_list(launches);
+		return 0;
+	}
+
+	if (select >= n) {
+		fprintf(stderr, "Launch %i not captured, %i available\n",
+				select, n);
+		return -1;
+	}
+
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	ret = 0;
+	for (l = launches, i = 0; l; l = l->next, i++) {
+		if (select >= 0 && i != select)
+			continue;
+
+		if (replay_launch(ctx, q, l, i))
+			ret = -1;
+	}
+
+	for (p = prgs; p; p = p->next) {
+		if (p->prg)
+			clReleaseProgram(p->prg);
+	}
+
+	opencl_teardown(&ctx, &q, NULL);
+	munmap(data, st.st_size);
+
+	return ret;
+}
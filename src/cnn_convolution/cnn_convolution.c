@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -54,6 +57,7 @@ int main(int argc, char **argv)
 	int64_t data_entries;
 	int64_t kernel_entries;
 	float *data, *kernels;
+	struct dataset *ds_data, *ds_kernels;
 	char *file_out = NULL;
 	unsigned int i;
 	int retval = 0;
@@ -70,6 +74,7 @@ int main(int argc, char **argv)
 
 	const unsigned int three = 3;
 	const unsigned int seven = 7;
+	double flops, bytes;
 
 	while ((c = getopt (argc, argv, "?i:d:k:C:"OPENCL_OPTS)) != -1)
 	{
@@ -98,11 +103,11 @@ int main(int argc, char **argv)
 		}
 	}
 
-	data_entries = csv_file_read_float(file, &data);
-	printf("Read %"PRIi64" entries\n", data_entries);
-	kernel_entries = csv_file_read_float(file_kernels, &kernels);
-	printf("Read %"PRIi64" kernel entries\n", kernel_entries);
+	/* Load the inputs while the platform is brought up */
+	ds_data = dataset_load_csv_float(file, &data);
+	ds_kernels = dataset_load_csv_float(file_kernels, &kernels);
 
+	opencl_index_enable();
 	ctx = opencl_create_context();
 	if (!ctx) {
 		usage(argv[0]);
@@ -120,25 +125,47 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	data_entries = dataset_wait(ds_data);
+	kernel_entries = dataset_wait(ds_kernels);
+	if (data_entries < 0 || kernel_entries < 0) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+	printf("Read %"PRIi64" kernel entries\n", kernel_entries);
+
+	/* The output holds 64 channels for every 3 input channels */
+	ret = opencl_index_select((data_entries * 64) / 3);
+	if (ret < 0)
+		return -1;
+	if (ret > 0) {
+		clReleaseProgram(prg);
+		prg = opencl_compile_program(ctx, 1, &programs);
+		if (!prg)
+			return -1;
+	}
+
 	kernel = clCreateKernel(prg, "cl_convolution", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
+	opencl_kernel_resources(kernel);
 
-	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	in = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	in_kernels = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	in_kernels = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			kernel_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create biases buffer\n");
 		return -1;
 	}
-	out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	out = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 			(data_entries * 64 * sizeof(float)) / 3, NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -174,6 +201,11 @@ int main(int argc, char **argv)
 	 * in same work-group diminishes perf. Too many cores for amount
 	 * of work?
 	 */
+	/* One multiply-add per output, kernel tap and input channel */
+	flops = 2. * dims[0] * dims[1] * dims[2] * seven * seven * three;
+	bytes = (data_entries + kernel_entries +
+			(double) dims[0] * dims[1] * dims[2]) * sizeof(float);
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		error = clEnqueueNDRangeKernel(q, kernel, 3, NULL, dims, NULL,
 				0, NULL, &time);
@@ -185,6 +217,8 @@ int main(int argc, char **argv)
 		clFinish(q);
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("cl_convolution", flops, bytes,
+				time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -201,14 +235,17 @@ int main(int argc, char **argv)
 			printf("Output invalid\n");
 	}
 
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 3, NULL, dims, NULL);
+
 	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
 			time_avg / opencl_get_iterations());
 
 	/* Tear down */
 	clReleaseEvent(time);
-	clReleaseMemObject(in);
-	clReleaseMemObject(in_kernels);
-	clReleaseMemObject(out);
+	opencl_release_buffer(in);
+	opencl_release_buffer(in_kernels);
+	opencl_release_buffer(out);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);
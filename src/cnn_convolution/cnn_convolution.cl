@@ -36,7 +36,8 @@ __kernel void cl_convolution(float __global *in, const float __global *kernels,
 		float __global *out, unsigned int kernelSize,
 		unsigned int inChannels, float __local *lkernels) {
 	/* Integer saves ~6% over size_t by reducing emulated
-	 * 64-bit int support. Careful not to overflow. */
+	 * 64-bit int support. Coordinates always fit, flat offsets use idx_t
+	 * which is only 64-bit if the buffers require it. */
 	unsigned int x = get_global_id(0);
 	unsigned int y = get_global_id(1);
 	unsigned int c = get_global_id(2);
@@ -44,7 +45,7 @@ __kernel void cl_convolution(float __global *in, const float __global *kernels,
 	unsigned int width = get_global_size(0);
 	unsigned int cLocal;
 	unsigned int inWidth = width + kernelSize - 1;
-	unsigned int inSurface = (height + kernelSize - 1) * inWidth;
+	idx_t inSurface = (idx_t) (height + kernelSize - 1) * inWidth;
 
 	/* Apply convolution */
 	float imageVal, kernelVal;
@@ -75,5 +76,5 @@ __kernel void cl_convolution(float __global *in, const float __global *kernels,
 			}
 		}
 	}
-	out[c*height*width + y*width + x] = filterSum;
+	out[(idx_t) c*height*width + y*width + x] = filterSum;
 }
@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -51,6 +54,7 @@ int main(int argc, char **argv)
 	char *out_ref = "data/cnn_maxpool/out.csv";
 	int64_t file_entries;
 	float *data;
+	struct dataset *ds;
 	unsigned int i;
 	int retval = 0;
 
@@ -67,6 +71,7 @@ int main(int argc, char **argv)
 
 	const int three = 3;
 	const int two = 2;
+	double flops, bytes;
 
 	while ((c = getopt (argc, argv, "?i:d:C:"OPENCL_OPTS)) != -1)
 	{
@@ -92,8 +97,8 @@ int main(int argc, char **argv)
 		}
 	}
 
-	file_entries = csv_file_read_float(file, &data);
-	printf("Read %"PRIi64" entries\n", file_entries);
+	/* Load the input while the platform is brought up */
+	ds = dataset_load_csv_float(file, &data);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -112,19 +117,27 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	file_entries = dataset_wait(ds);
+	if (file_entries < 0) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", file_entries);
+
 	kernel = clCreateKernel(prg, "cl_max_pooling", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
 
-	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	in = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			file_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	out = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 			file_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -149,12 +162,19 @@ int main(int argc, char **argv)
 
 	const size_t dims[] = {55, 55, 64};
 
+	/* One comparison per output and window element */
+	flops = (double) dims[0] * dims[1] * dims[2] * three * three;
+	bytes = (file_entries + (double) dims[0] * dims[1] * dims[2]) *
+			sizeof(float);
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		clEnqueueNDRangeKernel(q, kernel, 3, NULL, dims, NULL, 0, NULL,
 				&time);
 		clFinish(q);
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("cl_max_pooling", flops, bytes,
+				time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -170,13 +190,16 @@ int main(int argc, char **argv)
 			printf("Output invalid\n");
 	}
 
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 3, NULL, dims, NULL);
+
 	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
 				time_avg / opencl_get_iterations());
 
 	/* Tear down */
 	clReleaseEvent(time);
-	clReleaseMemObject(in);
-	clReleaseMemObject(out);
+	opencl_release_buffer(in);
+	opencl_release_buffer(out);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);
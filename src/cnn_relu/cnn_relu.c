@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -54,6 +57,7 @@ int main(int argc, char **argv)
 	int64_t data_entries;
 	int64_t bias_entries;
 	float *data, *bias;
+	struct dataset *ds_data, *ds_bias;
 	unsigned int i;
 	int retval = 0;
 
@@ -69,6 +73,7 @@ int main(int argc, char **argv)
 	char *file_out = NULL;
 
 	const int zero = 0;
+	double flops, bytes;
 
 	while ((c = getopt (argc, argv, "?i:b:C:d:"OPENCL_OPTS)) != -1)
 	{
@@ -97,10 +102,9 @@ int main(int argc, char **argv)
 		}
 	}
 
-	data_entries = csv_file_read_float(file, &data);
-	printf("Read %"PRIi64" entries\n", data_entries);
-	bias_entries = csv_file_read_float(file_bias, &bias);
-	printf("Read %"PRIi64" bias entries\n", bias_entries);
+	/* Load the inputs while the platform is brought up */
+	ds_data = dataset_load_csv_float(file, &data);
+	ds_bias = dataset_load_csv_float(file_bias, &bias);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -119,25 +123,35 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	data_entries = dataset_wait(ds_data);
+	bias_entries = dataset_wait(ds_bias);
+	if (data_entries < 0 || bias_entries < 0) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+	printf("Read %"PRIi64" bias entries\n", bias_entries);
+
 	kernel = clCreateKernel(prg, "cl_relu", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
 
-	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	in = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	in_bias = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	in_bias = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			bias_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create biases buffer\n");
 		return -1;
 	}
-	out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	out = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 			data_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -163,6 +177,11 @@ int main(int argc, char **argv)
 	}
 
 	const size_t dims[] = {256, 256, 2};
+
+	/* Bias add and comparison per element */
+	flops = 2. * dims[0] * dims[1] * dims[2];
+	bytes = (2. * dims[0] * dims[1] * dims[2] + dims[2]) * sizeof(float);
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		error = clEnqueueNDRangeKernel(q, kernel, 3, NULL, dims, NULL,
 				0, NULL, &time);
@@ -174,6 +193,7 @@ int main(int argc, char **argv)
 
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("cl_relu", flops, bytes, time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -189,14 +209,17 @@ int main(int argc, char **argv)
 			printf("Output invalid\n");
 	}
 
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 3, NULL, dims, NULL);
+
 	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
 			time_avg / opencl_get_iterations());
 
 	/* Tear down */
 	clReleaseEvent(time);
-	clReleaseMemObject(in);
-	clReleaseMemObject(in_bias);
-	clReleaseMemObject(out);
+	opencl_release_buffer(in);
+	opencl_release_buffer(in_bias);
+	opencl_release_buffer(out);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);
@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -53,6 +56,7 @@ int main(int argc, char **argv)
 	char *file_weights = "data/cnn_relu/weights_large.bin";
 	char *out_ref = "data/cnn_relu/out_large.csv";
 	float *data, *bias, *weight;
+	struct dataset *ds[3];
 	unsigned int i;
 	int retval = 0;
 
@@ -68,6 +72,7 @@ int main(int argc, char **argv)
 	char *file_out = NULL;
 
 	const int fourK = 4096;
+	double flops, bytes;
 
 	while ((c = getopt (argc, argv, "?i:b:C:d:"OPENCL_OPTS)) != -1)
 	{
@@ -96,9 +101,10 @@ int main(int argc, char **argv)
 		}
 	}
 
-	bin_file_read(file, 4096, (void **) &data);
-	bin_file_read(file_bias, 4096, (void **) &bias);
-	bin_file_read(file_weights, 4096*4096,(void **) &weight);
+	/* Load the inputs while the platform is brought up */
+	ds[0] = dataset_load_bin(file, 4096, (void **) &data);
+	ds[1] = dataset_load_bin(file_bias, 4096, (void **) &bias);
+	ds[2] = dataset_load_bin(file_weights, 4096*4096, (void **) &weight);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -117,32 +123,41 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	ret = 0;
+	for (i = 0; i < 3; i++)
+		ret |= dataset_wait(ds[i]);
+	if (ret) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+
 	kernel = clCreateKernel(prg, "cl_relu", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
 
-	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	in = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			4096 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	biases = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	biases = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			4096 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create biases buffer\n");
 		return -1;
 	}
-	weights = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	weights = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			4096*4096 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create biases buffer\n");
 		return -1;
 	}
 
-	out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	out = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 			4096 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -171,6 +186,13 @@ int main(int argc, char **argv)
 	}
 
 	const size_t dims[] = {4096};
+
+	/* A multiply-add per weight, a comparison per output. The weights
+	 * dominate the traffic. */
+	flops = 2. * fourK * dims[0] + dims[0];
+	bytes = ((double) fourK * dims[0] + fourK + 2 * dims[0]) *
+			sizeof(float);
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		error = clEnqueueNDRangeKernel(q, kernel, 1, NULL, dims, NULL,
 				0, NULL, &time);
@@ -182,6 +204,7 @@ int main(int argc, char **argv)
 
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("cl_relu_fc", flops, bytes, time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -197,15 +220,18 @@ int main(int argc, char **argv)
 			printf("Output invalid\n");
 	}
 
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 1, NULL, dims, NULL);
+
 	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
 			time_avg / opencl_get_iterations());
 
 	/* Tear down */
 	clReleaseEvent(time);
-	clReleaseMemObject(in);
-	clReleaseMemObject(biases);
-	clReleaseMemObject(weights);
-	clReleaseMemObject(out);
+	opencl_release_buffer(in);
+	opencl_release_buffer(biases);
+	opencl_release_buffer(weights);
+	opencl_release_buffer(out);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);
@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -50,6 +53,8 @@ int main(int argc, char **argv)
 	const cl_int N = 256;
 	const cl_int Ns = 1;
 	int retval = 0;
+	struct dataset *ds;
+	double flops, bytes;
 
 	cl_context ctx;
 	cl_command_queue q;
@@ -62,6 +67,8 @@ int main(int argc, char **argv)
 	cl_ulong time_avg = 0l;
 	/*TrackData *result;*/
 
+	opencl_real_enable();
+
 	while ((c = getopt (argc, argv, "?"OPENCL_OPTS)) != -1)
 	{
 		switch (c) {
@@ -77,10 +84,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Load the input while the platform is brought up */
 	data_entries = 512*1024;
-	bin_file_read("data/fft/in.bin", data_entries, (void **)&in);
-
-	printf("Read %"PRIi64" entries\n", data_entries);
+	ds = dataset_load_bin("data/fft/in.bin", data_entries, (void **)&in);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -99,28 +105,34 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	if (dataset_wait(ds)) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+
 	kernel = clCreateKernel(prg, "GPU_FFT_Global", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
 
-	clIn = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clIn = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clOut = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clOut = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	error = clEnqueueWriteBuffer(q, clIn, CL_FALSE, 0,
-			data_entries * sizeof(float), in, 0, NULL, NULL);
+	error = opencl_write_real(q, clIn, data_entries, in);
 	if (error != CL_SUCCESS) {
 		printf("Could not enqueue buffer write\n");
 		return -1;
@@ -136,6 +148,12 @@ int main(int argc, char **argv)
 	}
 
 	const size_t dims[] = {128,1024};
+
+	/* Per radix-2 butterfly two complex twiddle multiplies and a complex
+	 * add and subtract, excluding the twiddle factor computation */
+	flops = 16. * dims[0] * dims[1];
+	bytes = 2. * data_entries * opencl_real_size();
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
 
 		error = clEnqueueNDRangeKernel(q, kernel, 2, NULL, dims, NULL,
@@ -148,6 +166,8 @@ int main(int argc, char **argv)
 
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("GPU_FFT_Global", flops, bytes,
+				time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -161,13 +181,16 @@ int main(int argc, char **argv)
 			printf("Output invalid\n");
 	}
 
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 2, NULL, dims, NULL);
+
 	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
 			time_avg / opencl_get_iterations());
 
 	/* Tear down */
 	clReleaseEvent(time);
-	clReleaseMemObject(clIn);
-	clReleaseMemObject(clOut);
+	opencl_release_buffer(clIn);
+	opencl_release_buffer(clOut);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);
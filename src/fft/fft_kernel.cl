@@ -21,6 +21,11 @@
 #define __private
 #define CLK_LOCAL_MEM_FENCE 0
 typedef struct { float x; float y; } float2;
+typedef float real;
+typedef float2 real2;
+#define REAL_PI M_PI_F
+#define real_cos native_cos
+#define real_sin native_sin
 #endif
 
 // Block index
@@ -30,19 +35,19 @@ typedef struct { float x; float y; } float2;
 // Possible values are 2, 4, 8 and 16
 #define R 2
 
-inline float2 cmpMul( float2 a, float2 b ) { return (float2)( a.x*b.x-a.y*b.y, a.x*b.y+a.y*b.x ); }
+inline real2 cmpMul( real2 a, real2 b ) { return (real2)( a.x*b.x-a.y*b.y, a.x*b.y+a.y*b.x ); }
 
 #ifndef M_PI_F
 #define M_PI_F 3.141592653589793238462643f
 #endif
   
-inline void GPU_FFT2(__private float2 *v1, __private float2 *v2 ) { 
-  float2 v0 = *v1;
+inline void GPU_FFT2(__private real2 *v1, __private real2 *v2 ) { 
+  real2 v0 = *v1;
   *v1 = v0 + *v2; 
   *v2 = v0 - *v2;
 }
 
-inline void global_GPU_FFT2(__private float2* v){
+inline void global_GPU_FFT2(__private real2* v){
   GPU_FFT2(v, v+1);
 }
   
@@ -51,14 +56,14 @@ int GPU_expand(int idxL, int N1, int N2 ){
   return (idxL/N1)*N1*N2 + (idxL%N1); 
 }      
 
-void GPU_FftIteration(int j, int Ns, __global float2* data0, __global float2* data1, int N) { 
-  __private float2 v[R];
+void GPU_FftIteration(int j, int Ns, __global real2* data0, __global real2* data1, int N) { 
+  __private real2 v[R];
   int idxS = j;       
-  float angle = -2.f*M_PI_F*(j%Ns)/(Ns*2);
+  real angle = -2*REAL_PI*(j%Ns)/(Ns*2);
   
   for( int r=0; r<R; r++ ) { 
     v[r] = data0[idxS+r*N/R];
-    v[r] = cmpMul(v[r],((float2)(native_cos((float) r*angle), native_sin((float) r*angle))));
+    v[r] = cmpMul(v[r],((real2)(real_cos((real) r*angle), real_sin((real) r*angle))));
   }
 
   global_GPU_FFT2( v );
@@ -71,7 +76,7 @@ void GPU_FftIteration(int j, int Ns, __global float2* data0, __global float2* da
 
 }      
 
-__kernel void GPU_FFT_Global(int Ns, __global float2* data0, __global float2* data1, int N) { 
+__kernel void GPU_FFT_Global(int Ns, __global real2* data0, __global real2* data1, int N) { 
   /* Pick the right window */
   data0+=get_global_id(1)*N;
   data1+=get_global_id(1)*N;	 
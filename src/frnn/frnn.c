@@ -32,8 +32,12 @@
 #include <math.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
-#include "frnn/prefix_sum.h"
+#include "lib/dataset.h"
+#include "lib/svm.h"
+#include "lib/instr.h"
+#include "frnn/grid.h"
 
 enum AXIS {
 	X = 0,
@@ -47,6 +51,26 @@ const cl_float bins_dim = 100.0f; /* Bins per dimension */
 const cl_float radius = RADIUS;    /* Radius for neighbour search */
 const cl_float rsquare = RADIUS * RADIUS;
 
+/* Initial neighbour heap size, grown on overflow */
+#define NN_HEAP_NODES_PER_ELEM 8
+
+/* Host view of the neighbour lists, must match frnn_svm.cl */
+struct nn_node {
+	struct nn_node *next;
+	cl_ulong idx;
+	cl_float dist;
+};
+
+struct nn_list {
+	struct nn_node *head;
+	cl_uint count;
+};
+
+struct nn_heap {
+	cl_uint top;
+	cl_uint overflow;
+};
+
 void
 usage(char *prg)
 {
@@ -56,51 +80,97 @@ usage(char *prg)
 	printf("\t-i <file>\t Input file (default: "
 			"data/frnn/frnn_stanbun_000.txt)\n");
 	printf("\t-v\t\t Verbose: print neighbours\n");
+	printf("\t-l\t\t Build full neighbour lists in shared virtual "
+			"memory\n");
 	opencl_usage();
 }
 
+/* Compile the programs for the currently selected index width */
+static int
+frnn_compile(cl_context ctx, bool svm_lists, cl_program *prg,
+		cl_program *prg_svm)
+{
+	const char *programs = {
+		"src/frnn/frnn.cl"
+	};
+	const char *svm_programs[] = {
+		"src/frnn/frnn.cl",
+		"src/frnn/frnn_svm.cl",
+	};
+
+	*prg = opencl_compile_program(ctx, 1, &programs);
+	if (!*prg)
+		return -1;
+
+	if (!svm_lists)
+		return 0;
+
+	*prg_svm = opencl_compile_program_opts(ctx, 2, svm_programs,
+			"-cl-std=CL2.0");
+	if (!*prg_svm)
+		return -1;
+
+	return 0;
+}
+
+/* Points are normalised to [0, 1], keep the ones on the upper edge */
 cl_mem
-frnn_sort(cl_context ctx, cl_command_queue q, cl_program prg,
-		size_t elems, cl_mem in, cl_mem *bin_elems,
-		cl_mem *bin_prefix, cl_ulong *time_ns)
+frnn_sort(cl_context ctx, cl_command_queue q, size_t elems, cl_mem in,
+		cl_mem *bin_elems, cl_mem *bin_prefix, cl_ulong *time_ns)
 {
+	struct grid g;
 	cl_mem out;
-	cl_mem in_bin, bin_idx;
-	cl_kernel kernel_ins_cnt, kernel_reindex;
+
+	grid_init(&g, bins_dim, bins_dim, true);
+	out = grid_build(ctx, q, &g, elems, in, time_ns);
+	if (!out)
+		return NULL;
+
+	*bin_elems = g.cell_elems;
+	*bin_prefix = g.cell_start;
+
+	return out;
+}
+
+cl_mem
+frnn_nn(cl_context ctx, cl_command_queue q, cl_program prg,
+		size_t elems, cl_mem in, cl_mem bin_elems,
+		cl_mem bin_prefix, cl_ulong *time_ns)
+{
+	cl_mem nn;
+	cl_kernel kernel_nn;
 	cl_int error;
-	size_t bins;
-	const int zero = 0;
 	cl_event time;
-	cl_ulong t = 0ul;
+	cl_int b;
+	cl_ulong t;
+	struct instr *instr;
 
 	/* Determine grid point */
-	kernel_ins_cnt = clCreateKernel(prg, "kernel_ins_cnt", &error);
+	kernel_nn = clCreateKernel(prg, "kernel_nn", &error);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not create kernel\n");
 		return NULL;
 	}
 
-	in_bin = clCreateBuffer(ctx, CL_MEM_READ_WRITE, elems * sizeof(int),
-			NULL, &error);
+	nn = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
+			elems * opencl_index_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not create out buffer\n");
 		return NULL;
 	}
 
-	bins = prefix_sum_elems_ceil(ctx, bins_dim * bins_dim * bins_dim, NULL);
-	*bin_elems = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			bins * sizeof(int), NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create out buffer\n");
-		return NULL;
-	}
-	clEnqueueFillBuffer(q, *bin_elems, &zero, sizeof(int), 0,
-			bins * sizeof(int), 0, NULL, NULL);
+	opencl_kernel_resources(kernel_nn);
+	b = ceil(radius * bins_dim);
+	instr = instr_create(ctx, "kernel_nn", "bins,candidates", elems);
 
-	error =  clSetKernelArg(kernel_ins_cnt, 0, sizeof(cl_mem), &in);
-	error |= clSetKernelArg(kernel_ins_cnt, 1, sizeof(cl_float), &bins_dim);
-	error |= clSetKernelArg(kernel_ins_cnt, 2, sizeof(cl_mem), &in_bin);
-	error |= clSetKernelArg(kernel_ins_cnt, 3, sizeof(cl_mem), bin_elems);
+	error =  clSetKernelArg(kernel_nn, 0, sizeof(cl_mem), &in);
+	error |= clSetKernelArg(kernel_nn, 1, sizeof(cl_float), &bins_dim);
+	error |= clSetKernelArg(kernel_nn, 2, sizeof(cl_float), &rsquare);
+	error |= clSetKernelArg(kernel_nn, 3, sizeof(cl_int), &b);
+	error |= clSetKernelArg(kernel_nn, 4, sizeof(cl_mem), &bin_elems);
+	error |= clSetKernelArg(kernel_nn, 5, sizeof(cl_mem), &bin_prefix);
+	error |= clSetKernelArg(kernel_nn, 6, sizeof(cl_mem), &nn);
+	error |= instr_set_arg(instr, q, kernel_nn, 7);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "One of the arguments could not be set: %d.\n",
 				error);
@@ -108,7 +178,7 @@ frnn_sort(cl_context ctx, cl_command_queue q, cl_program prg,
 	}
 
 	const size_t dims[] = {elems};
-	error = clEnqueueNDRangeKernel(q, kernel_ins_cnt, 1, NULL, dims, NULL,
+	error = clEnqueueNDRangeKernel(q, kernel_nn, 1, NULL, dims, NULL,
 			0, NULL, &time);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
@@ -119,103 +189,54 @@ frnn_sort(cl_context ctx, cl_command_queue q, cl_program prg,
 	clFinish(q);
 	if (time_ns) {
 		t = opencl_exec_time(time);
-		printf("Time determining bins: %lins\n", t);
+		printf("Time determining nearest neighbour: %lins\n", t);
 		*time_ns += t;
-		t = 0ul;
 	}
 
 	clReleaseEvent(time);
+	instr_report(instr, q, 1);
 
-	/* Prefix sum to determine grid offsets */
-	*bin_prefix = prefix_sum(ctx, q, *bin_elems, bins, &t);
-	if (time_ns) {
-		printf("Time prefix-sum: %lins\n", t);
-		*time_ns += t;
-	}
-
-	/* Reorder elements into new buffers */
-	kernel_reindex = clCreateKernel(prg, "kernel_reindex", &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create kernel\n");
-		return NULL;
-	}
-
-	bin_idx = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			bins * sizeof(int), NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create out buffer\n");
-		return NULL;
-	}
-	clEnqueueFillBuffer(q, bin_idx, &zero, sizeof(int), 0,
-			bins * sizeof(int), 0, NULL, NULL);
-
-	out = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			3 * elems * sizeof(float), NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create reordered data buffer\n");
-		return NULL;
-	}
-
-	error =  clSetKernelArg(kernel_reindex, 0, sizeof(cl_mem), &in);
-	error |= clSetKernelArg(kernel_reindex, 1, sizeof(cl_mem), &out);
-	error |= clSetKernelArg(kernel_reindex, 2, sizeof(cl_mem), &in_bin);
-	error |= clSetKernelArg(kernel_reindex, 3, sizeof(cl_mem), bin_prefix);
-	error |= clSetKernelArg(kernel_reindex, 4, sizeof(cl_mem), &bin_idx);
-	if (error != CL_SUCCESS) {
-		printf("One of the arguments could not be set: %d.\n", error);
-		return NULL;
-	}
-	error = clEnqueueNDRangeKernel(q, kernel_reindex, 1, NULL, dims, NULL,
-			0, NULL, &time);
-	if (error != CL_SUCCESS) {
-		printf("Could not enqueue kernel execution: %d\n", error);
-		return NULL;
-	}
-
-	clFinish(q);
-	if (time_ns) {
-		t = opencl_exec_time(time);
-		printf("Time reindexing: %lins\n", t);
-		*time_ns += t;
-	}
-
-	clReleaseEvent(time);
+	/* Optional extra measurements */
+	opencl_kernel_measure(q, kernel_nn, 1, NULL, dims, NULL);
 
 	/* Tear-down */
-	clReleaseMemObject(bin_idx);
-	clReleaseMemObject(in_bin);
-	clReleaseKernel(kernel_ins_cnt);
-	clReleaseKernel(kernel_reindex);
+	instr_release(instr);
+	clReleaseKernel(kernel_nn);
 
-	return out;
+	return nn;
 }
 
-cl_mem
-frnn_nn(cl_context ctx, cl_command_queue q, cl_program prg,
-		size_t elems, cl_mem in, cl_mem bin_elems,
-		cl_mem bin_prefix, cl_ulong *time_ns)
+struct nn_list *
+frnn_nn_svm(cl_context ctx, cl_command_queue q, cl_program prg,
+		clSvmGranularity gran, size_t elems, cl_mem in,
+		cl_mem bin_elems, cl_mem bin_prefix, struct nn_node **heap_out,
+		cl_uint *heap_nodes, cl_ulong *time_ns)
 {
-	cl_mem nn;
+	struct nn_list *lists;
+	struct nn_node *heap = NULL;
+	struct nn_heap *alloc;
 	cl_kernel kernel_nn;
 	cl_int error;
 	cl_event time;
 	cl_int b;
-	cl_ulong t;
+	cl_uint heap_nodes_arg, used, overflow;
+	cl_ulong t, max_alloc;
+	size_t heap_size;
 
-	/* Determine grid point */
-	kernel_nn = clCreateKernel(prg, "kernel_nn", &error);
+	kernel_nn = clCreateKernel(prg, "kernel_nn_list", &error);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not create kernel\n");
 		return NULL;
 	}
 
-	nn = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, elems * sizeof(int),
-			NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create out buffer\n");
+	lists = opencl_svm_alloc(ctx, elems * sizeof(struct nn_list), gran);
+	alloc = opencl_svm_alloc(ctx, sizeof(struct nn_heap), gran);
+	if (!lists || !alloc) {
+		fprintf(stderr, "Could not allocate neighbour lists\n");
 		return NULL;
 	}
 
+	opencl_kernel_resources(kernel_nn);
 	b = ceil(radius * bins_dim);
 
 	error =  clSetKernelArg(kernel_nn, 0, sizeof(cl_mem), &in);
@@ -224,35 +245,100 @@ frnn_nn(cl_context ctx, cl_command_queue q, cl_program prg,
 	error |= clSetKernelArg(kernel_nn, 3, sizeof(cl_int), &b);
 	error |= clSetKernelArg(kernel_nn, 4, sizeof(cl_mem), &bin_elems);
 	error |= clSetKernelArg(kernel_nn, 5, sizeof(cl_mem), &bin_prefix);
-	error |= clSetKernelArg(kernel_nn, 6, sizeof(cl_mem), &nn);
+	error |= opencl_svm_set_kernel_arg(kernel_nn, 8, alloc);
+	error |= opencl_svm_set_kernel_arg(kernel_nn, 9, lists);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "One of the arguments could not be set: %d.\n",
 				error);
 		return NULL;
 	}
 
-	const size_t dims[] = {elems};
-	error = clEnqueueNDRangeKernel(q, kernel_nn, 1, NULL, dims, NULL,
-			0, NULL, &time);
+	error = clGetDeviceInfo(opencl_get_device(),
+			CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong),
+			&max_alloc, NULL);
 	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
-				error);
+		fprintf(stderr, "Could not query maximum allocation size\n");
 		return NULL;
 	}
 
-	clFinish(q);
-	if (time_ns) {
+	/* The number of neighbours is not known up front. Start with a modest
+	 * heap, and grow it if the kernel runs out of nodes. */
+	heap_size = elems * NN_HEAP_NODES_PER_ELEM;
+	do {
+		/* Nodes are indexed with 32 bits by the kernel */
+		if (heap_size > UINT32_MAX ||
+		    heap_size * sizeof(struct nn_node) > max_alloc) {
+			fprintf(stderr, "Neighbour heap of %zu nodes exceeds "
+					"the maximum allocation size\n",
+					heap_size);
+			return NULL;
+		}
+
+		heap = opencl_svm_alloc(ctx, heap_size * sizeof(struct nn_node),
+				gran);
+		if (!heap) {
+			fprintf(stderr, "Could not allocate neighbour heap of "
+					"%zu nodes\n", heap_size);
+			return NULL;
+		}
+
+		opencl_svm_map(q, alloc, sizeof(struct nn_heap), true);
+		alloc->top = 0;
+		alloc->overflow = 0;
+		opencl_svm_unmap(q, alloc);
+
+		heap_nodes_arg = heap_size;
+		error =  opencl_svm_set_kernel_arg(kernel_nn, 6, heap);
+		error |= clSetKernelArg(kernel_nn, 7, sizeof(cl_uint),
+				&heap_nodes_arg);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "One of the arguments could not be "
+					"set: %d.\n", error);
+			return NULL;
+		}
+
+		const size_t dims[] = {elems};
+		error = clEnqueueNDRangeKernel(q, kernel_nn, 1, NULL, dims,
+				NULL, 0, NULL, &time);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not enqueue kernel execution: "
+					"%d\n", error);
+			return NULL;
+		}
+
+		clFinish(q);
 		t = opencl_exec_time(time);
-		printf("Time determining nearest neighbour: %lins\n", t);
-		*time_ns += t;
-	}
+		clReleaseEvent(time);
+
+		opencl_svm_map(q, alloc, sizeof(struct nn_heap), false);
+		used = alloc->top;
+		overflow = alloc->overflow;
+		opencl_svm_unmap(q, alloc);
+
+		if (overflow) {
+			printf("Neighbour heap of %zu nodes exhausted after "
+					"%lins, retrying\n", heap_size, t);
+			opencl_svm_free(ctx, heap);
+			heap_size *= 2;
+		}
+	} while (overflow);
 
-	clReleaseEvent(time);
+	printf("Time building neighbour lists: %lins\n", t);
+	printf("Neighbour heap: %u of %zu nodes allocated\n", used,
+			heap_size);
+	if (time_ns)
+		*time_ns = t;
+
+	/* No extra measurements: every launch allocates its list nodes from
+	 * the shared heap, repeating it would exhaust the heap */
 
 	/* Tear-down */
+	opencl_svm_free(ctx, alloc);
 	clReleaseKernel(kernel_nn);
 
-	return nn;
+	*heap_out = heap;
+	*heap_nodes = heap_size;
+	return lists;
 }
 
 cl_mem
@@ -267,7 +353,8 @@ frnn_centoids(cl_context ctx, cl_command_queue q, cl_program prg,
 	cl_int b;
 	cl_ulong t;
 
-	out = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
+	out = opencl_create_buffer(ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
 			3 * elems * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not create centoid buffer\n");
@@ -281,6 +368,7 @@ frnn_centoids(cl_context ctx, cl_command_queue q, cl_program prg,
 		return NULL;
 	}
 
+	opencl_kernel_resources(kernel_nn);
 	b = ceil(radius * bins_dim);
 
 	error =  clSetKernelArg(kernel_nn, 0, sizeof(cl_mem), &in);
@@ -314,6 +402,9 @@ frnn_centoids(cl_context ctx, cl_command_queue q, cl_program prg,
 
 	clReleaseEvent(time);
 
+	/* Optional extra measurements */
+	opencl_kernel_measure(q, kernel_nn, 1, NULL, dims, NULL);
+
 	/* Tear-down */
 	clReleaseKernel(kernel_nn);
 
@@ -327,21 +418,28 @@ int main(int argc, char **argv)
 	char *file = "data/frnn/frnn_stanbun_000.txt";
 	int64_t data_entries;
 	float **data;
+	struct dataset *ds;
 
 	cl_context ctx;
 	cl_command_queue q;
-	cl_program prg;
+	cl_program prg, prg_svm = NULL;
 	cl_mem cldata, bin_elems, bin_prefix, nn, centoids;
 	cl_mem cldata_ordered;
 	cl_int error;
 	cl_ulong time_ns = 0;
+	cl_ulong t_nn = 0, t_nn_svm = 0;
 	bool verbose = false, verbose_centoids = false;
+	bool svm_lists = false;
+	clSvmGranularity svm_gran = OPENCL_SVM_NONE;
+	struct nn_list *lists = NULL;
+	struct nn_node *heap = NULL, *node;
+	cl_uint heap_nodes = 0;
 
-	int *result;
+	void *result;
 	float **data_ordered, **cents;
 	int i;
 
-	while ((c = getopt (argc, argv, "?i:vc"OPENCL_OPTS)) != -1)
+	while ((c = getopt (argc, argv, "?i:vcl"OPENCL_OPTS)) != -1)
 	{
 		switch (c) {
 		case '?':
@@ -356,6 +454,9 @@ int main(int argc, char **argv)
 		case 'c':
 			verbose_centoids = true;
 			break;
+		case 'l':
+			svm_lists = true;
+			break;
 		default:
 			ret = opencl_parse_option(c, optarg);
 			if (ret != 0) {
@@ -365,18 +466,10 @@ int main(int argc, char **argv)
 		}
 	}
 
-	data_entries = csv_file_read_float_n(file, 3, &data);
-	printf("Read %"PRIi64" entries\n", data_entries);
-
-	if (data_entries > UINT32_MAX) {
-		/* This limitation stems from the conversion of global id in
-		 * frnn.cl from size_t to 32-bit int. Improves AMD performance
-		 * by about 6% probably due to reduced register pressure.
-		 */
-		fprintf(stderr, "Data size (%"PRIu64") too large for"
-				"benchmark\n", data_entries);
-	}
+	/* Load the input while the platform is brought up */
+	ds = dataset_load_csv_float_n(file, 3, &data);
 
+	opencl_index_enable();
 	ctx = opencl_create_context();
 	if (!ctx) {
 		usage(argv[0]);
@@ -389,12 +482,42 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	const char *programs = {
-		"src/frnn/frnn.cl"
-	};
-	prg = opencl_compile_program(ctx, 1, &programs);
+	if (svm_lists) {
+		svm_gran = opencl_svm_caps();
+		if (svm_gran == OPENCL_SVM_NONE) {
+			fprintf(stderr, "Neighbour lists require shared "
+					"virtual memory support\n");
+			return -1;
+		}
+	}
+
+	if (frnn_compile(ctx, svm_lists, &prg, &prg_svm))
+		return -1;
+
+	data_entries = dataset_wait(ds);
+	if (data_entries < 0) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+
+	/* 32-bit indices improve AMD performance by about 6%, probably due to
+	 * reduced register pressure. Only go 64-bit if the input requires it.
+	 */
+	ret = opencl_index_select(data_entries);
+	if (ret < 0)
+		return -1;
+	if (ret > 0) {
+		clReleaseProgram(prg);
+		if (prg_svm)
+			clReleaseProgram(prg_svm);
+		if (frnn_compile(ctx, svm_lists, &prg, &prg_svm))
+			return -1;
+	}
 
-	cldata = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	opencl_mem_stage("input");
+	cldata = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not create data buffer\n");
@@ -409,20 +532,23 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	cldata_ordered = frnn_sort(ctx, q, prg, data_entries, cldata,
-			&bin_elems, &bin_prefix, &time_ns);
+	opencl_mem_stage("sort");
+	cldata_ordered = frnn_sort(ctx, q, data_entries, cldata, &bin_elems,
+			&bin_prefix, &time_ns);
+	if (!cldata_ordered)
+		return -1;
 
 	/* Now find nearest neighbours for each element.
 	 *
-	 * The current implementation only seeks the one closest neighbour
-	 * within specified radius.
+	 * By default only the one closest neighbour within specified radius
+	 * is sought.
 	 * A search for more (or all) neighbours is feasible, but requires
 	 * either;
 	 * - Linked lists. Requires a heterogeneous memory model and some
-	 *     form of (poor-mans) malloc. The former can technically be
-	 *     assumed in embedded systems. The latter requires significant
-	 *     overprovisioning of the heap as compute cores cannot request
-	 *     memory pages from the OS at runtime.
+	 *     form of (poor-mans) malloc. Implemented with -l using OpenCL
+	 *     2.0 SVM and a bump allocator. The heap is overprovisioned and
+	 *     grown on overflow, as compute cores cannot request memory
+	 *     pages from the OS at runtime.
 	 * - An n*n table. Of limited use as post-processing requires n^2
 	 *     algorithms to iterate the table.
 	 * kNN within radius can technically be done with static lists of k*n,
@@ -434,12 +560,26 @@ int main(int argc, char **argv)
 	 * requirements
 	 */
 
+	opencl_mem_stage("nn");
 	nn = frnn_nn(ctx, q, prg, data_entries, cldata_ordered, bin_elems,
-			bin_prefix, &time_ns);
+			bin_prefix, &t_nn);
+	time_ns += t_nn;
 
+	if (svm_lists) {
+		opencl_mem_stage("lists");
+		lists = frnn_nn_svm(ctx, q, prg_svm, svm_gran, data_entries,
+				cldata_ordered, bin_elems, bin_prefix, &heap,
+				&heap_nodes, &t_nn_svm);
+		if (!lists)
+			return -1;
+
+		printf("Neighbour lists vs. nearest neighbour: %lins vs. "
+				"%lins (%.2fx)\n", t_nn_svm, t_nn,
+				(double) t_nn_svm / t_nn);
+	}
 
 	if (verbose | verbose_centoids) {
-		result = malloc(data_entries * sizeof(int));
+		result = malloc(data_entries * opencl_index_size());
 
 		data_ordered = malloc(3 * sizeof(float *));
 		for (i = 0; i < 3; i++) {
@@ -453,14 +593,35 @@ int main(int argc, char **argv)
 	if (verbose) {
 		printf("Neighbours: \n");
 		clEnqueueReadBuffer(q, nn, CL_TRUE, 0,
-				sizeof(int) * data_entries, result, 0, NULL,
-				NULL);
+				opencl_index_size() * data_entries, result, 0,
+				NULL, NULL);
 		for(i = 0; i < data_entries; i++)
-			printf("%i (%.3f, %.3f, %.3f): %i\n", i,
+			printf("%i (%.3f, %.3f, %.3f): %"PRIi64"\n", i,
 					data_ordered[X][i], data_ordered[Y][i],
-					data_ordered[Z][i], result[i]);
+					data_ordered[Z][i],
+					opencl_index_get(result, i));
+	}
+
+	if (verbose && lists) {
+		/* Walk the device-built lists through their SVM pointers */
+		opencl_svm_map(q, lists, data_entries * sizeof(struct nn_list),
+				false);
+		opencl_svm_map(q, heap, heap_nodes * sizeof(struct nn_node),
+				false);
+
+		printf("Neighbour lists: \n");
+		for (i = 0; i < data_entries; i++) {
+			printf("%i (%u):", i, lists[i].count);
+			for (node = lists[i].head; node; node = node->next)
+				printf(" %"PRIu64, node->idx);
+			printf("\n");
+		}
+
+		opencl_svm_unmap(q, heap);
+		opencl_svm_unmap(q, lists);
 	}
 
+	opencl_mem_stage("centoids");
 	centoids = frnn_centoids(ctx, q, prg, data_entries, cldata_ordered,
 			bin_elems, bin_prefix, &time_ns);
 
@@ -484,11 +645,18 @@ int main(int argc, char **argv)
 	printf("Total execution time (excl data upload): %lins\n", time_ns);
 
 	/* Tear down */
-	clReleaseMemObject(cldata);
-	clReleaseMemObject(cldata_ordered);
-	clReleaseMemObject(centoids);
-	clReleaseMemObject(bin_elems);
-	clReleaseMemObject(bin_prefix);
+	opencl_release_buffer(cldata);
+	opencl_release_buffer(cldata_ordered);
+	opencl_release_buffer(centoids);
+	opencl_release_buffer(nn);
+	opencl_release_buffer(bin_elems);
+	opencl_release_buffer(bin_prefix);
+
+	if (svm_lists) {
+		opencl_svm_free(ctx, heap);
+		opencl_svm_free(ctx, lists);
+		clReleaseProgram(prg_svm);
+	}
 
 	opencl_teardown(&ctx, &q, &prg);
 	free(data[X]);
@@ -22,73 +22,30 @@
  * SOFTWARE.
  */
 
-inline int coord_to_bin(float x, float y, float z, float bins_dim)
-{
-	float b_x, b_y, b_z;
-
-	b_x = floor(x * bins_dim);
-	b_y = floor(y * bins_dim);
-	b_z = floor(z * bins_dim);
-
-	return b_x + (b_y * bins_dim) + (b_z * bins_dim * bins_dim);
-}
-
-/* Launch in 1D */
-__kernel void kernel_ins_cnt(float __global *data_x, float bins_dim,
-		int __global *data_bin, volatile int __global *bin_size) {
-
-	int bin;
-	unsigned int n = get_global_id(0);
-	unsigned int elems = get_global_size(0);
-
-	bin = coord_to_bin(data_x[n], data_x[n + elems], data_x[n + 2*elems],
-			bins_dim);
-	data_bin[n] = bin;
-	atomic_inc(&bin_size[bin]);
-}
-
-/* Launch in 1D */
-__kernel void kernel_reindex(float __global *in_x, float __global *out_x,
-		int __global *data_bin, volatile int __global *bin_prefix,
-		volatile __global int *bin_idx) {
-
-	int bin, elem;
-	size_t n = get_global_id(0);
-	unsigned int elems = get_global_size(0);
-
-	bin = data_bin[n];
-	elem = bin_prefix[bin] + atomic_inc(&bin_idx[bin]);
-
-	out_x[elem] = in_x[n];
-	out_x[elem + elems] = in_x[n + elems];
-	out_x[elem + (2*elems)] = in_x[n + (2*elems)];
-
-	return;
-}
-
 inline float manhattan_dist_3d(float x, float y, float z, float that_x,
 		float that_y, float that_z)
 {
 	return pown(that_x - x, 2) + pown(that_y - y, 2) + pown(that_z - z, 2);
 }
 
-/* Launch in 1D */
+/* Launch in 1D
+ * Instrumented: 0 = bins visited, 1 = candidate points compared */
 __kernel void kernel_nn(float __global *in_x, float bins_dim, float rsquare,
-		int b, int __global *bin_elems, int __global *bin_prefix,
-		int __global *nn)
+		int b, int __global *bin_elems, idx_t __global *bin_prefix,
+		sidx_t __global *nn INSTR_PARAM)
 {
-	/* Truncating to 32-bits increases occupancy on AMD RX460
+	/* 32-bit indices increase occupancy on AMD RX460
 	 * Result is ~10% more perf */
-	unsigned int n;
-	unsigned int i;
+	idx_t n;
+	idx_t i;
 	int b_x, b_y, b_z;
 	unsigned int i_x, i_y, i_z;
 	float x, y, z;
 	unsigned int bin;
-	int neighbour = -1;
+	sidx_t neighbour = -1;
 	float neigh_dist = FLT_MAX;
 	float dist;
-	unsigned int elems = get_global_size(0);
+	idx_t elems = get_global_size(0);
 
 	/* Find coords for my point */
 	n = get_global_id(0);
@@ -114,6 +71,8 @@ __kernel void kernel_nn(float __global *in_x, float bins_dim, float rsquare,
 
 				bin = i_x + (i_y * bins_dim) +
 					(i_z * bins_dim * bins_dim);
+				INSTR_INC(0);
+				INSTR_ADD(1, bin_elems[bin]);
 
 				for (i = bin_prefix[bin];
 				     i < bin_prefix[bin] + bin_elems[bin];
@@ -142,12 +101,12 @@ __kernel void kernel_nn(float __global *in_x, float bins_dim, float rsquare,
 /* Launch in 1D */
 __kernel void kernel_nn_centoids(float __global *in_x, float bins_dim,
 		float rsquare, int b, unsigned int __global *bin_elems,
-		unsigned int __global *bin_prefix,
+		idx_t __global *bin_prefix,
 		float __global *cent_x)
 {
-	/* Truncating n to 32-bits increases occupancy on AMD RX460 */
-	unsigned int n;
-	unsigned int i;
+	/* 32-bit indices increase occupancy on AMD RX460 */
+	idx_t n;
+	idx_t i;
 	int b_x, b_y, b_z;
 	unsigned int i_x, i_y, i_z;
 	float x, y, z;
@@ -155,7 +114,7 @@ __kernel void kernel_nn_centoids(float __global *in_x, float bins_dim,
 	float dist;
 	float3 centoid = {0.f,0.f,0.f};
 	unsigned int k = 0;
-	unsigned int elems = get_global_size(0);
+	idx_t elems = get_global_size(0);
 
 	/* Find coords for my point */
 	n = get_global_id(0);
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ * Full neighbour lists for the fixed-radius near neighbour search, stored as
+ * linked lists in shared virtual memory. Nodes are handed out by a device-side
+ * bump allocator. Requires OpenCL 2.0, compile together with frnn.cl.
+ */
+
+/* Node and list layout must match their host-side counterparts in frnn.c.
+ * Pointers are valid on both host and device. */
+struct nn_node {
+	__global struct nn_node *next;
+	ulong idx;
+	float dist;
+};
+
+struct nn_list {
+	__global struct nn_node *head;
+	unsigned int count;
+};
+
+struct nn_heap {
+	unsigned int top;
+	unsigned int overflow;
+};
+
+/* Nodes claimed from the heap per allocation, to reduce atomic contention */
+#define NN_CHUNK 8
+
+/* Launch in 1D */
+__kernel void kernel_nn_list(float __global *in_x, float bins_dim,
+		float rsquare, int b, int __global *bin_elems,
+		idx_t __global *bin_prefix, __global struct nn_node *heap,
+		unsigned int heap_size, volatile __global struct nn_heap *alloc,
+		__global struct nn_list *lists)
+{
+	idx_t n;
+	idx_t i;
+	int b_x, b_y, b_z;
+	unsigned int i_x, i_y, i_z;
+	float x, y, z;
+	unsigned int bin;
+	float dist;
+	idx_t elems = get_global_size(0);
+	__global struct nn_node *head = NULL;
+	unsigned int count = 0;
+	unsigned int slot = 0, slot_end = 0;
+
+	/* Find coords for my point */
+	n = get_global_id(0);
+
+	x = in_x[n];
+	y = in_x[n + elems];
+	z = in_x[n + (2*elems)];
+
+	b_x = floor(x * bins_dim);
+	b_y = floor(y * bins_dim);
+	b_z = floor(z * bins_dim);
+
+	for (i_z = max(0, b_z - b); i_z <= min((int)bins_dim, b_z + b); i_z++) {
+		for (i_y = max(0, b_y - b); i_y <= min((int)bins_dim , b_y + b);
+		     i_y++) {
+			for (i_x = max(0, b_x - b);
+			     i_x <= min((int)bins_dim , b_x + b); i_x++) {
+
+				bin = i_x + (i_y * bins_dim) +
+					(i_z * bins_dim * bins_dim);
+
+				for (i = bin_prefix[bin];
+				     i < bin_prefix[bin] + bin_elems[bin];
+				     i++) {
+
+					if (i == n)
+						continue;
+
+					dist = manhattan_dist_3d(x, y, z,
+						    in_x[i], in_x[i + elems],
+						    in_x[i + (2*elems)]);
+
+					if (dist > rsquare)
+						continue;
+
+					/* Grab a new chunk of nodes */
+					if (slot == slot_end) {
+						slot = atomic_add(&alloc->top,
+								NN_CHUNK);
+						slot_end = slot + NN_CHUNK;
+
+						if (slot_end > heap_size) {
+							alloc->overflow = 1;
+							goto out;
+						}
+					}
+
+					heap[slot].idx = i;
+					heap[slot].dist = dist;
+					heap[slot].next = head;
+					head = &heap[slot];
+					slot++;
+					count++;
+				}
+			}
+		}
+	}
+
+out:
+	lists[n].head = head;
+	lists[n].count = count;
+}
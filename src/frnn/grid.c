@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "frnn/grid.h"
+#include "frnn/prefix_sum.h"
+
+/* Upper bound on the local histogram, to keep a few work-groups resident */
+#define GRID_MAX_SLOTS 4096
+
+void
+grid_init(struct grid *g, cl_uint dim, cl_float scale, bool clamp)
+{
+	g->dim = dim;
+	g->scale = scale;
+	g->clamp = clamp;
+	g->cells = (size_t) dim * dim * dim;
+	g->elems = 0;
+	g->cell_elems = NULL;
+	g->cell_start = NULL;
+}
+
+void
+grid_release(struct grid *g)
+{
+	if (g->cell_elems)
+		opencl_release_buffer(g->cell_elems);
+	if (g->cell_start)
+		opencl_release_buffer(g->cell_start);
+
+	g->cell_elems = NULL;
+	g->cell_start = NULL;
+}
+
+/* Number of local histogram slots. A power of two, covering the entire grid
+ * if it fits in half the local memory. */
+static cl_uint
+grid_slots(size_t cells)
+{
+	cl_ulong local_mem;
+	cl_uint slots = 1;
+	cl_int error;
+
+	error = clGetDeviceInfo(opencl_get_device(), CL_DEVICE_LOCAL_MEM_SIZE,
+			sizeof(cl_ulong), &local_mem, NULL);
+	if (error != CL_SUCCESS)
+		local_mem = 16384;
+
+	while (slots < cells && slots < GRID_MAX_SLOTS &&
+	       (slots * 2) * (sizeof(cl_int) + sizeof(cl_uint)) <=
+	       local_mem / 2)
+		slots *= 2;
+
+	return slots;
+}
+
+/* Number of points in the sorted buffer */
+static size_t
+grid_sorted_elems(cl_command_queue q, struct grid *g)
+{
+	size_t last_cell;
+	cl_ulong prefix = 0;
+	cl_uint count = 0;
+
+	last_cell = g->cells - 1;
+	clEnqueueReadBuffer(q, g->cell_start, CL_FALSE,
+			opencl_index_size() * last_cell, opencl_index_size(),
+			&prefix, 0, NULL, NULL);
+	clEnqueueReadBuffer(q, g->cell_elems, CL_TRUE,
+			sizeof(cl_uint) * last_cell, sizeof(cl_uint), &count,
+			0, NULL, NULL);
+
+	return opencl_index_get(&prefix, 0) + count;
+}
+
+cl_mem
+grid_build(cl_context ctx, cl_command_queue q, struct grid *g,
+		size_t elems, cl_mem in, cl_ulong *time_ns)
+{
+	cl_program prg;
+	cl_kernel kernel_count = NULL, kernel_scatter = NULL;
+	cl_mem out = NULL;
+	cl_mem cell = NULL, rank = NULL;
+	cl_int error;
+	cl_event time;
+	cl_ulong t = 0ul;
+	size_t cells_ceil, wg_size, items;
+	cl_uint slots, mask;
+	const cl_int dim = g->dim;
+	const cl_int clamp = g->clamp;
+	const cl_uint zero = 0;
+
+	const char *programs = {
+		"src/frnn/grid.cl"
+	};
+	prg = opencl_compile_program(ctx, 1, &programs);
+	if (!prg)
+		return NULL;
+
+	kernel_count = clCreateKernel(prg, "grid_count", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel grid_count\n");
+		goto error;
+	}
+
+	kernel_scatter = clCreateKernel(prg, "grid_scatter", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel grid_scatter\n");
+		goto error;
+	}
+
+	wg_size = opencl_max_workgroup_size();
+	if (wg_size > 256)
+		wg_size = 256;
+	items = ((elems + wg_size - 1) / wg_size) * wg_size;
+
+	slots = grid_slots(g->cells);
+	mask = slots - 1;
+
+	cell = opencl_create_buffer(ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+			elems * sizeof(cl_int), NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create out buffer\n");
+		goto error;
+	}
+
+	rank = opencl_create_buffer(ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+			elems * sizeof(cl_uint), NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create out buffer\n");
+		goto error;
+	}
+
+	/* The scan reads past the last cell, keep the padding zero */
+	cells_ceil = prefix_sum_elems_ceil(ctx, g->cells, NULL);
+	g->cell_elems = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			cells_ceil * sizeof(cl_uint), NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create out buffer\n");
+		g->cell_elems = NULL;
+		goto error;
+	}
+	clEnqueueFillBuffer(q, g->cell_elems, &zero, sizeof(cl_uint), 0,
+			cells_ceil * sizeof(cl_uint), 0, NULL, NULL);
+
+	/* Count points per cell */
+	error =  clSetKernelArg(kernel_count, 0, sizeof(cl_mem), &in);
+	error |= opencl_set_kernel_arg_idx(kernel_count, 1, elems);
+	error |= clSetKernelArg(kernel_count, 2, sizeof(cl_float), &g->scale);
+	error |= clSetKernelArg(kernel_count, 3, sizeof(cl_int), &dim);
+	error |= clSetKernelArg(kernel_count, 4, sizeof(cl_int), &clamp);
+	error |= clSetKernelArg(kernel_count, 5, sizeof(cl_mem), &cell);
+	error |= clSetKernelArg(kernel_count, 6, sizeof(cl_mem), &rank);
+	error |= clSetKernelArg(kernel_count, 7, sizeof(cl_mem),
+			&g->cell_elems);
+	error |= clSetKernelArg(kernel_count, 8, sizeof(cl_uint), &mask);
+	error |= clSetKernelArg(kernel_count, 9, slots * sizeof(cl_int), NULL);
+	error |= clSetKernelArg(kernel_count, 10, slots * sizeof(cl_uint),
+			NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "One of the arguments could not be set: %d.\n",
+				error);
+		goto error;
+	}
+
+	const size_t dims[] = {items};
+	const size_t ldims[] = {wg_size};
+	error = clEnqueueNDRangeKernel(q, kernel_count, 1, NULL, dims, ldims,
+			0, NULL, &time);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
+				error);
+		goto error;
+	}
+
+	clFinish(q);
+	if (time_ns) {
+		t = opencl_exec_time(time);
+		printf("Time determining bins (%u slots): %lins\n", slots, t);
+		*time_ns += t;
+		t = 0ul;
+	}
+
+	clReleaseEvent(time);
+
+	/* Prefix sum to determine cell offsets */
+	g->cell_start = prefix_sum(ctx, q, g->cell_elems, cells_ceil, &t);
+	if (g->cell_start == (cl_mem) -1) {
+		fprintf(stderr, "Could not determine cell offsets\n");
+		g->cell_start = NULL;
+		goto error;
+	}
+	if (time_ns) {
+		printf("Time prefix-sum: %lins\n", t);
+		*time_ns += t;
+	}
+
+	g->elems = grid_sorted_elems(q, g);
+	if (g->elems == 0) {
+		fprintf(stderr, "No points inside the grid\n");
+		goto error;
+	}
+
+	/* Reorder elements into new buffer */
+	out = opencl_create_buffer(ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
+			3 * g->elems * sizeof(cl_float), NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create reordered data buffer\n");
+		out = NULL;
+		goto error;
+	}
+
+	error =  clSetKernelArg(kernel_scatter, 0, sizeof(cl_mem), &in);
+	error |= opencl_set_kernel_arg_idx(kernel_scatter, 1, elems);
+	error |= clSetKernelArg(kernel_scatter, 2, sizeof(cl_mem), &out);
+	error |= opencl_set_kernel_arg_idx(kernel_scatter, 3, g->elems);
+	error |= clSetKernelArg(kernel_scatter, 4, sizeof(cl_mem), &cell);
+	error |= clSetKernelArg(kernel_scatter, 5, sizeof(cl_mem), &rank);
+	error |= clSetKernelArg(kernel_scatter, 6, sizeof(cl_mem),
+			&g->cell_start);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "One of the arguments could not be set: %d.\n",
+				error);
+		goto error_out;
+	}
+
+	error = clEnqueueNDRangeKernel(q, kernel_scatter, 1, NULL, dims, ldims,
+			0, NULL, &time);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
+				error);
+		goto error_out;
+	}
+
+	clFinish(q);
+	if (time_ns) {
+		t = opencl_exec_time(time);
+		printf("Time reindexing: %lins\n", t);
+		*time_ns += t;
+	}
+
+	clReleaseEvent(time);
+
+	/* Optional extra measurements. The count adds to the cell sizes, only
+	 * the scatter can be repeated. */
+	opencl_kernel_measure(q, kernel_scatter, 1, NULL, dims, ldims);
+	goto out;
+
+error_out:
+	opencl_release_buffer(out);
+	out = NULL;
+error:
+	grid_release(g);
+out:
+	/* Tear-down */
+	if (rank)
+		opencl_release_buffer(rank);
+	if (cell)
+		opencl_release_buffer(cell);
+	if (kernel_scatter)
+		clReleaseKernel(kernel_scatter);
+	if (kernel_count)
+		clReleaseKernel(kernel_count);
+	clReleaseProgram(prg);
+
+	return out;
+}
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Uniform grid construction. Points are binned with a work-group private
+ * histogram in local memory, which also hands out each point's rank within
+ * its cell, such that the scatter needs no further atomics.
+ */
+
+inline int grid_cell(float x, float y, float z, float scale, int dim,
+		int clamp_cells)
+{
+	int3 c;
+
+	c = convert_int3_sat_rtn((float3)(x, y, z) * scale);
+
+	if (clamp_cells)
+		c = clamp(c, 0, dim - 1);
+	else if (any(c < 0) || any(c >= dim))
+		return -1;
+
+	return c.x + (c.y * dim) + (c.z * dim * dim);
+}
+
+/* Launch in 1D, global size rounded up to a multiple of the local size.
+ *
+ * The local histogram is a hash table of mask + 1 cells. If the grid has
+ * fewer cells than slots it is an ordinary privatised histogram, otherwise
+ * cells are claimed first-come first-serve and points that collide fall back
+ * to a global atomic. */
+__kernel void grid_count(float __global *in, idx_t elems, float scale,
+		int dim, int clamp_cells, int __global *cell,
+		uint __global *rank, volatile uint __global *cell_elems,
+		uint mask, volatile int __local *l_cell,
+		volatile uint __local *l_cnt)
+{
+	idx_t n = get_global_id(0);
+	uint lx = get_local_id(0);
+	uint i;
+	int c = -1;
+	int k;
+	int slot = -1;
+	uint r = 0;
+
+	for (i = lx; i <= mask; i += get_local_size(0)) {
+		l_cell[i] = -1;
+		l_cnt[i] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (n < elems) {
+		c = grid_cell(in[n], in[n + elems], in[n + (2 * elems)],
+				scale, dim, clamp_cells);
+		cell[n] = c;
+	}
+
+	if (c >= 0) {
+		slot = c & mask;
+		k = atomic_cmpxchg(&l_cell[slot], -1, c);
+		if (k == -1 || k == c) {
+			r = atomic_inc(&l_cnt[slot]);
+		} else {
+			slot = -1;
+			r = atomic_inc(&cell_elems[c]);
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* Flush, turning the local count into this work-group's base rank */
+	for (i = lx; i <= mask; i += get_local_size(0)) {
+		if (l_cnt[i])
+			l_cnt[i] = atomic_add(&cell_elems[l_cell[i]],
+					l_cnt[i]);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (slot >= 0)
+		r += l_cnt[slot];
+
+	if (n < elems)
+		rank[n] = r;
+}
+
+/* Launch in 1D, global size rounded up to a multiple of the local size */
+__kernel void grid_scatter(float __global *in, idx_t in_elems,
+		float __global *out, idx_t out_elems, int __global *cell,
+		uint __global *rank, idx_t __global *cell_start)
+{
+	idx_t n = get_global_id(0);
+	idx_t elem;
+	int c;
+
+	if (n >= in_elems)
+		return;
+
+	c = cell[n];
+	if (c < 0)
+		return;
+
+	elem = cell_start[c] + rank[n];
+
+	out[elem] = in[n];
+	out[elem + out_elems] = in[n + in_elems];
+	out[elem + (2 * out_elems)] = in[n + (2 * in_elems)];
+}
@@ -23,38 +23,55 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
+#include "frnn/prefix_sum.h"
 
-#if __WORDSIZE == 64
-# define clz(x) __builtin_clzl(x)
-#else
-# define clz(x) __builtin_clz(x)
-#endif
+/* Print the time of every pass */
+static bool verbose = true;
+
+void prefix_sum_verbose(bool enable)
+{
+	verbose = enable;
+}
 
 /* Next power-of-two */
 size_t next_pot(size_t in)
 {
-	int msb = 31 - clz(in - 1);
+	size_t pot = 1;
+
+	while (pot < in)
+		pot <<= 1;
 
-	return 1 << (msb + 1);
+	return pot;
 }
 
 size_t prefix_sum_elems_ceil(cl_context ctx, size_t elems, size_t *wgs)
 {
 	size_t wg_size, work_groups, elems_ceil;
 
+	/* Each work-item scans two elements */
 	wg_size = opencl_max_workgroup_size();
-	work_groups = ((elems / 2) + wg_size - 1) / wg_size;
+	work_groups = (((elems + 1) / 2) + wg_size - 1) / wg_size;
 
-	if (work_groups > 1) {
+	/* A single group is sized to a power of two, which must still fit
+	 * in one work-group */
+	elems_ceil = next_pot(elems);
+	if (elems_ceil < 2)
+		elems_ceil = 2;
+
+	if (work_groups > 1 || elems_ceil > 2 * wg_size) {
+		if (work_groups < 2)
+			work_groups = 2;
 		elems_ceil = 2 * work_groups * wg_size;
 	} else {
-		elems_ceil = next_pot(elems);
+		work_groups = 1;
 	}
 
 	if (wgs)
@@ -78,7 +95,7 @@ int do_prefix_sum(cl_context ctx, cl_command_queue q, cl_kernel krnl,
 
 	error =  clSetKernelArg(krnl, 0, sizeof(cl_mem), &in);
 	error |= clSetKernelArg(krnl, 1,
-			work_group_size * 2 * sizeof(unsigned int), NULL);
+			work_group_size * 2 * opencl_index_size(), NULL);
 	error |= clSetKernelArg(krnl, 2, sizeof(cl_mem), &out);
 	error |= clSetKernelArg(krnl, 3, sizeof(cl_mem), &incr);
 	if (error != CL_SUCCESS) {
@@ -100,7 +117,8 @@ int do_prefix_sum(cl_context ctx, cl_command_queue q, cl_kernel krnl,
 		clFinish(q);
 		t = opencl_exec_time(e_time);
 		*time += t;
-		printf("  Time do_prefix_sum: %lins\n", t);
+		if (verbose)
+			printf("  Time do_prefix_sum: %lins\n", t);
 		clReleaseEvent(e_time);
 	}
 
@@ -139,7 +157,8 @@ int do_prefix_sum_post(cl_context ctx, cl_command_queue q, cl_kernel krnl,
 		clFinish(q);
 		t = opencl_exec_time(e_time);
 		*time += t;
-		printf("  Time do_prefix_sum_post: %lins\n", t);
+		if (verbose)
+			printf("  Time do_prefix_sum_post: %lins\n", t);
 		clReleaseEvent(e_time);
 	}
 
@@ -147,87 +166,138 @@ int do_prefix_sum_post(cl_context ctx, cl_command_queue q, cl_kernel krnl,
 }
 
 /*
- * Prefix sum (scan) that can do up to two "levels" of hierarchical scan,
- * thus limited to max_workgroup_size^2 elements (~1M on GT650)
+ * Scan one level of the hierarchy in place of out, recursing on the per-block
+ * totals until they fit in a single work-group.
  */
-cl_mem prefix_sum(cl_context ctx, cl_command_queue q, cl_mem in, size_t elems,
-		cl_ulong *time)
+static int prefix_sum_level(cl_context ctx, cl_command_queue q,
+		cl_kernel k_scan, cl_kernel k_scan_idx, cl_kernel k_post,
+		cl_mem in, cl_mem out, size_t elems, cl_ulong *time)
 {
 	size_t wg_size, work_items, work_groups, incrs;
-	cl_mem out = (cl_mem)-1;
 	cl_mem incr = 0;
-	cl_program prg;
 	cl_int error;
-	cl_kernel k_prefix_sum, k_prefix_sum_post = 0;
+	const cl_ulong zero = 0;
+	int ret = -1;
 
 	wg_size = opencl_max_workgroup_size();
+	work_items = prefix_sum_elems_ceil(ctx, elems, &work_groups);
+	if (work_groups == 1)
+		return do_prefix_sum(ctx, q, k_scan, work_items / 2,
+				work_items / 2, in, out, 0, time);
+
+	/* The block totals are scanned as a level of their own, keep the
+	 * padding up to that level's size zero */
+	incrs = prefix_sum_elems_ceil(ctx, work_groups, NULL);
+	incr = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			incrs * opencl_index_size(), NULL, &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create prefix sum increment buffer\n");
+		return -1;
+	}
+	clEnqueueFillBuffer(q, incr, &zero, opencl_index_size(), 0,
+			incrs * opencl_index_size(), 0, NULL, NULL);
+
+	if (do_prefix_sum(ctx, q, k_scan, wg_size, work_items / 2, in, out,
+			incr, time))
+		goto error;
+
+	if (prefix_sum_level(ctx, q, k_scan_idx, k_scan_idx, k_post, incr,
+			incr, work_groups, time))
+		goto error;
+
+	if (do_prefix_sum_post(ctx, q, k_post, wg_size, work_items, out, incr,
+			time))
+		goto error;
+
+	ret = 0;
+
+error:
+	opencl_release_buffer(incr);
+
+	return ret;
+}
 
+cl_program prefix_sum_compile(cl_context ctx)
+{
 	const char *programs = {
 		"src/frnn/prefix_sum.cl"
 	};
-	prg = opencl_compile_program(ctx, 1, &programs);
+
+	return opencl_compile_program(ctx, 1, &programs);
+}
+
+/*
+ * Hierarchical prefix sum (scan). Each level scans blocks of
+ * 2 * max_workgroup_size elements, the block totals are scanned recursively
+ * and added back in. Elements beyond elems must be zero up to
+ * prefix_sum_elems_ceil(elems).
+ */
+cl_mem prefix_sum_prg(cl_context ctx, cl_command_queue q, cl_program prg,
+		cl_mem in, size_t elems, cl_ulong *time)
+{
+	size_t work_items;
+	cl_mem out = (cl_mem)-1;
+	cl_int error;
+	cl_kernel k_prefix_sum = 0, k_prefix_sum_idx = 0;
+	cl_kernel k_prefix_sum_post = 0;
 
 	k_prefix_sum = clCreateKernel(prg, "prefix_sum", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create prefix sum kernel\n");
-		return (cl_mem)-1;
+		goto error;
 	}
 
-	/* Calculate work dimension */
-	work_items = prefix_sum_elems_ceil(ctx, elems, &work_groups);
-	if (work_groups > 1) {
-		incrs = next_pot(work_groups);
-		if (incrs > wg_size) {
-			printf("Data size prefix sum exceeds limits\n");
-			goto error;
-		}
-
-		incr = clCreateBuffer(ctx,
-				CL_MEM_READ_WRITE,
-				incrs * sizeof(unsigned int), NULL, &error);
-		if (error != CL_SUCCESS) {
-			printf("Could not create prefix sum increment "
-					"buffer\n");
-			goto error;
-		}
-
-		k_prefix_sum_post = clCreateKernel(prg, "prefix_sum_post",
-				&error);
-		if (error != CL_SUCCESS) {
-			printf("Could not create prefix sum post kernel\n");
-			goto error;
-		}
-	} else {
-		wg_size = work_items / 2;
+	k_prefix_sum_idx = clCreateKernel(prg, "prefix_sum_idx", &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create prefix sum kernel\n");
+		goto error;
+	}
+
+	k_prefix_sum_post = clCreateKernel(prg, "prefix_sum_post", &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create prefix sum post kernel\n");
+		goto error;
 	}
 
 	/* Read-write for further processing */
-	out = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			work_items * sizeof(unsigned int), NULL, &error);
+	work_items = prefix_sum_elems_ceil(ctx, elems, NULL);
+	out = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			work_items * opencl_index_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create prefix sum out buffer\n");
 		out = (cl_mem)-1;
 		goto error;
 	}
 
-	do_prefix_sum(ctx, q, k_prefix_sum, wg_size, work_items / 2, in, out,
-			incr, time);
-
-	if (work_groups > 1) {
-		do_prefix_sum(ctx, q, k_prefix_sum, incrs / 2, incrs / 2, incr,
-				incr, NULL, time);
-		do_prefix_sum_post(ctx, q, k_prefix_sum_post, wg_size,
-				work_items, out, incr, time);
+	if (prefix_sum_level(ctx, q, k_prefix_sum, k_prefix_sum_idx,
+			k_prefix_sum_post, in, out, elems, time)) {
+		opencl_release_buffer(out);
+		out = (cl_mem)-1;
 	}
 
 error:
 	/* tear-down */
-	clReleaseKernel(k_prefix_sum);
+	if (k_prefix_sum)
+		clReleaseKernel(k_prefix_sum);
+	if (k_prefix_sum_idx)
+		clReleaseKernel(k_prefix_sum_idx);
 	if (k_prefix_sum_post)
 		clReleaseKernel(k_prefix_sum_post);
-	if (incr)
-		clReleaseMemObject(incr);
 
+	return out;
+}
+
+cl_mem prefix_sum(cl_context ctx, cl_command_queue q, cl_mem in, size_t elems,
+		cl_ulong *time)
+{
+	cl_program prg;
+	cl_mem out;
+
+	prg = prefix_sum_compile(ctx);
+	if (!prg)
+		return (cl_mem)-1;
+
+	out = prefix_sum_prg(ctx, q, prg, in, elems, time);
 	clReleaseProgram(prg);
 
 	return out;
@@ -25,22 +25,15 @@
  * with CUDA", GPU Gems 3.
  */
 
-/* Launch in 1D, as many threads as data elements, padded to next multiple of
- * block size. Block size must be POT */
-__kernel void prefix_sum(unsigned int __global *in, unsigned int __local *in_l,
-		unsigned int __global *out, unsigned int __global *incr) {
+/* Exclusive scan of the (2 * local size) elements in local memory. The block
+ * total is written to incr, if provided. */
+inline void prefix_sum_local(idx_t __local *in_l, idx_t __global *incr)
+{
 	size_t lx = get_local_id(0);
 	size_t lthreads;
 	size_t off;
-	event_t copy;
 	int i;
-	unsigned int tmp;
-
-	/* Copy data to local memory */
-	copy = async_work_group_copy(in_l,
-			&in[get_group_id(0) * get_local_size(0) * 2],
-			get_local_size(0) * 2, 0);
-	wait_group_events(1, &copy);
+	idx_t tmp;
 
 	/* Up-sweep */
 	lthreads = get_local_size(0);
@@ -73,11 +66,48 @@ __kernel void prefix_sum(unsigned int __global *in, unsigned int __local *in_l,
 
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
+}
+
+/* Launch in 1D, as many threads as data elements, padded to next multiple of
+ * block size. Block size must be POT. Scans 32-bit counts into idx_t
+ * offsets. */
+__kernel void prefix_sum(unsigned int __global *in, idx_t __local *in_l,
+		idx_t __global *out, idx_t __global *incr) {
+	size_t lx = get_local_id(0);
+	size_t base = get_group_id(0) * get_local_size(0) * 2;
+	event_t copy;
+
+	/* Copy data to local memory, widening to idx_t */
+	in_l[lx] = in[base + lx];
+	in_l[lx + get_local_size(0)] = in[base + lx + get_local_size(0)];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	prefix_sum_local(in_l, incr);
 
 	/* Copy result back to global memory */
-	copy = async_work_group_copy(
-			&out[get_group_id(0) * get_local_size(0) * 2],
-			in_l, get_local_size(0) * 2, 0);
+	copy = async_work_group_copy(&out[base], in_l,
+			get_local_size(0) * 2, 0);
+	wait_group_events(1, &copy);
+
+	return;
+}
+
+/* As prefix_sum, for idx_t input. Used to scan the per-block increments. */
+__kernel void prefix_sum_idx(idx_t __global *in, idx_t __local *in_l,
+		idx_t __global *out, idx_t __global *incr) {
+	size_t base = get_group_id(0) * get_local_size(0) * 2;
+	event_t copy;
+
+	/* Copy data to local memory */
+	copy = async_work_group_copy(in_l, &in[base],
+			get_local_size(0) * 2, 0);
+	wait_group_events(1, &copy);
+
+	prefix_sum_local(in_l, incr);
+
+	/* Copy result back to global memory */
+	copy = async_work_group_copy(&out[base], in_l,
+			get_local_size(0) * 2, 0);
 	wait_group_events(1, &copy);
 
 	return;
@@ -86,9 +116,9 @@ __kernel void prefix_sum(unsigned int __global *in, unsigned int __local *in_l,
 /* Launch in 1D, as many threads as data elements, padded to next multiple of
  * block size. Skipped the first (2 * workgroup size) entries as incr[0] is
  * known to be 0 */
-__kernel void prefix_sum_post(volatile unsigned int __global *data,
-		unsigned int __global *incr) {
-	data[mad24((int)get_local_size(0), 2, (int)get_global_id(0))] +=
+__kernel void prefix_sum_post(volatile idx_t __global *data,
+		idx_t __global *incr) {
+	data[(get_local_size(0) * 2) + get_global_id(0)] +=
 			incr[(get_group_id(0) >> 1) + 1];
 
 	return;
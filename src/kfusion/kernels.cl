@@ -65,6 +65,7 @@ inline float3 myrotate(const Matrix4 M, const float3 v) {
 
 /************** KFUSION KERNELS ***************/
 // inVertex iterate
+// Instrumented: early exits 0-4, in order of the result codes -1 to -5
 __kernel void trackKernel (
 		__global TrackData * output,
 		const uint2 outputSize,
@@ -80,6 +81,7 @@ __kernel void trackKernel (
 		const Matrix4 view,
 		const float dist_threshold,
 		const float normal_threshold
+		INSTR_PARAM
 ) {
 
 	const uint2 pixel = (uint2)(get_global_id(0),get_global_id(1));
@@ -90,6 +92,7 @@ __kernel void trackKernel (
 
 	if(inNormalPixel.x == INVALID ) {
 		output[pixel.x + outputSize.x * pixel.y].result = -1;
+		INSTR_INC(0);
 		return;
 	}
 
@@ -100,6 +103,7 @@ __kernel void trackKernel (
 
 	if(projPixel.x < 0.f || projPixel.x > refVertexSize.x-1.f || projPixel.y < 0.f || projPixel.y > refVertexSize.y-1.f ) {
 		output[pixel.x + outputSize.x * pixel.y].result = -2;
+		INSTR_INC(1);
 		return;
 	}
 
@@ -108,6 +112,7 @@ __kernel void trackKernel (
 
 	if(referenceNormal.x == INVALID) {
 		output[pixel.x + outputSize.x * pixel.y].result = -3;
+		INSTR_INC(2);
 		return;
 	}
 
@@ -116,11 +121,13 @@ __kernel void trackKernel (
 
 	if(length(diff) > dist_threshold ) {
 		output[pixel.x + outputSize.x * pixel.y].result = -4;
+		INSTR_INC(3);
 		return;
 	}
 
 	if(dot(projectedNormal, referenceNormal) < normal_threshold) {
 		output[pixel.x + outputSize.x * pixel.y] .result = -5;
+		INSTR_INC(4);
 		return;
 	}
 
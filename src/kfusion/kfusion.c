@@ -31,7 +31,11 @@
 #include <math.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/instr.h"
+#include "lib/cmdbuf.h"
 
 typedef struct sTrackData {
 	int result;
@@ -131,6 +135,7 @@ int main(int argc, char **argv)
 	float *refVertex;
 	float *refNormal;
 	float *mats;
+	struct dataset *ds[7];
 	const unsigned int size[2] = {640,480};
 	const float dist_threshold = 0.1f;
 	const float normal_threshold = 0.8f;
@@ -142,12 +147,17 @@ int main(int argc, char **argv)
 	cl_command_queue q;
 	cl_program prg;
 	cl_kernel kTrack, kDepth2Vertex, kVertex2Normal, kHalfSampleRobustImage;
+	struct instr *instr;
 	cl_mem clInDepth, clInVertex, clInNormal, clRefVertex, clRefNormal,
 		clOutput, clOutVertex, clOutNormal, clOutHalfSample;
 	cl_int error;
 	cl_event time;
 	cl_ulong time_diff = 0l;
 	cl_ulong time_avg[4] = {0,0,0,0};
+	cl_ulong time_seq = 0l;
+	int seq;
+	unsigned int direct = 0, replays = 0;
+	struct opencl_cmdbuf *cb;
 	//TrackData *result;
 
 	while ((c = getopt (argc, argv, "?"OPENCL_OPTS)) != -1)
@@ -165,19 +175,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Load the inputs while the platform is brought up */
 	data_entries = 640*480;
-	csv_file_read_float("data/kfusion/halfSampleRobustImage_in.csv",
-			&inDepth);
-	csv_file_read_float("data/kfusion/depth2vertex_invK.csv", &invK);
-	bin_file_read("data/kfusion/depth2vertex_out.bin", data_entries * 3,
-			(void **) &inVertex);
-	bin_file_read("data/kfusion/vertex2normal_out.bin", data_entries * 3,
-			(void **) &inNormal);
-	csv_file_read_float("data/kfusion/track_refVertex.csv", &refVertex);
-	csv_file_read_float("data/kfusion/track_refNormal.csv", &refNormal);
-	csv_file_read_float("data/kfusion/track_transformMats.csv", &mats);
-
-	printf("Read %"PRIi64" entries\n", data_entries);
+	ds[0] = dataset_load_csv_float(
+			"data/kfusion/halfSampleRobustImage_in.csv", &inDepth);
+	ds[1] = dataset_load_csv_float("data/kfusion/depth2vertex_invK.csv",
+			&invK);
+	ds[2] = dataset_load_csv_float("data/kfusion/track_refVertex.csv",
+			&refVertex);
+	ds[3] = dataset_load_csv_float("data/kfusion/track_refNormal.csv",
+			&refNormal);
+	ds[4] = dataset_load_csv_float("data/kfusion/track_transformMats.csv",
+			&mats);
+	ds[5] = dataset_load_bin("data/kfusion/depth2vertex_out.bin",
+			data_entries * 3, (void **) &inVertex);
+	ds[6] = dataset_load_bin("data/kfusion/vertex2normal_out.bin",
+			data_entries * 3, (void **) &inNormal);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -196,6 +209,18 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	ret = 0;
+	for (i = 0; i < 5; i++)
+		ret |= (dataset_wait(ds[i]) < 0);
+	for (; i < 7; i++)
+		ret |= (dataset_wait(ds[i]) != 0);
+	if (ret) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+
 	/** Create kernels */
 	kTrack = clCreateKernel(prg, "trackKernel", &error);
 	if (error != CL_SUCCESS) {
@@ -223,60 +248,64 @@ int main(int argc, char **argv)
 	}
 
 	/** Create buffers */
-	clInVertex = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	opencl_mem_stage("track");
+	clInVertex = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clInNormal = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clInNormal = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clRefVertex = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clRefVertex = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clRefNormal = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clRefNormal = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clOutput = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	clOutput = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 			data_entries * 8*sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	clInDepth = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	opencl_mem_stage("depth2vertex");
+	clInDepth = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clOutVertex = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	clOutVertex = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 				data_entries * 3 *sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	clOutNormal = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	opencl_mem_stage("vertex2normal");
+	clOutNormal = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 				data_entries * 3 *sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	clOutHalfSample = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+	opencl_mem_stage("halfsample");
+	clOutHalfSample = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
 			data_entries /* / 4 * sizeof(float) */, NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -316,6 +345,9 @@ int main(int argc, char **argv)
 	error |= clSetKernelArg(kTrack, 11, 16 * sizeof(float), &mats[16]);
 	error |= clSetKernelArg(kTrack, 12, sizeof(float), &dist_threshold);
 	error |= clSetKernelArg(kTrack, 13, sizeof(float), &normal_threshold);
+	instr = instr_create(ctx, "trackKernel", "invalid normal,out of view,"
+			"invalid ref normal,distance,angle", 640 * 480);
+	error |= instr_set_arg(instr, q, kTrack, 14);
 	if (error != CL_SUCCESS) {
 		printf("One of the arguments could not be set: %d.\n", error);
 		return -1;
@@ -359,9 +391,25 @@ int main(int argc, char **argv)
 
 	const size_t dims[] = {640,480};
 	const size_t hdims[] = {320,240};
+
+	/* With -B, the four kernels are recorded in the first iteration and
+	 * replayed in later ones */
+	cb = opencl_cmdbuf_create(q, "kfusion");
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
-		error = clEnqueueNDRangeKernel(q, kTrack, 2, NULL, dims, NULL,
-				0, NULL, &time);
+		seq = opencl_cmdbuf_replay(cb, &time_diff);
+		if (seq < 0)
+			return -1;
+		if (seq) {
+			time_seq += time_diff;
+			replays++;
+			printf("Sequence Time: %lu ns\n", time_diff);
+			continue;
+		}
+		direct++;
+
+		error = opencl_cmdbuf_kernel(cb, q, kTrack, 2, NULL, dims,
+				NULL, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue track execution: %d\n",
 					error);
@@ -373,8 +421,8 @@ int main(int argc, char **argv)
 		time_avg[0] += time_diff;
 		printf("Track Time: %lu ns\n", time_diff);
 
-		error = clEnqueueNDRangeKernel(q, kDepth2Vertex, 2, NULL, dims,
-				NULL, 0, NULL, &time);
+		error = opencl_cmdbuf_kernel(cb, q, kDepth2Vertex, 2, NULL,
+				dims, NULL, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue depth2Vertex execution: %d\n",
 					error);
@@ -386,8 +434,8 @@ int main(int argc, char **argv)
 		time_avg[1] += time_diff;
 		printf("Depth2Vertex Time: %lu ns\n", time_diff);
 
-		error = clEnqueueNDRangeKernel(q, kVertex2Normal, 2, NULL, dims,
-				NULL, 0, NULL, &time);
+		error = opencl_cmdbuf_kernel(cb, q, kVertex2Normal, 2, NULL,
+				dims, NULL, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue vertex2Normal execution: "
 					"%d\n",	error);
@@ -399,8 +447,8 @@ int main(int argc, char **argv)
 		time_avg[2] += time_diff;
 		printf("Vertex2Normal Time: %lu ns\n", time_diff);
 
-		error = clEnqueueNDRangeKernel(q, kHalfSampleRobustImage, 2,
-				NULL, hdims, NULL, 0, NULL, &time);
+		error = opencl_cmdbuf_kernel(cb, q, kHalfSampleRobustImage, 2,
+				NULL, hdims, NULL, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue kHalfSampleRobustImage "
 					"execution: %d\n", error);
@@ -411,6 +459,8 @@ int main(int argc, char **argv)
 		time_diff = opencl_exec_time(time);
 		time_avg[3] += time_diff;
 		printf("HalfSampleRobustImage Time: %lu ns\n", time_diff);
+
+		opencl_cmdbuf_end(cb);
 	}
 
 	ret = 0;
@@ -451,25 +501,38 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Output comparison error: %i\n", ret);
 	}
 
-	printf("Depth2Vertex time (avg of %u): %lu ns\n",
-			opencl_get_iterations(),
-			time_avg[1] / opencl_get_iterations());
-	printf("HalfSampleRobustImage time (avg of %u): %lu ns\n",
-			opencl_get_iterations(),
-			time_avg[3] / opencl_get_iterations());
-	printf("Track time (avg of %u): %lu ns\n", opencl_get_iterations(),
-			time_avg[0] / opencl_get_iterations());
-	printf("Vertex2Normal time (avg of %u): %lu ns\n",
-			opencl_get_iterations(),
-			time_avg[2] / opencl_get_iterations());
+	/* Counters only cover the iterations, report them before the
+	 * extra measurement launches add to them */
+	instr_report(instr, q, opencl_get_iterations());
+
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kTrack, 2, NULL, dims, NULL);
+	opencl_kernel_measure(q, kDepth2Vertex, 2, NULL, dims, NULL);
+	opencl_kernel_measure(q, kVertex2Normal, 2, NULL, dims, NULL);
+	opencl_kernel_measure(q, kHalfSampleRobustImage, 2, NULL, hdims,
+			NULL);
+
+	printf("Depth2Vertex time (avg of %u): %lu ns\n", direct,
+			time_avg[1] / direct);
+	printf("HalfSampleRobustImage time (avg of %u): %lu ns\n", direct,
+			time_avg[3] / direct);
+	printf("Track time (avg of %u): %lu ns\n", direct,
+			time_avg[0] / direct);
+	printf("Vertex2Normal time (avg of %u): %lu ns\n", direct,
+			time_avg[2] / direct);
+	if (replays)
+		printf("Sequence time (avg of %u replays): %lu ns\n",
+				replays, time_seq / replays);
 
 	/* Tear down */
+	opencl_cmdbuf_release(cb);
+	instr_release(instr);
 	clReleaseEvent(time);
-	clReleaseMemObject(clInVertex);
-	clReleaseMemObject(clInNormal);
-	clReleaseMemObject(clRefVertex);
-	clReleaseMemObject(clRefNormal);
-	clReleaseMemObject(clOutput);
+	opencl_release_buffer(clInVertex);
+	opencl_release_buffer(clInNormal);
+	opencl_release_buffer(clRefVertex);
+	opencl_release_buffer(clRefNormal);
+	opencl_release_buffer(clOutput);
 	clReleaseKernel(kTrack);
 
 	opencl_teardown(&ctx, &q, &prg);
@@ -0,0 +1,794 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The wrappers call the real entry points, SVM requires OpenCL 2.0 headers */
+#define OPENCL_CAPTURE_IMPL
+#define CL_TARGET_OPENCL_VERSION 200
+#include "lib/capture.h"
+#include "lib/cold.h"
+#include "lib/fanout.h"
+
+#define CAPTURE_NAME_MAX 128
+
+/** Last value set for a kernel argument */
+struct capture_arg {
+	bool set;
+	bool svm;
+	size_t size;
+	/** Copy of the value, NULL for __local arguments */
+	void *value;
+};
+
+struct capture_kernel {
+	cl_kernel kernel;
+	cl_uint n_args;
+	struct capture_arg *args;
+	struct capture_kernel *next;
+};
+
+struct capture_program {
+	cl_program prg;
+	cl_uint n;
+	char **names;
+	char **sources;
+	char *options;
+	/** Id in the capture file, -1 until written */
+	int id;
+	struct capture_program *next;
+};
+
+/** Launches recorded per kernel, to enforce the limit */
+struct capture_count {
+	struct capture_program *prg;
+	char name[CAPTURE_NAME_MAX];
+	unsigned int launches;
+	struct capture_count *next;
+};
+
+/** Buffer argument of a launch being recorded */
+struct capture_buf {
+	cl_mem mem;
+	size_t size;
+	void *before;
+	void *after;
+};
+
+static struct {
+	const char *file;
+	unsigned int limit;
+	pid_t pid;
+	FILE *fp;
+	bool closed;
+	bool track;
+
+	struct capture_kernel *kernels;
+	struct capture_program *programs;
+	struct capture_count *counts;
+
+	int program_ids;
+	unsigned int launches;
+	unsigned int kernel_cnt;
+	bool warned_info;
+	bool warned_svm;
+} capture = {
+	.file = NULL,
+	.limit = 1,
+	.fp = NULL,
+	.closed = false,
+	.track = false,
+	.kernels = NULL,
+	.programs = NULL,
+	.counts = NULL,
+	.program_ids = 0,
+	.launches = 0,
+	.kernel_cnt = 0,
+	.warned_info = false,
+	.warned_svm = false,
+};
+
+void
+opencl_capture_enable(const char *file, unsigned int limit)
+{
+	capture.file = file;
+	capture.limit = limit;
+	capture.pid = getpid();
+}
+
+bool
+opencl_capture_enabled(void)
+{
+	return capture.file && !capture.closed;
+}
+
+void
+opencl_capture_track_args(void)
+{
+	capture.track = true;
+}
+
+static bool
+capture_tracking(void)
+{
+	return capture.track || opencl_capture_enabled();
+}
+
+static struct capture_program *
+capture_program_find(cl_program prg)
+{
+	struct capture_program *p;
+
+	for (p = capture.programs; p; p = p->next) {
+		if (p->prg == prg)
+			return p;
+	}
+
+	return NULL;
+}
+
+static void
+capture_program_free(struct capture_program *p)
+{
+	cl_uint i;
+
+	for (i = 0; i < p->n; i++) {
+		if (p->names)
+			free(p->names[i]);
+		if (p->sources)
+			free(p->sources[i]);
+	}
+	free(p->names);
+	free(p->sources);
+	free(p->options);
+	p->names = NULL;
+	p->sources = NULL;
+	p->options = NULL;
+	p->n = 0;
+}
+
+void
+opencl_capture_program(cl_program prg, cl_uint n, const char **names,
+		const char **sources, const char *options)
+{
+	struct capture_program *p;
+	cl_uint i;
+
+	if (!opencl_capture_enabled() || !prg)
+		return;
+
+	/* Handles may be reused after a program is released */
+	p = capture_program_find(prg);
+	if (p) {
+		capture_program_free(p);
+	} else {
+		p = calloc(1, sizeof(struct capture_program));
+		if (!p)
+			goto error;
+		p->prg = prg;
+		p->next = capture.programs;
+		capture.programs = p;
+	}
+
+	p->id = -1;
+	p->n = n;
+	p->names = calloc(n, sizeof(char *));
+	p->sources = calloc(n, sizeof(char *));
+	p->options = strdup(options);
+	if (!p->names || !p->sources || !p->options)
+		goto error;
+
+	for (i = 0; i < n; i++) {
+		p->names[i] = strdup(names[i]);
+		p->sources[i] = strdup(sources[i]);
+		if (!p->names[i] || !p->sources[i])
+			goto error;
+	}
+
+	return;
+
+error:
+	fprintf(stderr, "Capture: could not store program sources\n");
+	if (p)
+		capture_program_free(p);
+}
+
+static struct capture_kernel *
+capture_kernel_get(cl_kernel kernel, cl_uint idx)
+{
+	struct capture_kernel *k;
+	struct capture_arg *args;
+
+	for (k = capture.kernels; k; k = k->next) {
+		if (k->kernel == kernel)
+			break;
+	}
+
+	if (!k) {
+		k = calloc(1, sizeof(struct capture_kernel));
+		if (!k)
+			return NULL;
+		k->kernel = kernel;
+		k->next = capture.kernels;
+		capture.kernels = k;
+	}
+
+	if (idx >= k->n_args) {
+		args = realloc(k->args, (idx + 1) * sizeof(struct capture_arg));
+		if (!args)
+			return NULL;
+		memset(&args[k->n_args], 0, (idx + 1 - k->n_args) *
+				sizeof(struct capture_arg));
+		k->args = args;
+		k->n_args = idx + 1;
+	}
+
+	return k;
+}
+
+cl_int
+opencl_capture_set_kernel_arg(cl_kernel kernel, cl_uint idx, size_t size,
+		const void *value)
+{
+	struct capture_kernel *k;
+	struct capture_arg *arg;
+	cl_int error;
+
+	error = clSetKernelArg(kernel, idx, size, value);
+	if (error != CL_SUCCESS || !capture_tracking())
+		return error;
+
+	k = capture_kernel_get(kernel, idx);
+	if (!k) {
+		fprintf(stderr, "Capture: could not record kernel argument\n");
+		return error;
+	}
+
+	arg = &k->args[idx];
+	free(arg->value);
+	arg->value = NULL;
+	arg->size = size;
+	arg->svm = false;
+	arg->set = true;
+
+	if (value) {
+		arg->value = malloc(size);
+		if (!arg->value) {
+			arg->set = false;
+			return error;
+		}
+		memcpy(arg->value, value, size);
+	}
+
+	return error;
+}
+
+cl_int
+opencl_capture_set_kernel_arg_svm(cl_kernel kernel, cl_uint idx,
+		const void *ptr)
+{
+	struct capture_kernel *k;
+	cl_int error;
+
+	error = clSetKernelArgSVMPointer(kernel, idx, ptr);
+	if (error != CL_SUCCESS || !capture_tracking())
+		return error;
+
+	k = capture_kernel_get(kernel, idx);
+	if (!k)
+		return error;
+
+	/* Kept for opencl_capture_clone_kernel */
+	free(k->args[idx].value);
+	k->args[idx].value = malloc(sizeof(void *));
+	k->args[idx].size = sizeof(void *);
+	k->args[idx].set = !!k->args[idx].value;
+	k->args[idx].svm = true;
+	if (k->args[idx].value)
+		memcpy(k->args[idx].value, &ptr, sizeof(void *));
+
+	return error;
+}
+
+cl_kernel
+opencl_capture_clone_kernel(cl_kernel kernel)
+{
+	char name[CAPTURE_NAME_MAX];
+	struct capture_kernel *k;
+	struct capture_arg *arg;
+	cl_kernel clone;
+	cl_program prg;
+	cl_int error;
+	cl_uint i;
+
+	for (k = capture.kernels; k; k = k->next) {
+		if (k->kernel == kernel)
+			break;
+	}
+
+	if (!k || clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(prg), &prg,
+			NULL) != CL_SUCCESS ||
+	    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS)
+		return NULL;
+
+	clone = clCreateKernel(prg, name, &error);
+	if (error != CL_SUCCESS)
+		return NULL;
+
+	/* Through the wrappers, such that the clone can be cloned and
+	 * captured in turn */
+	for (i = 0; i < k->n_args && error == CL_SUCCESS; i++) {
+		arg = &k->args[i];
+		if (!arg->set)
+			continue;
+
+		if (arg->svm)
+			error = opencl_capture_set_kernel_arg_svm(clone, i,
+					*(void **) arg->value);
+		else
+			error = opencl_capture_set_kernel_arg(clone, i,
+					arg->size, arg->value);
+	}
+
+	if (error != CL_SUCCESS) {
+		opencl_capture_release_kernel(clone);
+		return NULL;
+	}
+
+	return clone;
+}
+
+cl_int
+opencl_capture_release_kernel(cl_kernel kernel)
+{
+	struct capture_kernel **p, *k;
+	cl_uint i;
+
+	/* The handle may be reused by a kernel created later */
+	for (p = &capture.kernels; *p; p = &(*p)->next) {
+		if ((*p)->kernel == kernel)
+			break;
+	}
+
+	if (*p) {
+		k = *p;
+		*p = k->next;
+		for (i = 0; i < k->n_args; i++)
+			free(k->args[i].value);
+		free(k->args);
+		free(k);
+	}
+
+	opencl_cold_released(kernel);
+
+	return clReleaseKernel(kernel);
+}
+
+int
+opencl_capture_buffer_args(cl_kernel kernel, cl_uint n_args, cl_mem *mems)
+{
+	cl_kernel_arg_address_qualifier aq;
+	struct capture_kernel *k;
+	struct capture_arg *arg;
+	cl_uint i;
+
+	for (k = capture.kernels; k; k = k->next) {
+		if (k->kernel == kernel)
+			break;
+	}
+	if (!k || k->n_args < n_args)
+		return -1;
+
+	for (i = 0; i < n_args; i++) {
+		arg = &k->args[i];
+		mems[i] = NULL;
+		if (!arg->set)
+			return -1;
+		if (arg->svm || !arg->value)
+			continue;
+
+		if (clGetKernelArgInfo(kernel, i,
+				CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(aq),
+				&aq, NULL) != CL_SUCCESS)
+			return -1;
+
+		if (aq == CL_KERNEL_ARG_ADDRESS_GLOBAL ||
+		    aq == CL_KERNEL_ARG_ADDRESS_CONSTANT)
+			mems[i] = *(cl_mem *) arg->value;
+	}
+
+	return 0;
+}
+
+static void
+capture_u32(uint32_t val)
+{
+	fwrite(&val, sizeof(val), 1, capture.fp);
+}
+
+static void
+capture_u64(uint64_t val)
+{
+	fwrite(&val, sizeof(val), 1, capture.fp);
+}
+
+static void
+capture_str(const char *str)
+{
+	capture_u32(strlen(str));
+	fwrite(str, 1, strlen(str), capture.fp);
+}
+
+static void
+capture_blob(const void *buf, size_t size)
+{
+	capture_u64(size);
+	fwrite(buf, 1, size, capture.fp);
+}
+
+static int
+capture_open(void)
+{
+	char *name;
+	size_t len;
+
+	if (capture.fp)
+		return 0;
+
+	len = strlen(capture.file) + 16;
+	name = malloc(len);
+	if (!name)
+		return -1;
+
+	/* Forked variants must not clobber each other's captures */
+	if (getpid() != capture.pid)
+		snprintf(name, len, "%s.%i", capture.file, (int) getpid());
+	else
+		snprintf(name, len, "%s", capture.file);
+
+	capture.fp = fopen(name, "wb");
+	if (!capture.fp) {
+		fprintf(stderr, "Capture: could not create %s\n", name);
+		free(name);
+		capture.closed = true;
+		return -1;
+	}
+
+	capture.file = name;
+	fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), capture.fp);
+
+	return 0;
+}
+
+static void
+capture_write_program(struct capture_program *p)
+{
+	cl_uint i;
+
+	p->id = capture.program_ids++;
+
+	capture_u32(CAPTURE_REC_PROGRAM);
+	capture_u32(p->id);
+	capture_u32(p->n);
+	for (i = 0; i < p->n; i++) {
+		capture_str(p->names[i]);
+		capture_blob(p->sources[i], strlen(p->sources[i]));
+	}
+	capture_str(p->options);
+}
+
+static struct capture_count *
+capture_count_get(struct capture_program *p, const char *name)
+{
+	struct capture_count *c;
+
+	for (c = capture.counts; c; c = c->next) {
+		if (c->prg == p && !strcmp(c->name, name))
+			return c;
+	}
+
+	c = calloc(1, sizeof(struct capture_count));
+	if (!c)
+		return NULL;
+
+	c->prg = p;
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->next = capture.counts;
+	capture.counts = c;
+
+	return c;
+}
+
+/* Classify the arguments of a launch and collect its distinct buffers. Returns
+ * the number of buffers, negative if the launch cannot be recorded. */
+static int
+capture_classify(struct capture_kernel *k, cl_uint n_args,
+		uint32_t *kinds, uint32_t *buf_idx, struct capture_buf *bufs)
+{
+	cl_kernel_arg_address_qualifier aq;
+	cl_mem mem;
+	cl_uint i;
+	int j, n = 0;
+
+	for (i = 0; i < n_args; i++) {
+		if (!k || i >= k->n_args || !k->args[i].set)
+			return -1;
+
+		if (k->args[i].svm) {
+			if (!capture.warned_svm)
+				fprintf(stderr, "Capture: launches with SVM "
+						"arguments are not recorded\n");
+			capture.warned_svm = true;
+			return -1;
+		}
+
+		/* Requires -cl-kernel-arg-info, which is passed when
+		 * capturing */
+		if (clGetKernelArgInfo(k->kernel, i,
+				CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(aq),
+				&aq, NULL) != CL_SUCCESS) {
+			if (!capture.warned_info)
+				fprintf(stderr, "Capture: kernel argument "
+						"info not available\n");
+			capture.warned_info = true;
+			return -1;
+		}
+
+		switch (aq) {
+		case CL_KERNEL_ARG_ADDRESS_LOCAL:
+			kinds[i] = CAPTURE_ARG_LOCAL;
+			break;
+		case CL_KERNEL_ARG_ADDRESS_GLOBAL:
+		case CL_KERNEL_ARG_ADDRESS_CONSTANT:
+			mem = k->args[i].value ?
+					*(cl_mem *) k->args[i].value : NULL;
+			if (!mem) {
+				kinds[i] = CAPTURE_ARG_NULL;
+				break;
+			}
+
+			kinds[i] = CAPTURE_ARG_BUFFER;
+			for (j = 0; j < n; j++) {
+				if (bufs[j].mem == mem)
+					break;
+			}
+			if (j == n) {
+				bufs[n].mem = mem;
+				if (clGetMemObjectInfo(mem, CL_MEM_SIZE,
+						sizeof(size_t), &bufs[n].size,
+						NULL) != CL_SUCCESS)
+					return -1;
+				n++;
+			}
+			buf_idx[i] = j;
+			break;
+		default:
+			kinds[i] = CAPTURE_ARG_VALUE;
+			break;
+		}
+	}
+
+	return n;
+}
+
+static cl_int
+capture_snapshot(cl_command_queue q, struct capture_buf *bufs, int n,
+		bool after)
+{
+	cl_int error;
+	void *snap;
+	int i;
+
+	error = clFinish(q);
+	for (i = 0; i < n && error == CL_SUCCESS; i++) {
+		snap = malloc(bufs[i].size);
+		if (!snap)
+			return CL_OUT_OF_HOST_MEMORY;
+
+		if (after)
+			bufs[i].after = snap;
+		else
+			bufs[i].before = snap;
+
+		error = clEnqueueReadBuffer(q, bufs[i].mem, CL_TRUE, 0,
+				bufs[i].size, snap, 0, NULL, NULL);
+	}
+
+	return error;
+}
+
+static void
+capture_write_launch(struct capture_program *p, const char *name,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local, struct capture_kernel *k, cl_uint n_args,
+		uint32_t *kinds, uint32_t *buf_idx, struct capture_buf *bufs,
+		int n_bufs)
+{
+	bool changed;
+	cl_uint i;
+	int j;
+
+	capture_u32(CAPTURE_REC_LAUNCH);
+	capture_u32(p->id);
+	capture_str(name);
+	capture_u32(dim);
+	for (i = 0; i < 3; i++)
+		capture_u64((offset && i < dim) ? offset[i] : 0);
+	for (i = 0; i < 3; i++)
+		capture_u64(i < dim ? global[i] : 1);
+	for (i = 0; i < 3; i++)
+		capture_u64((local && i < dim) ? local[i] : 0);
+
+	/* Outputs are only stored if the launch changed them */
+	capture_u32(n_bufs);
+	for (j = 0; j < n_bufs; j++) {
+		changed = !!memcmp(bufs[j].before, bufs[j].after,
+				bufs[j].size);
+		capture_blob(bufs[j].before, bufs[j].size);
+		capture_u32(changed);
+		if (changed)
+			capture_blob(bufs[j].after, bufs[j].size);
+	}
+
+	capture_u32(n_args);
+	for (i = 0; i < n_args; i++) {
+		capture_u32(kinds[i]);
+		capture_u64(k->args[i].size);
+		if (kinds[i] == CAPTURE_ARG_VALUE)
+			fwrite(k->args[i].value, 1, k->args[i].size,
+					capture.fp);
+		else if (kinds[i] == CAPTURE_ARG_BUFFER)
+			capture_u32(buf_idx[i]);
+	}
+}
+
+cl_int
+opencl_capture_enqueue_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local, cl_uint n_events, const cl_event *events,
+		cl_event *event)
+{
+	char name[CAPTURE_NAME_MAX];
+	struct capture_program *p;
+	struct capture_kernel *k;
+	struct capture_count *c;
+	struct capture_buf *bufs = NULL;
+	uint32_t *kinds = NULL, *buf_idx = NULL;
+	cl_program prg;
+	cl_uint n_args;
+	cl_int error;
+	int n_bufs = 0, i;
+
+	fanout_barrier();
+
+	if (!opencl_capture_enabled())
+		goto passthrough;
+
+	if (clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(prg), &prg,
+			NULL) != CL_SUCCESS ||
+	    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS ||
+	    clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(n_args),
+			&n_args, NULL) != CL_SUCCESS)
+		goto passthrough;
+
+	/* Only programs built by opencl_compile_program_opts are known */
+	p = capture_program_find(prg);
+	if (!p || !p->options)
+		goto passthrough;
+
+	c = capture_count_get(p, name);
+	if (!c || (capture.limit && c->launches >= capture.limit))
+		goto passthrough;
+
+	for (k = capture.kernels; k; k = k->next) {
+		if (k->kernel == kernel)
+			break;
+	}
+
+	kinds = calloc(n_args + 1, sizeof(uint32_t));
+	buf_idx = calloc(n_args + 1, sizeof(uint32_t));
+	bufs = calloc(n_args + 1, sizeof(struct capture_buf));
+	if (!kinds || !buf_idx || !bufs)
+		goto passthrough;
+
+	n_bufs = capture_classify(k, n_args, kinds, buf_idx, bufs);
+	if (n_bufs < 0) {
+		n_bufs = 0;
+		goto passthrough;
+	}
+
+	error = capture_snapshot(q, bufs, n_bufs, false);
+	if (error != CL_SUCCESS)
+		goto out;
+
+	error = clEnqueueNDRangeKernel(q, kernel, dim, offset, global, local,
+			n_events, events, event);
+	if (error != CL_SUCCESS)
+		goto out;
+	if (event)
+		opencl_cold_launched(kernel, *event);
+
+	error = capture_snapshot(q, bufs, n_bufs, true);
+	if (error != CL_SUCCESS)
+		goto out;
+
+	if (capture_open())
+		goto out;
+
+	if (p->id < 0)
+		capture_write_program(p);
+	capture_write_launch(p, name, dim, offset, global, local, k, n_args,
+			kinds, buf_idx, bufs, n_bufs);
+
+	if (c->launches++ == 0)
+		capture.kernel_cnt++;
+	capture.launches++;
+
+out:
+	for (i = 0; i < n_bufs; i++) {
+		free(bufs[i].before);
+		free(bufs[i].after);
+	}
+	free(bufs);
+	free(kinds);
+	free(buf_idx);
+
+	return error;
+
+passthrough:
+	free(bufs);
+	free(kinds);
+	free(buf_idx);
+
+	error = clEnqueueNDRangeKernel(q, kernel, dim, offset, global, local,
+			n_events, events, event);
+	if (error == CL_SUCCESS && event)
+		opencl_cold_launched(kernel, *event);
+
+	return error;
+}
+
+void
+opencl_capture_report(void)
+{
+	if (!capture.file || capture.closed)
+		return;
+
+	capture.closed = true;
+	if (!capture.fp)
+		return;
+
+	if (ferror(capture.fp) | fclose(capture.fp))
+		fprintf(stderr, "Capture: error writing %s\n", capture.file);
+	capture.fp = NULL;
+
+	printf("Captured %u launches of %u kernels to %s\n", capture.launches,
+			capture.kernel_cnt, capture.file);
+}
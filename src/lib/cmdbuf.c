@@ -0,0 +1,666 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* CL_DEVICE_EXTENSIONS_WITH_VERSION, to match the provisional extension */
+#define CL_TARGET_OPENCL_VERSION 300
+#include "lib/cmdbuf.h"
+
+/* cl_khr_command_buffer is provisional, its entry points changed between
+ * revisions. Only use it with headers that state their revision. */
+#if defined(cl_khr_command_buffer) && \
+    defined(CL_KHR_COMMAND_BUFFER_EXTENSION_VERSION)
+#define CMDBUF_KHR
+#if CL_KHR_COMMAND_BUFFER_EXTENSION_VERSION >= CL_MAKE_VERSION(0, 9, 5)
+#define CMDBUF_KHR_PROPS	NULL,
+#else
+#define CMDBUF_KHR_PROPS
+#endif
+#endif
+
+#define CMDBUF_PATTERN_MAX 128
+
+enum cmdbuf_mode {
+	CMDBUF_DIRECT = 0,
+	CMDBUF_PREBUILT,
+	CMDBUF_KHR_BUFFER,
+};
+
+static const char *cmdbuf_mode_names[] = {
+	[CMDBUF_DIRECT] = "direct",
+	[CMDBUF_PREBUILT] = "prebuilt",
+	[CMDBUF_KHR_BUFFER] = "khr",
+};
+
+enum cmdbuf_type {
+	CMDBUF_KERNEL,
+	CMDBUF_COPY,
+	CMDBUF_FILL,
+};
+
+/** Command of a prebuilt sequence */
+struct cmdbuf_cmd {
+	enum cmdbuf_type type;
+
+	/* CMDBUF_KERNEL, the kernel is a clone owned by the sequence */
+	cl_kernel kernel;
+	cl_uint dim;
+	size_t offset[3];
+	size_t global[3];
+	size_t local[3];
+	bool has_offset;
+	bool has_local;
+
+	/* CMDBUF_COPY, CMDBUF_FILL */
+	cl_mem src;
+	cl_mem dst;
+	size_t src_offset;
+	size_t dst_offset;
+	size_t size;
+	uint8_t pattern[CMDBUF_PATTERN_MAX];
+	size_t pattern_size;
+};
+
+struct opencl_cmdbuf {
+	const char *name;
+	cl_command_queue q;
+	enum cmdbuf_mode mode;
+	bool recorded;
+	bool released;
+
+	/* CMDBUF_PREBUILT */
+	struct cmdbuf_cmd *cmds;
+	unsigned int n_cmds;
+	unsigned int cmds_size;
+
+#ifdef CMDBUF_KHR
+	cl_command_buffer_khr khr;
+	cl_sync_point_khr sync;
+	bool has_sync;
+#endif
+
+	/* Statistics, kept after release for the report */
+	unsigned int commands;
+	uint64_t t_direct;
+	uint64_t t_replay;
+	unsigned int replays;
+
+	struct opencl_cmdbuf *next;
+};
+
+static struct {
+	bool enabled;
+	bool prebuilt;
+	struct opencl_cmdbuf *sequences;
+
+#ifdef CMDBUF_KHR
+	bool khr_probed;
+	bool khr;
+	clCreateCommandBufferKHR_fn create;
+	clFinalizeCommandBufferKHR_fn finalize;
+	clReleaseCommandBufferKHR_fn release;
+	clEnqueueCommandBufferKHR_fn enqueue;
+	clCommandNDRangeKernelKHR_fn ndrange;
+	clCommandCopyBufferKHR_fn copy;
+	clCommandFillBufferKHR_fn fill;
+#endif
+} cmdbuf = {
+	.enabled = false,
+	.prebuilt = false,
+	.sequences = NULL,
+};
+
+static uint64_t
+cmdbuf_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+int
+opencl_cmdbuf_enable(const char *mode)
+{
+	if (!strcmp(mode, "prebuilt"))
+		cmdbuf.prebuilt = true;
+	else if (strcmp(mode, "auto"))
+		return -EINVAL;
+
+	/* Prebuilt sequences clone kernels with their arguments */
+	opencl_capture_track_args();
+	cmdbuf.enabled = true;
+
+	return 0;
+}
+
+bool
+opencl_cmdbuf_enabled(void)
+{
+	return cmdbuf.enabled;
+}
+
+#ifdef CMDBUF_KHR
+static bool
+cmdbuf_khr_probe(void)
+{
+	cl_name_version *exts = NULL;
+	cl_platform_id platform;
+	cl_device_id dev;
+	size_t size, i;
+	bool match = false;
+
+	if (cmdbuf.khr_probed)
+		return cmdbuf.khr;
+	cmdbuf.khr_probed = true;
+
+	if (!opencl_device_has_extension("cl_khr_command_buffer"))
+		return false;
+
+	/* The device must implement the revision the headers describe */
+	dev = opencl_get_device();
+	if (clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS_WITH_VERSION, 0, NULL,
+			&size) != CL_SUCCESS)
+		return false;
+
+	exts = malloc(size);
+	if (!exts || clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS_WITH_VERSION,
+			size, exts, NULL) != CL_SUCCESS)
+		goto out;
+
+	for (i = 0; i < size / sizeof(cl_name_version); i++) {
+		if (!strcmp(exts[i].name, "cl_khr_command_buffer") &&
+		    exts[i].version == CL_KHR_COMMAND_BUFFER_EXTENSION_VERSION)
+			match = true;
+	}
+	if (!match) {
+		printf("cl_khr_command_buffer revision differs from the "
+				"headers, using prebuilt sequences\n");
+		goto out;
+	}
+
+	if (clGetDeviceInfo(dev, CL_DEVICE_PLATFORM, sizeof(platform),
+			&platform, NULL) != CL_SUCCESS)
+		goto out;
+
+	cmdbuf.create = clGetExtensionFunctionAddressForPlatform(platform,
+			"clCreateCommandBufferKHR");
+	cmdbuf.finalize = clGetExtensionFunctionAddressForPlatform(platform,
+			"clFinalizeCommandBufferKHR");
+	cmdbuf.release = clGetExtensionFunctionAddressForPlatform(platform,
+			"clReleaseCommandBufferKHR");
+	cmdbuf.enqueue = clGetExtensionFunctionAddressForPlatform(platform,
+			"clEnqueueCommandBufferKHR");
+	cmdbuf.ndrange = clGetExtensionFunctionAddressForPlatform(platform,
+			"clCommandNDRangeKernelKHR");
+	cmdbuf.copy = clGetExtensionFunctionAddressForPlatform(platform,
+			"clCommandCopyBufferKHR");
+	cmdbuf.fill = clGetExtensionFunctionAddressForPlatform(platform,
+			"clCommandFillBufferKHR");
+
+	cmdbuf.khr = cmdbuf.create && cmdbuf.finalize && cmdbuf.release &&
+			cmdbuf.enqueue && cmdbuf.ndrange && cmdbuf.copy &&
+			cmdbuf.fill;
+
+out:
+	free(exts);
+	return cmdbuf.khr;
+}
+#endif
+
+struct opencl_cmdbuf *
+opencl_cmdbuf_create(cl_command_queue q, const char *name)
+{
+	struct opencl_cmdbuf *cb;
+#ifdef CMDBUF_KHR
+	cl_int error;
+#endif
+
+	if (!cmdbuf.enabled)
+		return NULL;
+
+	cb = calloc(1, sizeof(struct opencl_cmdbuf));
+	if (!cb) {
+		fprintf(stderr, "Could not allocate command sequence\n");
+		return NULL;
+	}
+
+	cb->name = name;
+	cb->q = q;
+	cb->mode = CMDBUF_PREBUILT;
+
+#ifdef CMDBUF_KHR
+	if (!cmdbuf.prebuilt && cmdbuf_khr_probe()) {
+		cb->khr = cmdbuf.create(1, &q, NULL, &error);
+		if (error == CL_SUCCESS)
+			cb->mode = CMDBUF_KHR_BUFFER;
+		else
+			printf("Could not create command-buffer for %s: %d, "
+					"using prebuilt sequence\n", name,
+					error);
+	}
+#endif
+
+	cb->next = cmdbuf.sequences;
+	cmdbuf.sequences = cb;
+
+	return cb;
+}
+
+static struct cmdbuf_cmd *
+cmdbuf_cmd_add(struct opencl_cmdbuf *cb, enum cmdbuf_type type)
+{
+	struct cmdbuf_cmd *cmds;
+
+	if (cb->n_cmds == cb->cmds_size) {
+		cmds = realloc(cb->cmds, (cb->cmds_size + 8) *
+				sizeof(struct cmdbuf_cmd));
+		if (!cmds)
+			return NULL;
+		cb->cmds = cmds;
+		cb->cmds_size += 8;
+	}
+
+	memset(&cb->cmds[cb->n_cmds], 0, sizeof(struct cmdbuf_cmd));
+	cb->cmds[cb->n_cmds].type = type;
+
+	return &cb->cmds[cb->n_cmds++];
+}
+
+/* A failed recording degrades the sequence to running directly */
+static void
+cmdbuf_fail(struct opencl_cmdbuf *cb, cl_int error)
+{
+	if (cb->mode == CMDBUF_DIRECT)
+		return;
+
+	fprintf(stderr, "Could not record %s: %d, running directly\n",
+			cb->name, error);
+	cb->mode = CMDBUF_DIRECT;
+}
+
+#ifdef CMDBUF_KHR
+/* Commands in a command-buffer are unordered, chain them like an in-order
+ * queue would */
+static cl_uint
+cmdbuf_khr_wait(struct opencl_cmdbuf *cb, const cl_sync_point_khr **wait)
+{
+	*wait = cb->has_sync ? &cb->sync : NULL;
+	cb->has_sync = true;
+
+	return *wait ? 1 : 0;
+}
+#endif
+
+cl_int
+opencl_cmdbuf_kernel(struct opencl_cmdbuf *cb, cl_command_queue q,
+		cl_kernel kernel, cl_uint dim, const size_t *offset,
+		const size_t *global, const size_t *local, cl_event *event)
+{
+	struct cmdbuf_cmd *cmd;
+	uint64_t t_start;
+	cl_int error;
+	cl_uint i;
+#ifdef CMDBUF_KHR
+	const cl_sync_point_khr *wait;
+	cl_uint n_wait;
+#endif
+
+	t_start = cmdbuf_time_ns();
+	error = clEnqueueNDRangeKernel(q, kernel, dim, offset, global, local,
+			0, NULL, event);
+	if (!cb || cb->recorded || cb->released || error != CL_SUCCESS)
+		return error;
+
+	cb->t_direct += cmdbuf_time_ns() - t_start;
+	cb->commands++;
+
+	switch (cb->mode) {
+	case CMDBUF_PREBUILT:
+		cmd = cmdbuf_cmd_add(cb, CMDBUF_KERNEL);
+		if (!cmd) {
+			cmdbuf_fail(cb, CL_OUT_OF_HOST_MEMORY);
+			break;
+		}
+
+		cmd->kernel = opencl_capture_clone_kernel(kernel);
+		if (!cmd->kernel) {
+			cmdbuf_fail(cb, CL_INVALID_KERNEL);
+			break;
+		}
+
+		cmd->dim = dim;
+		cmd->has_offset = !!offset;
+		cmd->has_local = !!local;
+		for (i = 0; i < dim; i++) {
+			cmd->offset[i] = offset ? offset[i] : 0;
+			cmd->global[i] = global[i];
+			cmd->local[i] = local ? local[i] : 0;
+		}
+		break;
+#ifdef CMDBUF_KHR
+	case CMDBUF_KHR_BUFFER:
+		n_wait = cmdbuf_khr_wait(cb, &wait);
+		error = cmdbuf.ndrange(cb->khr, NULL, NULL, kernel, dim,
+				offset, global, local, n_wait, wait, &cb->sync,
+				NULL);
+		if (error != CL_SUCCESS)
+			cmdbuf_fail(cb, error);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return CL_SUCCESS;
+}
+
+cl_int
+opencl_cmdbuf_copy(struct opencl_cmdbuf *cb, cl_command_queue q, cl_mem src,
+		cl_mem dst, size_t src_offset, size_t dst_offset, size_t size)
+{
+	struct cmdbuf_cmd *cmd;
+	uint64_t t_start;
+	cl_int error;
+#ifdef CMDBUF_KHR
+	const cl_sync_point_khr *wait;
+	cl_uint n_wait;
+#endif
+
+	t_start = cmdbuf_time_ns();
+	error = clEnqueueCopyBuffer(q, src, dst, src_offset, dst_offset, size,
+			0, NULL, NULL);
+	if (!cb || cb->recorded || cb->released || error != CL_SUCCESS)
+		return error;
+
+	cb->t_direct += cmdbuf_time_ns() - t_start;
+	cb->commands++;
+
+	switch (cb->mode) {
+	case CMDBUF_PREBUILT:
+		cmd = cmdbuf_cmd_add(cb, CMDBUF_COPY);
+		if (!cmd) {
+			cmdbuf_fail(cb, CL_OUT_OF_HOST_MEMORY);
+			break;
+		}
+
+		clRetainMemObject(src);
+		clRetainMemObject(dst);
+		cmd->src = src;
+		cmd->dst = dst;
+		cmd->src_offset = src_offset;
+		cmd->dst_offset = dst_offset;
+		cmd->size = size;
+		break;
+#ifdef CMDBUF_KHR
+	case CMDBUF_KHR_BUFFER:
+		n_wait = cmdbuf_khr_wait(cb, &wait);
+		error = cmdbuf.copy(cb->khr, NULL, CMDBUF_KHR_PROPS src, dst,
+				src_offset, dst_offset, size, n_wait, wait,
+				&cb->sync, NULL);
+		if (error != CL_SUCCESS)
+			cmdbuf_fail(cb, error);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return CL_SUCCESS;
+}
+
+cl_int
+opencl_cmdbuf_fill(struct opencl_cmdbuf *cb, cl_command_queue q, cl_mem buf,
+		const void *pattern, size_t pattern_size, size_t offset,
+		size_t size)
+{
+	struct cmdbuf_cmd *cmd;
+	uint64_t t_start;
+	cl_int error;
+#ifdef CMDBUF_KHR
+	const cl_sync_point_khr *wait;
+	cl_uint n_wait;
+#endif
+
+	t_start = cmdbuf_time_ns();
+	error = clEnqueueFillBuffer(q, buf, pattern, pattern_size, offset,
+			size, 0, NULL, NULL);
+	if (!cb || cb->recorded || cb->released || error != CL_SUCCESS)
+		return error;
+
+	cb->t_direct += cmdbuf_time_ns() - t_start;
+	cb->commands++;
+
+	switch (cb->mode) {
+	case CMDBUF_PREBUILT:
+		cmd = cmdbuf_cmd_add(cb, CMDBUF_FILL);
+		if (!cmd || pattern_size > CMDBUF_PATTERN_MAX) {
+			cmdbuf_fail(cb, CL_OUT_OF_HOST_MEMORY);
+			break;
+		}
+
+		clRetainMemObject(buf);
+		cmd->dst = buf;
+		memcpy(cmd->pattern, pattern, pattern_size);
+		cmd->pattern_size = pattern_size;
+		cmd->dst_offset = offset;
+		cmd->size = size;
+		break;
+#ifdef CMDBUF_KHR
+	case CMDBUF_KHR_BUFFER:
+		n_wait = cmdbuf_khr_wait(cb, &wait);
+		error = cmdbuf.fill(cb->khr, NULL, CMDBUF_KHR_PROPS buf,
+				pattern, pattern_size, offset, size, n_wait,
+				wait, &cb->sync, NULL);
+		if (error != CL_SUCCESS)
+			cmdbuf_fail(cb, error);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return CL_SUCCESS;
+}
+
+cl_int
+opencl_cmdbuf_end(struct opencl_cmdbuf *cb)
+{
+	cl_int error = CL_SUCCESS;
+
+	if (!cb || cb->recorded)
+		return CL_SUCCESS;
+
+#ifdef CMDBUF_KHR
+	if (cb->mode == CMDBUF_KHR_BUFFER) {
+		error = cmdbuf.finalize(cb->khr);
+		if (error != CL_SUCCESS)
+			cmdbuf_fail(cb, error);
+	}
+#endif
+
+	cb->recorded = true;
+
+	return error;
+}
+
+static cl_int
+cmdbuf_replay_prebuilt(struct opencl_cmdbuf *cb, cl_event *first,
+		cl_event *last)
+{
+	struct cmdbuf_cmd *cmd;
+	cl_event *event;
+	cl_int error = CL_SUCCESS;
+	unsigned int i;
+
+	for (i = 0; i < cb->n_cmds && error == CL_SUCCESS; i++) {
+		cmd = &cb->cmds[i];
+
+		/* Only the ends of the sequence are timed */
+		event = NULL;
+		if (i == 0)
+			event = first;
+		else if (i == cb->n_cmds - 1)
+			event = last;
+
+		switch (cmd->type) {
+		case CMDBUF_KERNEL:
+			error = clEnqueueNDRangeKernel(cb->q, cmd->kernel,
+					cmd->dim,
+					cmd->has_offset ? cmd->offset : NULL,
+					cmd->global,
+					cmd->has_local ? cmd->local : NULL,
+					0, NULL, event);
+			break;
+		case CMDBUF_COPY:
+			error = clEnqueueCopyBuffer(cb->q, cmd->src, cmd->dst,
+					cmd->src_offset, cmd->dst_offset,
+					cmd->size, 0, NULL, event);
+			break;
+		case CMDBUF_FILL:
+			error = clEnqueueFillBuffer(cb->q, cmd->dst,
+					cmd->pattern, cmd->pattern_size,
+					cmd->dst_offset, cmd->size, 0, NULL,
+					event);
+			break;
+		}
+	}
+
+	if (error == CL_SUCCESS)
+		error = clFlush(cb->q);
+
+	return error;
+}
+
+int
+opencl_cmdbuf_replay(struct opencl_cmdbuf *cb, cl_ulong *time)
+{
+	cl_ulong t_start = 0l, t_end = 0l;
+	cl_event first = NULL, last = NULL;
+	uint64_t t_submit;
+	cl_int error = CL_SUCCESS;
+
+	if (!cb || !cb->recorded || cb->released ||
+	    cb->mode == CMDBUF_DIRECT || cb->commands == 0)
+		return 0;
+
+	t_submit = cmdbuf_time_ns();
+	switch (cb->mode) {
+	case CMDBUF_PREBUILT:
+		error = cmdbuf_replay_prebuilt(cb, &first,
+				cb->n_cmds > 1 ? &last : NULL);
+		break;
+#ifdef CMDBUF_KHR
+	case CMDBUF_KHR_BUFFER:
+		error = cmdbuf.enqueue(0, NULL, cb->khr, 0, NULL, &first);
+		break;
+#endif
+	default:
+		break;
+	}
+	cb->t_replay += cmdbuf_time_ns() - t_submit;
+	cb->replays++;
+
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not replay %s: %d\n", cb->name, error);
+		return -1;
+	}
+
+	clFinish(cb->q);
+
+	clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START,
+			sizeof(cl_ulong), &t_start, NULL);
+	clGetEventProfilingInfo(last ? last : first, CL_PROFILING_COMMAND_END,
+			sizeof(cl_ulong), &t_end, NULL);
+	*time = t_end - t_start;
+
+	clReleaseEvent(first);
+	if (last)
+		clReleaseEvent(last);
+
+	return 1;
+}
+
+void
+opencl_cmdbuf_release(struct opencl_cmdbuf *cb)
+{
+	struct cmdbuf_cmd *cmd;
+	unsigned int i;
+
+	if (!cb)
+		return;
+
+	for (i = 0; i < cb->n_cmds; i++) {
+		cmd = &cb->cmds[i];
+		if (cmd->kernel)
+			clReleaseKernel(cmd->kernel);
+		if (cmd->src)
+			clReleaseMemObject(cmd->src);
+		if (cmd->dst)
+			clReleaseMemObject(cmd->dst);
+	}
+	free(cb->cmds);
+	cb->cmds = NULL;
+	cb->n_cmds = 0;
+
+#ifdef CMDBUF_KHR
+	if (cb->khr)
+		cmdbuf.release(cb->khr);
+	cb->khr = NULL;
+#endif
+
+	cb->released = true;
+}
+
+void
+opencl_cmdbuf_report(void)
+{
+	struct opencl_cmdbuf *cb;
+	double direct, replay;
+
+	while ((cb = cmdbuf.sequences)) {
+		cmdbuf.sequences = cb->next;
+
+		if (cb->replays) {
+			direct = cb->t_direct / 1000.;
+			replay = cb->t_replay / (1000. * cb->replays);
+			printf("Sequence %s (%s): %u commands, host submit "
+					"%.1f us direct, %.1f us replayed "
+					"(avg of %u), %.1f us saved per "
+					"iteration\n", cb->name,
+					cmdbuf_mode_names[cb->mode],
+					cb->commands, direct, replay,
+					cb->replays, direct - replay);
+		}
+
+		opencl_cmdbuf_release(cb);
+		free(cb);
+	}
+}
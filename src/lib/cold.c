@@ -0,0 +1,493 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/cold.h"
+
+#define COLD_NAME_MAX 128
+/* Launches remembered until their time is accounted */
+#define COLD_RING 64
+/* Evicts caches, larger than any last-level cache */
+#define COLD_FLUSH_SIZE (128ul << 20)
+
+/** Timed launches of a kernel */
+struct cold_kernel {
+	cl_kernel kernel;
+	char name[COLD_NAME_MAX];
+	/** Launches enqueued, timed or not */
+	unsigned int launches;
+
+	/** First launches, one per kernel object once merged by name */
+	unsigned int firsts;
+	cl_ulong first_exec;
+	cl_ulong first_lat;
+
+	unsigned int steady;
+	cl_ulong steady_exec;
+	cl_ulong steady_lat;
+
+	struct cold_kernel *next;
+};
+
+struct cold_launch {
+	cl_event event;
+	struct cold_kernel *k;
+	bool first;
+};
+
+static struct {
+	unsigned int launches;
+	struct cold_kernel *kernels;
+	/** Kernels released or reported. Their handles may be reused, so new
+	 * launches are no longer attributed to them. */
+	struct cold_kernel *retired;
+	struct cold_launch ring[COLD_RING];
+	unsigned int head;
+} cold = {
+	.launches = 0,
+	.kernels = NULL,
+	.retired = NULL,
+	.head = 0,
+};
+
+void
+opencl_cold_enable(unsigned int launches)
+{
+	cold.launches = launches;
+
+	/* Buffer arguments are swapped for fresh copies */
+	opencl_capture_track_args();
+}
+
+bool
+opencl_cold_enabled(void)
+{
+	return cold.launches > 0;
+}
+
+static struct cold_kernel *
+cold_kernel_get(cl_kernel kernel)
+{
+	struct cold_kernel *k;
+
+	for (k = cold.kernels; k; k = k->next) {
+		if (k->kernel == kernel)
+			return k;
+	}
+
+	k = calloc(1, sizeof(struct cold_kernel));
+	if (!k)
+		return NULL;
+
+	k->kernel = kernel;
+	if (clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(k->name),
+			k->name, NULL) != CL_SUCCESS)
+		snprintf(k->name, sizeof(k->name), "kernel");
+	k->next = cold.kernels;
+	cold.kernels = k;
+
+	return k;
+}
+
+void
+opencl_cold_released(cl_kernel kernel)
+{
+	struct cold_kernel **p, *k;
+
+	for (p = &cold.kernels; *p; p = &(*p)->next) {
+		if ((*p)->kernel == kernel)
+			break;
+	}
+	if (!*p)
+		return;
+
+	/* Launches still in the ring are accounted to the retired entry, a
+	 * new kernel reusing the handle starts with a first launch again */
+	k = *p;
+	*p = k->next;
+	k->kernel = NULL;
+	k->next = cold.retired;
+	cold.retired = k;
+}
+
+void
+opencl_cold_launched(cl_kernel kernel, cl_event event)
+{
+	struct cold_launch *l;
+	struct cold_kernel *k;
+
+	k = cold_kernel_get(kernel);
+	if (!k)
+		return;
+
+	l = &cold.ring[cold.head++ % COLD_RING];
+	l->event = event;
+	l->k = k;
+	l->first = (k->launches++ == 0);
+}
+
+void
+opencl_cold_account(cl_event event, cl_ulong start, cl_ulong end)
+{
+	struct cold_launch *l = NULL;
+	struct cold_kernel *k;
+	cl_ulong queued, exec, lat;
+	unsigned int i;
+
+	/* Newest first, the runtime may reuse handles of released events */
+	for (i = 1; i <= COLD_RING; i++) {
+		l = &cold.ring[(cold.head - i) % COLD_RING];
+		if (l->event == event)
+			break;
+	}
+	if (!event || i > COLD_RING)
+		return;
+
+	if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED,
+			sizeof(cl_ulong), &queued, NULL) != CL_SUCCESS ||
+	    queued > start)
+		queued = start;
+
+	k = l->k;
+	exec = end - start;
+	lat = end - queued;
+	if (l->first) {
+		k->firsts++;
+		k->first_exec += exec;
+		k->first_lat += lat;
+	} else {
+		k->steady++;
+		k->steady_exec += exec;
+		k->steady_lat += lat;
+	}
+	l->event = NULL;
+}
+
+/* Release fresh copies of buffers, each only once if arguments alias */
+static void
+cold_release_buffers(cl_mem *fresh, cl_uint n_args)
+{
+	cl_uint i, j;
+
+	for (i = 0; i < n_args; i++) {
+		for (j = 0; j < i; j++) {
+			if (fresh[j] == fresh[i])
+				break;
+		}
+		if (fresh[i] && j == i)
+			clReleaseMemObject(fresh[i]);
+	}
+	memset(fresh, 0, n_args * sizeof(cl_mem));
+}
+
+/* Point the buffer arguments of a kernel at fresh copies of the originals */
+static cl_int
+cold_fresh_buffers(cl_command_queue q, cl_context ctx, cl_kernel kernel,
+		cl_mem *orig, cl_mem *fresh, cl_uint n_args)
+{
+	cl_mem_flags flags;
+	cl_int error = CL_SUCCESS;
+	size_t size;
+	cl_uint i, j;
+
+	for (i = 0; i < n_args && error == CL_SUCCESS; i++) {
+		if (!orig[i])
+			continue;
+
+		for (j = 0; j < i; j++) {
+			if (orig[j] == orig[i])
+				break;
+		}
+
+		if (j < i) {
+			fresh[i] = fresh[j];
+		} else {
+			error = clGetMemObjectInfo(orig[i], CL_MEM_SIZE,
+					sizeof(size_t), &size, NULL);
+			error |= clGetMemObjectInfo(orig[i], CL_MEM_FLAGS,
+					sizeof(cl_mem_flags), &flags, NULL);
+			if (error != CL_SUCCESS)
+				break;
+
+			flags &= ~(CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR);
+			fresh[i] = clCreateBuffer(ctx, flags, size, NULL,
+					&error);
+			if (error != CL_SUCCESS)
+				break;
+
+			error = clEnqueueCopyBuffer(q, orig[i], fresh[i], 0, 0,
+					size, 0, NULL, NULL);
+			if (error != CL_SUCCESS)
+				break;
+		}
+
+		error = clSetKernelArg(kernel, i, sizeof(cl_mem), &fresh[i]);
+	}
+
+	if (error == CL_SUCCESS)
+		error = clFinish(q);
+
+	return error;
+}
+
+void
+opencl_cold_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local)
+{
+	char name[COLD_NAME_MAX];
+	struct cold_kernel *k;
+	cl_context ctx;
+	cl_kernel clone;
+	cl_event event;
+	cl_mem *orig = NULL, *fresh = NULL;
+	cl_mem flush[2] = {NULL, NULL};
+	char *host_flush = NULL;
+	cl_ulong queued, start, end;
+	cl_ulong exec_sum = 0, exec_max = 0, lat_sum = 0, lat_max = 0;
+	cl_uint n_args;
+	cl_int error;
+	unsigned int n;
+
+	if (!opencl_cold_enabled())
+		return;
+
+	if (clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS)
+		snprintf(name, sizeof(name), "kernel");
+
+	if (clGetCommandQueueInfo(q, CL_QUEUE_CONTEXT, sizeof(cl_context),
+			&ctx, NULL) != CL_SUCCESS ||
+	    clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint),
+			&n_args, NULL) != CL_SUCCESS) {
+		fprintf(stderr, "Cold %s: could not query kernel\n", name);
+		return;
+	}
+
+	orig = calloc(n_args + 1, sizeof(cl_mem));
+	fresh = calloc(n_args + 1, sizeof(cl_mem));
+	host_flush = malloc(COLD_FLUSH_SIZE);
+	if (!orig || !fresh || !host_flush) {
+		fprintf(stderr, "Cold %s: out of memory\n", name);
+		goto error;
+	}
+
+	if (opencl_capture_buffer_args(kernel, n_args, orig)) {
+		fprintf(stderr, "Cold %s: kernel arguments not known\n", name);
+		goto error;
+	}
+
+	flush[0] = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+			COLD_FLUSH_SIZE, NULL, &error);
+	if (error == CL_SUCCESS)
+		flush[1] = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+				COLD_FLUSH_SIZE, NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Cold %s: could not create flush buffers\n",
+				name);
+		goto error;
+	}
+
+	clFinish(q);
+	for (n = 0; n < cold.launches; n++) {
+		clone = opencl_capture_clone_kernel(kernel);
+		if (!clone) {
+			error = CL_OUT_OF_RESOURCES;
+			break;
+		}
+
+		error = cold_fresh_buffers(q, ctx, clone, orig, fresh, n_args);
+
+		/* Evict device caches with a large copy, host caches by
+		 * writing a large buffer */
+		if (error == CL_SUCCESS)
+			error = clEnqueueCopyBuffer(q, flush[0], flush[1], 0, 0,
+					COLD_FLUSH_SIZE, 0, NULL, NULL);
+		if (error == CL_SUCCESS)
+			error = clFinish(q);
+		memset(host_flush, n, COLD_FLUSH_SIZE);
+
+		if (error == CL_SUCCESS)
+			error = clEnqueueNDRangeKernel(q, clone, dim, offset,
+					global, local, 0, NULL, &event);
+		if (error == CL_SUCCESS) {
+			error = clWaitForEvents(1, &event);
+			if (error == CL_SUCCESS)
+				error = clGetEventProfilingInfo(event,
+						CL_PROFILING_COMMAND_QUEUED,
+						sizeof(cl_ulong), &queued,
+						NULL);
+			if (error == CL_SUCCESS)
+				error = clGetEventProfilingInfo(event,
+						CL_PROFILING_COMMAND_START,
+						sizeof(cl_ulong), &start, NULL);
+			if (error == CL_SUCCESS)
+				error = clGetEventProfilingInfo(event,
+						CL_PROFILING_COMMAND_END,
+						sizeof(cl_ulong), &end, NULL);
+			clReleaseEvent(event);
+		}
+
+		cold_release_buffers(fresh, n_args);
+		clReleaseKernel(clone);
+		if (error != CL_SUCCESS)
+			break;
+
+		if (queued > start)
+			queued = start;
+		exec_sum += end - start;
+		lat_sum += end - queued;
+		if (end - start > exec_max)
+			exec_max = end - start;
+		if (end - queued > lat_max)
+			lat_max = end - queued;
+	}
+
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Cold %s: launch failed after %u launches: "
+				"%d\n", name, n, error);
+		goto error;
+	}
+
+	printf("Cold %s: %u launches, exec mean %.3f max %.3f us, latency "
+			"mean %.3f max %.3f us", name, n,
+			exec_sum * 1e-3 / n, exec_max * 1e-3,
+			lat_sum * 1e-3 / n, lat_max * 1e-3);
+	k = cold_kernel_get(kernel);
+	if (k && k->steady)
+		printf(", %.2fx steady", (double) exec_sum * k->steady /
+				(k->steady_exec * n));
+	printf("\n");
+
+error:
+	if (flush[0])
+		clReleaseMemObject(flush[0]);
+	if (flush[1])
+		clReleaseMemObject(flush[1]);
+	free(host_flush);
+	free(orig);
+	free(fresh);
+}
+
+/* Fold retired kernels into one entry per name, dropping the ones that were
+ * never timed */
+static void
+cold_merge(void)
+{
+	struct cold_kernel **p, *k, *m;
+
+	p = &cold.retired;
+	while ((k = *p)) {
+		for (m = cold.retired; m != k; m = m->next) {
+			if (!strcmp(m->name, k->name))
+				break;
+		}
+
+		if (m == k && (k->firsts || k->steady)) {
+			p = &k->next;
+			continue;
+		}
+
+		m->firsts += k->firsts;
+		m->first_exec += k->first_exec;
+		m->first_lat += k->first_lat;
+		m->steady += k->steady;
+		m->steady_exec += k->steady_exec;
+		m->steady_lat += k->steady_lat;
+
+		*p = k->next;
+		free(k);
+	}
+}
+
+void
+opencl_cold_report(void)
+{
+	struct cold_kernel *k;
+	bool header = false;
+
+	while ((k = cold.kernels)) {
+		cold.kernels = k->next;
+		k->kernel = NULL;
+		k->next = cold.retired;
+		cold.retired = k;
+	}
+	memset(cold.ring, 0, sizeof(cold.ring));
+	cold_merge();
+
+	for (k = cold.retired; k; k = k->next) {
+		if (!header) {
+			printf("%-22s %11s %11s %11s %11s %8s\n", "Kernel",
+					"first (us)", "latency", "steady (us)",
+					"latency", "ratio");
+			header = true;
+		}
+
+		printf("%-22s", k->name);
+		if (k->firsts)
+			printf(" %11.3f %11.3f", k->first_exec * 1e-3 /
+					k->firsts, k->first_lat * 1e-3 /
+					k->firsts);
+		else
+			printf(" %11s %11s", "-", "-");
+		if (k->steady)
+			printf(" %11.3f %11.3f", k->steady_exec * 1e-3 /
+					k->steady, k->steady_lat * 1e-3 /
+					k->steady);
+		else
+			printf(" %11s %11s", "-", "-");
+		if (k->firsts && k->steady && k->steady_exec)
+			printf(" %7.2fx", ((double) k->first_exec / k->firsts) /
+					((double) k->steady_exec / k->steady));
+		printf("\n");
+	}
+}
+
+bool
+opencl_cold_kernel_time(unsigned int i, const char **name, double *mean)
+{
+	struct cold_kernel *k, *lists[2] = {cold.kernels, cold.retired};
+	unsigned int l;
+
+	for (l = 0; l < 2; l++) {
+		for (k = lists[l]; k; k = k->next) {
+			if (!k->firsts && !k->steady)
+				continue;
+			if (i-- > 0)
+				continue;
+
+			*name = k->name;
+			if (k->steady)
+				*mean = (double) k->steady_exec / k->steady;
+			else
+				*mean = (double) k->first_exec / k->firsts;
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/compile.h"
+
+/* Defined uniquely for every build, never used by the kernels */
+#define COMPILE_NONCE " -D CLAXON_BUILD_NONCE="
+
+/* Environment variables that disable the binary caches of implementations */
+static const char *compile_nocache[][2] = {
+	{"CUDA_CACHE_DISABLE", "1"},
+	{"POCL_KERNEL_CACHE", "0"},
+	{"MESA_SHADER_CACHE_DISABLE", "true"},
+	{"NEO_CACHE_PERSISTENT", "0"},
+};
+
+static struct {
+	unsigned int builds;
+	unsigned int nonce;
+} compile = {
+	.builds = 0,
+	.nonce = 0,
+};
+
+void
+opencl_compile_enable(unsigned int builds)
+{
+	unsigned int i;
+
+	compile.builds = builds;
+
+	/* Explicit settings in the environment take precedence */
+	for (i = 0; i < sizeof(compile_nocache) / sizeof(compile_nocache[0]);
+	     i++)
+		setenv(compile_nocache[i][0], compile_nocache[i][1], 0);
+}
+
+bool
+opencl_compile_enabled(void)
+{
+	return compile.builds > 0;
+}
+
+static uint64_t
+compile_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+/* Print the binary size and the resources of every kernel in a program */
+static void
+compile_describe(cl_program prg)
+{
+	cl_kernel kernel;
+	size_t binary = 0, len = 0;
+	char *names, *name, *save;
+	cl_int error;
+
+	if (clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, sizeof(size_t),
+			&binary, NULL) == CL_SUCCESS)
+		printf("  Binary: %zu B\n", binary);
+
+	if (clGetProgramInfo(prg, CL_PROGRAM_KERNEL_NAMES, 0, NULL, &len) !=
+			CL_SUCCESS || !len)
+		return;
+
+	names = malloc(len);
+	if (!names)
+		return;
+
+	if (clGetProgramInfo(prg, CL_PROGRAM_KERNEL_NAMES, len, names, NULL) ==
+			CL_SUCCESS) {
+		for (name = strtok_r(names, ";", &save); name;
+		     name = strtok_r(NULL, ";", &save)) {
+			kernel = clCreateKernel(prg, name, &error);
+			if (error != CL_SUCCESS)
+				continue;
+
+			printf("  ");
+			opencl_kernel_resources(kernel);
+			clReleaseKernel(kernel);
+		}
+	}
+	free(names);
+}
+
+int
+opencl_compile_bench(cl_context ctx, cl_uint n, const char **sources,
+		const char *options, const char *label)
+{
+	cl_device_id dev = opencl_get_device();
+	cl_program prg;
+	cl_int error;
+	size_t src_bytes = 0, len, kernels = 0;
+	uint64_t t, t_sum = 0, t_min = UINT64_MAX, t_max = 0;
+	unsigned int b;
+	char *opts;
+	double mean;
+
+	if (!opencl_compile_enabled())
+		return 0;
+
+	for (b = 0; b < n; b++)
+		src_bytes += strlen(sources[b]);
+
+	len = strlen(options) + sizeof(COMPILE_NONCE) + 32;
+	opts = malloc(len);
+	if (!opts) {
+		fprintf(stderr, "Compile %s: out of memory\n", label);
+		return -1;
+	}
+
+	for (b = 0; b < compile.builds; b++) {
+		snprintf(opts, len, "%s"COMPILE_NONCE"%d_%u", options,
+				(int) getpid(), compile.nonce++);
+
+		prg = clCreateProgramWithSource(ctx, n, sources, NULL, &error);
+		if (error != CL_SUCCESS)
+			break;
+
+		t = compile_time_ns();
+		error = clBuildProgram(prg, 1, &dev, opts, NULL, NULL);
+		t = compile_time_ns() - t;
+		if (error != CL_SUCCESS) {
+			clReleaseProgram(prg);
+			break;
+		}
+
+		t_sum += t;
+		if (t < t_min)
+			t_min = t;
+		if (t > t_max)
+			t_max = t;
+
+		if (b == 0) {
+			printf("Compile %s: %s\n", label, options);
+			clGetProgramInfo(prg, CL_PROGRAM_NUM_KERNELS,
+					sizeof(size_t), &kernels, NULL);
+			compile_describe(prg);
+		}
+		clReleaseProgram(prg);
+	}
+	free(opts);
+
+	if (b < compile.builds) {
+		fprintf(stderr, "Compile %s: build %u failed: %d\n", label, b,
+				error);
+		return -1;
+	}
+
+	mean = (double) t_sum / compile.builds;
+	printf("  %u builds: min %.3f, mean %.3f, max %.3f ms, %.1f KiB/s "
+			"source, %.1f kernels/s\n", compile.builds,
+			t_min * 1e-6, mean * 1e-6, t_max * 1e-6,
+			src_bytes / 1024. / (mean * 1e-9),
+			kernels / (mean * 1e-9));
+
+	return 0;
+}
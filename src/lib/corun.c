@@ -0,0 +1,359 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/corun.h"
+
+#define CORUN_NAME_MAX 128
+
+/* Per-thread working set, well beyond the last-level cache */
+#define CORUN_BUF_SIZE (64ul << 20)
+#define CORUN_WORDS (CORUN_BUF_SIZE / sizeof(uint64_t))
+#define CORUN_LINE 64ul
+/* Bytes touched between bandwidth checks */
+#define CORUN_CHUNK (64ul << 10)
+/* Minimum time spent per step, such that the co-runners reach steady state */
+#define CORUN_STEP_NS 100000000ul
+/* Stride between thrash accesses, such that all hit the same cache sets */
+#define CORUN_THRASH_STRIDE (64ul << 10)
+/* Random line selection, Knuth's MMIX LCG */
+#define CORUN_LCG_MUL 6364136223846793005ul
+#define CORUN_LCG_ADD 1442695040888963407ul
+
+static const char *corun_names[OPENCL_CORUN_COUNT] = {
+	[OPENCL_CORUN_READ] = "read",
+	[OPENCL_CORUN_WRITE] = "write",
+	[OPENCL_CORUN_RANDOM] = "random",
+	[OPENCL_CORUN_THRASH] = "thrash",
+};
+
+struct corun_thread {
+	pthread_t thread;
+	uint64_t *buf;
+	uint64_t bytes;
+	uint64_t ns;
+	uint64_t sink;
+	unsigned int seed;
+};
+
+static struct {
+	bool enabled;
+	clCorunKind kind;
+	unsigned int threads;
+	unsigned int rate;
+
+	/* Control of the running co-runners */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int running;
+	volatile bool stop;
+} corun = {
+	.enabled = false,
+	.kind = OPENCL_CORUN_READ,
+	.threads = 0,
+	.rate = 0,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.running = 0,
+	.stop = false,
+};
+
+int
+opencl_corun_enable(char *spec)
+{
+	char *sep;
+	long cpus;
+	int i;
+
+	sep = strchr(spec, ':');
+	if (sep)
+		*sep++ = '\0';
+
+	for (i = 0; i < OPENCL_CORUN_COUNT; i++) {
+		if (!strcmp(spec, corun_names[i]))
+			break;
+	}
+	if (i == OPENCL_CORUN_COUNT)
+		return -EINVAL;
+	corun.kind = i;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	corun.threads = cpus > 1 ? cpus - 1 : 1;
+	corun.rate = 0;
+
+	if (sep && sscanf(sep, "%u:%u", &corun.threads, &corun.rate) < 1)
+		return -EINVAL;
+	if (!corun.threads)
+		return -EINVAL;
+
+	corun.enabled = true;
+	return 0;
+}
+
+bool
+opencl_corun_enabled(void)
+{
+	return corun.enabled;
+}
+
+static uint64_t
+corun_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+/* Touch one chunk worth of memory, return the position to continue from */
+static uint64_t
+corun_chunk(struct corun_thread *t, uint64_t pos)
+{
+	uint64_t *buf = t->buf;
+	uint64_t sink = t->sink;
+	unsigned int i;
+
+	switch (corun.kind) {
+	case OPENCL_CORUN_READ:
+		for (i = 0; i < CORUN_CHUNK / sizeof(uint64_t); i++)
+			sink += buf[pos++ & (CORUN_WORDS - 1)];
+		break;
+	case OPENCL_CORUN_WRITE:
+		for (i = 0; i < CORUN_CHUNK / sizeof(uint64_t); i++, pos++)
+			buf[pos & (CORUN_WORDS - 1)] = pos;
+		break;
+	case OPENCL_CORUN_RANDOM:
+		/* One word per cache line, counted as a full line */
+		for (i = 0; i < CORUN_CHUNK / CORUN_LINE; i++) {
+			pos = pos * CORUN_LCG_MUL + CORUN_LCG_ADD;
+			sink += buf[((pos >> 32) * (CORUN_LINE /
+					sizeof(uint64_t))) & (CORUN_WORDS - 1)];
+		}
+		break;
+	case OPENCL_CORUN_THRASH:
+		for (i = 0; i < CORUN_CHUNK / CORUN_LINE; i++, pos++)
+			sink += buf[(pos * (CORUN_THRASH_STRIDE /
+					sizeof(uint64_t))) & (CORUN_WORDS - 1)];
+		break;
+	default:
+		break;
+	}
+
+	t->sink = sink;
+	return pos;
+}
+
+static void *
+corun_worker(void *arg)
+{
+	struct corun_thread *t = arg;
+	struct timespec ts;
+	uint64_t t_start, due, elapsed, pos = t->seed;
+
+	/* Fault the working set in before the measurement starts */
+	memset(t->buf, t->seed, CORUN_BUF_SIZE);
+
+	pthread_mutex_lock(&corun.lock);
+	corun.running++;
+	pthread_cond_broadcast(&corun.cond);
+	pthread_mutex_unlock(&corun.lock);
+
+	t_start = corun_time_ns();
+	while (!corun.stop) {
+		pos = corun_chunk(t, pos);
+		t->bytes += CORUN_CHUNK;
+
+		if (!corun.rate)
+			continue;
+
+		/* MB/s equals bytes per us */
+		due = (t->bytes * 1000ul) / corun.rate;
+		elapsed = corun_time_ns() - t_start;
+		if (due > elapsed) {
+			ts.tv_sec = (due - elapsed) / 1000000000ul;
+			ts.tv_nsec = (due - elapsed) % 1000000000ul;
+			nanosleep(&ts, NULL);
+		}
+	}
+	t->ns = corun_time_ns() - t_start;
+
+	return NULL;
+}
+
+/* Start n co-runners, returns the number that started */
+static unsigned int
+corun_start(struct corun_thread *threads, unsigned int n)
+{
+	unsigned int i;
+
+	corun.stop = false;
+	corun.running = 0;
+
+	for (i = 0; i < n; i++) {
+		threads[i].bytes = 0;
+		threads[i].ns = 0;
+		threads[i].sink = 0;
+		threads[i].seed = i + 1;
+		threads[i].buf = malloc(CORUN_BUF_SIZE);
+		if (!threads[i].buf) {
+			fprintf(stderr, "Co-run: could not allocate working "
+					"set\n");
+			break;
+		}
+
+		if (pthread_create(&threads[i].thread, NULL, corun_worker,
+				&threads[i])) {
+			fprintf(stderr, "Co-run: could not start thread\n");
+			free(threads[i].buf);
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&corun.lock);
+	while (corun.running < i)
+		pthread_cond_wait(&corun.cond, &corun.lock);
+	pthread_mutex_unlock(&corun.lock);
+
+	return i;
+}
+
+/* Stop n co-runners, returns their combined bandwidth in MB/s */
+static double
+corun_stop(struct corun_thread *threads, unsigned int n)
+{
+	double mbps = 0.;
+	unsigned int i;
+
+	corun.stop = true;
+	for (i = 0; i < n; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].ns)
+			mbps += threads[i].bytes * 1e3 / threads[i].ns;
+		free(threads[i].buf);
+	}
+
+	return mbps;
+}
+
+void
+opencl_corun_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local)
+{
+	struct corun_thread *threads;
+	char name[CORUN_NAME_MAX];
+	cl_ulong start, end, t_sum, t_max, t_base = 0;
+	cl_event event;
+	cl_int error = CL_SUCCESS;
+	uint64_t t_step;
+	double mbps;
+	unsigned int i, n, started, iterations;
+
+	if (!opencl_corun_enabled())
+		return;
+
+	if (clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS)
+		snprintf(name, sizeof(name), "kernel");
+
+	threads = calloc(corun.threads, sizeof(struct corun_thread));
+	if (!threads) {
+		fprintf(stderr, "Co-run: could not allocate threads\n");
+		return;
+	}
+
+	iterations = opencl_get_iterations();
+	if (!iterations)
+		iterations = 1;
+
+	printf("Co-run %s: %s", name, corun_names[corun.kind]);
+	if (corun.rate)
+		printf(", %u MB/s per thread", corun.rate);
+	printf("\n  %7s %10s %8s %12s %12s %9s\n", "threads", "MB/s",
+			"launches", "mean (us)", "max (us)", "slowdown");
+
+	for (n = 0; n <= corun.threads; n++) {
+		clFinish(q);
+		started = corun_start(threads, n);
+
+		t_sum = 0;
+		t_max = 0;
+		t_step = corun_time_ns();
+		for (i = 0; i < iterations ||
+		     corun_time_ns() - t_step < CORUN_STEP_NS; i++) {
+			error = clEnqueueNDRangeKernel(q, kernel, dim, offset,
+					global, local, 0, NULL, &event);
+			if (error != CL_SUCCESS)
+				break;
+
+			error = clWaitForEvents(1, &event);
+			if (error == CL_SUCCESS)
+				error = clGetEventProfilingInfo(event,
+						CL_PROFILING_COMMAND_START,
+						sizeof(cl_ulong), &start, NULL);
+			if (error == CL_SUCCESS)
+				error = clGetEventProfilingInfo(event,
+						CL_PROFILING_COMMAND_END,
+						sizeof(cl_ulong), &end, NULL);
+			clReleaseEvent(event);
+			if (error != CL_SUCCESS)
+				break;
+
+			t_sum += end - start;
+			if (end - start > t_max)
+				t_max = end - start;
+		}
+		mbps = corun_stop(threads, started);
+
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Co-run %s: measurement failed with %u "
+					"threads: %d\n", name, n, error);
+			break;
+		}
+
+		if (started < n) {
+			printf("  Only %u of %u co-runners started\n", started,
+					n);
+			break;
+		}
+
+		t_sum /= i;
+		if (n == 0)
+			t_base = t_sum;
+
+		printf("  %7u %10.1f %8u %12.3f %12.3f %8.2fx\n", n, mbps, i,
+				t_sum * 1e-3, t_max * 1e-3,
+				t_base ? (double) t_sum / t_base : 0.);
+	}
+
+	free(threads);
+}
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lib/dataset.h"
+#include "lib/csv.h"
+
+enum dataset_type {
+	DATASET_BIN,
+	DATASET_CSV_FLOAT,
+	DATASET_CSV_FLOAT_N,
+};
+
+struct dataset {
+	enum dataset_type type;
+	char *file;
+	size_t n;
+	void *buf;
+	int64_t result;
+
+	pthread_t thread;
+	bool done;
+	bool joined;
+	uint64_t t_load;
+
+	struct dataset *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct dataset *pending;
+
+	unsigned int loaded;
+	uint64_t t_load;
+	uint64_t t_blocked;
+} loader = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.pending = NULL,
+	.loaded = 0,
+	.t_load = 0ul,
+	.t_blocked = 0ul,
+};
+
+static uint64_t
+dataset_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+static void *
+dataset_worker(void *arg)
+{
+	struct dataset *ds = arg;
+	uint64_t t_start;
+
+	t_start = dataset_time_ns();
+
+	switch (ds->type) {
+	case DATASET_BIN:
+		ds->result = bin_file_read(ds->file, ds->n, (void **) ds->buf);
+		break;
+	case DATASET_CSV_FLOAT:
+		ds->result = csv_file_read_float(ds->file, (float **) ds->buf);
+		break;
+	case DATASET_CSV_FLOAT_N:
+		ds->result = csv_file_read_float_n(ds->file, ds->n,
+				(float ***) ds->buf);
+		break;
+	}
+
+	pthread_mutex_lock(&loader.lock);
+	ds->t_load = dataset_time_ns() - t_start;
+	ds->done = true;
+	pthread_cond_broadcast(&loader.cond);
+	pthread_mutex_unlock(&loader.lock);
+
+	return NULL;
+}
+
+static struct dataset *
+dataset_load(enum dataset_type type, char *file, size_t n, void *buf)
+{
+	struct dataset *ds;
+
+	ds = calloc(1, sizeof(struct dataset));
+	if (!ds) {
+		fprintf(stderr, "Could not allocate dataset handle\n");
+		return NULL;
+	}
+
+	ds->type = type;
+	ds->file = file;
+	ds->n = n;
+	ds->buf = buf;
+
+	pthread_mutex_lock(&loader.lock);
+	if (pthread_create(&ds->thread, NULL, dataset_worker, ds)) {
+		pthread_mutex_unlock(&loader.lock);
+		fprintf(stderr, "Could not start loader for %s\n", file);
+		free(ds);
+		return NULL;
+	}
+	ds->next = loader.pending;
+	loader.pending = ds;
+	pthread_mutex_unlock(&loader.lock);
+
+	return ds;
+}
+
+struct dataset *
+dataset_load_bin(char *file, size_t n, void **buf)
+{
+	return dataset_load(DATASET_BIN, file, n, buf);
+}
+
+struct dataset *
+dataset_load_csv_float(char *file, float **buf)
+{
+	return dataset_load(DATASET_CSV_FLOAT, file, 0, buf);
+}
+
+struct dataset *
+dataset_load_csv_float_n(char *file, int n, float ***buf)
+{
+	return dataset_load(DATASET_CSV_FLOAT_N, file, n, buf);
+}
+
+int64_t
+dataset_wait(struct dataset *ds)
+{
+	struct dataset **p;
+	uint64_t t_start;
+	int64_t result;
+
+	if (!ds)
+		return -1;
+
+	t_start = dataset_time_ns();
+
+	pthread_mutex_lock(&loader.lock);
+	while (!ds->done)
+		pthread_cond_wait(&loader.cond, &loader.lock);
+
+	for (p = &loader.pending; *p; p = &(*p)->next) {
+		if (*p == ds) {
+			*p = ds->next;
+			break;
+		}
+	}
+
+	loader.loaded++;
+	loader.t_load += ds->t_load;
+	loader.t_blocked += dataset_time_ns() - t_start;
+	pthread_mutex_unlock(&loader.lock);
+
+	if (!ds->joined)
+		pthread_join(ds->thread, NULL);
+	result = ds->result;
+	free(ds);
+
+	return result;
+}
+
+void
+dataset_quiesce(void)
+{
+	struct dataset *ds;
+
+	pthread_mutex_lock(&loader.lock);
+	for (ds = loader.pending; ds; ds = ds->next) {
+		while (!ds->done)
+			pthread_cond_wait(&loader.cond, &loader.lock);
+
+		/* Reap the worker, such that the process can safely fork */
+		if (!ds->joined) {
+			pthread_join(ds->thread, NULL);
+			ds->joined = true;
+		}
+	}
+	pthread_mutex_unlock(&loader.lock);
+}
+
+void
+dataset_report(void)
+{
+	uint64_t saved = 0ul;
+
+	pthread_mutex_lock(&loader.lock);
+	if (loader.t_load > loader.t_blocked)
+		saved = loader.t_load - loader.t_blocked;
+
+	printf("Loaded %u datasets in %"PRIu64" us, blocked for %"PRIu64" us, "
+			"startup time saved: %"PRIu64" us\n", loader.loaded,
+			loader.t_load / 1000, loader.t_blocked / 1000,
+			saved / 1000);
+	pthread_mutex_unlock(&loader.lock);
+}
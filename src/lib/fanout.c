@@ -0,0 +1,514 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "lib/opencl.h"
+#include "lib/dataset.h"
+#include "lib/mem.h"
+#include "lib/cold.h"
+#include "lib/fanout.h"
+
+/* Kernels whose mean execution time is reported */
+#define FANOUT_KERNELS_MAX 8
+#define FANOUT_NAME_MAX 48
+
+struct fanout_kernel {
+	char name[FANOUT_NAME_MAX];
+	double mean;
+};
+
+/* Sent from child to parent over a pipe upon exit, small enough to be
+ * written atomically */
+struct fanout_result {
+	cl_ulong t_exec;
+	unsigned int kernels;
+	bool compared;
+	double err_abs;
+	double err_rel;
+	size_t mem_peak;
+	unsigned int mem_allocs;
+	unsigned int n_kernels;
+	struct fanout_kernel kernel[FANOUT_KERNELS_MAX];
+};
+
+struct fanout_variant {
+	struct fanout_result res;
+	bool reported;
+	int status;
+
+	pid_t pid;
+	int fd;
+	/* Read end of the ready pipe of a concurrent child */
+	int ready;
+};
+
+static int fanout_fd = -1;
+/* Start barrier of concurrent children, see fanout_barrier */
+static int fanout_ready_fd = -1;
+static int fanout_go_fd = -1;
+
+static void
+fanout_child_report(void)
+{
+	struct fanout_result res;
+	const char *name;
+
+	memset(&res, 0, sizeof(res));
+	res.t_exec = opencl_total_exec_time(&res.kernels);
+	res.compared = opencl_max_error(&res.err_abs, &res.err_rel);
+	res.mem_peak = opencl_mem_peak(&res.mem_allocs);
+
+	while (res.n_kernels < FANOUT_KERNELS_MAX &&
+	       opencl_cold_kernel_time(res.n_kernels, &name,
+			&res.kernel[res.n_kernels].mean)) {
+		snprintf(res.kernel[res.n_kernels].name, FANOUT_NAME_MAX, "%s",
+				name);
+		res.n_kernels++;
+	}
+
+	if (write(fanout_fd, &res, sizeof(res)) != sizeof(res))
+		fprintf(stderr, "Could not report results to parent\n");
+	close(fanout_fd);
+}
+
+/* Fork a child for a variant. Returns 0 in the child, the child's pid in the
+ * parent. */
+static pid_t
+fanout_spawn(struct fanout_variant *var)
+{
+	int fds[2];
+
+	if (pipe(fds)) {
+		perror("Could not create pipe");
+		exit(-1);
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	var->pid = fork();
+	if (var->pid < 0) {
+		perror("Could not fork");
+		exit(-1);
+	}
+
+	if (var->pid == 0) {
+		close(fds[0]);
+		fanout_fd = fds[1];
+		atexit(fanout_child_report);
+		return 0;
+	}
+
+	close(fds[1]);
+	var->fd = fds[0];
+
+	return var->pid;
+}
+
+/* Wait for a child to exit and collect its results. Returns 0 if the child
+ * exited successfully. */
+static int
+fanout_collect(struct fanout_variant *var)
+{
+	var->reported = (read(var->fd, &var->res,
+			sizeof(struct fanout_result)) ==
+			sizeof(struct fanout_result));
+	close(var->fd);
+
+	waitpid(var->pid, &var->status, 0);
+	if (!WIFEXITED(var->status) || WEXITSTATUS(var->status))
+		return -1;
+
+	return 0;
+}
+
+void
+fanout_barrier(void)
+{
+	char c = 0;
+
+	if (fanout_ready_fd < 0)
+		return;
+
+	if (write(fanout_ready_fd, &c, 1) != 1)
+		fprintf(stderr, "Could not signal parent\n");
+	close(fanout_ready_fd);
+	fanout_ready_fd = -1;
+
+	/* The parent closes the write end once every child is ready */
+	while (read(fanout_go_fd, &c, 1) > 0)
+		;
+	close(fanout_go_fd);
+	fanout_go_fd = -1;
+}
+
+static void
+fanout_print_status(int status)
+{
+	char buf[16];
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		snprintf(buf, sizeof(buf), "ok");
+	else if (WIFEXITED(status))
+		snprintf(buf, sizeof(buf), "exit %i", WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		snprintf(buf, sizeof(buf), "signal %i", WTERMSIG(status));
+	else
+		snprintf(buf, sizeof(buf), "unknown");
+
+	printf(" %-10s", buf);
+}
+
+/* Kernel runs per second */
+static double
+fanout_throughput(struct fanout_variant *var)
+{
+	if (!var->reported || !var->res.t_exec)
+		return 0.;
+
+	return (var->res.kernels * 1e9) / var->res.t_exec;
+}
+
+static void
+fanout_summary(const char *title, unsigned int variants, const char **labels,
+		struct fanout_variant *var)
+{
+	unsigned int v;
+
+	printf("\n%-10s %-10s %8s %18s %12s %12s %12s %10s %7s\n", title,
+			"Status", "Kernels", "Kernel time (ns)", "Kernels/s",
+			"Max abs err", "Max rel err", "Peak MiB", "Allocs");
+
+	for (v = 0; v < variants; v++) {
+		printf("%-10s", labels[v]);
+		fanout_print_status(var[v].status);
+
+		if (!var[v].reported) {
+			printf(" %8s %18s %12s %12s %12s %10s %7s\n", "-",
+					"-", "-", "-", "-", "-", "-");
+			continue;
+		}
+
+		printf(" %8u %18lu %12.1f", var[v].res.kernels,
+				var[v].res.t_exec, fanout_throughput(&var[v]));
+		if (var[v].res.compared)
+			printf(" %12g %12g", var[v].res.err_abs,
+					var[v].res.err_rel);
+		else
+			printf(" %12s %12s", "-", "-");
+		printf(" %10.2f %7u\n",
+				var[v].res.mem_peak / (1024. * 1024.),
+				var[v].res.mem_allocs);
+	}
+}
+
+static void
+fanout_summary_scaling(const char *title, unsigned int variants,
+		const char **labels, struct fanout_variant *iso,
+		struct fanout_variant *con)
+{
+	unsigned int v;
+	double tp_iso, tp_con;
+	double sum_iso = 0., sum_con = 0.;
+
+	printf("\n%-10s %-10s %-10s %14s %14s %10s\n", title, "Isolated",
+			"Concurrent", "Isolated k/s", "Concurrent k/s",
+			"Efficiency");
+
+	for (v = 0; v < variants; v++) {
+		tp_iso = fanout_throughput(&iso[v]);
+		tp_con = fanout_throughput(&con[v]);
+		sum_iso += tp_iso;
+		sum_con += tp_con;
+
+		printf("%-10s", labels[v]);
+		fanout_print_status(iso[v].status);
+		fanout_print_status(con[v].status);
+		printf(" %14.1f %14.1f", tp_iso, tp_con);
+		if (tp_iso > 0.)
+			printf(" %9.1f%%\n", (tp_con * 100.) / tp_iso);
+		else
+			printf(" %10s\n", "-");
+	}
+
+	if (sum_iso > 0.)
+		printf("Aggregate: %.1f kernels/s isolated, %.1f kernels/s "
+				"concurrent, scaling efficiency %.1f%%\n",
+				sum_iso, sum_con, (sum_con * 100.) / sum_iso);
+}
+
+/* Mean time of a kernel in a variant, negative if it did not run */
+static double
+fanout_kernel_mean(struct fanout_variant *var, const char *name)
+{
+	unsigned int k;
+
+	if (!var->reported || !WIFEXITED(var->status) ||
+	    WEXITSTATUS(var->status))
+		return -1.;
+
+	for (k = 0; k < var->res.n_kernels; k++) {
+		if (!strcmp(var->res.kernel[k].name, name))
+			return var->res.kernel[k].mean;
+	}
+
+	return -1.;
+}
+
+/* Whether variant a is at least as fast and as accurate as b, and strictly
+ * better in one of the two */
+static bool
+fanout_dominates(double t_a, double err_a, double t_b, double err_b)
+{
+	return t_a <= t_b && err_a <= err_b && (t_a < t_b || err_a < err_b);
+}
+
+static void
+fanout_summary_pareto(unsigned int variants, const char **labels,
+		const char **descs, struct fanout_variant *var)
+{
+	const char *name;
+	double t_u, t_w, err_u, err_w;
+	unsigned int u, v, w, k, n;
+	bool compared = false, dominated;
+
+	for (v = 0; v < variants; v++)
+		compared |= var[v].reported && var[v].res.compared;
+	if (!compared)
+		printf("\nOutputs were not compared (-c), Pareto fronts only "
+				"consider kernel time\n");
+
+	for (v = 0; v < variants; v++) {
+		for (k = 0; var[v].reported && k < var[v].res.n_kernels; k++) {
+			name = var[v].res.kernel[k].name;
+
+			/* Each kernel once, at the first variant running it */
+			for (w = 0; w < v; w++) {
+				if (fanout_kernel_mean(&var[w], name) >= 0.)
+					break;
+			}
+			if (w < v || fanout_kernel_mean(&var[v], name) < 0.)
+				continue;
+
+			printf("\nPareto front %s:\n%-10s %14s %12s  %s\n",
+					name, "Variant", "Mean (us)",
+					"Max rel err", "Options");
+
+			n = 0;
+			for (w = 0; w < variants; w++) {
+				t_w = fanout_kernel_mean(&var[w], name);
+				if (t_w < 0.)
+					continue;
+				err_w = var[w].res.compared ?
+						var[w].res.err_rel : 0.;
+
+				dominated = false;
+				for (u = 0; u < variants && !dominated; u++) {
+					t_u = fanout_kernel_mean(&var[u], name);
+					err_u = var[u].res.compared ?
+							var[u].res.err_rel : 0.;
+					dominated = t_u >= 0. &&
+						fanout_dominates(t_u, err_u,
+							t_w, err_w);
+				}
+				if (dominated)
+					continue;
+
+				printf("%-10s %14.3f", labels[w], t_w * 1e-3);
+				if (var[w].res.compared)
+					printf(" %12g", err_w);
+				else
+					printf(" %12s", "-");
+				printf("  %s\n", descs[w]);
+				n++;
+			}
+			printf("%u of %u variants on the front\n", n,
+					variants);
+		}
+	}
+}
+
+static struct fanout_variant *
+fanout_alloc(unsigned int variants)
+{
+	struct fanout_variant *var;
+
+	var = calloc(variants, sizeof(struct fanout_variant));
+	if (!var) {
+		fprintf(stderr, "Could not allocate fanout results\n");
+		exit(-1);
+	}
+
+	return var;
+}
+
+void
+fanout_run(const char *title, unsigned int variants, const char **labels,
+		void (*setup)(unsigned int variant))
+{
+	struct fanout_variant *var;
+	unsigned int v;
+	int failed = 0;
+
+	var = fanout_alloc(variants);
+
+	/* Loader threads don't survive fork() */
+	dataset_quiesce();
+
+	for (v = 0; v < variants; v++) {
+		printf("=== %s: %s ===\n", title, labels[v]);
+
+		if (fanout_spawn(&var[v]) == 0) {
+			free(var);
+			setup(v);
+			return;
+		}
+
+		failed |= fanout_collect(&var[v]);
+	}
+
+	fanout_summary(title, variants, labels, var);
+	free(var);
+
+	exit(failed ? -1 : 0);
+}
+
+void
+fanout_run_scaling(const char *title, unsigned int variants,
+		const char **labels, void (*setup)(unsigned int variant))
+{
+	struct fanout_variant *iso, *con;
+	unsigned int v;
+	int go[2], ready[2];
+	int failed = 0;
+	char c;
+
+	iso = fanout_alloc(variants);
+	con = fanout_alloc(variants);
+
+	dataset_quiesce();
+
+	/* Baseline: every variant on its own */
+	for (v = 0; v < variants; v++) {
+		printf("=== %s: %s (isolated) ===\n", title, labels[v]);
+
+		if (fanout_spawn(&iso[v]) == 0) {
+			free(iso);
+			free(con);
+			setup(v);
+			return;
+		}
+
+		failed |= fanout_collect(&iso[v]);
+	}
+
+	/* Then all of them at once. Children set up their context, programs
+	 * and data in their own time, and wait for each other before the
+	 * first kernel launch such that the kernel phases overlap */
+	printf("=== %s: all (concurrent) ===\n", title);
+	if (pipe(go)) {
+		perror("Could not create pipe");
+		exit(-1);
+	}
+
+	for (v = 0; v < variants; v++) {
+		if (pipe(ready)) {
+			perror("Could not create pipe");
+			exit(-1);
+		}
+
+		if (fanout_spawn(&con[v]) == 0) {
+			close(go[1]);
+			close(ready[0]);
+			fanout_go_fd = go[0];
+			fanout_ready_fd = ready[1];
+			free(iso);
+			free(con);
+			setup(v);
+			return;
+		}
+
+		close(ready[1]);
+		con[v].ready = ready[0];
+	}
+	close(go[0]);
+
+	/* A child that exits before its first launch closes its pipe too */
+	for (v = 0; v < variants; v++) {
+		while (read(con[v].ready, &c, 1) < 0 && errno == EINTR)
+			;
+		close(con[v].ready);
+	}
+	close(go[1]);
+
+	for (v = 0; v < variants; v++)
+		failed |= fanout_collect(&con[v]);
+
+	fanout_summary(title, variants, labels, con);
+	fanout_summary_scaling(title, variants, labels, iso, con);
+	free(iso);
+	free(con);
+
+	exit(failed ? -1 : 0);
+}
+
+void
+fanout_run_pareto(const char *title, unsigned int variants,
+		const char **labels, const char **descs,
+		void (*setup)(unsigned int variant))
+{
+	struct fanout_variant *var;
+	unsigned int v;
+	int failed = 0;
+
+	var = fanout_alloc(variants);
+
+	dataset_quiesce();
+
+	for (v = 0; v < variants; v++) {
+		printf("=== %s: %s (%s) ===\n", title, labels[v], descs[v]);
+
+		if (fanout_spawn(&var[v]) == 0) {
+			free(var);
+			setup(v);
+			return;
+		}
+
+		failed |= fanout_collect(&var[v]);
+	}
+
+	fanout_summary(title, variants, labels, var);
+	fanout_summary_pareto(variants, labels, descs, var);
+	free(var);
+
+	exit(failed ? -1 : 0);
+}
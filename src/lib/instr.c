@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "lib/instr.h"
+
+#if defined(CLAXON_INSTRUMENT)
+
+#define INSTR_MAX_COUNTERS 16
+/* Power-of-two histogram buckets: 0, 1, 2-3, 4-7, ..., 2^30 and up */
+#define INSTR_BUCKETS 32
+
+struct instr {
+	const char *kernel;
+	char *names;
+	const char *name[INSTR_MAX_COUNTERS];
+	unsigned int counters;
+	size_t items;
+
+	cl_mem buf;
+};
+
+struct instr *
+instr_create(cl_context ctx, const char *kernel, const char *counters,
+		size_t items)
+{
+	struct instr *in;
+	cl_int error;
+	char *c;
+
+	in = calloc(1, sizeof(struct instr));
+	if (!in) {
+		fprintf(stderr, "Could not allocate instrumentation\n");
+		return NULL;
+	}
+
+	in->kernel = kernel;
+	in->items = items;
+	in->names = strdup(counters);
+	if (!in->names) {
+		fprintf(stderr, "Could not allocate instrumentation\n");
+		goto error;
+	}
+
+	for (c = strtok(in->names, ","); c; c = strtok(NULL, ",")) {
+		if (in->counters == INSTR_MAX_COUNTERS) {
+			fprintf(stderr, "Too many counters for %s\n", kernel);
+			goto error;
+		}
+		in->name[in->counters++] = c;
+	}
+
+	in->buf = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			(1 + in->counters * items) * sizeof(cl_uint), NULL,
+			&error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create instrumentation buffer\n");
+		in->buf = NULL;
+		goto error;
+	}
+
+	return in;
+
+error:
+	instr_release(in);
+	return NULL;
+}
+
+cl_int
+instr_set_arg(struct instr *in, cl_command_queue q, cl_kernel k,
+		cl_uint arg)
+{
+	const cl_uint zero = 0;
+	cl_int error;
+
+	if (!in)
+		return CL_INVALID_MEM_OBJECT;
+
+	error = clEnqueueFillBuffer(q, in->buf, &zero, sizeof(cl_uint), 0,
+			(1 + in->counters * in->items) * sizeof(cl_uint), 0,
+			NULL, NULL);
+	if (error != CL_SUCCESS)
+		return error;
+
+	return clSetKernelArg(k, arg, sizeof(cl_mem), &in->buf);
+}
+
+static unsigned int
+instr_bucket(uint64_t v)
+{
+	unsigned int b = 0;
+
+	while (v && b < INSTR_BUCKETS - 1) {
+		v >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+static void
+instr_report_counter(struct instr *in, const char *name, cl_uint *ctr,
+		size_t wg_size, unsigned int launches)
+{
+	uint64_t hist[INSTR_BUCKETS] = {0};
+	uint64_t sum = 0, max = 0, busy = 0, spread = 0;
+	uint64_t g_min, g_max, v;
+	size_t groups = 0;
+	size_t i, g, n;
+	unsigned int b;
+
+	for (g = 0; g < in->items; g += wg_size) {
+		n = in->items - g < wg_size ? in->items - g : wg_size;
+		g_min = UINT64_MAX;
+		g_max = 0;
+
+		for (i = g; i < g + n; i++) {
+			v = ctr[i];
+			sum += v;
+			hist[instr_bucket(v / launches)]++;
+			if (v < g_min)
+				g_min = v;
+			if (v > g_max)
+				g_max = v;
+		}
+
+		if (g_max > max)
+			max = g_max;
+		spread += g_max - g_min;
+		busy += g_max * n;
+		groups++;
+	}
+
+	/* SIMD efficiency: the fraction of lock-stepped work-item iterations
+	 * that counted an event, assuming each work-group runs until its
+	 * busiest work-item is done */
+	printf("  %-16s %12.2f %10.2f %10.2f %7.1f%%\n", name,
+			(double) sum / in->items / launches,
+			(double) max / launches,
+			(double) spread / groups / launches,
+			busy ? 100. * sum / busy : 100.);
+
+	printf("  %-16s", "");
+	for (b = 0; b < INSTR_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+
+		if (b < 2)
+			printf(" [%u]", b);
+		else
+			printf(" [%"PRIu64"-%"PRIu64"]",
+					(uint64_t) 1 << (b - 1),
+					((uint64_t) 1 << b) - 1);
+		printf(" %.1f%%", 100. * hist[b] / in->items);
+	}
+	printf("\n");
+}
+
+void
+instr_report(struct instr *in, cl_command_queue q, unsigned int launches)
+{
+	cl_uint *ctr;
+	size_t wg_size;
+	cl_int error;
+	unsigned int c;
+
+	if (!in || !launches)
+		return;
+
+	ctr = malloc((1 + in->counters * in->items) * sizeof(cl_uint));
+	if (!ctr) {
+		fprintf(stderr, "Could not allocate instrumentation "
+				"readback\n");
+		return;
+	}
+
+	error = clEnqueueReadBuffer(q, in->buf, CL_TRUE, 0,
+			(1 + in->counters * in->items) * sizeof(cl_uint), ctr,
+			0, NULL, NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not read instrumentation counters\n");
+		free(ctr);
+		return;
+	}
+
+	/* Zero if no work-item counted anything */
+	wg_size = ctr[0] ? ctr[0] : 1;
+
+	printf("Instrumentation %s: %zu work-items, work-group size %zu, "
+			"%u launch(es)\n", in->kernel, in->items, wg_size,
+			launches);
+	printf("  %-16s %12s %10s %10s %8s\n", "Counter", "Mean", "Max",
+			"WG spread", "SIMD eff");
+	for (c = 0; c < in->counters; c++)
+		instr_report_counter(in, in->name[c],
+				&ctr[1 + c * in->items], wg_size, launches);
+
+	free(ctr);
+}
+
+void
+instr_release(struct instr *in)
+{
+	if (!in)
+		return;
+
+	if (in->buf)
+		opencl_release_buffer(in->buf);
+	free(in->names);
+	free(in);
+}
+
+#endif /* CLAXON_INSTRUMENT */
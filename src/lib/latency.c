@@ -0,0 +1,459 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* pthread_setaffinity_np */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "lib/latency.h"
+
+#define LATENCY_NAME_MAX 128
+
+/* Log-linear histogram: values below 2 * LATENCY_SUB are exact, above that
+ * each power of two is split into LATENCY_SUB buckets. */
+#define LATENCY_SUB_BITS 7
+#define LATENCY_SUB (1u << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+/* Number of outlier runs listed by number */
+#define LATENCY_OUTLIERS_MAX 8
+
+struct latency_hist {
+	const char *metric;
+	uint64_t *count;
+	uint64_t n;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+	double sumsq;
+};
+
+/** Scheduling state of the measuring thread, restored afterwards */
+struct latency_sched {
+	bool pinned;
+	cpu_set_t cpus;
+	bool fifo;
+	int policy;
+	struct sched_param param;
+};
+
+static struct {
+	unsigned int runs;
+	const char *csv_file;
+	FILE *csv;
+	int cpu;
+	bool fifo;
+} latency = {
+	.runs = 0,
+	.csv_file = NULL,
+	.csv = NULL,
+	.cpu = -1,
+	.fifo = false,
+};
+
+void
+opencl_latency_enable(unsigned int runs, const char *csv)
+{
+	latency.runs = runs;
+	latency.csv_file = csv;
+}
+
+void
+opencl_latency_pin(int cpu)
+{
+	latency.cpu = cpu;
+}
+
+void
+opencl_latency_fifo(void)
+{
+	latency.fifo = true;
+}
+
+bool
+opencl_latency_enabled(void)
+{
+	return latency.runs > 0;
+}
+
+static uint64_t
+latency_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+static unsigned int
+latency_bucket(uint64_t v)
+{
+	unsigned int shift;
+
+	if (v < 2 * LATENCY_SUB)
+		return v;
+
+	shift = 63 - __builtin_clzll(v) - LATENCY_SUB_BITS;
+	return shift * LATENCY_SUB + (v >> shift);
+}
+
+/* Lowest value and width of a bucket */
+static uint64_t
+latency_bucket_low(unsigned int b, uint64_t *width)
+{
+	unsigned int shift;
+
+	if (b < 2 * LATENCY_SUB) {
+		*width = 1;
+		return b;
+	}
+
+	shift = b / LATENCY_SUB - 1;
+	*width = 1ul << shift;
+	return (uint64_t) (b - shift * LATENCY_SUB) << shift;
+}
+
+static int
+latency_hist_init(struct latency_hist *h, const char *metric)
+{
+	memset(h, 0, sizeof(*h));
+	h->metric = metric;
+	h->min = UINT64_MAX;
+	h->count = calloc(LATENCY_BUCKETS, sizeof(uint64_t));
+
+	return h->count ? 0 : -1;
+}
+
+static void
+latency_hist_add(struct latency_hist *h, uint64_t v)
+{
+	h->count[latency_bucket(v)]++;
+	h->n++;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->sum += v;
+	h->sumsq += (double) v * v;
+}
+
+/* Upper bound of the p-quantile, such that it never under-estimates */
+static uint64_t
+latency_hist_quantile(struct latency_hist *h, double p)
+{
+	uint64_t target, seen = 0, low, width;
+	unsigned int b;
+
+	target = (uint64_t) ceil(p * h->n);
+	if (target == 0)
+		target = 1;
+
+	for (b = 0; b < LATENCY_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen >= target)
+			break;
+	}
+
+	low = latency_bucket_low(b, &width);
+	if (low + width - 1 > h->max)
+		return h->max;
+	return low + width - 1;
+}
+
+static void
+latency_hist_print(struct latency_hist *h)
+{
+	double mean, sd;
+
+	mean = h->sum / h->n;
+	sd = sqrt(fmax(h->sumsq / h->n - mean * mean, 0.));
+
+	printf("  %-8s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f "
+			"%9.3f\n", h->metric, h->min * 1e-3,
+			latency_hist_quantile(h, .5) * 1e-3,
+			latency_hist_quantile(h, .9) * 1e-3,
+			latency_hist_quantile(h, .99) * 1e-3,
+			latency_hist_quantile(h, .999) * 1e-3,
+			latency_hist_quantile(h, .9999) * 1e-3,
+			h->max * 1e-3, (h->max - h->min) * 1e-3, sd * 1e-3);
+}
+
+static void
+latency_hist_export(struct latency_hist *h, const char *name)
+{
+	uint64_t low, width;
+	unsigned int b;
+
+	if (!latency.csv && latency.csv_file) {
+		latency.csv = fopen(latency.csv_file, "w");
+		if (!latency.csv) {
+			fprintf(stderr, "Could not open %s for writing\n",
+					latency.csv_file);
+			latency.csv_file = NULL;
+			return;
+		}
+		fprintf(latency.csv, "kernel,metric,low_ns,high_ns,count\n");
+	}
+
+	if (!latency.csv)
+		return;
+
+	for (b = 0; b < LATENCY_BUCKETS; b++) {
+		if (!h->count[b])
+			continue;
+
+		low = latency_bucket_low(b, &width);
+		fprintf(latency.csv, "%s,%s,%"PRIu64",%"PRIu64",%"PRIu64"\n",
+				name, h->metric, low, low + width - 1,
+				h->count[b]);
+	}
+}
+
+static void
+latency_sched_enter(struct latency_sched *s)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int ret;
+
+	s->pinned = false;
+	s->fifo = false;
+
+	if (latency.cpu >= 0 &&
+	    !pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t),
+			&s->cpus)) {
+		CPU_ZERO(&cpus);
+		CPU_SET(latency.cpu, &cpus);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				&cpus);
+		if (ret)
+			fprintf(stderr, "Latency: could not pin to CPU %d: "
+					"%s\n", latency.cpu, strerror(ret));
+		else
+			s->pinned = true;
+	}
+
+	if (latency.fifo &&
+	    !pthread_getschedparam(pthread_self(), &s->policy, &s->param)) {
+		param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+				&param);
+		if (ret)
+			fprintf(stderr, "Latency: could not enable SCHED_FIFO: "
+					"%s\n", strerror(ret));
+		else
+			s->fifo = true;
+	}
+}
+
+static void
+latency_sched_leave(struct latency_sched *s)
+{
+	if (s->fifo)
+		pthread_setschedparam(pthread_self(), s->policy, &s->param);
+	if (s->pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				&s->cpus);
+}
+
+static cl_int
+latency_exec_time(cl_event event, uint64_t *time)
+{
+	cl_ulong start, end;
+	cl_int error;
+
+	error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+			sizeof(cl_ulong), &start, NULL);
+	if (error == CL_SUCCESS)
+		error = clGetEventProfilingInfo(event,
+				CL_PROFILING_COMMAND_END, sizeof(cl_ulong),
+				&end, NULL);
+	if (error == CL_SUCCESS)
+		*time = end > start ? end - start : 0;
+
+	return error;
+}
+
+static int
+latency_cmp(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a, vb = *(const uint64_t *) b;
+
+	return (va > vb) - (va < vb);
+}
+
+static void
+latency_outliers(struct latency_hist *h, const uint64_t *samples)
+{
+	uint64_t q1, q3, fence, outliers = 0;
+	uint64_t *sorted;
+	unsigned int i;
+
+	/* Exact quartiles, the histogram buckets are too coarse for tight
+	 * distributions */
+	sorted = malloc(h->n * sizeof(uint64_t));
+	if (!sorted) {
+		fprintf(stderr, "Latency: could not allocate samples\n");
+		return;
+	}
+	memcpy(sorted, samples, h->n * sizeof(uint64_t));
+	qsort(sorted, h->n, sizeof(uint64_t), latency_cmp);
+	q1 = sorted[h->n / 4];
+	q3 = sorted[(3 * h->n) / 4];
+	fence = q3 + 3 * (q3 - q1);
+	free(sorted);
+
+	/* Don't flag differences below the histogram resolution */
+	if (fence < q3 + q3 / LATENCY_SUB)
+		fence = q3 + q3 / LATENCY_SUB;
+
+	for (i = 0; i < h->n; i++) {
+		if (samples[i] > fence)
+			outliers++;
+	}
+
+	if (!outliers) {
+		printf("  No outliers above %.3f us (Q3 + 3 IQR)\n",
+				fence * 1e-3);
+		return;
+	}
+
+	printf("  %"PRIu64" outliers above %.3f us (Q3 + 3 IQR), runs:",
+			outliers, fence * 1e-3);
+	for (i = 0, outliers = 0; i < h->n; i++) {
+		if (samples[i] <= fence)
+			continue;
+		if (outliers++ == LATENCY_OUTLIERS_MAX) {
+			printf(" ...");
+			break;
+		}
+		printf(" %u (%.3f us)", i, samples[i] * 1e-3);
+	}
+	printf("\n");
+}
+
+void
+opencl_latency_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local)
+{
+	struct latency_hist exec = { .count = NULL };
+	struct latency_hist response = { .count = NULL };
+	struct latency_sched sched;
+	char name[LATENCY_NAME_MAX];
+	uint64_t *samples = NULL;
+	uint64_t t_exec, t_resp;
+	cl_event event;
+	cl_int error = CL_SUCCESS;
+	unsigned int n;
+
+	if (!opencl_latency_enabled())
+		return;
+
+	if (clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS)
+		snprintf(name, sizeof(name), "kernel");
+
+	if (latency_hist_init(&exec, "exec") ||
+	    latency_hist_init(&response, "response")) {
+		fprintf(stderr, "Latency: could not allocate histograms\n");
+		goto error;
+	}
+
+	samples = malloc(latency.runs * sizeof(uint64_t));
+	if (!samples) {
+		fprintf(stderr, "Latency: could not allocate samples\n");
+		goto error;
+	}
+
+	clFinish(q);
+	latency_sched_enter(&sched);
+	for (n = 0; n < latency.runs; n++) {
+		t_resp = latency_time_ns();
+		error = clEnqueueNDRangeKernel(q, kernel, dim, offset, global,
+				local, 0, NULL, &event);
+		if (error != CL_SUCCESS)
+			break;
+
+		error = clWaitForEvents(1, &event);
+		t_resp = latency_time_ns() - t_resp;
+		if (error == CL_SUCCESS)
+			error = latency_exec_time(event, &t_exec);
+		clReleaseEvent(event);
+		if (error != CL_SUCCESS)
+			break;
+
+		samples[n] = t_exec;
+		latency_hist_add(&exec, t_exec);
+		latency_hist_add(&response, t_resp);
+	}
+	latency_sched_leave(&sched);
+
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Latency %s: measurement failed after %u runs: "
+				"%d\n", name, n, error);
+		goto error;
+	}
+
+	printf("Latency %s: %u runs", name, n);
+	if (sched.pinned)
+		printf(", CPU %d", latency.cpu);
+	if (sched.fifo)
+		printf(", SCHED_FIFO");
+	printf(" (us)\n");
+	printf("  %-8s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "", "min",
+			"p50", "p90", "p99", "p99.9", "p99.99", "max",
+			"jitter", "stddev");
+	latency_hist_print(&exec);
+	latency_hist_print(&response);
+	latency_outliers(&exec, samples);
+
+	latency_hist_export(&exec, name);
+	latency_hist_export(&response, name);
+
+error:
+	free(samples);
+	free(exec.count);
+	free(response.count);
+}
+
+void
+opencl_latency_report(void)
+{
+	if (!latency.csv)
+		return;
+
+	fclose(latency.csv);
+	latency.csv = NULL;
+	printf("Latency histograms written to %s\n", latency.csv_file);
+}
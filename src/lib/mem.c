@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/mem.h"
+
+#define MEM_STAGES_MAX 32
+
+struct mem_stage {
+	const char *name;
+	unsigned int allocs;
+	size_t allocated;
+	size_t peak;
+};
+
+struct mem_alloc {
+	const void *key;
+	size_t size;
+	unsigned int stage;
+};
+
+static struct {
+	struct mem_alloc *allocs;
+	unsigned int alloc_cnt;
+	unsigned int alloc_max;
+
+	struct mem_stage stages[MEM_STAGES_MAX];
+	unsigned int stage_cnt;
+	unsigned int stage;
+
+	unsigned int total_allocs;
+	size_t live;
+	size_t peak;
+} mem = {
+	.allocs = NULL,
+	.alloc_cnt = 0,
+	.alloc_max = 0,
+	.stages = {
+		[0] = { .name = "main", },
+	},
+	.stage_cnt = 1,
+	.stage = 0,
+	.total_allocs = 0,
+	.live = 0,
+	.peak = 0,
+};
+
+static double
+mem_mib(size_t bytes)
+{
+	return bytes / (1024. * 1024.);
+}
+
+void
+opencl_mem_track(const void *key, size_t size)
+{
+	struct mem_alloc *allocs;
+	struct mem_stage *stage;
+	unsigned int max;
+
+	if (mem.alloc_cnt == mem.alloc_max) {
+		max = mem.alloc_max ? mem.alloc_max * 2 : 64;
+		allocs = realloc(mem.allocs, max * sizeof(struct mem_alloc));
+		if (!allocs) {
+			fprintf(stderr, "Could not grow memory accounting "
+					"table\n");
+			return;
+		}
+		mem.allocs = allocs;
+		mem.alloc_max = max;
+	}
+
+	mem.allocs[mem.alloc_cnt].key = key;
+	mem.allocs[mem.alloc_cnt].size = size;
+	mem.allocs[mem.alloc_cnt].stage = mem.stage;
+	mem.alloc_cnt++;
+
+	mem.total_allocs++;
+	mem.live += size;
+	if (mem.live > mem.peak)
+		mem.peak = mem.live;
+
+	stage = &mem.stages[mem.stage];
+	stage->allocs++;
+	stage->allocated += size;
+	if (mem.live > stage->peak)
+		stage->peak = mem.live;
+}
+
+void
+opencl_mem_untrack(const void *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < mem.alloc_cnt; i++) {
+		if (mem.allocs[i].key != key)
+			continue;
+
+		mem.live -= mem.allocs[i].size;
+		mem.allocs[i] = mem.allocs[--mem.alloc_cnt];
+		return;
+	}
+}
+
+cl_mem
+opencl_create_buffer(cl_context ctx, cl_mem_flags flags, size_t size,
+		void *host_ptr, cl_int *error)
+{
+	cl_mem buf;
+
+	buf = clCreateBuffer(ctx, flags, size, host_ptr, error);
+	if (buf)
+		opencl_mem_track(buf, size);
+
+	return buf;
+}
+
+cl_int
+opencl_release_buffer(cl_mem buf)
+{
+	if (buf)
+		opencl_mem_untrack(buf);
+
+	return clReleaseMemObject(buf);
+}
+
+void
+opencl_mem_stage(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < mem.stage_cnt; i++) {
+		if (!strcmp(mem.stages[i].name, name))
+			break;
+	}
+
+	if (i == mem.stage_cnt) {
+		if (mem.stage_cnt == MEM_STAGES_MAX) {
+			fprintf(stderr, "Too many memory stages, accounting "
+					"\"%s\" to \"%s\"\n", name,
+					mem.stages[mem.stage].name);
+			return;
+		}
+
+		mem.stages[i].name = name;
+		mem.stage_cnt++;
+	}
+
+	mem.stage = i;
+
+	/* Buffers still live from earlier stages count towards the peak */
+	if (mem.live > mem.stages[i].peak)
+		mem.stages[i].peak = mem.live;
+}
+
+size_t
+opencl_mem_peak(unsigned int *allocs)
+{
+	if (allocs)
+		*allocs = mem.total_allocs;
+
+	return mem.peak;
+}
+
+void
+opencl_mem_report(void)
+{
+	struct mem_stage *stage;
+	unsigned int i;
+
+	if (!mem.total_allocs)
+		return;
+
+	printf("\nDevice memory: peak %.2f MiB, %u allocations, %.2f MiB "
+			"in %u buffers not released\n", mem_mib(mem.peak),
+			mem.total_allocs, mem_mib(mem.live), mem.alloc_cnt);
+	printf("%-16s %8s %16s %16s\n", "Stage", "Allocs", "Allocated (MiB)",
+			"Peak live (MiB)");
+
+	for (i = 0; i < mem.stage_cnt; i++) {
+		stage = &mem.stages[i];
+		if (!stage->allocs)
+			continue;
+
+		printf("%-16s %8u %16.2f %16.2f\n", stage->name, stage->allocs,
+				mem_mib(stage->allocated),
+				mem_mib(stage->peak));
+	}
+}
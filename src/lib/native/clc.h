@@ -0,0 +1,826 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Builtins for kernels compiled natively on the host, see lib/native.h.
+ */
+
+/*
+ * Included ahead of the prelude when clang compiles a program for the
+ * CLAXON_NATIVE backend. Clang's OpenCL C front-end handles the language:
+ * address spaces, vector literals and swizzles. This header supplies what a
+ * device compiler would otherwise provide: the scalar and vector types, the
+ * work-item functions, which the runtime implements, and the subset of the
+ * builtin library the kernels use, implemented on top of clang's C builtins.
+ *
+ * Work-items of a group run one after another on the same thread. Kernels
+ * that call barrier() run each work-item as a fiber, barrier() switches to the
+ * next one.
+ */
+
+#ifndef CLAXON_NATIVE_CLC_H
+#define CLAXON_NATIVE_CLC_H
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+/* Types */
+typedef unsigned char uchar;
+typedef unsigned short ushort;
+typedef unsigned int uint;
+typedef unsigned long ulong;
+typedef __SIZE_TYPE__ size_t;
+typedef __PTRDIFF_TYPE__ ptrdiff_t;
+typedef __INTPTR_TYPE__ intptr_t;
+typedef __UINTPTR_TYPE__ uintptr_t;
+typedef uint cl_mem_fence_flags;
+
+#define CLC_VECTORS(T) \
+	typedef T T##2 __attribute__((ext_vector_type(2))); \
+	typedef T T##3 __attribute__((ext_vector_type(3))); \
+	typedef T T##4 __attribute__((ext_vector_type(4))); \
+	typedef T T##8 __attribute__((ext_vector_type(8))); \
+	typedef T T##16 __attribute__((ext_vector_type(16)));
+
+CLC_VECTORS(char)
+CLC_VECTORS(uchar)
+CLC_VECTORS(short)
+CLC_VECTORS(ushort)
+CLC_VECTORS(int)
+CLC_VECTORS(uint)
+CLC_VECTORS(long)
+CLC_VECTORS(ulong)
+CLC_VECTORS(float)
+CLC_VECTORS(double)
+
+/* Constants */
+#define CHAR_BIT	8
+#define CHAR_MAX	SCHAR_MAX
+#define CHAR_MIN	SCHAR_MIN
+#define SCHAR_MAX	127
+#define SCHAR_MIN	(-127 - 1)
+#define UCHAR_MAX	255
+#define SHRT_MAX	32767
+#define SHRT_MIN	(-32767 - 1)
+#define USHRT_MAX	65535
+#define INT_MAX		2147483647
+#define INT_MIN		(-2147483647 - 1)
+#define UINT_MAX	0xffffffffU
+#define LONG_MAX	0x7fffffffffffffffL
+#define LONG_MIN	(-0x7fffffffffffffffL - 1)
+#define ULONG_MAX	0xffffffffffffffffUL
+
+#define FLT_DIG		6
+#define FLT_MANT_DIG	24
+#define FLT_MAX		0x1.fffffep127f
+#define FLT_MIN		0x1.0p-126f
+#define FLT_EPSILON	0x1.0p-23f
+#define DBL_MAX		0x1.fffffffffffffp1023
+#define DBL_MIN		0x1.0p-1022
+#define DBL_EPSILON	0x1.0p-52
+
+#define MAXFLOAT	FLT_MAX
+#define HUGE_VALF	__builtin_huge_valf()
+#define HUGE_VAL	__builtin_huge_val()
+#define INFINITY	__builtin_inff()
+#define NAN		__builtin_nanf("")
+
+#define M_E_F		2.71828182845904523536f
+#define M_LOG2E_F	1.44269504088896340736f
+#define M_LN2_F		0.69314718055994530942f
+#define M_PI_F		3.14159265358979323846f
+#define M_PI_2_F	1.57079632679489661923f
+#define M_1_PI_F	0.31830988618379067154f
+#define M_SQRT2_F	1.41421356237309504880f
+#define M_E		2.71828182845904523536
+#define M_LN2		0.69314718055994530942
+#define M_PI		3.14159265358979323846
+#define M_PI_2		1.57079632679489661923
+#define M_1_PI		0.31830988618379067154
+#define M_SQRT2		1.41421356237309504880
+
+#define NULL		((void *) 0)
+
+#define CLK_LOCAL_MEM_FENCE	0x1
+#define CLK_GLOBAL_MEM_FENCE	0x2
+
+#define CLC_DECL static inline __attribute__((overloadable, always_inline))
+
+/* Work-item functions, implemented by the runtime */
+uint claxon_native_work_dim(void);
+size_t claxon_native_global_size(uint dim);
+size_t claxon_native_global_id(uint dim);
+size_t claxon_native_global_offset(uint dim);
+size_t claxon_native_local_size(uint dim);
+size_t claxon_native_local_id(uint dim);
+size_t claxon_native_num_groups(uint dim);
+size_t claxon_native_group_id(uint dim);
+void claxon_native_barrier(void);
+
+static inline uint get_work_dim(void)
+{
+	return claxon_native_work_dim();
+}
+
+static inline size_t get_global_size(uint dim)
+{
+	return claxon_native_global_size(dim);
+}
+
+static inline size_t get_global_id(uint dim)
+{
+	return claxon_native_global_id(dim);
+}
+
+static inline size_t get_global_offset(uint dim)
+{
+	return claxon_native_global_offset(dim);
+}
+
+static inline size_t get_local_size(uint dim)
+{
+	return claxon_native_local_size(dim);
+}
+
+static inline size_t get_local_id(uint dim)
+{
+	return claxon_native_local_id(dim);
+}
+
+static inline size_t get_num_groups(uint dim)
+{
+	return claxon_native_num_groups(dim);
+}
+
+static inline size_t get_group_id(uint dim)
+{
+	return claxon_native_group_id(dim);
+}
+
+static inline size_t get_local_linear_id(void)
+{
+	return (get_local_id(2) * get_local_size(1) + get_local_id(1)) *
+			get_local_size(0) + get_local_id(0);
+}
+
+/* Synchronisation. Work-items of a group share a thread, so fences only
+ * matter for memory shared with other work-groups. */
+static inline void barrier(cl_mem_fence_flags flags)
+{
+	claxon_native_barrier();
+}
+
+static inline void mem_fence(cl_mem_fence_flags flags)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void read_mem_fence(cl_mem_fence_flags flags)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void write_mem_fence(cl_mem_fence_flags flags)
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* Component-wise vector versions of scalar functions */
+#define CLC_VEC_ALL(M, fn, T) \
+	M(fn, T, 2) M(fn, T, 3) M(fn, T, 4) M(fn, T, 8) M(fn, T, 16)
+
+#define CLC_VEC_UNARY(fn, T, n) \
+	CLC_DECL T##n fn(T##n x) \
+	{ \
+		T##n r = x; \
+		for (int i = 0; i < n; i++) \
+			r[i] = fn(x[i]); \
+		return r; \
+	}
+
+#define CLC_VEC_BINARY(fn, T, n) \
+	CLC_DECL T##n fn(T##n x, T##n y) \
+	{ \
+		T##n r = x; \
+		for (int i = 0; i < n; i++) \
+			r[i] = fn(x[i], y[i]); \
+		return r; \
+	}
+
+#define CLC_VEC_TERNARY(fn, T, n) \
+	CLC_DECL T##n fn(T##n x, T##n y, T##n z) \
+	{ \
+		T##n r = x; \
+		for (int i = 0; i < n; i++) \
+			r[i] = fn(x[i], y[i], z[i]); \
+		return r; \
+	}
+
+/* Vector with scalar second (and third) argument */
+#define CLC_VEC_BINARY_S(fn, T, n) \
+	CLC_DECL T##n fn(T##n x, T y) \
+	{ \
+		return fn(x, (T##n) y); \
+	}
+
+#define CLC_VEC_TERNARY_S(fn, T, n) \
+	CLC_DECL T##n fn(T##n x, T y, T z) \
+	{ \
+		return fn(x, (T##n) y, (T##n) z); \
+	}
+
+/* Floating point functions */
+#define CLC_UNARY(fn, f, d) \
+	CLC_DECL float fn(float x) { return f(x); } \
+	CLC_DECL double fn(double x) { return d(x); } \
+	CLC_VEC_ALL(CLC_VEC_UNARY, fn, float) \
+	CLC_VEC_ALL(CLC_VEC_UNARY, fn, double)
+
+#define CLC_BINARY(fn, f, d) \
+	CLC_DECL float fn(float x, float y) { return f(x, y); } \
+	CLC_DECL double fn(double x, double y) { return d(x, y); } \
+	CLC_VEC_ALL(CLC_VEC_BINARY, fn, float) \
+	CLC_VEC_ALL(CLC_VEC_BINARY, fn, double)
+
+#define CLC_TERNARY(fn, f, d) \
+	CLC_DECL float fn(float x, float y, float z) \
+	{ \
+		return f(x, y, z); \
+	} \
+	CLC_DECL double fn(double x, double y, double z) \
+	{ \
+		return d(x, y, z); \
+	} \
+	CLC_VEC_ALL(CLC_VEC_TERNARY, fn, float) \
+	CLC_VEC_ALL(CLC_VEC_TERNARY, fn, double)
+
+#define clc_rsqrtf(x)		(1.0f / __builtin_sqrtf(x))
+#define clc_rsqrt(x)		(1.0 / __builtin_sqrt(x))
+#define clc_recipf(x)		(1.0f / (x))
+#define clc_recip(x)		(1.0 / (x))
+#define clc_divf(x, y)		((x) / (y))
+#define clc_div(x, y)		((x) / (y))
+#define clc_madf(a, b, c)	((a) * (b) + (c))
+#define clc_mad(a, b, c)	((a) * (b) + (c))
+#define clc_signf(x)		((x) > 0.0f ? 1.0f : (x) < 0.0f ? -1.0f : \
+				 (x) == (x) ? (x) : 0.0f)
+#define clc_sign(x)		((x) > 0.0 ? 1.0 : (x) < 0.0 ? -1.0 : \
+				 (x) == (x) ? (x) : 0.0)
+#define clc_stepf(e, x)		((x) < (e) ? 0.0f : 1.0f)
+#define clc_step(e, x)		((x) < (e) ? 0.0 : 1.0)
+#define clc_mixf(x, y, a)	((x) + ((y) - (x)) * (a))
+#define clc_mix(x, y, a)	((x) + ((y) - (x)) * (a))
+#define clc_clampf(x, l, h)	__builtin_fminf(__builtin_fmaxf(x, l), h)
+#define clc_clamp(x, l, h)	__builtin_fmin(__builtin_fmax(x, l), h)
+#define clc_degreesf(x)		((x) * (180.0f / M_PI_F))
+#define clc_degrees(x)		((x) * (180.0 / M_PI))
+#define clc_radiansf(x)		((x) * (M_PI_F / 180.0f))
+#define clc_radians(x)		((x) * (M_PI / 180.0))
+
+CLC_UNARY(sqrt, __builtin_sqrtf, __builtin_sqrt)
+CLC_UNARY(rsqrt, clc_rsqrtf, clc_rsqrt)
+CLC_UNARY(cbrt, __builtin_cbrtf, __builtin_cbrt)
+CLC_UNARY(fabs, __builtin_fabsf, __builtin_fabs)
+CLC_UNARY(floor, __builtin_floorf, __builtin_floor)
+CLC_UNARY(ceil, __builtin_ceilf, __builtin_ceil)
+CLC_UNARY(trunc, __builtin_truncf, __builtin_trunc)
+CLC_UNARY(round, __builtin_roundf, __builtin_round)
+CLC_UNARY(rint, __builtin_rintf, __builtin_rint)
+CLC_UNARY(sin, __builtin_sinf, __builtin_sin)
+CLC_UNARY(cos, __builtin_cosf, __builtin_cos)
+CLC_UNARY(tan, __builtin_tanf, __builtin_tan)
+CLC_UNARY(asin, __builtin_asinf, __builtin_asin)
+CLC_UNARY(acos, __builtin_acosf, __builtin_acos)
+CLC_UNARY(atan, __builtin_atanf, __builtin_atan)
+CLC_UNARY(sinh, __builtin_sinhf, __builtin_sinh)
+CLC_UNARY(cosh, __builtin_coshf, __builtin_cosh)
+CLC_UNARY(tanh, __builtin_tanhf, __builtin_tanh)
+CLC_UNARY(exp, __builtin_expf, __builtin_exp)
+CLC_UNARY(exp2, __builtin_exp2f, __builtin_exp2)
+CLC_UNARY(log, __builtin_logf, __builtin_log)
+CLC_UNARY(log2, __builtin_log2f, __builtin_log2)
+CLC_UNARY(log10, __builtin_log10f, __builtin_log10)
+CLC_UNARY(sign, clc_signf, clc_sign)
+CLC_UNARY(degrees, clc_degreesf, clc_degrees)
+CLC_UNARY(radians, clc_radiansf, clc_radians)
+CLC_UNARY(native_sqrt, __builtin_sqrtf, __builtin_sqrt)
+CLC_UNARY(native_rsqrt, clc_rsqrtf, clc_rsqrt)
+CLC_UNARY(native_recip, clc_recipf, clc_recip)
+CLC_UNARY(native_sin, __builtin_sinf, __builtin_sin)
+CLC_UNARY(native_cos, __builtin_cosf, __builtin_cos)
+CLC_UNARY(native_tan, __builtin_tanf, __builtin_tan)
+CLC_UNARY(native_exp, __builtin_expf, __builtin_exp)
+CLC_UNARY(native_exp2, __builtin_exp2f, __builtin_exp2)
+CLC_UNARY(native_log, __builtin_logf, __builtin_log)
+CLC_UNARY(native_log2, __builtin_log2f, __builtin_log2)
+
+CLC_BINARY(pow, __builtin_powf, __builtin_pow)
+CLC_BINARY(powr, __builtin_powf, __builtin_pow)
+CLC_BINARY(native_powr, __builtin_powf, __builtin_pow)
+CLC_BINARY(native_divide, clc_divf, clc_div)
+CLC_BINARY(fmod, __builtin_fmodf, __builtin_fmod)
+CLC_BINARY(atan2, __builtin_atan2f, __builtin_atan2)
+CLC_BINARY(hypot, __builtin_hypotf, __builtin_hypot)
+CLC_BINARY(copysign, __builtin_copysignf, __builtin_copysign)
+CLC_BINARY(fmin, __builtin_fminf, __builtin_fmin)
+CLC_BINARY(fmax, __builtin_fmaxf, __builtin_fmax)
+CLC_BINARY(min, __builtin_fminf, __builtin_fmin)
+CLC_BINARY(max, __builtin_fmaxf, __builtin_fmax)
+CLC_BINARY(step, clc_stepf, clc_step)
+
+CLC_TERNARY(mad, clc_madf, clc_mad)
+CLC_TERNARY(fma, __builtin_fmaf, __builtin_fma)
+CLC_TERNARY(mix, clc_mixf, clc_mix)
+CLC_TERNARY(clamp, clc_clampf, clc_clamp)
+
+CLC_VEC_ALL(CLC_VEC_BINARY_S, fmin, float)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, fmin, double)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, fmax, float)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, fmax, double)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, min, float)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, min, double)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, max, float)
+CLC_VEC_ALL(CLC_VEC_BINARY_S, max, double)
+CLC_VEC_ALL(CLC_VEC_TERNARY_S, clamp, float)
+CLC_VEC_ALL(CLC_VEC_TERNARY_S, clamp, double)
+
+#define CLC_VEC_POWN(fn, T, n) \
+	CLC_DECL T##n pown(T##n x, int##n y) \
+	{ \
+		T##n r = x; \
+		for (int i = 0; i < n; i++) \
+			r[i] = pown(x[i], y[i]); \
+		return r; \
+	}
+
+CLC_DECL float pown(float x, int y) { return __builtin_powif(x, y); }
+CLC_DECL double pown(double x, int y) { return __builtin_powi(x, y); }
+CLC_VEC_ALL(CLC_VEC_POWN, pown, float)
+CLC_VEC_ALL(CLC_VEC_POWN, pown, double)
+
+#define CLC_CLASSIFY(T) \
+	CLC_DECL int isnan(T x) { return x != x; } \
+	CLC_DECL int isinf(T x) { return __builtin_isinf(x); } \
+	CLC_DECL int isfinite(T x) { return __builtin_isfinite(x); }
+
+CLC_CLASSIFY(float)
+CLC_CLASSIFY(double)
+
+/* Geometric functions */
+#define CLC_GEOMETRIC(T, n) \
+	CLC_DECL T dot(T##n a, T##n b) \
+	{ \
+		T r = 0; \
+		for (int i = 0; i < n; i++) \
+			r += a[i] * b[i]; \
+		return r; \
+	} \
+	CLC_DECL T length(T##n a) { return sqrt(dot(a, a)); } \
+	CLC_DECL T fast_length(T##n a) { return sqrt(dot(a, a)); } \
+	CLC_DECL T distance(T##n a, T##n b) { return length(a - b); } \
+	CLC_DECL T##n normalize(T##n a) \
+	{ \
+		T l2 = dot(a, a); \
+		return l2 > (T) 0 ? a * rsqrt(l2) : a; \
+	} \
+	CLC_DECL T##n fast_normalize(T##n a) { return normalize(a); }
+
+CLC_GEOMETRIC(float, 2)
+CLC_GEOMETRIC(float, 3)
+CLC_GEOMETRIC(float, 4)
+CLC_GEOMETRIC(double, 2)
+CLC_GEOMETRIC(double, 3)
+CLC_GEOMETRIC(double, 4)
+
+#define CLC_GEOMETRIC_SCALAR(T) \
+	CLC_DECL T dot(T a, T b) { return a * b; } \
+	CLC_DECL T length(T a) { return fabs(a); } \
+	CLC_DECL T distance(T a, T b) { return fabs(a - b); } \
+	CLC_DECL T normalize(T a) { return a == (T) 0 ? a : sign(a); }
+
+CLC_GEOMETRIC_SCALAR(float)
+CLC_GEOMETRIC_SCALAR(double)
+
+#define CLC_CROSS(T) \
+	CLC_DECL T##3 cross(T##3 a, T##3 b) \
+	{ \
+		return (T##3)(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, \
+				a.x * b.y - a.y * b.x); \
+	} \
+	CLC_DECL T##4 cross(T##4 a, T##4 b) \
+	{ \
+		return (T##4)(cross(a.xyz, b.xyz), (T) 0); \
+	}
+
+CLC_CROSS(float)
+CLC_CROSS(double)
+
+/* Integer functions */
+#define CLC_INT_MIN(a, b)	((b) < (a) ? (b) : (a))
+#define CLC_INT_MAX(a, b)	((a) < (b) ? (b) : (a))
+#define CLC_INT_CLAMP(x, l, h)	CLC_INT_MIN(CLC_INT_MAX(x, l), h)
+
+#define CLC_INTEGER(T) \
+	CLC_DECL T min(T a, T b) { return CLC_INT_MIN(a, b); } \
+	CLC_DECL T max(T a, T b) { return CLC_INT_MAX(a, b); } \
+	CLC_DECL T clamp(T x, T l, T h) { return CLC_INT_CLAMP(x, l, h); } \
+	CLC_VEC_ALL(CLC_VEC_BINARY, min, T) \
+	CLC_VEC_ALL(CLC_VEC_BINARY, max, T) \
+	CLC_VEC_ALL(CLC_VEC_TERNARY, clamp, T) \
+	CLC_VEC_ALL(CLC_VEC_BINARY_S, min, T) \
+	CLC_VEC_ALL(CLC_VEC_BINARY_S, max, T) \
+	CLC_VEC_ALL(CLC_VEC_TERNARY_S, clamp, T)
+
+CLC_INTEGER(char)
+CLC_INTEGER(uchar)
+CLC_INTEGER(short)
+CLC_INTEGER(ushort)
+CLC_INTEGER(int)
+CLC_INTEGER(uint)
+CLC_INTEGER(long)
+CLC_INTEGER(ulong)
+
+#define CLC_ABS(T, U) \
+	CLC_DECL U abs(T x) { return x < 0 ? (U) -x : (U) x; } \
+	CLC_DECL U abs(U x) { return x; }
+
+CLC_ABS(char, uchar)
+CLC_ABS(short, ushort)
+CLC_ABS(int, uint)
+CLC_ABS(long, ulong)
+
+#define CLC_BITS(T, U, bits, clz_fn, popcount_fn) \
+	CLC_DECL T clz(T x) { return x ? (T) clz_fn(x) : (T) (bits); } \
+	CLC_DECL T popcount(T x) { return (T) popcount_fn(x); } \
+	CLC_DECL T rotate(T x, T n) \
+	{ \
+		uint s = (uint) n & ((bits) - 1); \
+		return s ? (T) (((U) x << s) | ((U) x >> ((bits) - s))) : x; \
+	}
+
+CLC_BITS(int, uint, 32, __builtin_clz, __builtin_popcount)
+CLC_BITS(uint, uint, 32, __builtin_clz, __builtin_popcount)
+CLC_BITS(long, ulong, 64, __builtin_clzl, __builtin_popcountl)
+CLC_BITS(ulong, ulong, 64, __builtin_clzl, __builtin_popcountl)
+
+#define CLC_MUL24(T) \
+	CLC_DECL T mul24(T a, T b) { return a * b; } \
+	CLC_DECL T mad24(T a, T b, T c) { return a * b + c; }
+
+CLC_MUL24(int)
+CLC_MUL24(uint)
+
+#define CLC_RELATIONAL(n) \
+	CLC_DECL int any(int##n x) \
+	{ \
+		for (int i = 0; i < n; i++) \
+			if (x[i] < 0) \
+				return 1; \
+		return 0; \
+	} \
+	CLC_DECL int all(int##n x) \
+	{ \
+		for (int i = 0; i < n; i++) \
+			if (x[i] >= 0) \
+				return 0; \
+		return 1; \
+	}
+
+CLC_RELATIONAL(2)
+CLC_RELATIONAL(3)
+CLC_RELATIONAL(4)
+CLC_RELATIONAL(8)
+CLC_RELATIONAL(16)
+
+CLC_DECL int any(int x) { return x < 0; }
+CLC_DECL int all(int x) { return x < 0; }
+
+/* Conversions. Plain conversions round like C casts: towards zero from
+ * floating point, to nearest into floating point. */
+#define CLC_CONVERT_VEC(D, S, n) \
+	CLC_DECL D##n convert_##D##n(S##n x) \
+	{ \
+		return __builtin_convertvector(x, D##n); \
+	}
+
+#define CLC_CONVERT_TO(D, S) \
+	CLC_DECL D convert_##D(S x) { return (D) x; } \
+	CLC_CONVERT_VEC(D, S, 2) \
+	CLC_CONVERT_VEC(D, S, 3) \
+	CLC_CONVERT_VEC(D, S, 4) \
+	CLC_CONVERT_VEC(D, S, 8) \
+	CLC_CONVERT_VEC(D, S, 16)
+
+#define CLC_CONVERT(D) \
+	CLC_CONVERT_TO(D, char) \
+	CLC_CONVERT_TO(D, uchar) \
+	CLC_CONVERT_TO(D, short) \
+	CLC_CONVERT_TO(D, ushort) \
+	CLC_CONVERT_TO(D, int) \
+	CLC_CONVERT_TO(D, uint) \
+	CLC_CONVERT_TO(D, long) \
+	CLC_CONVERT_TO(D, ulong) \
+	CLC_CONVERT_TO(D, float) \
+	CLC_CONVERT_TO(D, double)
+
+CLC_CONVERT(char)
+CLC_CONVERT(uchar)
+CLC_CONVERT(short)
+CLC_CONVERT(ushort)
+CLC_CONVERT(int)
+CLC_CONVERT(uint)
+CLC_CONVERT(long)
+CLC_CONVERT(ulong)
+CLC_CONVERT(float)
+CLC_CONVERT(double)
+
+/* Floating point to integer with explicit rounding and saturation */
+#define CLC_SATURATE(D, lo, hi) \
+	CLC_DECL D clc_sat_##D(double x) \
+	{ \
+		if (x != x) \
+			return 0; \
+		if (x <= (double) (lo)) \
+			return lo; \
+		if (x >= (double) (hi)) \
+			return hi; \
+		return (D) x; \
+	}
+
+CLC_SATURATE(char, SCHAR_MIN, SCHAR_MAX)
+CLC_SATURATE(uchar, 0, UCHAR_MAX)
+CLC_SATURATE(short, SHRT_MIN, SHRT_MAX)
+CLC_SATURATE(ushort, 0, USHRT_MAX)
+CLC_SATURATE(int, INT_MIN, INT_MAX)
+CLC_SATURATE(uint, 0, UINT_MAX)
+CLC_SATURATE(long, LONG_MIN, LONG_MAX)
+CLC_SATURATE(ulong, 0, ULONG_MAX)
+
+#define CLC_ROUND_VEC(D, S, m, n) \
+	CLC_DECL D##n convert_##D##n##m(S##n x) \
+	{ \
+		D##n r; \
+		for (int i = 0; i < n; i++) \
+			r[i] = convert_##D##m(x[i]); \
+		return r; \
+	}
+
+#define CLC_ROUND_MODE(D, S, m, rnd) \
+	CLC_DECL D convert_##D##m(S x) { return (D) rnd(x); } \
+	CLC_ROUND_VEC(D, S, m, 2) \
+	CLC_ROUND_VEC(D, S, m, 3) \
+	CLC_ROUND_VEC(D, S, m, 4) \
+	CLC_ROUND_VEC(D, S, m, 8) \
+	CLC_ROUND_VEC(D, S, m, 16)
+
+#define CLC_SAT_MODE(D, S, m, rnd) \
+	CLC_DECL D convert_##D##_sat##m(S x) { return clc_sat_##D(rnd(x)); } \
+	CLC_ROUND_VEC(D, S, _sat##m, 2) \
+	CLC_ROUND_VEC(D, S, _sat##m, 3) \
+	CLC_ROUND_VEC(D, S, _sat##m, 4) \
+	CLC_ROUND_VEC(D, S, _sat##m, 8) \
+	CLC_ROUND_VEC(D, S, _sat##m, 16)
+
+#define CLC_ROUND_FROM(D, S) \
+	CLC_ROUND_MODE(D, S, _rte, rint) \
+	CLC_ROUND_MODE(D, S, _rtz, trunc) \
+	CLC_ROUND_MODE(D, S, _rtn, floor) \
+	CLC_ROUND_MODE(D, S, _rtp, ceil) \
+	CLC_SAT_MODE(D, S, , trunc) \
+	CLC_SAT_MODE(D, S, _rte, rint) \
+	CLC_SAT_MODE(D, S, _rtz, trunc) \
+	CLC_SAT_MODE(D, S, _rtn, floor) \
+	CLC_SAT_MODE(D, S, _rtp, ceil)
+
+#define CLC_ROUND(D) \
+	CLC_ROUND_FROM(D, float) \
+	CLC_ROUND_FROM(D, double)
+
+CLC_ROUND(char)
+CLC_ROUND(uchar)
+CLC_ROUND(short)
+CLC_ROUND(ushort)
+CLC_ROUND(int)
+CLC_ROUND(uint)
+CLC_ROUND(long)
+CLC_ROUND(ulong)
+
+/* Reinterpretation */
+#define as_char(x) __builtin_astype((x), char)
+#define as_char2(x) __builtin_astype((x), char2)
+#define as_char3(x) __builtin_astype((x), char3)
+#define as_char4(x) __builtin_astype((x), char4)
+#define as_char8(x) __builtin_astype((x), char8)
+#define as_char16(x) __builtin_astype((x), char16)
+#define as_uchar(x) __builtin_astype((x), uchar)
+#define as_uchar2(x) __builtin_astype((x), uchar2)
+#define as_uchar3(x) __builtin_astype((x), uchar3)
+#define as_uchar4(x) __builtin_astype((x), uchar4)
+#define as_uchar8(x) __builtin_astype((x), uchar8)
+#define as_uchar16(x) __builtin_astype((x), uchar16)
+#define as_short(x) __builtin_astype((x), short)
+#define as_short2(x) __builtin_astype((x), short2)
+#define as_short3(x) __builtin_astype((x), short3)
+#define as_short4(x) __builtin_astype((x), short4)
+#define as_short8(x) __builtin_astype((x), short8)
+#define as_short16(x) __builtin_astype((x), short16)
+#define as_ushort(x) __builtin_astype((x), ushort)
+#define as_ushort2(x) __builtin_astype((x), ushort2)
+#define as_ushort3(x) __builtin_astype((x), ushort3)
+#define as_ushort4(x) __builtin_astype((x), ushort4)
+#define as_ushort8(x) __builtin_astype((x), ushort8)
+#define as_ushort16(x) __builtin_astype((x), ushort16)
+#define as_int(x) __builtin_astype((x), int)
+#define as_int2(x) __builtin_astype((x), int2)
+#define as_int3(x) __builtin_astype((x), int3)
+#define as_int4(x) __builtin_astype((x), int4)
+#define as_int8(x) __builtin_astype((x), int8)
+#define as_int16(x) __builtin_astype((x), int16)
+#define as_uint(x) __builtin_astype((x), uint)
+#define as_uint2(x) __builtin_astype((x), uint2)
+#define as_uint3(x) __builtin_astype((x), uint3)
+#define as_uint4(x) __builtin_astype((x), uint4)
+#define as_uint8(x) __builtin_astype((x), uint8)
+#define as_uint16(x) __builtin_astype((x), uint16)
+#define as_long(x) __builtin_astype((x), long)
+#define as_long2(x) __builtin_astype((x), long2)
+#define as_long3(x) __builtin_astype((x), long3)
+#define as_long4(x) __builtin_astype((x), long4)
+#define as_long8(x) __builtin_astype((x), long8)
+#define as_long16(x) __builtin_astype((x), long16)
+#define as_ulong(x) __builtin_astype((x), ulong)
+#define as_ulong2(x) __builtin_astype((x), ulong2)
+#define as_ulong3(x) __builtin_astype((x), ulong3)
+#define as_ulong4(x) __builtin_astype((x), ulong4)
+#define as_ulong8(x) __builtin_astype((x), ulong8)
+#define as_ulong16(x) __builtin_astype((x), ulong16)
+#define as_float(x) __builtin_astype((x), float)
+#define as_float2(x) __builtin_astype((x), float2)
+#define as_float3(x) __builtin_astype((x), float3)
+#define as_float4(x) __builtin_astype((x), float4)
+#define as_float8(x) __builtin_astype((x), float8)
+#define as_float16(x) __builtin_astype((x), float16)
+#define as_double(x) __builtin_astype((x), double)
+#define as_double2(x) __builtin_astype((x), double2)
+#define as_double3(x) __builtin_astype((x), double3)
+#define as_double4(x) __builtin_astype((x), double4)
+#define as_double8(x) __builtin_astype((x), double8)
+#define as_double16(x) __builtin_astype((x), double16)
+
+/* Vector loads and stores */
+#define CLC_VLOAD(T, n, AS) \
+	CLC_DECL T##n vload##n(size_t off, const AS T *p) \
+	{ \
+		T##n r; \
+		for (int i = 0; i < n; i++) \
+			r[i] = p[off * n + i]; \
+		return r; \
+	}
+
+#define CLC_VSTORE(T, n, AS) \
+	CLC_DECL void vstore##n(T##n v, size_t off, AS T *p) \
+	{ \
+		for (int i = 0; i < n; i++) \
+			p[off * n + i] = v[i]; \
+	}
+
+#define CLC_VLOADSTORE_N(T, n) \
+	CLC_VLOAD(T, n, __global) \
+	CLC_VLOAD(T, n, __local) \
+	CLC_VLOAD(T, n, __constant) \
+	CLC_VLOAD(T, n, __private) \
+	CLC_VSTORE(T, n, __global) \
+	CLC_VSTORE(T, n, __local) \
+	CLC_VSTORE(T, n, __private)
+
+#define CLC_VLOADSTORE(T) \
+	CLC_VLOADSTORE_N(T, 2) \
+	CLC_VLOADSTORE_N(T, 3) \
+	CLC_VLOADSTORE_N(T, 4) \
+	CLC_VLOADSTORE_N(T, 8) \
+	CLC_VLOADSTORE_N(T, 16)
+
+CLC_VLOADSTORE(int)
+CLC_VLOADSTORE(uint)
+CLC_VLOADSTORE(float)
+CLC_VLOADSTORE(double)
+
+/* 32-bit atomics, cl_khr_{global,local}_int32_{base,extended}_atomics */
+#define CLC_ATOMIC_MINMAX(T, AS, fn, op) \
+	CLC_DECL T fn(volatile AS T *p, T v) \
+	{ \
+		T old = *p, prev; \
+		while (v op old) { \
+			prev = __sync_val_compare_and_swap(p, old, v); \
+			if (prev == old) \
+				break; \
+			old = prev; \
+		} \
+		return old; \
+	}
+
+#define CLC_ATOMICS(T, AS) \
+	CLC_DECL T atomic_add(volatile AS T *p, T v) \
+	{ \
+		return __sync_fetch_and_add(p, v); \
+	} \
+	CLC_DECL T atomic_sub(volatile AS T *p, T v) \
+	{ \
+		return __sync_fetch_and_sub(p, v); \
+	} \
+	CLC_DECL T atomic_inc(volatile AS T *p) \
+	{ \
+		return __sync_fetch_and_add(p, (T) 1); \
+	} \
+	CLC_DECL T atomic_dec(volatile AS T *p) \
+	{ \
+		return __sync_fetch_and_sub(p, (T) 1); \
+	} \
+	CLC_DECL T atomic_and(volatile AS T *p, T v) \
+	{ \
+		return __sync_fetch_and_and(p, v); \
+	} \
+	CLC_DECL T atomic_or(volatile AS T *p, T v) \
+	{ \
+		return __sync_fetch_and_or(p, v); \
+	} \
+	CLC_DECL T atomic_xor(volatile AS T *p, T v) \
+	{ \
+		return __sync_fetch_and_xor(p, v); \
+	} \
+	CLC_DECL T atomic_xchg(volatile AS T *p, T v) \
+	{ \
+		return __sync_lock_test_and_set(p, v); \
+	} \
+	CLC_DECL T atomic_cmpxchg(volatile AS T *p, T cmp, T v) \
+	{ \
+		return __sync_val_compare_and_swap(p, cmp, v); \
+	} \
+	CLC_ATOMIC_MINMAX(T, AS, atomic_min, <) \
+	CLC_ATOMIC_MINMAX(T, AS, atomic_max, >)
+
+CLC_ATOMICS(int, __global)
+CLC_ATOMICS(uint, __global)
+CLC_ATOMICS(int, __local)
+CLC_ATOMICS(uint, __local)
+
+#define CLC_ATOMIC_XCHG_FLOAT(AS) \
+	CLC_DECL float atomic_xchg(volatile AS float *p, float v) \
+	{ \
+		return as_float(atomic_xchg((volatile AS int *) p, \
+				as_int(v))); \
+	}
+
+CLC_ATOMIC_XCHG_FLOAT(__global)
+CLC_ATOMIC_XCHG_FLOAT(__local)
+
+/* Asynchronous copies complete immediately. The first work-item of the group
+ * copies, all others run after it, or wait at a barrier. */
+#define CLC_ASYNC_COPY(T, DST, SRC) \
+	CLC_DECL event_t async_work_group_copy(DST T *dst, const SRC T *src, \
+			size_t n, event_t e) \
+	{ \
+		if (get_local_linear_id() == 0) \
+			for (size_t i = 0; i < n; i++) \
+				dst[i] = src[i]; \
+		return e; \
+	}
+
+#define CLC_ASYNC(T) \
+	CLC_ASYNC_COPY(T, __local, __global) \
+	CLC_ASYNC_COPY(T, __global, __local)
+
+CLC_ASYNC(char)
+CLC_ASYNC(uchar)
+CLC_ASYNC(short)
+CLC_ASYNC(ushort)
+CLC_ASYNC(int)
+CLC_ASYNC(uint)
+CLC_ASYNC(long)
+CLC_ASYNC(ulong)
+CLC_ASYNC(float)
+CLC_ASYNC(double)
+
+static inline void wait_group_events(int n, event_t *events)
+{
+}
+
+#endif /* CLAXON_NATIVE_CLC_H */
@@ -0,0 +1,2028 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Host implementation of the OpenCL entry points CLaxon uses, backed by the
+ * program variants native_gen registers, see lib/native.h.
+ *
+ * There is one platform with one CPU device. Its compute units are threads,
+ * CLAXON_NATIVE_THREADS overrides the number of online CPUs. Commands execute
+ * synchronously when they are enqueued, so events are complete by the time
+ * the caller sees them. Work-groups of an NDRange are handed out to a pool of
+ * threads. Within a group, work-items run one after another. For kernels that
+ * call barrier() each work-item is a fiber that yields to the next at every
+ * barrier.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+/* Implements the 2.0 entry points used by lib/svm.c */
+#define CL_TARGET_OPENCL_VERSION 200
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#include <CL/opencl.h>
+
+#include "lib/native.h"
+
+/** Largest work-group, matches common GPUs */
+#define NATIVE_WG_MAX		1024
+/** Local memory per work-group */
+#define NATIVE_LOCAL_MEM	(64ul << 10)
+/** Alignment of buffers, __local arguments and argument values. Covers the
+ * largest vector type, double16. */
+#define NATIVE_ALIGN		128
+/** Stack size of a work-item fiber, excluding the guard page */
+#define NATIVE_STACK_SIZE	(64ul << 10)
+/** Upper bound on program variants, raise if CMakeLists.txt outgrows it */
+#define NATIVE_PROGRAMS_MAX	256
+
+#define NATIVE_ROUNDUP(x, a)	((((x) + (a) - 1) / (a)) * (a))
+
+static const char native_extensions[] =
+	"cl_khr_global_int32_base_atomics "
+	"cl_khr_global_int32_extended_atomics "
+	"cl_khr_local_int32_base_atomics "
+	"cl_khr_local_int32_extended_atomics "
+	"cl_khr_byte_addressable_store";
+
+struct _cl_platform_id {
+	bool init;
+};
+
+struct _cl_device_id {
+	/** Worker threads, the device's compute units */
+	unsigned int threads;
+	/** Root device for sub-devices, NULL for the root device */
+	struct _cl_device_id *parent;
+};
+
+struct _cl_context {
+	cl_device_id dev;
+};
+
+struct _cl_command_queue {
+	cl_context ctx;
+	cl_device_id dev;
+};
+
+struct _cl_mem {
+	void *ptr;
+	size_t size;
+	cl_mem_flags flags;
+	/** ptr was allocated by us, rather than CL_MEM_USE_HOST_PTR */
+	bool owned;
+	unsigned int refs;
+};
+
+struct _cl_program {
+	cl_context ctx;
+	unsigned int n_sources;
+	uint64_t *sources;
+	const struct native_program_desc *desc;
+	cl_build_status status;
+	char *options;
+	char *log;
+};
+
+struct _cl_kernel {
+	cl_program prg;
+	const struct native_program_desc *desc;
+	unsigned int k;
+	unsigned int n_args;
+	const char *kinds;
+	/** Per argument: value size, __local size, whether it was set */
+	size_t *sizes;
+	size_t *local;
+	bool *set;
+	/** Per argument a pointer to its value, the layout dispatch expects */
+	void **argv;
+	void *vals;
+};
+
+struct _cl_event {
+	cl_ulong queued;
+	cl_ulong start;
+	cl_ulong end;
+};
+
+/** One clEnqueueNDRangeKernel, shared by the threads executing it */
+struct native_launch {
+	cl_kernel kernel;
+	unsigned int dim;
+	size_t offset[3];
+	size_t global[3];
+	size_t local[3];
+	size_t groups[3];
+	size_t n_groups;
+	size_t n_items;
+	size_t local_mem;
+	/** Pool threads joining the calling thread */
+	unsigned int helpers;
+	/** Next work-group to execute */
+	size_t next;
+	int error;
+};
+
+#if defined(__x86_64__) && defined(__LP64__)
+/* Swapping user contexts costs a sigprocmask() system call, which dominates
+ * barrier-heavy kernels. On x86-64, switch stacks by hand instead, saving only
+ * the callee-saved registers. A context is the saved stack pointer. */
+typedef void *native_ctx;
+
+__asm__(
+	".text\n"
+	".p2align 4\n"
+	"native_ctx_switch:\n"
+	"	pushq	%rbp\n"
+	"	pushq	%rbx\n"
+	"	pushq	%r12\n"
+	"	pushq	%r13\n"
+	"	pushq	%r14\n"
+	"	pushq	%r15\n"
+	"	movq	%rsp, (%rdi)\n"
+	"	movq	(%rsi), %rsp\n"
+	"	popq	%r15\n"
+	"	popq	%r14\n"
+	"	popq	%r13\n"
+	"	popq	%r12\n"
+	"	popq	%rbx\n"
+	"	popq	%rbp\n"
+	"	ret\n");
+#else
+typedef ucontext_t native_ctx;
+#endif
+
+void native_ctx_switch(native_ctx *from, native_ctx *to);
+
+/** Work-item fibers of a thread, for kernels that call barrier() */
+struct native_fibers {
+	native_ctx sched;
+	native_ctx *ctx;
+	bool *done;
+	char *stacks;
+	size_t stack_len;
+	size_t n;
+};
+
+/** Work-item currently executing on this thread */
+static __thread struct {
+	const struct native_launch *l;
+	void **argv;
+	size_t group[3];
+	size_t local[3];
+	struct native_fibers *fibers;
+	size_t fiber;
+} item;
+
+static struct _cl_platform_id native_platform;
+static struct _cl_device_id native_device;
+
+static struct {
+	pthread_mutex_t lock;
+	const struct native_program_desc *desc[NATIVE_PROGRAMS_MAX];
+	unsigned int n;
+} registry = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.n = 0,
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	unsigned int threads;
+	unsigned long gen;
+	struct native_launch *launch;
+	unsigned int busy;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.threads = 0,
+	.gen = 0ul,
+	.launch = NULL,
+	.busy = 0,
+};
+
+void
+native_program_register(const struct native_program_desc *desc)
+{
+	pthread_mutex_lock(&registry.lock);
+	if (registry.n == NATIVE_PROGRAMS_MAX)
+		fprintf(stderr, "Native: too many program variants, dropping "
+				"%s\n", desc->name);
+	else
+		registry.desc[registry.n++] = desc;
+	pthread_mutex_unlock(&registry.lock);
+}
+
+static cl_ulong
+native_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+static void
+native_init(void)
+{
+	const char *env;
+	long cpus;
+
+	if (native_platform.init)
+		return;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	env = getenv("CLAXON_NATIVE_THREADS");
+	if (env && atoi(env) > 0)
+		cpus = atoi(env);
+	if (cpus < 1)
+		cpus = 1;
+
+	native_device.threads = cpus;
+	native_device.parent = NULL;
+	native_platform.init = true;
+}
+
+/* Copy a query result out, following the clGet*Info conventions */
+static cl_int
+native_info(const void *val, size_t size, size_t param_value_size,
+		void *param_value, size_t *param_value_size_ret)
+{
+	if (param_value_size_ret)
+		*param_value_size_ret = size;
+
+	if (param_value) {
+		if (param_value_size < size)
+			return CL_INVALID_VALUE;
+		memcpy(param_value, val, size);
+	}
+
+	return CL_SUCCESS;
+}
+
+static void
+native_error(cl_int *errcode_ret, cl_int error)
+{
+	if (errcode_ret)
+		*errcode_ret = error;
+}
+
+/* Commands run synchronously, so an event only records the time stamps */
+static cl_int
+native_event(cl_event *event, cl_ulong start)
+{
+	cl_event ev;
+
+	if (!event)
+		return CL_SUCCESS;
+
+	ev = malloc(sizeof(struct _cl_event));
+	if (!ev)
+		return CL_OUT_OF_HOST_MEMORY;
+
+	ev->queued = start;
+	ev->start = start;
+	ev->end = native_time_ns();
+	*event = ev;
+
+	return CL_SUCCESS;
+}
+
+/*
+ * Platform, devices, contexts and queues
+ */
+
+cl_int
+clGetPlatformIDs(cl_uint num_entries, cl_platform_id *platforms,
+		cl_uint *num_platforms)
+{
+	if (platforms && num_entries == 0)
+		return CL_INVALID_VALUE;
+
+	native_init();
+
+	if (platforms)
+		platforms[0] = &native_platform;
+	if (num_platforms)
+		*num_platforms = 1;
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clGetPlatformInfo(cl_platform_id platform, cl_platform_info param_name,
+		size_t param_value_size, void *param_value,
+		size_t *param_value_size_ret)
+{
+	const char *str;
+
+	if (platform != &native_platform)
+		return CL_INVALID_PLATFORM;
+
+	switch (param_name) {
+	case CL_PLATFORM_PROFILE:
+		str = "FULL_PROFILE";
+		break;
+	case CL_PLATFORM_VERSION:
+		str = "OpenCL 2.0 CLaxon native";
+		break;
+	case CL_PLATFORM_NAME:
+		str = "CLaxon native";
+		break;
+	case CL_PLATFORM_VENDOR:
+		str = "CLaxon";
+		break;
+	case CL_PLATFORM_EXTENSIONS:
+		str = "";
+		break;
+	default:
+		return CL_INVALID_VALUE;
+	}
+
+	return native_info(str, strlen(str) + 1, param_value_size,
+			param_value, param_value_size_ret);
+}
+
+/* No extensions, hence no extension functions */
+void *
+clGetExtensionFunctionAddressForPlatform(cl_platform_id platform,
+		const char *func_name)
+{
+	return NULL;
+}
+
+cl_int
+clGetDeviceIDs(cl_platform_id platform, cl_device_type device_type,
+		cl_uint num_entries, cl_device_id *devices,
+		cl_uint *num_devices)
+{
+	if (platform != &native_platform)
+		return CL_INVALID_PLATFORM;
+	if (devices && num_entries == 0)
+		return CL_INVALID_VALUE;
+
+	if (!(device_type & (CL_DEVICE_TYPE_CPU | CL_DEVICE_TYPE_DEFAULT)))
+		return CL_DEVICE_NOT_FOUND;
+
+	if (devices)
+		devices[0] = &native_device;
+	if (num_devices)
+		*num_devices = 1;
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clGetDeviceInfo(cl_device_id device, cl_device_info param_name,
+		size_t param_value_size, void *param_value,
+		size_t *param_value_size_ret)
+{
+	cl_device_partition_property part[] = {
+		CL_DEVICE_PARTITION_EQUALLY,
+		CL_DEVICE_PARTITION_BY_COUNTS,
+	};
+	size_t wi_sizes[3] = {NATIVE_WG_MAX, NATIVE_WG_MAX, NATIVE_WG_MAX};
+	union {
+		cl_uint u;
+		cl_ulong ul;
+		size_t sz;
+		cl_bitfield bf;
+		void *ptr;
+	} v;
+	const void *val = &v;
+	size_t size;
+	long pages;
+
+	if (!device)
+		return CL_INVALID_DEVICE;
+
+	pages = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+	switch (param_name) {
+	case CL_DEVICE_TYPE:
+		v.bf = CL_DEVICE_TYPE_CPU;
+		size = sizeof(cl_device_type);
+		break;
+	case CL_DEVICE_MAX_COMPUTE_UNITS:
+	case CL_DEVICE_PARTITION_MAX_SUB_DEVICES:
+		v.u = device->threads;
+		size = sizeof(cl_uint);
+		break;
+	case CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS:
+		v.u = 3;
+		size = sizeof(cl_uint);
+		break;
+	case CL_DEVICE_MAX_WORK_ITEM_SIZES:
+		val = wi_sizes;
+		size = sizeof(wi_sizes);
+		break;
+	case CL_DEVICE_MAX_WORK_GROUP_SIZE:
+		v.sz = NATIVE_WG_MAX;
+		size = sizeof(size_t);
+		break;
+	case CL_DEVICE_MAX_CLOCK_FREQUENCY:
+		v.u = 0;
+		size = sizeof(cl_uint);
+		break;
+	case CL_DEVICE_ADDRESS_BITS:
+		v.u = sizeof(void *) * 8;
+		size = sizeof(cl_uint);
+		break;
+	case CL_DEVICE_GLOBAL_MEM_SIZE:
+		v.ul = pages;
+		size = sizeof(cl_ulong);
+		break;
+	case CL_DEVICE_MAX_MEM_ALLOC_SIZE:
+		v.ul = pages / 4;
+		size = sizeof(cl_ulong);
+		break;
+	case CL_DEVICE_LOCAL_MEM_SIZE:
+		v.ul = NATIVE_LOCAL_MEM;
+		size = sizeof(cl_ulong);
+		break;
+	case CL_DEVICE_DOUBLE_FP_CONFIG:
+	case CL_DEVICE_PARTITION_AFFINITY_DOMAIN:
+		v.bf = 0;
+		size = sizeof(cl_bitfield);
+		break;
+	case CL_DEVICE_SVM_CAPABILITIES:
+		v.bf = CL_DEVICE_SVM_COARSE_GRAIN_BUFFER |
+				CL_DEVICE_SVM_FINE_GRAIN_BUFFER;
+		size = sizeof(cl_device_svm_capabilities);
+		break;
+	case CL_DEVICE_PARTITION_PROPERTIES:
+		val = part;
+		size = device->parent ? sizeof(part[0]) : sizeof(part);
+		break;
+	case CL_DEVICE_PLATFORM:
+		v.ptr = &native_platform;
+		size = sizeof(cl_platform_id);
+		break;
+	case CL_DEVICE_PARENT_DEVICE:
+		v.ptr = device->parent;
+		size = sizeof(cl_device_id);
+		break;
+	case CL_DEVICE_NAME:
+		val = "CLaxon native host";
+		size = strlen(val) + 1;
+		break;
+	case CL_DEVICE_VENDOR:
+		val = "CLaxon";
+		size = strlen(val) + 1;
+		break;
+	case CL_DRIVER_VERSION:
+		val = "1.0";
+		size = strlen(val) + 1;
+		break;
+	case CL_DEVICE_VERSION:
+		val = "OpenCL 2.0 CLaxon native";
+		size = strlen(val) + 1;
+		break;
+	case CL_DEVICE_OPENCL_C_VERSION:
+		val = "OpenCL C 2.0 ";
+		size = strlen(val) + 1;
+		break;
+	case CL_DEVICE_EXTENSIONS:
+		val = native_extensions;
+		size = sizeof(native_extensions);
+		break;
+	default:
+		return CL_INVALID_VALUE;
+	}
+
+	/* Sub-devices cannot be partitioned any further */
+	if (param_name == CL_DEVICE_PARTITION_PROPERTIES && device->parent)
+		part[0] = 0;
+
+	return native_info(val, size, param_value_size, param_value,
+			param_value_size_ret);
+}
+
+cl_int
+clCreateSubDevices(cl_device_id in_device,
+		const cl_device_partition_property *properties,
+		cl_uint num_devices, cl_device_id *out_devices,
+		cl_uint *num_devices_ret)
+{
+	unsigned int counts[NATIVE_WG_MAX];
+	unsigned int n = 0, i, sum = 0;
+
+	if (!in_device)
+		return CL_INVALID_DEVICE;
+	if (!properties || in_device->parent)
+		return CL_INVALID_VALUE;
+
+	switch (properties[0]) {
+	case CL_DEVICE_PARTITION_EQUALLY:
+		if (properties[1] <= 0 ||
+		    properties[1] > in_device->threads)
+			return CL_INVALID_VALUE;
+		n = in_device->threads / properties[1];
+		for (i = 0; i < n; i++)
+			counts[i] = properties[1];
+		break;
+	case CL_DEVICE_PARTITION_BY_COUNTS:
+		for (i = 1; properties[i] !=
+				CL_DEVICE_PARTITION_BY_COUNTS_LIST_END; i++) {
+			if (n == NATIVE_WG_MAX || properties[i] < 0)
+				return CL_INVALID_DEVICE_PARTITION_COUNT;
+			counts[n++] = properties[i];
+			sum += properties[i];
+		}
+		if (n == 0 || sum > in_device->threads)
+			return CL_INVALID_DEVICE_PARTITION_COUNT;
+		for (i = 0; i < n; i++) {
+			if (counts[i] == 0)
+				return CL_INVALID_DEVICE_PARTITION_COUNT;
+		}
+		break;
+	default:
+		/* No NUMA topology to partition by */
+		return CL_INVALID_VALUE;
+	}
+
+	if (num_devices_ret)
+		*num_devices_ret = n;
+	if (!out_devices)
+		return CL_SUCCESS;
+	if (num_devices < n)
+		return CL_INVALID_VALUE;
+
+	for (i = 0; i < n; i++) {
+		out_devices[i] = malloc(sizeof(struct _cl_device_id));
+		if (!out_devices[i]) {
+			while (i--)
+				free(out_devices[i]);
+			return CL_OUT_OF_HOST_MEMORY;
+		}
+		out_devices[i]->threads = counts[i];
+		out_devices[i]->parent = in_device;
+	}
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clReleaseDevice(cl_device_id device)
+{
+	if (!device)
+		return CL_INVALID_DEVICE;
+
+	if (device->parent)
+		free(device);
+
+	return CL_SUCCESS;
+}
+
+cl_context
+clCreateContext(const cl_context_properties *properties, cl_uint num_devices,
+		const cl_device_id *devices,
+		void (CL_CALLBACK *pfn_notify)(const char *, const void *,
+				size_t, void *),
+		void *user_data, cl_int *errcode_ret)
+{
+	cl_context ctx;
+
+	if (num_devices != 1 || !devices || !devices[0]) {
+		native_error(errcode_ret, CL_INVALID_VALUE);
+		return NULL;
+	}
+
+	ctx = malloc(sizeof(struct _cl_context));
+	if (!ctx) {
+		native_error(errcode_ret, CL_OUT_OF_HOST_MEMORY);
+		return NULL;
+	}
+
+	ctx->dev = devices[0];
+	native_error(errcode_ret, CL_SUCCESS);
+
+	return ctx;
+}
+
+cl_int
+clReleaseContext(cl_context context)
+{
+	if (!context)
+		return CL_INVALID_CONTEXT;
+
+	free(context);
+
+	return CL_SUCCESS;
+}
+
+cl_command_queue
+clCreateCommandQueue(cl_context context, cl_device_id device,
+		cl_command_queue_properties properties, cl_int *errcode_ret)
+{
+	cl_command_queue q;
+
+	if (!context) {
+		native_error(errcode_ret, CL_INVALID_CONTEXT);
+		return NULL;
+	}
+	if (device != context->dev) {
+		native_error(errcode_ret, CL_INVALID_DEVICE);
+		return NULL;
+	}
+
+	q = malloc(sizeof(struct _cl_command_queue));
+	if (!q) {
+		native_error(errcode_ret, CL_OUT_OF_HOST_MEMORY);
+		return NULL;
+	}
+
+	q->ctx = context;
+	q->dev = device;
+	native_error(errcode_ret, CL_SUCCESS);
+
+	return q;
+}
+
+cl_int
+clReleaseCommandQueue(cl_command_queue command_queue)
+{
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+
+	free(command_queue);
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clGetCommandQueueInfo(cl_command_queue command_queue,
+		cl_command_queue_info param_name, size_t param_value_size,
+		void *param_value, size_t *param_value_size_ret)
+{
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+
+	switch (param_name) {
+	case CL_QUEUE_CONTEXT:
+		return native_info(&command_queue->ctx, sizeof(cl_context),
+				param_value_size, param_value,
+				param_value_size_ret);
+	case CL_QUEUE_DEVICE:
+		return native_info(&command_queue->dev, sizeof(cl_device_id),
+				param_value_size, param_value,
+				param_value_size_ret);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+cl_int
+clFlush(cl_command_queue command_queue)
+{
+	return command_queue ? CL_SUCCESS : CL_INVALID_COMMAND_QUEUE;
+}
+
+cl_int
+clFinish(cl_command_queue command_queue)
+{
+	return command_queue ? CL_SUCCESS : CL_INVALID_COMMAND_QUEUE;
+}
+
+/*
+ * Events
+ */
+
+cl_int
+clWaitForEvents(cl_uint num_events, const cl_event *event_list)
+{
+	if (num_events == 0 || !event_list)
+		return CL_INVALID_VALUE;
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clGetEventProfilingInfo(cl_event event, cl_profiling_info param_name,
+		size_t param_value_size, void *param_value,
+		size_t *param_value_size_ret)
+{
+	cl_ulong t;
+
+	if (!event)
+		return CL_INVALID_EVENT;
+
+	switch (param_name) {
+	case CL_PROFILING_COMMAND_QUEUED:
+	case CL_PROFILING_COMMAND_SUBMIT:
+		t = event->queued;
+		break;
+	case CL_PROFILING_COMMAND_START:
+		t = event->start;
+		break;
+	case CL_PROFILING_COMMAND_END:
+	case CL_PROFILING_COMMAND_COMPLETE:
+		t = event->end;
+		break;
+	default:
+		return CL_INVALID_VALUE;
+	}
+
+	return native_info(&t, sizeof(t), param_value_size, param_value,
+			param_value_size_ret);
+}
+
+/* Commands complete before clEnqueue* returns, call back right away */
+cl_int
+clSetEventCallback(cl_event event, cl_int command_exec_callback_type,
+		void (CL_CALLBACK *pfn_notify)(cl_event, cl_int, void *),
+		void *user_data)
+{
+	if (!event)
+		return CL_INVALID_EVENT;
+	if (!pfn_notify || (command_exec_callback_type != CL_COMPLETE &&
+	    command_exec_callback_type != CL_RUNNING &&
+	    command_exec_callback_type != CL_SUBMITTED))
+		return CL_INVALID_VALUE;
+
+	pfn_notify(event, command_exec_callback_type, user_data);
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clReleaseEvent(cl_event event)
+{
+	if (!event)
+		return CL_INVALID_EVENT;
+
+	free(event);
+
+	return CL_SUCCESS;
+}
+
+/*
+ * Memory objects
+ */
+
+cl_mem
+clCreateBuffer(cl_context context, cl_mem_flags flags, size_t size,
+		void *host_ptr, cl_int *errcode_ret)
+{
+	bool use = !!(flags & CL_MEM_USE_HOST_PTR);
+	bool copy = !!(flags & CL_MEM_COPY_HOST_PTR);
+	cl_mem mem;
+
+	if (!context) {
+		native_error(errcode_ret, CL_INVALID_CONTEXT);
+		return NULL;
+	}
+	if (size == 0) {
+		native_error(errcode_ret, CL_INVALID_BUFFER_SIZE);
+		return NULL;
+	}
+	if ((use || copy) != !!host_ptr || (use && copy)) {
+		native_error(errcode_ret, CL_INVALID_HOST_PTR);
+		return NULL;
+	}
+
+	mem = malloc(sizeof(struct _cl_mem));
+	if (!mem) {
+		native_error(errcode_ret, CL_OUT_OF_HOST_MEMORY);
+		return NULL;
+	}
+
+	mem->size = size;
+	mem->flags = flags;
+	mem->owned = !use;
+	mem->refs = 1;
+	if (use) {
+		mem->ptr = host_ptr;
+	} else if (posix_memalign(&mem->ptr, NATIVE_ALIGN,
+			NATIVE_ROUNDUP(size, NATIVE_ALIGN))) {
+		free(mem);
+		native_error(errcode_ret, CL_MEM_OBJECT_ALLOCATION_FAILURE);
+		return NULL;
+	}
+
+	if (copy)
+		memcpy(mem->ptr, host_ptr, size);
+
+	native_error(errcode_ret, CL_SUCCESS);
+
+	return mem;
+}
+
+cl_int
+clRetainMemObject(cl_mem memobj)
+{
+	if (!memobj)
+		return CL_INVALID_MEM_OBJECT;
+
+	memobj->refs++;
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clReleaseMemObject(cl_mem memobj)
+{
+	if (!memobj)
+		return CL_INVALID_MEM_OBJECT;
+
+	if (--memobj->refs)
+		return CL_SUCCESS;
+
+	if (memobj->owned)
+		free(memobj->ptr);
+	free(memobj);
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clGetMemObjectInfo(cl_mem memobj, cl_mem_info param_name,
+		size_t param_value_size, void *param_value,
+		size_t *param_value_size_ret)
+{
+	if (!memobj)
+		return CL_INVALID_MEM_OBJECT;
+
+	switch (param_name) {
+	case CL_MEM_SIZE:
+		return native_info(&memobj->size, sizeof(size_t),
+				param_value_size, param_value,
+				param_value_size_ret);
+	case CL_MEM_FLAGS:
+		return native_info(&memobj->flags, sizeof(cl_mem_flags),
+				param_value_size, param_value,
+				param_value_size_ret);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+cl_int
+clEnqueueWriteBuffer(cl_command_queue command_queue, cl_mem buffer,
+		cl_bool blocking_write, size_t offset, size_t size,
+		const void *ptr, cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	cl_ulong start = native_time_ns();
+
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!buffer)
+		return CL_INVALID_MEM_OBJECT;
+	if (!ptr || offset + size > buffer->size)
+		return CL_INVALID_VALUE;
+
+	memcpy((char *) buffer->ptr + offset, ptr, size);
+
+	return native_event(event, start);
+}
+
+cl_int
+clEnqueueReadBuffer(cl_command_queue command_queue, cl_mem buffer,
+		cl_bool blocking_read, size_t offset, size_t size, void *ptr,
+		cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	cl_ulong start = native_time_ns();
+
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!buffer)
+		return CL_INVALID_MEM_OBJECT;
+	if (!ptr || offset + size > buffer->size)
+		return CL_INVALID_VALUE;
+
+	memcpy(ptr, (char *) buffer->ptr + offset, size);
+
+	return native_event(event, start);
+}
+
+cl_int
+clEnqueueCopyBuffer(cl_command_queue command_queue, cl_mem src_buffer,
+		cl_mem dst_buffer, size_t src_offset, size_t dst_offset,
+		size_t size, cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	cl_ulong start = native_time_ns();
+
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!src_buffer || !dst_buffer)
+		return CL_INVALID_MEM_OBJECT;
+	if (src_offset + size > src_buffer->size ||
+	    dst_offset + size > dst_buffer->size)
+		return CL_INVALID_VALUE;
+
+	memmove((char *) dst_buffer->ptr + dst_offset,
+			(char *) src_buffer->ptr + src_offset, size);
+
+	return native_event(event, start);
+}
+
+cl_int
+clEnqueueFillBuffer(cl_command_queue command_queue, cl_mem buffer,
+		const void *pattern, size_t pattern_size, size_t offset,
+		size_t size, cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	cl_ulong start = native_time_ns();
+	char *dst;
+	size_t i;
+
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!buffer)
+		return CL_INVALID_MEM_OBJECT;
+	if (!pattern || pattern_size == 0 || offset % pattern_size ||
+	    size % pattern_size || offset + size > buffer->size)
+		return CL_INVALID_VALUE;
+
+	dst = (char *) buffer->ptr + offset;
+	if (pattern_size == 1) {
+		memset(dst, *(const char *) pattern, size);
+	} else {
+		for (i = 0; i < size; i += pattern_size)
+			memcpy(&dst[i], pattern, pattern_size);
+	}
+
+	return native_event(event, start);
+}
+
+/*
+ * Shared virtual memory. Host and device share an address space, so mapping
+ * is a no-op.
+ */
+
+void *
+clSVMAlloc(cl_context context, cl_svm_mem_flags flags, size_t size,
+		cl_uint alignment)
+{
+	void *ptr;
+
+	if (!context || size == 0)
+		return NULL;
+
+	if (alignment < NATIVE_ALIGN)
+		alignment = NATIVE_ALIGN;
+
+	if (posix_memalign(&ptr, alignment, NATIVE_ROUNDUP(size, alignment)))
+		return NULL;
+
+	return ptr;
+}
+
+void
+clSVMFree(cl_context context, void *svm_pointer)
+{
+	free(svm_pointer);
+}
+
+cl_int
+clEnqueueSVMMap(cl_command_queue command_queue, cl_bool blocking_map,
+		cl_map_flags flags, void *svm_ptr, size_t size,
+		cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!svm_ptr || size == 0)
+		return CL_INVALID_VALUE;
+
+	return native_event(event, native_time_ns());
+}
+
+cl_int
+clEnqueueSVMUnmap(cl_command_queue command_queue, void *svm_ptr,
+		cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!svm_ptr)
+		return CL_INVALID_VALUE;
+
+	return native_event(event, native_time_ns());
+}
+
+/*
+ * Programs
+ */
+
+cl_program
+clCreateProgramWithSource(cl_context context, cl_uint count,
+		const char **strings, const size_t *lengths,
+		cl_int *errcode_ret)
+{
+	cl_program prg;
+	size_t len;
+	cl_uint i;
+
+	if (!context) {
+		native_error(errcode_ret, CL_INVALID_CONTEXT);
+		return NULL;
+	}
+	if (count == 0 || !strings) {
+		native_error(errcode_ret, CL_INVALID_VALUE);
+		return NULL;
+	}
+
+	prg = calloc(1, sizeof(struct _cl_program));
+	if (!prg)
+		goto error;
+
+	prg->sources = malloc(count * sizeof(uint64_t));
+	if (!prg->sources)
+		goto error;
+
+	for (i = 0; i < count; i++) {
+		if (!strings[i]) {
+			free(prg->sources);
+			free(prg);
+			native_error(errcode_ret, CL_INVALID_VALUE);
+			return NULL;
+		}
+
+		len = (lengths && lengths[i]) ? lengths[i] : strlen(strings[i]);
+		prg->sources[i] = native_hash(strings[i], len);
+	}
+
+	prg->ctx = context;
+	prg->n_sources = count;
+	prg->status = CL_BUILD_NONE;
+	native_error(errcode_ret, CL_SUCCESS);
+
+	return prg;
+
+error:
+	if (prg)
+		free(prg->sources);
+	free(prg);
+	native_error(errcode_ret, CL_OUT_OF_HOST_MEMORY);
+	return NULL;
+}
+
+static bool
+native_program_sources_match(cl_program prg,
+		const struct native_program_desc *desc)
+{
+	unsigned int i;
+
+	if (desc->n_sources != prg->n_sources)
+		return false;
+
+	for (i = 0; i < prg->n_sources; i++) {
+		if (desc->sources[i] != prg->sources[i])
+			return false;
+	}
+
+	return true;
+}
+
+/* Build log naming the variants that exist for these sources, if any */
+static char *
+native_program_log(cl_program prg, const char *defines)
+{
+	const struct native_program_desc *desc;
+	size_t len, pos;
+	unsigned int i;
+	char *log;
+
+	len = 256 + strlen(defines);
+	for (i = 0; i < registry.n; i++)
+		len += strlen(registry.desc[i]->defines) + 8;
+
+	log = malloc(len);
+	if (!log)
+		return NULL;
+
+	pos = snprintf(log, len, "Native: no variant of this program was "
+			"built with defines \"%s\".\n", defines);
+
+	for (i = 0; i < registry.n; i++) {
+		desc = registry.desc[i];
+		if (!native_program_sources_match(prg, desc))
+			continue;
+
+		pos += snprintf(&log[pos], len - pos, "\t\"%s\"\n",
+				desc->defines);
+	}
+
+	snprintf(&log[pos], len - pos, "Add it with claxon_native_program() "
+			"in CMakeLists.txt.\n");
+
+	return log;
+}
+
+cl_int
+clBuildProgram(cl_program program, cl_uint num_devices,
+		const cl_device_id *device_list, const char *options,
+		void (CL_CALLBACK *pfn_notify)(cl_program, void *),
+		void *user_data)
+{
+	const struct native_program_desc *desc;
+	char defines[1024];
+	unsigned int i;
+
+	if (!program)
+		return CL_INVALID_PROGRAM;
+
+	free(program->options);
+	free(program->log);
+	program->options = strdup(options ? options : "");
+	program->log = NULL;
+	program->desc = NULL;
+
+	if (native_defines(options, defines, sizeof(defines))) {
+		program->status = CL_BUILD_ERROR;
+		program->log = strdup("Native: too many defines\n");
+		return CL_INVALID_BUILD_OPTIONS;
+	}
+
+	pthread_mutex_lock(&registry.lock);
+	for (i = 0; i < registry.n; i++) {
+		desc = registry.desc[i];
+		if (native_program_sources_match(program, desc) &&
+		    !strcmp(desc->defines, defines)) {
+			program->desc = desc;
+			break;
+		}
+	}
+
+	if (!program->desc)
+		program->log = native_program_log(program, defines);
+	pthread_mutex_unlock(&registry.lock);
+
+	if (!program->desc) {
+		program->status = CL_BUILD_ERROR;
+		return CL_BUILD_PROGRAM_FAILURE;
+	}
+
+	program->status = CL_BUILD_SUCCESS;
+	program->log = strdup("");
+
+	if (pfn_notify)
+		pfn_notify(program, user_data);
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clGetProgramInfo(cl_program program, cl_program_info param_name,
+		size_t param_value_size, void *param_value,
+		size_t *param_value_size_ret)
+{
+	const struct native_program_desc *desc;
+	cl_uint one = 1;
+	size_t n, len = 1, pos = 0, zero = 0;
+	char *names;
+	cl_int ret;
+
+	if (!program)
+		return CL_INVALID_PROGRAM;
+
+	switch (param_name) {
+	case CL_PROGRAM_NUM_DEVICES:
+		return native_info(&one, sizeof(cl_uint), param_value_size,
+				param_value, param_value_size_ret);
+	case CL_PROGRAM_BINARY_SIZES:
+		/* Compiled ahead of time, there is no binary to hand out */
+		return native_info(&zero, sizeof(size_t), param_value_size,
+				param_value, param_value_size_ret);
+	case CL_PROGRAM_NUM_KERNELS:
+	case CL_PROGRAM_KERNEL_NAMES:
+		break;
+	default:
+		return CL_INVALID_VALUE;
+	}
+
+	desc = program->desc;
+	if (!desc)
+		return CL_INVALID_PROGRAM_EXECUTABLE;
+
+	if (param_name == CL_PROGRAM_NUM_KERNELS) {
+		n = desc->n_kernels;
+		return native_info(&n, sizeof(size_t), param_value_size,
+				param_value, param_value_size_ret);
+	}
+
+	/* Semicolon separated kernel names */
+	for (n = 0; n < desc->n_kernels; n++)
+		len += strlen(desc->kernels[n].name) + 1;
+
+	names = malloc(len);
+	if (!names)
+		return CL_OUT_OF_HOST_MEMORY;
+
+	names[0] = '\0';
+	for (n = 0; n < desc->n_kernels; n++)
+		pos += snprintf(&names[pos], len - pos, "%s%s", n ? ";" : "",
+				desc->kernels[n].name);
+
+	ret = native_info(names, pos + 1, param_value_size, param_value,
+			param_value_size_ret);
+	free(names);
+
+	return ret;
+}
+
+cl_int
+clGetProgramBuildInfo(cl_program program, cl_device_id device,
+		cl_program_build_info param_name, size_t param_value_size,
+		void *param_value, size_t *param_value_size_ret)
+{
+	const char *str;
+
+	if (!program)
+		return CL_INVALID_PROGRAM;
+
+	switch (param_name) {
+	case CL_PROGRAM_BUILD_STATUS:
+		return native_info(&program->status, sizeof(cl_build_status),
+				param_value_size, param_value,
+				param_value_size_ret);
+	case CL_PROGRAM_BUILD_OPTIONS:
+		str = program->options;
+		break;
+	case CL_PROGRAM_BUILD_LOG:
+		str = program->log;
+		break;
+	default:
+		return CL_INVALID_VALUE;
+	}
+
+	if (!str)
+		str = "";
+
+	return native_info(str, strlen(str) + 1, param_value_size,
+			param_value, param_value_size_ret);
+}
+
+cl_int
+clReleaseProgram(cl_program program)
+{
+	if (!program)
+		return CL_INVALID_PROGRAM;
+
+	free(program->sources);
+	free(program->options);
+	free(program->log);
+	free(program);
+
+	return CL_SUCCESS;
+}
+
+/*
+ * Kernels
+ */
+
+cl_kernel
+clCreateKernel(cl_program program, const char *kernel_name,
+		cl_int *errcode_ret)
+{
+	const struct native_program_desc *desc;
+	cl_kernel kernel;
+	size_t off = 0;
+	unsigned int i, k;
+
+	if (!program) {
+		native_error(errcode_ret, CL_INVALID_PROGRAM);
+		return NULL;
+	}
+
+	desc = program->desc;
+	if (!desc) {
+		native_error(errcode_ret, CL_INVALID_PROGRAM_EXECUTABLE);
+		return NULL;
+	}
+
+	for (k = 0; k < desc->n_kernels; k++) {
+		if (!strcmp(desc->kernels[k].name, kernel_name))
+			break;
+	}
+
+	if (k == desc->n_kernels) {
+		native_error(errcode_ret, CL_INVALID_KERNEL_NAME);
+		return NULL;
+	}
+
+	kernel = calloc(1, sizeof(struct _cl_kernel));
+	if (!kernel)
+		goto error;
+
+	kernel->prg = program;
+	kernel->desc = desc;
+	kernel->k = k;
+	kernel->kinds = desc->kernels[k].args;
+	kernel->n_args = strlen(kernel->kinds);
+
+	kernel->sizes = calloc(kernel->n_args + 1, sizeof(size_t));
+	kernel->local = calloc(kernel->n_args + 1, sizeof(size_t));
+	kernel->set = calloc(kernel->n_args + 1, sizeof(bool));
+	kernel->argv = calloc(kernel->n_args + 1, sizeof(void *));
+	if (!kernel->sizes || !kernel->local || !kernel->set || !kernel->argv)
+		goto error;
+
+	desc->sizes(k, kernel->sizes);
+
+	/* One aligned slot per argument, __local ones hold a pointer that is
+	 * only filled in at launch */
+	for (i = 0; i < kernel->n_args; i++) {
+		if (kernel->kinds[i] == NATIVE_ARG_VALUE)
+			off += NATIVE_ROUNDUP(kernel->sizes[i], NATIVE_ALIGN);
+		else
+			off += NATIVE_ALIGN;
+	}
+
+	if (off && posix_memalign(&kernel->vals, NATIVE_ALIGN, off))
+		goto error;
+
+	off = 0;
+	for (i = 0; i < kernel->n_args; i++) {
+		kernel->argv[i] = (char *) kernel->vals + off;
+		if (kernel->kinds[i] == NATIVE_ARG_VALUE)
+			off += NATIVE_ROUNDUP(kernel->sizes[i], NATIVE_ALIGN);
+		else
+			off += NATIVE_ALIGN;
+	}
+
+	native_error(errcode_ret, CL_SUCCESS);
+
+	return kernel;
+
+error:
+	if (kernel) {
+		free(kernel->sizes);
+		free(kernel->local);
+		free(kernel->set);
+		free(kernel->argv);
+		free(kernel);
+	}
+	native_error(errcode_ret, CL_OUT_OF_HOST_MEMORY);
+	return NULL;
+}
+
+cl_int
+clReleaseKernel(cl_kernel kernel)
+{
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+
+	free(kernel->sizes);
+	free(kernel->local);
+	free(kernel->set);
+	free(kernel->argv);
+	free(kernel->vals);
+	free(kernel);
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clSetKernelArg(cl_kernel kernel, cl_uint arg_index, size_t arg_size,
+		const void *arg_value)
+{
+	cl_mem mem;
+
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+	if (arg_index >= kernel->n_args)
+		return CL_INVALID_ARG_INDEX;
+
+	switch (kernel->kinds[arg_index]) {
+	case NATIVE_ARG_GLOBAL:
+		if (arg_size != sizeof(cl_mem))
+			return CL_INVALID_ARG_SIZE;
+
+		mem = arg_value ? *(const cl_mem *) arg_value : NULL;
+		*(void **) kernel->argv[arg_index] = mem ? mem->ptr : NULL;
+		break;
+	case NATIVE_ARG_LOCAL:
+		if (arg_value)
+			return CL_INVALID_ARG_VALUE;
+		if (arg_size == 0)
+			return CL_INVALID_ARG_SIZE;
+
+		kernel->local[arg_index] = arg_size;
+		break;
+	default:
+		if (!arg_value)
+			return CL_INVALID_ARG_VALUE;
+		if (arg_size != kernel->sizes[arg_index])
+			return CL_INVALID_ARG_SIZE;
+
+		memcpy(kernel->argv[arg_index], arg_value, arg_size);
+		break;
+	}
+
+	kernel->set[arg_index] = true;
+
+	return CL_SUCCESS;
+}
+
+cl_int
+clSetKernelArgSVMPointer(cl_kernel kernel, cl_uint arg_index,
+		const void *arg_value)
+{
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+	if (arg_index >= kernel->n_args)
+		return CL_INVALID_ARG_INDEX;
+	if (kernel->kinds[arg_index] != NATIVE_ARG_GLOBAL)
+		return CL_INVALID_ARG_VALUE;
+
+	*(const void **) kernel->argv[arg_index] = arg_value;
+	kernel->set[arg_index] = true;
+
+	return CL_SUCCESS;
+}
+
+static size_t
+native_kernel_local_mem(cl_kernel kernel)
+{
+	size_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < kernel->n_args; i++)
+		size += NATIVE_ROUNDUP(kernel->local[i], NATIVE_ALIGN);
+
+	return size;
+}
+
+cl_int
+clGetKernelInfo(cl_kernel kernel, cl_kernel_info param_name,
+		size_t param_value_size, void *param_value,
+		size_t *param_value_size_ret)
+{
+	const char *name;
+
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+
+	switch (param_name) {
+	case CL_KERNEL_FUNCTION_NAME:
+		name = kernel->desc->kernels[kernel->k].name;
+		return native_info(name, strlen(name) + 1, param_value_size,
+				param_value, param_value_size_ret);
+	case CL_KERNEL_NUM_ARGS:
+		return native_info(&kernel->n_args, sizeof(cl_uint),
+				param_value_size, param_value,
+				param_value_size_ret);
+	case CL_KERNEL_PROGRAM:
+		return native_info(&kernel->prg, sizeof(cl_program),
+				param_value_size, param_value,
+				param_value_size_ret);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+/* Argument info is always available, -cl-kernel-arg-info is implied */
+cl_int
+clGetKernelArgInfo(cl_kernel kernel, cl_uint arg_index,
+		cl_kernel_arg_info param_name, size_t param_value_size,
+		void *param_value, size_t *param_value_size_ret)
+{
+	cl_kernel_arg_address_qualifier aq;
+
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+
+	if (arg_index >= kernel->n_args)
+		return CL_INVALID_ARG_INDEX;
+
+	if (param_name != CL_KERNEL_ARG_ADDRESS_QUALIFIER)
+		return CL_KERNEL_ARG_INFO_NOT_AVAILABLE;
+
+	switch (kernel->kinds[arg_index]) {
+	case NATIVE_ARG_GLOBAL:
+		aq = CL_KERNEL_ARG_ADDRESS_GLOBAL;
+		break;
+	case NATIVE_ARG_LOCAL:
+		aq = CL_KERNEL_ARG_ADDRESS_LOCAL;
+		break;
+	default:
+		aq = CL_KERNEL_ARG_ADDRESS_PRIVATE;
+		break;
+	}
+
+	return native_info(&aq, sizeof(aq), param_value_size, param_value,
+			param_value_size_ret);
+}
+
+cl_int
+clGetKernelWorkGroupInfo(cl_kernel kernel, cl_device_id device,
+		cl_kernel_work_group_info param_name, size_t param_value_size,
+		void *param_value, size_t *param_value_size_ret)
+{
+	size_t sz[3] = {0, 0, 0};
+	cl_ulong ul;
+
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+
+	switch (param_name) {
+	case CL_KERNEL_WORK_GROUP_SIZE:
+		sz[0] = NATIVE_WG_MAX;
+		return native_info(sz, sizeof(size_t), param_value_size,
+				param_value, param_value_size_ret);
+	case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE:
+		sz[0] = 1;
+		return native_info(sz, sizeof(size_t), param_value_size,
+				param_value, param_value_size_ret);
+	case CL_KERNEL_COMPILE_WORK_GROUP_SIZE:
+		return native_info(sz, sizeof(sz), param_value_size,
+				param_value, param_value_size_ret);
+	case CL_KERNEL_LOCAL_MEM_SIZE:
+		ul = native_kernel_local_mem(kernel);
+		break;
+	case CL_KERNEL_PRIVATE_MEM_SIZE:
+		ul = 0;
+		break;
+	default:
+		return CL_INVALID_VALUE;
+	}
+
+	return native_info(&ul, sizeof(ul), param_value_size, param_value,
+			param_value_size_ret);
+}
+
+/*
+ * Execution
+ */
+
+static bool
+native_kernel_flag(cl_kernel kernel, unsigned int flag)
+{
+	return !!(kernel->desc->kernels[kernel->k].flags & flag);
+}
+
+unsigned int
+claxon_native_work_dim(void)
+{
+	return item.l->dim;
+}
+
+size_t
+claxon_native_global_size(unsigned int dim)
+{
+	return dim < item.l->dim ? item.l->global[dim] : 1;
+}
+
+size_t
+claxon_native_global_id(unsigned int dim)
+{
+	if (dim >= item.l->dim)
+		return 0;
+
+	return item.l->offset[dim] + item.group[dim] * item.l->local[dim] +
+			item.local[dim];
+}
+
+size_t
+claxon_native_global_offset(unsigned int dim)
+{
+	return dim < item.l->dim ? item.l->offset[dim] : 0;
+}
+
+size_t
+claxon_native_local_size(unsigned int dim)
+{
+	return dim < item.l->dim ? item.l->local[dim] : 1;
+}
+
+size_t
+claxon_native_local_id(unsigned int dim)
+{
+	return dim < 3 ? item.local[dim] : 0;
+}
+
+size_t
+claxon_native_num_groups(unsigned int dim)
+{
+	return dim < item.l->dim ? item.l->groups[dim] : 1;
+}
+
+size_t
+claxon_native_group_id(unsigned int dim)
+{
+	return dim < 3 ? item.group[dim] : 0;
+}
+
+static void
+native_item_local(const struct native_launch *l, size_t i)
+{
+	item.local[0] = i % l->local[0];
+	item.local[1] = (i / l->local[0]) % l->local[1];
+	item.local[2] = i / (l->local[0] * l->local[1]);
+}
+
+void
+claxon_native_barrier(void)
+{
+	struct native_fibers *f = item.fibers;
+
+	if (!f) {
+		fprintf(stderr, "Native: barrier() in a kernel not marked as "
+				"calling it\n");
+		abort();
+	}
+
+	native_ctx_switch(&f->ctx[item.fiber], &f->sched);
+}
+
+/* A fiber runs its work-item of every work-group the thread executes. Between
+ * groups it waits in native_ctx_switch(). */
+static void
+native_fiber(void)
+{
+	struct native_fibers *f = item.fibers;
+	const struct native_launch *l = item.l;
+
+	while (true) {
+		l->kernel->desc->dispatch(l->kernel->k, item.argv);
+		f->done[item.fiber] = true;
+		native_ctx_switch(&f->ctx[item.fiber], &f->sched);
+	}
+}
+
+#if defined(__x86_64__) && defined(__LP64__)
+static void
+native_ctx_init(native_ctx *ctx, char *stack, size_t size)
+{
+	void **sp = (void **) &stack[size];
+	unsigned int i;
+
+	/* Frame as left by native_ctx_switch(), returning into native_fiber()
+	 * with the stack aligned as if it were called */
+	*--sp = NULL;
+	*--sp = (void *) native_fiber;
+	for (i = 0; i < 6; i++)
+		*--sp = NULL;
+
+	*ctx = sp;
+}
+#else
+void
+native_ctx_switch(native_ctx *from, native_ctx *to)
+{
+	swapcontext(from, to);
+}
+
+static void
+native_ctx_init(native_ctx *ctx, char *stack, size_t size)
+{
+	getcontext(ctx);
+	ctx->uc_stack.ss_sp = stack;
+	ctx->uc_stack.ss_size = size;
+	ctx->uc_link = NULL;
+	makecontext(ctx, native_fiber, 0);
+}
+#endif
+
+static int
+native_fibers_alloc(struct native_fibers *f, size_t n)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	f->n = n;
+	f->stack_len = NATIVE_STACK_SIZE + page;
+	f->ctx = calloc(n, sizeof(native_ctx));
+	f->done = calloc(n, sizeof(bool));
+	f->stacks = mmap(NULL, n * f->stack_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (f->stacks == MAP_FAILED)
+		f->stacks = NULL;
+	if (!f->ctx || !f->done || !f->stacks)
+		return -1;
+
+	/* Guard page below each stack */
+	for (i = 0; i < n; i++) {
+		mprotect(&f->stacks[i * f->stack_len], page, PROT_NONE);
+		native_ctx_init(&f->ctx[i], &f->stacks[i * f->stack_len + page],
+				NATIVE_STACK_SIZE);
+	}
+
+	return 0;
+}
+
+static void
+native_fibers_free(struct native_fibers *f)
+{
+	if (f->stacks)
+		munmap(f->stacks, f->n * f->stack_len);
+	free(f->ctx);
+	free(f->done);
+}
+
+static void
+native_group_run(const struct native_launch *l, size_t g)
+{
+	struct native_fibers *f = item.fibers;
+	const struct native_program_desc *desc = l->kernel->desc;
+	unsigned int k = l->kernel->k;
+	size_t i, live;
+
+	item.group[0] = g % l->groups[0];
+	item.group[1] = (g / l->groups[0]) % l->groups[1];
+	item.group[2] = g / (l->groups[0] * l->groups[1]);
+
+	if (!f) {
+		for (i = 0; i < l->n_items; i++) {
+			native_item_local(l, i);
+			desc->dispatch(k, item.argv);
+		}
+		return;
+	}
+
+	/* Round-robin, each pass moves all work-items to the next barrier */
+	memset(f->done, 0, l->n_items * sizeof(bool));
+	for (live = l->n_items; live; ) {
+		for (i = 0; i < l->n_items; i++) {
+			if (f->done[i])
+				continue;
+
+			native_item_local(l, i);
+			item.fiber = i;
+			native_ctx_switch(&f->sched, &f->ctx[i]);
+			if (f->done[i])
+				live--;
+		}
+	}
+}
+
+/* Execute work-groups of a launch until none are left */
+static void
+native_launch_run(struct native_launch *l)
+{
+	cl_kernel kernel = l->kernel;
+	struct native_fibers fibers;
+	void *argv[kernel->n_args + 1];
+	void *lptr[kernel->n_args + 1];
+	char *lmem = NULL;
+	size_t g, off = 0;
+	unsigned int i;
+
+	memset(&fibers, 0, sizeof(fibers));
+	item.l = l;
+	item.argv = argv;
+	item.fibers = NULL;
+
+	if (l->local_mem && posix_memalign((void **) &lmem, NATIVE_ALIGN,
+			l->local_mem))
+		goto error;
+
+	for (i = 0; i < kernel->n_args; i++) {
+		if (kernel->kinds[i] != NATIVE_ARG_LOCAL) {
+			argv[i] = kernel->argv[i];
+			continue;
+		}
+
+		lptr[i] = &lmem[off];
+		argv[i] = &lptr[i];
+		off += NATIVE_ROUNDUP(kernel->local[i], NATIVE_ALIGN);
+	}
+
+	if (native_kernel_flag(kernel, NATIVE_KERNEL_BARRIER)) {
+		if (native_fibers_alloc(&fibers, l->n_items))
+			goto error;
+		item.fibers = &fibers;
+	}
+
+	while ((g = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED)) <
+			l->n_groups)
+		native_group_run(l, g);
+
+	native_fibers_free(&fibers);
+	free(lmem);
+	item.fibers = NULL;
+	item.l = NULL;
+	return;
+
+error:
+	native_fibers_free(&fibers);
+	free(lmem);
+	item.fibers = NULL;
+	item.l = NULL;
+	__atomic_store_n(&l->error, CL_OUT_OF_HOST_MEMORY, __ATOMIC_RELAXED);
+}
+
+static void *
+native_worker(void *arg)
+{
+	unsigned int id = (uintptr_t) arg;
+	unsigned long gen = 0ul;
+	struct native_launch *l;
+
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		while (pool.gen == gen)
+			pthread_cond_wait(&pool.wake, &pool.lock);
+
+		gen = pool.gen;
+		l = pool.launch;
+		if (id >= l->helpers)
+			continue;
+
+		pthread_mutex_unlock(&pool.lock);
+		native_launch_run(l);
+		pthread_mutex_lock(&pool.lock);
+
+		if (--pool.busy == 0)
+			pthread_cond_signal(&pool.idle);
+	}
+
+	return NULL;
+}
+
+/* Worker threads don't survive fork(), the child starts a new pool */
+static void
+native_pool_atfork(void)
+{
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.wake, NULL);
+	pthread_cond_init(&pool.idle, NULL);
+	pool.threads = 0;
+	pool.gen = 0ul;
+	pool.busy = 0;
+}
+
+static unsigned int
+native_pool_start(unsigned int threads)
+{
+	static bool atfork = false;
+	pthread_attr_t attr;
+	pthread_t t;
+
+	if (!atfork) {
+		pthread_atfork(NULL, NULL, native_pool_atfork);
+		atfork = true;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (pool.threads < threads) {
+		if (pthread_create(&t, &attr, native_worker,
+				(void *) (uintptr_t) pool.threads))
+			break;
+		pool.threads++;
+	}
+	pthread_attr_destroy(&attr);
+
+	return pool.threads;
+}
+
+static cl_int
+native_launch(cl_device_id dev, struct native_launch *l)
+{
+	unsigned int helpers = 0;
+
+	if (!native_kernel_flag(l->kernel, NATIVE_KERNEL_SERIAL) &&
+	    dev->threads > 1 && l->n_groups > 1) {
+		helpers = dev->threads - 1;
+		if (helpers > l->n_groups - 1)
+			helpers = l->n_groups - 1;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	if (helpers > pool.threads)
+		helpers = native_pool_start(helpers);
+
+	l->helpers = helpers;
+	pool.launch = l;
+	pool.busy = helpers;
+	pool.gen++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+
+	native_launch_run(l);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.busy)
+		pthread_cond_wait(&pool.idle, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+
+	return l->error;
+}
+
+/* Largest divisor of n up to max, the local size picked for NULL */
+static size_t
+native_local_size(size_t n, size_t max)
+{
+	size_t d;
+
+	for (d = (n < max ? n : max); d > 1; d--) {
+		if (n % d == 0)
+			return d;
+	}
+
+	return 1;
+}
+
+cl_int
+clEnqueueNDRangeKernel(cl_command_queue command_queue, cl_kernel kernel,
+		cl_uint work_dim, const size_t *global_work_offset,
+		const size_t *global_work_size,
+		const size_t *local_work_size,
+		cl_uint num_events_in_wait_list,
+		const cl_event *event_wait_list, cl_event *event)
+{
+	cl_ulong start = native_time_ns();
+	struct native_launch l;
+	unsigned int d;
+	cl_int error;
+
+	if (!command_queue)
+		return CL_INVALID_COMMAND_QUEUE;
+	if (!kernel)
+		return CL_INVALID_KERNEL;
+	if (work_dim < 1 || work_dim > 3)
+		return CL_INVALID_WORK_DIMENSION;
+	if (!global_work_size)
+		return CL_INVALID_GLOBAL_WORK_SIZE;
+
+	for (d = 0; d < kernel->n_args; d++) {
+		if (!kernel->set[d])
+			return CL_INVALID_KERNEL_ARGS;
+	}
+
+	memset(&l, 0, sizeof(l));
+	l.kernel = kernel;
+	l.dim = work_dim;
+	l.n_groups = 1;
+	l.n_items = 1;
+
+	for (d = 0; d < 3; d++) {
+		if (d >= work_dim) {
+			l.global[d] = 1;
+			l.local[d] = 1;
+		} else {
+			if (global_work_size[d] == 0)
+				return CL_INVALID_GLOBAL_WORK_SIZE;
+
+			l.global[d] = global_work_size[d];
+			if (global_work_offset)
+				l.offset[d] = global_work_offset[d];
+
+			if (local_work_size)
+				l.local[d] = local_work_size[d];
+			else if (d == 0)
+				l.local[d] = native_local_size(l.global[d],
+						64);
+			else
+				l.local[d] = 1;
+		}
+
+		if (l.local[d] == 0 || l.global[d] % l.local[d])
+			return CL_INVALID_WORK_GROUP_SIZE;
+
+		l.groups[d] = l.global[d] / l.local[d];
+		l.n_groups *= l.groups[d];
+		l.n_items *= l.local[d];
+	}
+
+	if (l.n_items > NATIVE_WG_MAX)
+		return CL_INVALID_WORK_GROUP_SIZE;
+
+	l.local_mem = native_kernel_local_mem(kernel);
+	if (l.local_mem > NATIVE_LOCAL_MEM)
+		return CL_OUT_OF_RESOURCES;
+
+	error = native_launch(command_queue->dev, &l);
+	if (error != CL_SUCCESS)
+		return error;
+
+	return native_event(event, start);
+}
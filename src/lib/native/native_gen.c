@@ -0,0 +1,791 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Build-time helper for the CLAXON_NATIVE backend.
+ *
+ * Reads a program variant that clang preprocessed against clc.h, finds its
+ * kernels and their parameters, and writes
+ * - an OpenCL C file that includes the preprocessed source and adds an entry
+ *   point calling each kernel from an array of argument pointers,
+ * - a C file describing the variant to the runtime, see lib/native.h.
+ *
+ * This is a token scanner, not a parser. It relies on kernels being written
+ * as plain function definitions, which holds for all of CLaxon.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "lib/native.h"
+
+enum tok_type {
+	TOK_IDENT,
+	TOK_NUMBER,
+	TOK_STRING,
+	TOK_PUNCT,
+};
+
+struct tok {
+	enum tok_type type;
+	const char *s;
+	size_t len;
+};
+
+struct func {
+	size_t name;
+	size_t params;		/* First token after ( */
+	size_t params_end;	/* Matching ) */
+	size_t body;		/* { */
+	size_t body_end;	/* Matching } */
+	bool kernel;
+	int sym;
+};
+
+/* Function names, shared by overloads, with the barrier property */
+struct sym {
+	const char *s;
+	size_t len;
+	bool barrier;
+};
+
+static struct {
+	char *src;
+	struct tok *tok;
+	size_t n_tok;
+
+	struct func *func;
+	size_t n_func;
+
+	struct sym *sym;
+	size_t n_sym;
+	int *sym_hash;
+	size_t sym_hash_size;
+} gen;
+
+static char *
+gen_read(const char *file, size_t *len)
+{
+	FILE *fp;
+	char *buf;
+	long size;
+
+	fp = fopen(file, "rb");
+	if (!fp) {
+		fprintf(stderr, "native_gen: cannot open %s\n", file);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf = malloc(size + 1);
+	if (!buf) {
+		fclose(fp);
+		return NULL;
+	}
+
+	if (fread(buf, 1, size, fp) != (size_t) size) {
+		fprintf(stderr, "native_gen: cannot read %s\n", file);
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+	buf[size] = '\0';
+	fclose(fp);
+
+	if (len)
+		*len = size;
+
+	return buf;
+}
+
+static bool
+tok_is(size_t i, const char *s)
+{
+	return i < gen.n_tok && gen.tok[i].len == strlen(s) &&
+			!memcmp(gen.tok[i].s, s, gen.tok[i].len);
+}
+
+static bool
+tok_is_punct(size_t i, char c)
+{
+	return i < gen.n_tok && gen.tok[i].type == TOK_PUNCT &&
+			gen.tok[i].s[0] == c;
+}
+
+static int
+tok_push(enum tok_type type, const char *s, size_t len)
+{
+	static size_t size = 0;
+	struct tok *t;
+
+	if (gen.n_tok == size) {
+		size = size ? 2 * size : 65536;
+		t = realloc(gen.tok, size * sizeof(struct tok));
+		if (!t)
+			return -1;
+		gen.tok = t;
+	}
+
+	gen.tok[gen.n_tok].type = type;
+	gen.tok[gen.n_tok].s = s;
+	gen.tok[gen.n_tok].len = len;
+	gen.n_tok++;
+
+	return 0;
+}
+
+/* Split preprocessed source into tokens, skipping line markers and pragmas */
+static int
+gen_tokenize(const char *p)
+{
+	bool line_start = true;
+	const char *s;
+	char q;
+
+	while (*p) {
+		if (*p == '\n') {
+			line_start = true;
+			p++;
+			continue;
+		}
+
+		if (isspace((unsigned char) *p)) {
+			p++;
+			continue;
+		}
+
+		if (line_start && *p == '#') {
+			p += strcspn(p, "\n");
+			continue;
+		}
+		line_start = false;
+
+		s = p;
+		if (p[0] == '/' && p[1] == '/') {
+			p += strcspn(p, "\n");
+		} else if (p[0] == '/' && p[1] == '*') {
+			p = strstr(p + 2, "*/");
+			if (!p)
+				return -1;
+			p += 2;
+		} else if (isalpha((unsigned char) *p) || *p == '_') {
+			while (isalnum((unsigned char) *p) || *p == '_')
+				p++;
+			if (tok_push(TOK_IDENT, s, p - s))
+				return -1;
+		} else if (isdigit((unsigned char) *p) ||
+			   (*p == '.' && isdigit((unsigned char) p[1]))) {
+			while (isalnum((unsigned char) *p) || *p == '.' ||
+			       *p == '_' || ((*p == '+' || *p == '-') &&
+			       (p[-1] == 'e' || p[-1] == 'E' ||
+			        p[-1] == 'p' || p[-1] == 'P')))
+				p++;
+			if (tok_push(TOK_NUMBER, s, p - s))
+				return -1;
+		} else if (*p == '"' || *p == '\'') {
+			q = *p++;
+			while (*p && *p != q) {
+				if (*p == '\\' && p[1])
+					p++;
+				p++;
+			}
+			if (*p)
+				p++;
+			if (tok_push(TOK_STRING, s, p - s))
+				return -1;
+		} else {
+			p++;
+			if (tok_push(TOK_PUNCT, s, 1))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Index of the token closing the bracket opened at token i */
+static size_t
+tok_match(size_t i)
+{
+	char open = gen.tok[i].s[0];
+	char close = open == '(' ? ')' : open == '[' ? ']' : '}';
+	int depth = 0;
+
+	for (; i < gen.n_tok; i++) {
+		if (tok_is_punct(i, open))
+			depth++;
+		else if (tok_is_punct(i, close) && --depth == 0)
+			return i;
+	}
+
+	return gen.n_tok;
+}
+
+/* Index of the token opening the bracket closed at token i */
+static size_t
+tok_match_back(size_t i)
+{
+	char close = gen.tok[i].s[0];
+	char open = close == ')' ? '(' : close == ']' ? '[' : '{';
+	int depth = 0;
+
+	for (;; i--) {
+		if (tok_is_punct(i, close))
+			depth++;
+		else if (tok_is_punct(i, open) && --depth == 0)
+			return i;
+		if (i == 0)
+			return gen.n_tok;
+	}
+}
+
+static unsigned int
+sym_hash(const char *s, size_t len)
+{
+	return (unsigned int) native_hash(s, len);
+}
+
+/* Look up or insert a function name */
+static int
+sym_get(size_t t)
+{
+	const char *s = gen.tok[t].s;
+	size_t len = gen.tok[t].len;
+	size_t h, mask = gen.sym_hash_size - 1;
+	struct sym *sym;
+	int i;
+
+	for (h = sym_hash(s, len) & mask;; h = (h + 1) & mask) {
+		i = gen.sym_hash[h];
+		if (i < 0)
+			break;
+		if (gen.sym[i].len == len && !memcmp(gen.sym[i].s, s, len))
+			return i;
+	}
+
+	/* Functions are inserted as they are defined, so there are at most
+	 * as many symbols as there are function definitions. */
+	sym = &gen.sym[gen.n_sym];
+	sym->s = s;
+	sym->len = len;
+	sym->barrier = false;
+	gen.sym_hash[h] = gen.n_sym;
+
+	return gen.n_sym++;
+}
+
+/* Existing function name, -1 if no function of that name is defined */
+static int
+sym_find(size_t t)
+{
+	const char *s = gen.tok[t].s;
+	size_t len = gen.tok[t].len;
+	size_t h, mask = gen.sym_hash_size - 1;
+	int i;
+
+	for (h = sym_hash(s, len) & mask;; h = (h + 1) & mask) {
+		i = gen.sym_hash[h];
+		if (i < 0)
+			return -1;
+		if (gen.sym[i].len == len && !memcmp(gen.sym[i].s, s, len))
+			return i;
+	}
+}
+
+/* Collect every function definition at file scope */
+static int
+gen_functions(void)
+{
+	size_t i, stmt = 0, lp, name, end, j;
+	struct func *f;
+
+	gen.func = malloc(gen.n_tok * sizeof(struct func));
+	if (!gen.func)
+		return -1;
+
+	for (i = 0; i < gen.n_tok; i++) {
+		if (tok_is_punct(i, ';')) {
+			stmt = i + 1;
+			continue;
+		}
+
+		if (tok_is_punct(i, '(')) {
+			i = tok_match(i);
+			continue;
+		}
+
+		if (!tok_is_punct(i, '{'))
+			continue;
+
+		end = tok_match(i);
+		if (end == gen.n_tok) {
+			fprintf(stderr, "native_gen: unbalanced braces\n");
+			return -1;
+		}
+
+		/* Struct, union, enum or initialiser */
+		if (i == 0 || !tok_is_punct(i - 1, ')')) {
+			i = end;
+			continue;
+		}
+
+		lp = tok_match_back(i - 1);
+		if (lp == gen.n_tok || lp == 0 ||
+		    gen.tok[lp - 1].type != TOK_IDENT) {
+			i = end;
+			continue;
+		}
+		name = lp - 1;
+
+		f = &gen.func[gen.n_func++];
+		f->name = name;
+		f->params = lp + 1;
+		f->params_end = i - 1;
+		f->body = i;
+		f->body_end = end;
+		f->kernel = false;
+		for (j = stmt; j < name; j++) {
+			if (tok_is(j, "__kernel") || tok_is(j, "kernel"))
+				f->kernel = true;
+		}
+
+		i = end;
+		stmt = end + 1;
+	}
+
+	return 0;
+}
+
+/* Flag every function that reaches claxon_native_barrier() */
+static int
+gen_barriers(void)
+{
+	size_t i, t;
+	bool changed;
+	int s;
+
+	gen.sym_hash_size = 1;
+	while (gen.sym_hash_size < 2 * gen.n_func + 2)
+		gen.sym_hash_size <<= 1;
+
+	gen.sym = malloc((gen.n_func + 1) * sizeof(struct sym));
+	gen.sym_hash = malloc(gen.sym_hash_size * sizeof(int));
+	if (!gen.sym || !gen.sym_hash)
+		return -1;
+	memset(gen.sym_hash, 0xff, gen.sym_hash_size * sizeof(int));
+
+	for (i = 0; i < gen.n_func; i++)
+		gen.func[i].sym = sym_get(gen.func[i].name);
+
+	do {
+		changed = false;
+		for (i = 0; i < gen.n_func; i++) {
+			if (gen.sym[gen.func[i].sym].barrier)
+				continue;
+
+			for (t = gen.func[i].body; t < gen.func[i].body_end;
+			     t++) {
+				if (gen.tok[t].type != TOK_IDENT ||
+				    !tok_is_punct(t + 1, '('))
+					continue;
+
+				if (!tok_is(t, "claxon_native_barrier")) {
+					s = sym_find(t);
+					if (s < 0 || !gen.sym[s].barrier)
+						continue;
+				}
+
+				gen.sym[gen.func[i].sym].barrier = true;
+				changed = true;
+				break;
+			}
+		}
+	} while (changed);
+
+	return 0;
+}
+
+/* Does the kernel body declare a __local variable? Pointers to local memory
+ * are private variables, and don't count. */
+static bool
+gen_has_local_vars(struct func *f)
+{
+	size_t t, d;
+
+	for (t = f->body + 1; t < f->body_end; t++) {
+		if (tok_is_punct(t, '(')) {
+			t = tok_match(t);
+			continue;
+		}
+
+		if (!tok_is(t, "__local") && !tok_is(t, "local"))
+			continue;
+
+		/* A * before the declarator is complete makes it a pointer */
+		for (d = t + 1; d < f->body_end; d++) {
+			if (tok_is_punct(d, '*'))
+				break;
+			if (tok_is_punct(d, '[') || tok_is_punct(d, '=') ||
+			    tok_is_punct(d, ',') || tok_is_punct(d, ';'))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+tok_print(FILE *fp, size_t from, size_t to)
+{
+	size_t i;
+
+	for (i = from; i < to; i++)
+		fprintf(fp, "%s%.*s", i == from ? "" : " ",
+				(int) gen.tok[i].len, gen.tok[i].s);
+}
+
+struct param {
+	size_t from;	/* First token of the type */
+	size_t name;	/* Declarator name */
+	bool array;
+	char kind;
+};
+
+/* Split a kernel's parameter list. Returns the number of parameters, -1 on
+ * error. */
+static int
+gen_params(struct func *f, struct param *p, int max)
+{
+	size_t t, from = f->params, end;
+	bool ptr, local;
+	int n = 0;
+
+	if (f->params_end == f->params ||
+	    (f->params_end == f->params + 1 && tok_is(f->params, "void")))
+		return 0;
+
+	for (t = f->params; t <= f->params_end; t++) {
+		if (tok_is_punct(t, '(') || tok_is_punct(t, '[')) {
+			t = tok_match(t);
+			continue;
+		}
+		if (t < f->params_end && !tok_is_punct(t, ','))
+			continue;
+
+		if (n == max)
+			return -1;
+
+		end = t;
+		p[n].from = from;
+		p[n].array = tok_is_punct(end - 1, ']');
+		if (p[n].array)
+			end = tok_match_back(end - 1);
+		p[n].name = end - 1;
+		if (p[n].name <= from || gen.tok[p[n].name].type != TOK_IDENT) {
+			fprintf(stderr, "native_gen: cannot parse parameter "
+					"%i of %.*s\n", n,
+					(int) gen.tok[f->name].len,
+					gen.tok[f->name].s);
+			return -1;
+		}
+
+		ptr = p[n].array;
+		local = false;
+		for (end = from; end < p[n].name; end++) {
+			ptr |= tok_is_punct(end, '*');
+			local |= tok_is(end, "__local") || tok_is(end, "local");
+		}
+
+		if (!ptr)
+			p[n].kind = NATIVE_ARG_VALUE;
+		else if (local)
+			p[n].kind = NATIVE_ARG_LOCAL;
+		else
+			p[n].kind = NATIVE_ARG_GLOBAL;
+
+		n++;
+		from = t + 1;
+	}
+
+	return n;
+}
+
+/* Type of parameter p, arrays decayed to pointers */
+static void
+param_type(FILE *fp, struct param *p)
+{
+	tok_print(fp, p->from, p->name);
+	if (p->array)
+		fprintf(fp, " *");
+}
+
+#define GEN_MAX_PARAMS 64
+
+static int
+gen_dispatch(FILE *fp, const char *name, const char *in)
+{
+	struct param p[GEN_MAX_PARAMS];
+	struct func *f;
+	unsigned int k = 0;
+	size_t i;
+	int n, j;
+
+	fprintf(fp, "/* Generated by native_gen for %s, do not edit */\n\n"
+			"#include \"%s\"\n\n", name, in);
+
+	fprintf(fp, "void claxon_native_dispatch_%s(uint k, void **a)\n{\n"
+			"\tswitch (k) {\n", name);
+	for (i = 0; i < gen.n_func; i++) {
+		f = &gen.func[i];
+		if (!f->kernel)
+			continue;
+
+		n = gen_params(f, p, GEN_MAX_PARAMS);
+		if (n < 0)
+			return -1;
+
+		fprintf(fp, "\tcase %u:\n\t\t", k++);
+		tok_print(fp, f->name, f->name + 1);
+		fprintf(fp, "(");
+		for (j = 0; j < n; j++) {
+			fprintf(fp, "%s\n\t\t\t*(", j ? "," : "");
+			param_type(fp, &p[j]);
+			fprintf(fp, " *) a[%i]", j);
+		}
+		fprintf(fp, ");\n\t\tbreak;\n");
+	}
+	fprintf(fp, "\t}\n}\n\n");
+
+	k = 0;
+	fprintf(fp, "void claxon_native_sizes_%s(uint k, size_t *sz)\n{\n"
+			"\tswitch (k) {\n", name);
+	for (i = 0; i < gen.n_func; i++) {
+		f = &gen.func[i];
+		if (!f->kernel)
+			continue;
+
+		n = gen_params(f, p, GEN_MAX_PARAMS);
+		fprintf(fp, "\tcase %u:\n", k++);
+		for (j = 0; j < n; j++) {
+			fprintf(fp, "\t\tsz[%i] = ", j);
+			if (p[j].kind == NATIVE_ARG_LOCAL) {
+				fprintf(fp, "0;\n");
+				continue;
+			}
+			fprintf(fp, "sizeof(");
+			param_type(fp, &p[j]);
+			fprintf(fp, ");\n");
+		}
+		fprintf(fp, "\t\tbreak;\n");
+	}
+	fprintf(fp, "\t}\n}\n");
+
+	return 0;
+}
+
+static int
+gen_registry(FILE *fp, const char *name, const char *defines,
+		int n_src, char **src)
+{
+	struct param p[GEN_MAX_PARAMS];
+	struct func *f;
+	unsigned int flags;
+	char *buf;
+	size_t i, len;
+	int n, j;
+
+	fprintf(fp, "/* Generated by native_gen for %s, do not edit */\n\n"
+			"#include \"lib/native.h\"\n\n"
+			"void claxon_native_dispatch_%s(unsigned int k, "
+			"void **args);\n"
+			"void claxon_native_sizes_%s(unsigned int k, "
+			"size_t *sz);\n\n"
+			"static const struct native_kernel_desc "
+			"kernels[] = {\n",
+			name, name, name);
+
+	for (i = 0; i < gen.n_func; i++) {
+		f = &gen.func[i];
+		if (!f->kernel)
+			continue;
+
+		n = gen_params(f, p, GEN_MAX_PARAMS);
+		flags = 0;
+		if (gen.sym[f->sym].barrier)
+			flags |= NATIVE_KERNEL_BARRIER;
+		if (gen_has_local_vars(f))
+			flags |= NATIVE_KERNEL_SERIAL;
+
+		fprintf(fp, "\t{ \"");
+		tok_print(fp, f->name, f->name + 1);
+		fprintf(fp, "\", \"");
+		for (j = 0; j < n; j++)
+			fputc(p[j].kind, fp);
+		fprintf(fp, "\", %u },\n", flags);
+	}
+	fprintf(fp, "\t{ NULL, NULL, 0 },\n};\n\n"
+			"static const uint64_t sources[] = {\n");
+
+	for (j = 0; j < n_src; j++) {
+		buf = gen_read(src[j], &len);
+		if (!buf)
+			return -1;
+		fprintf(fp, "\t0x%016llxull, /* %s */\n",
+				(unsigned long long) native_hash(buf, len),
+				src[j]);
+		free(buf);
+	}
+
+	fprintf(fp, "};\n\n"
+			"static const struct native_program_desc program = {\n"
+			"\t.name = \"%s\",\n"
+			"\t.defines = \"%s\",\n"
+			"\t.n_sources = %i,\n"
+			"\t.sources = sources,\n"
+			"\t.n_kernels = sizeof(kernels) / "
+			"sizeof(kernels[0]) - 1,\n"
+			"\t.kernels = kernels,\n"
+			"\t.dispatch = claxon_native_dispatch_%s,\n"
+			"\t.sizes = claxon_native_sizes_%s,\n"
+			"};\n\n"
+			"static void __attribute__((constructor))\n"
+			"native_register(void)\n{\n"
+			"\tnative_program_register(&program);\n}\n",
+			name, defines, n_src, name, name);
+
+	return 0;
+}
+
+static void
+usage(const char *bin)
+{
+	fprintf(stderr, "Usage: %s -n <name> -i <preprocessed.cl> "
+			"-o <dispatch.cl> -r <registry.c> [-D <defines>] "
+			"<source.cl>...\n", bin);
+	fprintf(stderr, "\t<defines> is a ; or space separated list, "
+			"<source.cl> are the\n\tprelude and program files "
+			"in the order passed to clCreateProgramWithSource\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	char *name = NULL, *in = NULL, *out = NULL, *reg = NULL;
+	char *defs = "";
+	char opts[1024], defines[1024];
+	char *p, *d;
+	FILE *fp;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "n:i:o:r:D:")) != -1) {
+		switch (c) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'i':
+			in = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'r':
+			reg = optarg;
+			break;
+		case 'D':
+			defs = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!name || !in || !out || !reg || optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (p = name; *p; p++) {
+		if (!isalnum((unsigned char) *p) && *p != '_') {
+			fprintf(stderr, "native_gen: %s is not a valid "
+					"identifier\n", name);
+			return 1;
+		}
+	}
+
+	/* Turn the CMake list into -D options, then normalise */
+	opts[0] = '\0';
+	d = strdup(defs);
+	for (p = strtok(d, "; "); p; p = strtok(NULL, "; ")) {
+		if (strlen(opts) + strlen(p) + 5 > sizeof(opts)) {
+			fprintf(stderr, "native_gen: too many defines\n");
+			return 1;
+		}
+		strcat(opts, " -D ");
+		strcat(opts, p);
+	}
+	free(d);
+
+	if (native_defines(opts, defines, sizeof(defines))) {
+		fprintf(stderr, "native_gen: too many defines\n");
+		return 1;
+	}
+
+	gen.src = gen_read(in, NULL);
+	if (!gen.src)
+		return 1;
+
+	if (gen_tokenize(gen.src) || gen_functions() || gen_barriers()) {
+		fprintf(stderr, "native_gen: cannot scan %s\n", in);
+		return 1;
+	}
+
+	fp = fopen(out, "w");
+	if (!fp) {
+		fprintf(stderr, "native_gen: cannot write %s\n", out);
+		return 1;
+	}
+	ret = gen_dispatch(fp, name, in);
+	fclose(fp);
+	if (ret)
+		return 1;
+
+	fp = fopen(reg, "w");
+	if (!fp) {
+		fprintf(stderr, "native_gen: cannot write %s\n", reg);
+		return 1;
+	}
+	ret = gen_registry(fp, name, defines, argc - optind, &argv[optind]);
+	fclose(fp);
+
+	return ret ? 1 : 0;
+}
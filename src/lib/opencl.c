@@ -30,25 +30,112 @@
 #include <errno.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 /* We're targeting Clover amongst other APIs */
 #include "lib/opencl.h"
 #include "lib/csv.h"
+#include "lib/fanout.h"
+#include "lib/dataset.h"
+#include "lib/mem.h"
+#include "lib/roofline.h"
+#include "lib/cmdbuf.h"
+#include "lib/throughput.h"
+#include "lib/latency.h"
+#include "lib/corun.h"
+#include "lib/soak.h"
+#include "lib/cold.h"
+#include "lib/compile.h"
+#include "lib/sweep.h"
+
+/* Maximum number of entries in a sub-device partition property list */
+#define OPENCL_PARTITION_MAX 34
+
+typedef enum {
+	OPENCL_SUBDEV_ONE = 0,
+	OPENCL_SUBDEV_EACH,
+	OPENCL_SUBDEV_ALL,
+} clSubdevMode;
 
 struct {
 	int platform;
 	int device;
 	bool compare_output;
 	unsigned int iterations;
+	clPrecision precision;
+	bool precision_all;
+	bool real_enabled;
+	clIndexWidth index_mode;
+	bool index_all;
+	bool index_enabled;
+	bool idx64;
+
+	cl_device_partition_property partition[OPENCL_PARTITION_MAX];
+	bool partitioned;
+	clSubdevMode subdev_mode;
+	unsigned int subdevice;
 
 	cl_platform_id cl_platform;
 	cl_device_id cl_device;
+	cl_device_id cl_root_device;
+	cl_device_id *cl_subdevices;
+	cl_uint subdevices;
+
+	/* Statistics */
+	cl_ulong t_exec;
+	unsigned int kernels;
+	bool compared;
+	double err_abs;
+	double err_rel;
 } state = {.platform = 0, .device = 0, .compare_output = false,
-		.iterations = 10, .cl_platform = NULL, .cl_device = NULL};
+		.iterations = 10, .precision = OPENCL_PRECISION_SINGLE,
+		.precision_all = false, .real_enabled = false,
+		.index_mode = OPENCL_INDEX_AUTO, .index_all = false,
+		.index_enabled = false, .idx64 = false,
+		.partitioned = false, .subdev_mode = OPENCL_SUBDEV_ONE,
+		.subdevice = 0, .cl_platform = NULL, .cl_device = NULL,
+		.cl_root_device = NULL, .cl_subdevices = NULL,
+		.subdevices = 0, .t_exec = 0l,
+		.kernels = 0, .compared = false, .err_abs = 0.,
+		.err_rel = 0.};
 
 const char *opt_generic = "-I .";
 const char *opt_nv_sm_20 = "-I . -D NV_SM_20";
 
+const char *prelude_file = "src/lib/prelude.cl";
+
+#if defined(CLAXON_INSTRUMENT)
+static const char *opt_instrument = " -D CLAXON_INSTRUMENT";
+#else
+static const char *opt_instrument = "";
+#endif
+
+static const char *precision_names[OPENCL_PRECISION_COUNT] = {
+	[OPENCL_PRECISION_HALF] = "half",
+	[OPENCL_PRECISION_SINGLE] = "single",
+	[OPENCL_PRECISION_DOUBLE] = "double",
+};
+
+static const char *precision_opts[OPENCL_PRECISION_COUNT] = {
+	[OPENCL_PRECISION_HALF] = " -D CLAXON_REAL_HALF",
+	[OPENCL_PRECISION_SINGLE] = "",
+	[OPENCL_PRECISION_DOUBLE] = " -D CLAXON_REAL_DOUBLE",
+};
+
+static const char *precision_exts[OPENCL_PRECISION_COUNT] = {
+	[OPENCL_PRECISION_HALF] = "cl_khr_fp16",
+	[OPENCL_PRECISION_SINGLE] = NULL,
+	[OPENCL_PRECISION_DOUBLE] = "cl_khr_fp64",
+};
+
+static const char *index_names[] = {
+	[OPENCL_INDEX_AUTO] = "auto",
+	[OPENCL_INDEX_32] = "32",
+	[OPENCL_INDEX_64] = "64",
+};
+
 bool
 opencl_compare_output()
 {
@@ -61,6 +148,313 @@ opencl_get_iterations()
 	return state.iterations;
 }
 
+void
+opencl_real_enable()
+{
+	state.real_enabled = true;
+}
+
+clPrecision
+opencl_precision()
+{
+	return state.precision;
+}
+
+size_t
+opencl_real_size()
+{
+	switch (state.precision) {
+	case OPENCL_PRECISION_HALF:
+		return sizeof(cl_half);
+	case OPENCL_PRECISION_DOUBLE:
+		return sizeof(cl_double);
+	default:
+		return sizeof(cl_float);
+	}
+}
+
+/* IEEE 754 binary16 conversion, round to nearest even */
+static cl_half
+opencl_float_to_half(float f)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v = {.f = f};
+	uint32_t sign = (v.u >> 16) & 0x8000;
+	int32_t exp = ((v.u >> 23) & 0xff) - 127 + 15;
+	uint32_t mant = v.u & 0x7fffff;
+	uint32_t shift, rem, half;
+
+	/* Inf, NaN */
+	if (((v.u >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+	/* Overflow */
+	if (exp >= 0x1f)
+		return sign | 0x7c00;
+
+	/* Subnormal or zero */
+	if (exp <= 0) {
+		if (exp < -10)
+			return sign;
+
+		mant |= 0x800000;
+		shift = 14 - exp;
+		half = mant >> shift;
+		rem = mant & ((1u << shift) - 1);
+		if (rem > (1u << (shift - 1)) ||
+		    (rem == (1u << (shift - 1)) && (half & 1)))
+			half++;
+
+		return sign | half;
+	}
+
+	/* A carry out of the mantissa correctly bumps the exponent */
+	half = sign | (exp << 10) | (mant >> 13);
+	rem = mant & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+		half++;
+
+	return half;
+}
+
+static float
+opencl_half_to_float(cl_half h)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v;
+	uint32_t sign = (h & 0x8000) << 16;
+	int32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+
+	if (exp == 0x1f) {
+		v.u = sign | 0x7f800000 | (mant << 13);
+	} else if (exp == 0) {
+		if (!mant) {
+			v.u = sign;
+		} else {
+			/* Normalise subnormal */
+			exp = 1;
+			while (!(mant & 0x400)) {
+				mant <<= 1;
+				exp--;
+			}
+			mant &= 0x3ff;
+			v.u = sign | ((exp + 112) << 23) | (mant << 13);
+		}
+	} else {
+		v.u = sign | ((exp + 112) << 23) | (mant << 13);
+	}
+
+	return v.f;
+}
+
+void
+opencl_real_from_float(void *dst, const float *src, size_t elems)
+{
+	size_t i;
+
+	switch (state.precision) {
+	case OPENCL_PRECISION_HALF:
+		for (i = 0; i < elems; i++)
+			((cl_half *)dst)[i] = opencl_float_to_half(src[i]);
+		break;
+	case OPENCL_PRECISION_DOUBLE:
+		for (i = 0; i < elems; i++)
+			((cl_double *)dst)[i] = src[i];
+		break;
+	default:
+		memcpy(dst, src, elems * sizeof(float));
+		break;
+	}
+}
+
+void
+opencl_real_to_float(float *dst, const void *src, size_t elems)
+{
+	size_t i;
+
+	switch (state.precision) {
+	case OPENCL_PRECISION_HALF:
+		for (i = 0; i < elems; i++)
+			dst[i] = opencl_half_to_float(((cl_half *)src)[i]);
+		break;
+	case OPENCL_PRECISION_DOUBLE:
+		for (i = 0; i < elems; i++)
+			dst[i] = ((cl_double *)src)[i];
+		break;
+	default:
+		memcpy(dst, src, elems * sizeof(float));
+		break;
+	}
+}
+
+cl_int
+opencl_write_real(cl_command_queue q, cl_mem buf, size_t elems,
+		const float *src)
+{
+	void *vals;
+	cl_int error;
+
+	if (state.precision == OPENCL_PRECISION_SINGLE)
+		return clEnqueueWriteBuffer(q, buf, CL_TRUE, 0,
+				elems * sizeof(float), src, 0, NULL, NULL);
+
+	vals = malloc(elems * opencl_real_size());
+	if (!vals)
+		return CL_OUT_OF_HOST_MEMORY;
+
+	opencl_real_from_float(vals, src, elems);
+	error = clEnqueueWriteBuffer(q, buf, CL_TRUE, 0,
+			elems * opencl_real_size(), vals, 0, NULL, NULL);
+	free(vals);
+
+	return error;
+}
+
+cl_int
+opencl_set_kernel_arg_real(cl_kernel kernel, cl_uint idx, float val)
+{
+	union {
+		cl_half h;
+		cl_float f;
+		cl_double d;
+	} arg;
+
+	opencl_real_from_float(&arg, &val, 1);
+
+	return clSetKernelArg(kernel, idx, opencl_real_size(), &arg);
+}
+
+static void
+opencl_precision_select(unsigned int variant)
+{
+	state.precision = variant;
+}
+
+void
+opencl_index_enable()
+{
+	state.index_enabled = true;
+}
+
+int
+opencl_index_select(size_t elems)
+{
+	bool wide = (elems > UINT32_MAX);
+
+	if (wide && state.index_mode == OPENCL_INDEX_32) {
+		fprintf(stderr, "Error: %zu elements cannot be indexed with "
+				"32-bit indices.\n", elems);
+		return -1;
+	}
+
+	if (state.index_mode != OPENCL_INDEX_AUTO || wide == state.idx64)
+		return 0;
+
+	state.idx64 = wide;
+	printf("Index width: %u-bit for %zu elements\n", wide ? 64 : 32,
+			elems);
+
+	return 1;
+}
+
+size_t
+opencl_index_size()
+{
+	return state.idx64 ? sizeof(cl_ulong) : sizeof(cl_uint);
+}
+
+cl_int
+opencl_set_kernel_arg_idx(cl_kernel kernel, cl_uint idx, size_t val)
+{
+	cl_ulong arg64 = val;
+	cl_uint arg32 = val;
+
+	if (state.idx64)
+		return clSetKernelArg(kernel, idx, sizeof(cl_ulong), &arg64);
+
+	return clSetKernelArg(kernel, idx, sizeof(cl_uint), &arg32);
+}
+
+cl_int
+opencl_write_idx(cl_command_queue q, cl_mem buf, size_t elems,
+		const cl_int *src)
+{
+	cl_long *tmp;
+	cl_int error;
+	size_t i;
+
+	if (!state.idx64)
+		return clEnqueueWriteBuffer(q, buf, CL_TRUE, 0,
+				elems * sizeof(cl_int), src, 0, NULL, NULL);
+
+	tmp = malloc(elems * sizeof(cl_long));
+	if (!tmp)
+		return CL_OUT_OF_HOST_MEMORY;
+
+	for (i = 0; i < elems; i++)
+		tmp[i] = src[i];
+
+	error = clEnqueueWriteBuffer(q, buf, CL_TRUE, 0,
+			elems * sizeof(cl_long), tmp, 0, NULL, NULL);
+	free(tmp);
+
+	return error;
+}
+
+cl_long
+opencl_index_get(const void *buf, size_t i)
+{
+	if (state.idx64)
+		return ((const cl_long *) buf)[i];
+
+	return ((const cl_int *) buf)[i];
+}
+
+void
+opencl_kernel_resources(cl_kernel kernel)
+{
+	char name[64];
+	size_t wg_size = 0, wg_multiple = 0;
+	cl_ulong mem_private = 0, mem_local = 0;
+
+	clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL);
+	clGetKernelWorkGroupInfo(kernel, state.cl_device,
+			CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &wg_size,
+			NULL);
+	clGetKernelWorkGroupInfo(kernel, state.cl_device,
+			CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(size_t), &wg_multiple, NULL);
+	clGetKernelWorkGroupInfo(kernel, state.cl_device,
+			CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong),
+			&mem_private, NULL);
+	clGetKernelWorkGroupInfo(kernel, state.cl_device,
+			CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &mem_local,
+			NULL);
+
+	printf("Kernel %s (%u-bit idx): max work-group %zu (multiple of %zu), "
+			"private %lu B, local %lu B\n", name,
+			state.idx64 ? 64 : 32, wg_size, wg_multiple,
+			mem_private, mem_local);
+}
+
+static const char *index_labels[] = {
+	"32-bit",
+	"64-bit",
+};
+
+static void
+opencl_index_fanout_select(unsigned int variant)
+{
+	state.index_mode = OPENCL_INDEX_32 + variant;
+	state.idx64 = (state.index_mode == OPENCL_INDEX_64);
+}
+
 size_t
 opencl_kernel_size(const char *filename)
 {
@@ -96,69 +490,77 @@ opencl_kernel_read(const char *filename)
 	return file;
 }
 
-cl_uint
-opencl_nv_sm_major()
+bool
+opencl_device_has_extension(const char *ext)
 {
 	char *exts;
 	size_t size;
 	cl_int error;
-	cl_uint sm_major = 0;
+	bool found;
 
 	error = clGetDeviceInfo(state.cl_device, CL_DEVICE_EXTENSIONS, 0, NULL,
 			&size);
 	if (error != CL_SUCCESS) {
 		printf("Error: could not read device extensions.\n");
-		return 0;
+		return false;
 	}
 
 	exts = malloc(size);
 	if (!exts) {
 		printf("Error: could not allocate buffer for extensions.\n");
-		return 0;
+		return false;
 	}
 
 	error = clGetDeviceInfo(state.cl_device, CL_DEVICE_EXTENSIONS, size,
 			exts, NULL);
-	if (!exts) {
+	if (error != CL_SUCCESS) {
 		printf("Error: could not read device extensions\n");
-		goto error;
+		free(exts);
+		return false;
 	}
 
-	if (strstr(exts, "cl_nv_device_attribute_query") != NULL) {
+	found = (strstr(exts, ext) != NULL);
+	free(exts);
+
+	return found;
+}
+
+cl_uint
+opencl_nv_sm_major()
+{
+	cl_int error;
+	cl_uint sm_major = 0;
+
+	if (opencl_device_has_extension("cl_nv_device_attribute_query")) {
 		error = clGetDeviceInfo(state.cl_device,
 				CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV,
 				sizeof(cl_uint), &sm_major, NULL);
-		if (!exts)
+		if (error != CL_SUCCESS)
 			printf("Error: could not read compute capability.\n");
 	}
 
-error:
-	free(exts);
-
 	return sm_major;
-
 }
 
-cl_context
-opencl_create_context()
+/* Look up the platform and device selected by the P and d optargs */
+static int
+opencl_find_device()
 {
 	cl_uint c_platforms, c_devs;
-	cl_int error = 0;
 	cl_platform_id *l_platforms;
 	cl_device_id *l_devs;
-	cl_context ctx;
 
 	/* Find our platform */
 	clGetPlatformIDs(0, NULL, &c_platforms);
 	if (c_platforms == 0) {
 		fprintf(stderr, "Error: no OpenCL platforms found.\n");
-		return NULL;
+		return -1;
 	}
 
 	if (c_platforms < state.platform + 1) {
 		fprintf(stderr, "Error: no OpenCL platform with index %u \n",
 				state.platform);
-		return NULL;
+		return -1;
 	}
 
 	l_platforms = malloc(c_platforms * sizeof(cl_platform_id));
@@ -170,13 +572,13 @@ opencl_create_context()
 	clGetDeviceIDs(state.cl_platform, CL_DEVICE_TYPE_ALL, 0, NULL, &c_devs);
 	if(c_devs == 0) {
 		fprintf(stderr, "Error: no OpenCL devices found.\n");
-		return NULL;
+		return -1;
 	}
 
 	if (c_devs < state.device + 1) {
 		fprintf(stderr, "Error: no OpenCL device with index %u \n",
 				state.device);
-		return NULL;
+		return -1;
 	}
 
 	l_devs = malloc(c_devs * sizeof(cl_device_id));
@@ -185,6 +587,228 @@ opencl_create_context()
 	state.cl_device = l_devs[state.device];
 	free(l_devs);
 
+	return 0;
+}
+
+/* Split the selected device into sub-devices as specified by the s optarg */
+static int
+opencl_partition_device()
+{
+	cl_uint n;
+	cl_int error;
+
+	error = clCreateSubDevices(state.cl_device, state.partition, 0, NULL,
+			&n);
+	if (error != CL_SUCCESS || n == 0) {
+		fprintf(stderr, "Error: could not partition device (%u, %u): "
+				"%i\n", state.platform, state.device, error);
+		return -1;
+	}
+
+	state.cl_subdevices = malloc(n * sizeof(cl_device_id));
+	if (!state.cl_subdevices) {
+		fprintf(stderr, "Error: could not allocate sub-device list\n");
+		return -1;
+	}
+
+	error = clCreateSubDevices(state.cl_device, state.partition, n,
+			state.cl_subdevices, NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Error: could not partition device (%u, %u): "
+				"%i\n", state.platform, state.device, error);
+		free(state.cl_subdevices);
+		state.cl_subdevices = NULL;
+		return -1;
+	}
+
+	state.subdevices = n;
+
+	return 0;
+}
+
+/* Number of sub-devices the partition yields. Determined in a short-lived
+ * child process, such that the OpenCL runtime is not initialised before
+ * fanning out. */
+static int
+opencl_subdevice_count()
+{
+	int fds[2];
+	int count = -1;
+	pid_t pid;
+
+	if (pipe(fds)) {
+		perror("Error: could not create pipe");
+		return -1;
+	}
+
+	dataset_quiesce();
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) {
+		perror("Error: could not fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+		if (!opencl_find_device() && !opencl_partition_device())
+			count = state.subdevices;
+		if (write(fds[1], &count, sizeof(count)) != sizeof(count))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], &count, sizeof(count)) != sizeof(count))
+		count = -1;
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	return count;
+}
+
+static void
+opencl_subdevice_select(unsigned int variant)
+{
+	state.subdevice = variant;
+}
+
+/* Run once for every sub-device, each in its own process */
+static int
+opencl_subdevice_fanout()
+{
+	clSubdevMode mode = state.subdev_mode;
+	char **labels;
+	int count;
+	int i;
+
+	if (state.precision_all || state.index_all) {
+		fprintf(stderr, "Error: -%c all cannot be combined with "
+				"-u %s\n", state.precision_all ? 'p' : 'x',
+				mode == OPENCL_SUBDEV_EACH ? "each" : "all");
+		return -1;
+	}
+
+	count = opencl_subdevice_count();
+	if (count <= 0)
+		return -1;
+
+	labels = malloc(count * sizeof(char *));
+	if (!labels)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		labels[i] = malloc(16);
+		if (!labels[i])
+			return -1;
+		snprintf(labels[i], 16, "sub%i", i);
+	}
+
+	state.subdev_mode = OPENCL_SUBDEV_ONE;
+	if (mode == OPENCL_SUBDEV_EACH)
+		fanout_run("Sub-device", count, (const char **) labels,
+				opencl_subdevice_select);
+	else
+		fanout_run_scaling("Sub-device", count,
+				(const char **) labels,
+				opencl_subdevice_select);
+
+	/* Child process */
+	for (i = 0; i < count; i++)
+		free(labels[i]);
+	free(labels);
+
+	return 0;
+}
+
+cl_context
+opencl_create_context()
+{
+	cl_int error = 0;
+	cl_context ctx;
+	cl_uint cus;
+
+	if ((state.precision != OPENCL_PRECISION_SINGLE ||
+	     state.precision_all) && !state.real_enabled) {
+		fprintf(stderr, "Error: this benchmark does not support "
+				"precision selection.\n");
+		return NULL;
+	}
+
+	if ((state.index_mode != OPENCL_INDEX_AUTO || state.index_all) &&
+	    !state.index_enabled) {
+		fprintf(stderr, "Error: this benchmark does not support "
+				"index width selection.\n");
+		return NULL;
+	}
+
+	if (state.precision_all && state.index_all) {
+		fprintf(stderr, "Error: -p all cannot be combined with "
+				"-x all.\n");
+		return NULL;
+	}
+
+	if (opencl_sweep_pending() && (state.precision_all ||
+	    state.index_all || state.subdev_mode != OPENCL_SUBDEV_ONE)) {
+		fprintf(stderr, "Error: -O and -E cannot be combined with -p "
+				"all, -x all or -u each/all.\n");
+		return NULL;
+	}
+
+	if ((state.subdevice || state.subdev_mode != OPENCL_SUBDEV_ONE) &&
+	    !state.partitioned) {
+		fprintf(stderr, "Error: sub-device selection requires a "
+				"partition (-s).\n");
+		return NULL;
+	}
+
+	if (state.subdev_mode != OPENCL_SUBDEV_ONE) {
+		if (opencl_subdevice_fanout())
+			return NULL;
+	}
+
+	/* Run once for every precision, each in its own process */
+	if (state.precision_all) {
+		state.precision_all = false;
+		fanout_run("Precision", OPENCL_PRECISION_COUNT,
+				precision_names, opencl_precision_select);
+	}
+
+	/* Run once for every index width, each in its own process */
+	if (state.index_all) {
+		state.index_all = false;
+		fanout_run("Index", 2, index_labels,
+				opencl_index_fanout_select);
+	}
+
+	/* Run once for every combination of build options */
+	if (opencl_sweep_pending())
+		opencl_sweep_run();
+
+	if (opencl_find_device())
+		return NULL;
+
+	if (state.partitioned) {
+		if (opencl_partition_device())
+			return NULL;
+
+		if (state.subdevice >= state.subdevices) {
+			fprintf(stderr, "Error: no sub-device with index %u\n",
+					state.subdevice);
+			return NULL;
+		}
+
+		state.cl_root_device = state.cl_device;
+		state.cl_device = state.cl_subdevices[state.subdevice];
+
+		clGetDeviceInfo(state.cl_device, CL_DEVICE_MAX_COMPUTE_UNITS,
+				sizeof(cl_uint), &cus, NULL);
+		printf("Sub-device %u of %u, %u compute units\n",
+				state.subdevice, state.subdevices, cus);
+	}
+
 	/* Get the context */
 	cl_context_properties ctx_props[] = {
 			CL_CONTEXT_PLATFORM,
@@ -201,6 +825,13 @@ opencl_create_context()
 		return NULL;
 	}
 
+	if (state.real_enabled)
+		printf("Precision: %s\n", precision_names[state.precision]);
+	if (state.index_enabled)
+		printf("Index width: %u-bit%s\n", state.idx64 ? 64 : 32,
+				state.index_mode == OPENCL_INDEX_AUTO ?
+				" (auto)" : "");
+
 	return ctx;
 }
 
@@ -229,32 +860,60 @@ opencl_create_cmdqueue(cl_context ctx)
 	return q;
 }
 
+cl_device_id
+opencl_get_device()
+{
+	return state.cl_device;
+}
+
 cl_program
 opencl_compile_program(cl_context ctx, cl_uint source_cnt,
 		const char **source_files)
+{
+	return opencl_compile_program_opts(ctx, source_cnt, source_files,
+			NULL);
+}
+
+cl_program
+opencl_compile_program_opts(cl_context ctx, cl_uint source_cnt,
+		const char **source_files, const char *extra_opts)
 {
 	cl_program prg;
 	cl_int error;
 	int i;
 	const char **sources;
-	const char *options;
+	const char **names;
+	const char *base_opts;
+	char options[1024];
 	char *status;
 	int bStatus = 0;
 	size_t ret_val_size;
 	cl_uint sm_major;
 
-	sources = malloc(source_cnt * sizeof (char *));
+	if (precision_exts[state.precision] &&
+	    !opencl_device_has_extension(precision_exts[state.precision])) {
+		fprintf(stderr, "Error: %s precision requires %s, not supported "
+				"by this device.\n",
+				precision_names[state.precision],
+				precision_exts[state.precision]);
+		return NULL;
+	}
+
+	/* The prelude goes first, followed by the requested files */
+	sources = malloc((source_cnt + 1) * sizeof (char *));
 	if(!sources) {
 		fprintf(stderr, "Error: Cannot allocate memory for source "
 						"files");
 		return NULL;
 	}
 
+	sources[0] = opencl_kernel_read(prelude_file);
 	for (i = 0; i < source_cnt; i++) {
-		sources[i] = opencl_kernel_read(source_files[i]);
+		sources[i + 1] = opencl_kernel_read(source_files[i]);
 	}
 
-	prg = clCreateProgramWithSource(ctx, source_cnt, sources, NULL, &error);
+	prg = clCreateProgramWithSource(ctx, source_cnt + 1, sources, NULL,
+			&error);
 	if (error) {
 		fprintf(stderr, "Error: Cannot create program");
 		return NULL;
@@ -262,9 +921,18 @@ opencl_compile_program(cl_context ctx, cl_uint source_cnt,
 
 	sm_major = opencl_nv_sm_major();
 	if (sm_major >= 2)
-		options = opt_nv_sm_20;
+		base_opts = opt_nv_sm_20;
 	else
-		options = opt_generic;
+		base_opts = opt_generic;
+
+	/* Capture classifies buffer arguments by their address space */
+	snprintf(options, sizeof(options), "%s%s%s%s%s%s%s%s", base_opts,
+			precision_opts[state.precision],
+			state.idx64 ? " -D CLAXON_IDX64" : "", opt_instrument,
+			opencl_capture_enabled() || opencl_cold_enabled() ?
+				" -cl-kernel-arg-info" : "",
+			opencl_sweep_options(), extra_opts ? " " : "",
+			extra_opts ? extra_opts : "");
 
 	error = clBuildProgram (prg, 1, &state.cl_device,
 			options, NULL, NULL);
@@ -299,7 +967,23 @@ opencl_compile_program(cl_context ctx, cl_uint source_cnt,
 		return NULL;
 	}
 
-	for (i = 0; i < source_cnt; i++)
+	if (opencl_capture_enabled()) {
+		names = malloc((source_cnt + 1) * sizeof (char *));
+		if (names) {
+			names[0] = prelude_file;
+			for (i = 0; i < source_cnt; i++)
+				names[i + 1] = source_files[i];
+			opencl_capture_program(prg, source_cnt + 1, names,
+					sources, options);
+			free(names);
+		}
+	}
+
+	/* -J: time repeated builds of the same sources */
+	opencl_compile_bench(ctx, source_cnt + 1, sources, options,
+			source_cnt ? source_files[0] : prelude_file);
+
+	for (i = 0; i < source_cnt + 1; i++)
 		free((char *)sources[i]);
 	free(sources);
 
@@ -316,9 +1000,31 @@ opencl_exec_time(cl_event time)
 	clGetEventProfilingInfo (time, CL_PROFILING_COMMAND_END,
 				sizeof(cl_ulong), &time_end, NULL);
 
+	state.t_exec += time_end - time_start;
+	state.kernels++;
+	opencl_cold_account(time, time_start, time_end);
+
 	return time_end - time_start;
 }
 
+cl_ulong
+opencl_total_exec_time(unsigned int *kernels)
+{
+	if (kernels)
+		*kernels = state.kernels;
+
+	return state.t_exec;
+}
+
+bool
+opencl_max_error(double *abs, double *rel)
+{
+	*abs = state.err_abs;
+	*rel = state.err_rel;
+
+	return state.compared;
+}
+
 size_t
 opencl_max_workgroup_size()
 {
@@ -330,9 +1036,31 @@ opencl_max_workgroup_size()
 	return max_items;
 }
 
+void
+opencl_kernel_measure(cl_command_queue q, cl_kernel kernel, cl_uint dim,
+		const size_t *offset, const size_t *global, const size_t *local)
+{
+	opencl_throughput_kernel(q, kernel, dim, offset, global, local);
+	opencl_latency_kernel(q, kernel, dim, offset, global, local);
+	opencl_corun_kernel(q, kernel, dim, offset, global, local);
+	opencl_soak_kernel(q, kernel, dim, offset, global, local);
+	opencl_cold_kernel(q, kernel, dim, offset, global, local);
+}
+
 void
 opencl_teardown(cl_context *ctx, cl_command_queue *q, cl_program *prg)
 {
+	cl_uint i;
+
+	opencl_cold_report();
+	opencl_mem_report();
+	if (ctx && *ctx && q && *q)
+		opencl_roofline_report(*ctx, *q);
+	opencl_capture_report();
+	opencl_cmdbuf_report();
+	opencl_latency_report();
+	opencl_soak_report();
+
 	if (prg && *prg) {
 		clReleaseProgram(*prg);
 		*prg = NULL;
@@ -347,6 +1075,47 @@ opencl_teardown(cl_context *ctx, cl_command_queue *q, cl_program *prg)
 		clReleaseContext(*ctx);
 		*ctx = NULL;
 	}
+
+	if (state.cl_subdevices) {
+		for (i = 0; i < state.subdevices; i++)
+			clReleaseDevice(state.cl_subdevices[i]);
+		free(state.cl_subdevices);
+
+		state.cl_subdevices = NULL;
+		state.subdevices = 0;
+		state.cl_device = state.cl_root_device;
+	}
+}
+
+/* Blocking download of a buffer of reals into a newly allocated float array */
+static float *
+opencl_read_real(cl_command_queue q, cl_mem out, size_t elems)
+{
+	float *ovals;
+	void *vals;
+
+	ovals = malloc(elems * sizeof(float));
+	if (!ovals)
+		return NULL;
+
+	if (state.precision == OPENCL_PRECISION_SINGLE) {
+		clEnqueueReadBuffer(q, out, CL_TRUE, 0, elems * sizeof(float),
+				ovals, 0, NULL, NULL);
+		return ovals;
+	}
+
+	vals = malloc(elems * opencl_real_size());
+	if (!vals) {
+		free(ovals);
+		return NULL;
+	}
+
+	clEnqueueReadBuffer(q, out, CL_TRUE, 0, elems * opencl_real_size(),
+			vals, 0, NULL, NULL);
+	opencl_real_to_float(ovals, vals, elems);
+	free(vals);
+
+	return ovals;
 }
 
 void
@@ -355,15 +1124,13 @@ opencl_download_float_csv(cl_command_queue q, cl_mem out, char *file,
 {
 	float *result;
 
-	result = malloc(elems*sizeof(float));
+	result = opencl_read_real(q, out, elems);
 	if (!result) {
 		printf("ERROR: could not allocate out-buffer, not downloading "
 				"results.\n");
 		return;
 	}
 
-	clEnqueueReadBuffer(q, out, CL_TRUE, 0, elems*sizeof(float), result, 0,
-			NULL, NULL);
 	csv_file_write(file, elems, result);
 
 	free(result);
@@ -374,36 +1141,51 @@ static int
 opencl_compare_out_float(float *rvals, float *ovals, size_t elems, float delta,
 		clErrorMarginType dType)
 {
-	float diff;
+	float diff, err_abs, err_rel;
 	size_t i;
 	int retval;
 	int errors;
 
 	retval = 0;
 	errors = 0;
+	state.compared = true;
 
 	for (i = 0; i < elems; i++) {
+		err_abs = fabs(rvals[i] - ovals[i]);
+		err_rel = fabs((ovals[i] / rvals[i]) - 1.f);
+
+		/* Keep track of the error over all elements, for reporting */
+		if (err_abs > state.err_abs)
+			state.err_abs = err_abs;
+		if (rvals[i] != 0.f && err_rel > state.err_rel)
+			state.err_rel = err_rel;
+
 		switch (dType) {
 		case OPENCL_ERROR_FRAC:
-			diff = fabs((ovals[i] / rvals[i]) - 1.f);
+			diff = err_rel;
 			break;
 		default:
-			diff = fabs(rvals[i] - ovals[i]);
+			diff = err_abs;
 		}
 
-		if (diff > delta) {
+		if (diff > delta && errors < 10) {
 			retval = -EINVAL;
-			fprintf(stderr,"%06zx: MISMATCH %f != %f\n", i*4, ovals[i],
-								rvals[i]);
+			fprintf(stderr,"%06zx: MISMATCH %f != %f\n",
+					i * opencl_real_size(), ovals[i],
+					rvals[i]);
 			errors++;
-		}
 
-		if (errors >= 10) {
-			fprintf(stderr,"Too many errors, quitting.\n");
-			break;
+			if (errors >= 10)
+				fprintf(stderr,"Too many errors, not "
+						"reporting further.\n");
 		}
 	}
 
+	if (state.real_enabled)
+		printf("Max error (%s): %g abs, %g rel\n",
+				precision_names[state.precision],
+				state.err_abs, state.err_rel);
+
 	return retval;
 }
 
@@ -416,8 +1198,8 @@ opencl_compare_out_csv(cl_command_queue q, cl_mem out, char *file,
 	size_t relems;
 	int retval;
 
-	/* Allocate local buffer */
-	ovals = malloc(elems * sizeof(float));
+	/* Download buffer */
+	ovals = opencl_read_real(q, out, elems);
 	if (!ovals)
 		return -ENOMEM;
 
@@ -428,10 +1210,6 @@ opencl_compare_out_csv(cl_command_queue q, cl_mem out, char *file,
 		goto out;
 	}
 
-	/* Download buffer */
-	clEnqueueReadBuffer(q, out, CL_TRUE, 0, elems*sizeof(float), ovals, 0,
-				NULL, NULL);
-
 	/* Go compare */
 	retval = opencl_compare_out_float(rvals, ovals, elems, delta, dType);
 
@@ -449,8 +1227,8 @@ opencl_compare_out_bin(cl_command_queue q, cl_mem out, char *file,
 	float *rvals;
 	int retval;
 
-	/* Allocate local buffer */
-	ovals = malloc(elems * sizeof(float));
+	/* Download buffer */
+	ovals = opencl_read_real(q, out, elems);
 	if (!ovals)
 		return -ENOMEM;
 
@@ -460,10 +1238,6 @@ opencl_compare_out_bin(cl_command_queue q, cl_mem out, char *file,
 		goto out;
 	}
 
-	/* Download buffer */
-	clEnqueueReadBuffer(q, out, CL_TRUE, 0, elems*sizeof(float), ovals, 0,
-				NULL, NULL);
-
 	/* Go compare */
 	retval = opencl_compare_out_float(rvals, ovals, elems, delta, dType);
 
@@ -473,10 +1247,54 @@ out:
 	return retval;
 }
 
+static int
+opencl_parse_partition(char *spec)
+{
+	unsigned int val;
+	unsigned int n = 0;
+	char *tok;
+
+	if (!strcmp(spec, "numa")) {
+		state.partition[n++] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+		state.partition[n++] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+	} else if (!strncmp(spec, "equally:", 8)) {
+		if (sscanf(spec + 8, "%u", &val) != 1 || val == 0)
+			return -EINVAL;
+
+		state.partition[n++] = CL_DEVICE_PARTITION_EQUALLY;
+		state.partition[n++] = val;
+	} else if (!strncmp(spec, "counts:", 7)) {
+		state.partition[n++] = CL_DEVICE_PARTITION_BY_COUNTS;
+
+		for (tok = strtok(spec + 7, ","); tok;
+		     tok = strtok(NULL, ",")) {
+			if (n >= OPENCL_PARTITION_MAX - 2)
+				return -EINVAL;
+			if (sscanf(tok, "%u", &val) != 1 || val == 0)
+				return -EINVAL;
+
+			state.partition[n++] = val;
+		}
+
+		if (n == 1)
+			return -EINVAL;
+
+		state.partition[n++] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+	} else {
+		return -EINVAL;
+	}
+
+	state.partition[n] = 0;
+	state.partitioned = true;
+
+	return 0;
+}
+
 int
 opencl_parse_option(int c, char *optarg)
 {
 	unsigned int optval;
+	char *sep;
 	int ret;
 
 	switch (c)
@@ -507,6 +1325,132 @@ opencl_parse_option(int c, char *optarg)
 		state.compare_output = true;
 		return 0;
 		break;
+	case 'p':
+		if (!strcmp(optarg, "all")) {
+			state.precision_all = true;
+			return 0;
+		}
+
+		for (optval = 0; optval < OPENCL_PRECISION_COUNT; optval++) {
+			if (!strcmp(optarg, precision_names[optval])) {
+				state.precision = optval;
+				return 0;
+			}
+		}
+
+		return -EINVAL;
+		break;
+	case 's':
+		return opencl_parse_partition(optarg);
+		break;
+	case 'u':
+		if (!strcmp(optarg, "each")) {
+			state.subdev_mode = OPENCL_SUBDEV_EACH;
+			return 0;
+		} else if (!strcmp(optarg, "all")) {
+			state.subdev_mode = OPENCL_SUBDEV_ALL;
+			return 0;
+		}
+
+		ret = sscanf(optarg, "%u", &optval);
+		if (ret != 1)
+			return -EINVAL;
+		state.subdevice = optval;
+		return 0;
+		break;
+	case 'x':
+		if (!strcmp(optarg, "all")) {
+			state.index_all = true;
+			return 0;
+		}
+
+		for (optval = 0; optval < 3; optval++) {
+			if (!strcmp(optarg, index_names[optval])) {
+				state.index_mode = optval;
+				state.idx64 = (optval == OPENCL_INDEX_64);
+				return 0;
+			}
+		}
+
+		return -EINVAL;
+		break;
+	case 'R':
+		opencl_roofline_enable(strcmp(optarg, "-") ? optarg : NULL);
+		return 0;
+		break;
+	case 'B':
+		return opencl_cmdbuf_enable(optarg);
+		break;
+	case 'T':
+		/* <launches>[:cb] */
+		sep = strchr(optarg, ':');
+		if (sep && strcmp(sep, ":cb"))
+			return -EINVAL;
+		ret = sscanf(optarg, "%u", &optval);
+		if (ret != 1 || optval == 0)
+			return -EINVAL;
+		opencl_throughput_enable(optval, !!sep);
+		return 0;
+		break;
+	case 'W':
+		/* <runs>[:<file>] */
+		sep = strchr(optarg, ':');
+		ret = sscanf(optarg, "%u", &optval);
+		if (ret != 1 || optval == 0)
+			return -EINVAL;
+		opencl_latency_enable(optval, sep ? sep + 1 : NULL);
+		return 0;
+		break;
+	case 'A':
+		ret = sscanf(optarg, "%u", &optval);
+		if (ret != 1)
+			return -EINVAL;
+		opencl_latency_pin(optval);
+		return 0;
+		break;
+	case 'F':
+		opencl_latency_fifo();
+		return 0;
+		break;
+	case 'K':
+		return opencl_corun_enable(optarg);
+		break;
+	case 'L':
+		return opencl_soak_enable(optarg);
+		break;
+	case 'Z':
+		ret = sscanf(optarg, "%u", &optval);
+		if (ret != 1 || optval == 0)
+			return -EINVAL;
+		opencl_cold_enable(optval);
+		return 0;
+		break;
+	case 'J':
+		ret = sscanf(optarg, "%u", &optval);
+		if (ret != 1 || optval == 0)
+			return -EINVAL;
+		opencl_compile_enable(optval);
+		return 0;
+		break;
+	case 'O':
+		return opencl_sweep_flags(optarg);
+		break;
+	case 'E':
+		return opencl_sweep_alternatives(optarg);
+		break;
+	case 'X':
+		/* <file>[:<launches per kernel>] */
+		sep = strrchr(optarg, ':');
+		optval = 1;
+		if (sep) {
+			ret = sscanf(sep + 1, "%u", &optval);
+			if (ret != 1)
+				return -EINVAL;
+			*sep = '\0';
+		}
+		opencl_capture_enable(optarg, optval);
+		return 0;
+		break;
 	default:
 		break;
 	}
@@ -521,4 +1465,60 @@ opencl_usage()
 	printf("\t-d <device id>   OpenCL device (default: 0)\n");
 	printf("\t-I <iterations>  Number of iterations (default: 10)\n");
 	printf("\t-c               Compare output(s) (default: off)\n");
+	printf("\t-p <precision>   Precision of real in kernels: half, single,\n"
+	       "\t                 double or all (default: single)\n");
+	printf("\t-s <partition>   Split device into sub-devices: numa,\n"
+	       "\t                 equally:<CUs> or counts:<CUs>,<CUs>,...\n");
+	printf("\t-u <sub-device>  Sub-device to run on: index, each to run\n"
+	       "\t                 on every sub-device in turn, all to also\n"
+	       "\t                 run on all concurrently (default: 0)\n");
+	printf("\t-x <width>       Index width in kernels: auto, 32, 64 or\n"
+	       "\t                 all (default: auto, by input size)\n");
+	printf("\t-R <file>        Report achieved rates against the measured\n"
+	       "\t                 roofline and export it as CSV, - to only\n"
+	       "\t                 print the report\n");
+	printf("\t-B <mode>        Record per-iteration command sequences\n"
+	       "\t                 once and replay them: auto for\n"
+	       "\t                 cl_khr_command_buffer if supported, or\n"
+	       "\t                 prebuilt for per-command kernel objects\n");
+	printf("\t-T <n>[:cb]      Also enqueue n launches of each kernel back\n"
+	       "\t                 to back and report the sustained rate, cb\n"
+	       "\t                 to time them from event callbacks. This,\n"
+	       "\t                 -W, -K, -L and -Z skip the kernels that\n"
+	       "\t                 can't be repeated as is: atomics, frnn\n"
+	       "\t                 lists, grid counts, ndt per-element\n"
+	       "\t                 passes, the radix digit scan, the\n"
+	       "\t                 library and look-back scans and the\n"
+	       "\t                 upper scan levels\n");
+	printf("\t-W <n>[:<file>]  Also launch each kernel n times, one at a\n"
+	       "\t                 time, and report the latency distribution,\n"
+	       "\t                 exporting histograms to a CSV file\n");
+	printf("\t-A <cpu>         Pin the host thread to a CPU during -W\n");
+	printf("\t-F               Use SCHED_FIFO during -W\n");
+	printf("\t-K <kind>[:<threads>[:<MB/s>]]\n"
+	       "\t                 Also time each kernel with up to threads\n"
+	       "\t                 host co-runners of kind read, write,\n"
+	       "\t                 random or thrash, each limited to MB/s\n"
+	       "\t                 (default: all but one CPU, unlimited)\n");
+	printf("\t-L <s>[:<window>[:<file>]]\n"
+	       "\t                 Also launch each kernel back to back for s\n"
+	       "\t                 seconds, sampling throughput, CPU\n"
+	       "\t                 frequency and temperature every window\n"
+	       "\t                 (default: 1 s) into a CSV file\n");
+	printf("\t-Z <n>           Also launch each kernel n times cold, with\n"
+	       "\t                 a new kernel object, copies of its\n"
+	       "\t                 buffers and caches evicted\n");
+	printf("\t-J <n>           Also build each program n times with\n"
+	       "\t                 compiler caches disabled and report the\n"
+	       "\t                 build time and kernel resources\n");
+	printf("\t-O <opt>[,<opt>...]\n"
+	       "\t                 Run every combination of these build\n"
+	       "\t                 options, default for the -cl-* math\n"
+	       "\t                 flags, and report the Pareto front of\n"
+	       "\t                 kernel time versus error (with -c)\n");
+	printf("\t-E <opt>[,<opt>...]\n"
+	       "\t                 Also run each -O combination with each\n"
+	       "\t                 of these, e.g. -cl-std variants\n");
+	printf("\t-X <file>[:<n>]  Capture n launches of each kernel for\n"
+	       "\t                 clreplay, 0 for all (default: 1)\n");
 }
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Prepended to every program compiled through opencl_compile_program.
+ * Provides the types and helpers selected by the library's build options.
+ */
+
+/* Floating point type selected with the -p option. Kernels that support
+ * reduced or extended precision use real in place of float. */
+#if defined(CLAXON_REAL_HALF)
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+typedef half real;
+typedef half2 real2;
+typedef half4 real4;
+#define CLAXON_REAL_SIZE 2
+#define REAL_PI ((half) M_PI_F)
+#define real_cos(x) cos(x)
+#define real_sin(x) sin(x)
+#elif defined(CLAXON_REAL_DOUBLE)
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 real2;
+typedef double4 real4;
+#define CLAXON_REAL_SIZE 8
+#define REAL_PI M_PI
+#define real_cos(x) cos(x)
+#define real_sin(x) sin(x)
+#else
+typedef float real;
+typedef float2 real2;
+typedef float4 real4;
+#define CLAXON_REAL_SIZE 4
+#define REAL_PI M_PI_F
+#define real_cos(x) native_cos(x)
+#define real_sin(x) native_sin(x)
+#endif
+
+/* Element index type selected with the -x option. 32-bit indices reduce
+ * register pressure, 64-bit indices are required beyond 4G elements. */
+#if defined(CLAXON_IDX64)
+typedef ulong idx_t;
+typedef long sidx_t;
+#else
+typedef uint idx_t;
+typedef int sidx_t;
+#endif
+
+/* Workload counters, compiled in with the CLAXON_INSTRUMENT build option.
+ * Instrumented kernels append INSTR_PARAM to their parameter list and count
+ * per work-item events with INSTR_ADD(counter, value), the host binds the
+ * counter buffer with instr_set_arg. Without instrumentation the parameter
+ * disappears and only the side effects of value remain. */
+#if defined(CLAXON_INSTRUMENT)
+#define INSTR_PARAM , __global uint *instr_ctr
+#define INSTR_ADD(c, v) instr_add(instr_ctr, (c), (v))
+
+/* Work-items are numbered group by group, such that each work-group's
+ * counters are contiguous for the host to compare. */
+inline size_t instr_wi(void)
+{
+	size_t group, local;
+
+	group = (get_group_id(2) * get_num_groups(1) + get_group_id(1)) *
+			get_num_groups(0) + get_group_id(0);
+	local = (get_local_id(2) * get_local_size(1) + get_local_id(1)) *
+			get_local_size(0) + get_local_id(0);
+
+	return group * get_local_size(0) * get_local_size(1) *
+			get_local_size(2) + local;
+}
+
+inline void instr_add(__global uint *ctr, uint c, uint v)
+{
+	size_t items = get_global_size(0) * get_global_size(1) *
+			get_global_size(2);
+
+	/* Word 0 reports the work-group size chosen by the runtime */
+	if (get_local_id(0) == 0 && get_local_id(1) == 0 &&
+	    get_local_id(2) == 0)
+		ctr[0] = get_local_size(0) * get_local_size(1) *
+				get_local_size(2);
+
+	ctr[1 + c * items + instr_wi()] += v;
+}
+#else
+#define INSTR_PARAM
+#define INSTR_ADD(c, v) ((void) (v))
+#endif
+
+#define INSTR_INC(c) INSTR_ADD(c, 1)
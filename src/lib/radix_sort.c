@@ -0,0 +1,483 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "lib/radix_sort.h"
+
+/* Must match radix_sort.cl */
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+
+/* Work-groups per pass, per compute unit */
+#define RADIX_GROUPS_PER_CU 4
+
+struct radix_sort {
+	cl_context ctx;
+	cl_program prg;
+	cl_kernel count;
+	cl_kernel scan;
+	cl_kernel scatter;
+	cl_kernel seg_pack;
+	cl_kernel seg_unpack;
+
+	bool key64;
+	bool values;
+	size_t key_size;
+	size_t wg_size;
+	size_t groups;
+
+	/* Digit counts, and ping-pong buffers grown on demand */
+	cl_mem counts;
+	cl_mem keys_tmp;
+	cl_mem vals_tmp;
+	size_t tmp_elems;
+
+	/* 64-bit instance used to sort packed segment/key pairs */
+	struct radix_sort *seg;
+	cl_mem seg_keys;
+	size_t seg_elems;
+
+	/* Work-items of the last radix_sort_run or radix_sort_segments call,
+	 * 0 if it did not complete or was not the last one */
+	size_t run_items;
+	size_t seg_items;
+	/* The input of the last scatter was not overwritten afterwards */
+	bool scatter_intact;
+};
+
+struct radix_sort *
+radix_sort_create(cl_context ctx, bool key64, bool values)
+{
+	struct radix_sort *r;
+	char opts[64];
+	cl_uint cus;
+	cl_int error;
+
+	r = calloc(1, sizeof(struct radix_sort));
+	if (!r) {
+		fprintf(stderr, "Could not allocate radix sort\n");
+		return NULL;
+	}
+
+	r->ctx = ctx;
+	r->key64 = key64;
+	r->values = values;
+	r->key_size = key64 ? sizeof(cl_ulong) : sizeof(cl_uint);
+
+	snprintf(opts, sizeof(opts), "%s%s", key64 ? "-D RADIX_KEY64" : "",
+			values ? " -D RADIX_VALUES" : "");
+
+	const char *programs = {
+		"src/lib/radix_sort.cl"
+	};
+	r->prg = opencl_compile_program_opts(ctx, 1, &programs, opts);
+	if (!r->prg)
+		goto error;
+
+	r->count = clCreateKernel(r->prg, "radix_count", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel radix_count\n");
+		goto error;
+	}
+
+	r->scan = clCreateKernel(r->prg, "radix_scan", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel radix_scan\n");
+		goto error;
+	}
+
+	r->scatter = clCreateKernel(r->prg, "radix_scatter", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel radix_scatter\n");
+		goto error;
+	}
+
+	if (key64) {
+		r->seg_pack = clCreateKernel(r->prg, "radix_seg_pack", &error);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not create kernel "
+					"radix_seg_pack\n");
+			goto error;
+		}
+
+		r->seg_unpack = clCreateKernel(r->prg, "radix_seg_unpack",
+				&error);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not create kernel "
+					"radix_seg_unpack\n");
+			goto error;
+		}
+	}
+
+	r->wg_size = opencl_max_workgroup_size();
+	if (r->wg_size > 256)
+		r->wg_size = 256;
+	if (r->wg_size < RADIX) {
+		fprintf(stderr, "Radix sort needs work-groups of at least %u "
+				"work-items\n", RADIX);
+		goto error;
+	}
+
+	error = clGetDeviceInfo(opencl_get_device(),
+			CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &cus,
+			NULL);
+	if (error != CL_SUCCESS)
+		cus = 1;
+	r->groups = cus * RADIX_GROUPS_PER_CU;
+
+	r->counts = opencl_create_buffer(ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+			RADIX * r->groups * sizeof(cl_uint), NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create radix count buffer\n");
+		r->counts = NULL;
+		goto error;
+	}
+
+	return r;
+
+error:
+	radix_sort_release(r);
+	return NULL;
+}
+
+static int
+radix_sort_enqueue(cl_command_queue q, cl_kernel k, size_t items,
+		size_t wg_size, cl_ulong *time_ns)
+{
+	cl_int error;
+	cl_event time;
+
+	const size_t dims[] = {items};
+	const size_t ldims[] = {wg_size};
+	error = clEnqueueNDRangeKernel(q, k, 1, NULL, dims, ldims, 0, NULL,
+			time_ns ? &time : NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
+				error);
+		return -1;
+	}
+
+	if (time_ns) {
+		clFinish(q);
+		*time_ns += opencl_exec_time(time);
+		clReleaseEvent(time);
+	}
+
+	return 0;
+}
+
+static int
+radix_sort_grow(struct radix_sort *r, size_t elems)
+{
+	cl_int error;
+
+	if (elems <= r->tmp_elems)
+		return 0;
+
+	if (r->keys_tmp)
+		opencl_release_buffer(r->keys_tmp);
+	if (r->vals_tmp)
+		opencl_release_buffer(r->vals_tmp);
+	r->vals_tmp = NULL;
+	r->tmp_elems = 0;
+
+	r->keys_tmp = opencl_create_buffer(r->ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+			elems * r->key_size, NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create radix sort buffer\n");
+		r->keys_tmp = NULL;
+		return -1;
+	}
+
+	if (r->values) {
+		r->vals_tmp = opencl_create_buffer(r->ctx,
+				CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+				elems * sizeof(cl_uint), NULL, &error);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not create radix sort "
+					"buffer\n");
+			r->vals_tmp = NULL;
+			return -1;
+		}
+	}
+
+	r->tmp_elems = elems;
+
+	return 0;
+}
+
+int
+radix_sort_run(struct radix_sort *r, cl_command_queue q, cl_mem keys,
+		cl_mem values, size_t elems, unsigned int key_bits,
+		cl_ulong *time_ns)
+{
+	cl_mem k_in, k_out, v_in, v_out, tmp;
+	size_t groups, chunk;
+	cl_uint shift, n;
+	cl_int error;
+	const cl_mem none = NULL;
+
+	r->run_items = 0;
+	r->seg_items = 0;
+	if (elems < 2)
+		return 0;
+
+	if (elems > UINT32_MAX) {
+		fprintf(stderr, "Radix sort limited to %u elements\n",
+				UINT32_MAX);
+		return -1;
+	}
+
+	if (key_bits == 0 || key_bits > 8 * r->key_size)
+		key_bits = 8 * r->key_size;
+
+	if (radix_sort_grow(r, elems))
+		return -1;
+
+	/* Fewer work-groups than tiles would leave work-items idle */
+	groups = (elems + r->wg_size - 1) / r->wg_size;
+	if (groups > r->groups)
+		groups = r->groups;
+	chunk = (elems + groups - 1) / groups;
+	n = RADIX * groups;
+
+	k_in = keys;
+	k_out = r->keys_tmp;
+	v_in = r->values ? values : none;
+	v_out = r->values ? r->vals_tmp : none;
+
+	for (shift = 0; shift < key_bits; shift += RADIX_BITS) {
+		error =  clSetKernelArg(r->count, 0, sizeof(cl_mem), &k_in);
+		error |= opencl_set_kernel_arg_idx(r->count, 1, elems);
+		error |= opencl_set_kernel_arg_idx(r->count, 2, chunk);
+		error |= clSetKernelArg(r->count, 3, sizeof(cl_uint), &shift);
+		error |= clSetKernelArg(r->count, 4, sizeof(cl_mem),
+				&r->counts);
+
+		error |= clSetKernelArg(r->scan, 0, sizeof(cl_mem),
+				&r->counts);
+		error |= clSetKernelArg(r->scan, 1, sizeof(cl_uint), &n);
+		error |= clSetKernelArg(r->scan, 2,
+				r->wg_size * sizeof(cl_uint), NULL);
+
+		error |= clSetKernelArg(r->scatter, 0, sizeof(cl_mem), &k_in);
+		error |= clSetKernelArg(r->scatter, 1, sizeof(cl_mem), &k_out);
+		error |= clSetKernelArg(r->scatter, 2, sizeof(cl_mem), &v_in);
+		error |= clSetKernelArg(r->scatter, 3, sizeof(cl_mem), &v_out);
+		error |= opencl_set_kernel_arg_idx(r->scatter, 4, elems);
+		error |= opencl_set_kernel_arg_idx(r->scatter, 5, chunk);
+		error |= clSetKernelArg(r->scatter, 6, sizeof(cl_uint), &shift);
+		error |= clSetKernelArg(r->scatter, 7, sizeof(cl_mem),
+				&r->counts);
+		error |= clSetKernelArg(r->scatter, 8,
+				r->wg_size * r->key_size, NULL);
+		error |= clSetKernelArg(r->scatter, 9,
+				r->wg_size * sizeof(cl_uint), NULL);
+		error |= clSetKernelArg(r->scatter, 10,
+				3 * r->wg_size * sizeof(cl_uint), NULL);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "One of the arguments could not be "
+					"set: %d.\n", error);
+			return -1;
+		}
+
+		if (radix_sort_enqueue(q, r->count, groups * r->wg_size,
+				r->wg_size, time_ns))
+			return -1;
+		if (radix_sort_enqueue(q, r->scan, r->wg_size, r->wg_size,
+				time_ns))
+			return -1;
+		if (radix_sort_enqueue(q, r->scatter, groups * r->wg_size,
+				r->wg_size, time_ns))
+			return -1;
+
+		tmp = k_in;
+		k_in = k_out;
+		k_out = tmp;
+		tmp = v_in;
+		v_in = v_out;
+		v_out = tmp;
+	}
+
+	r->run_items = groups * r->wg_size;
+	r->scatter_intact = (k_in == keys);
+
+	/* After an odd number of passes the result is in the scratch buffer */
+	if (k_in != keys) {
+		clEnqueueCopyBuffer(q, k_in, keys, 0, 0, elems * r->key_size,
+				0, NULL, NULL);
+		if (r->values)
+			clEnqueueCopyBuffer(q, v_in, values, 0, 0,
+					elems * sizeof(cl_uint), 0, NULL,
+					NULL);
+	}
+
+	return 0;
+}
+
+int
+radix_sort_segments(struct radix_sort *r, cl_command_queue q,
+		cl_mem keys, cl_mem values, cl_mem seg_offsets, size_t segs,
+		size_t elems, cl_ulong *time_ns)
+{
+	struct radix_sort *seg;
+	unsigned int seg_bits = 0;
+	size_t items;
+	cl_uint segs_arg = segs;
+	cl_int error;
+
+	r->run_items = 0;
+	r->seg_items = 0;
+	if (r->key64) {
+		fprintf(stderr, "Segmented radix sort needs 32-bit keys\n");
+		return -1;
+	}
+
+	if (elems < 2)
+		return 0;
+
+	if (!r->seg) {
+		r->seg = radix_sort_create(r->ctx, true, r->values);
+		if (!r->seg)
+			return -1;
+	}
+	seg = r->seg;
+
+	if (elems > r->seg_elems) {
+		if (r->seg_keys)
+			opencl_release_buffer(r->seg_keys);
+
+		r->seg_keys = opencl_create_buffer(r->ctx,
+				CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+				elems * sizeof(cl_ulong), NULL, &error);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not create segment key "
+					"buffer\n");
+			r->seg_keys = NULL;
+			r->seg_elems = 0;
+			return -1;
+		}
+		r->seg_elems = elems;
+	}
+
+	/* Only sort on as many segment bits as there are segments */
+	while (seg_bits < 32 && (1ul << seg_bits) < segs)
+		seg_bits++;
+
+	items = ((elems + seg->wg_size - 1) / seg->wg_size) * seg->wg_size;
+
+	error =  clSetKernelArg(seg->seg_pack, 0, sizeof(cl_mem), &keys);
+	error |= clSetKernelArg(seg->seg_pack, 1, sizeof(cl_mem),
+			&r->seg_keys);
+	error |= clSetKernelArg(seg->seg_pack, 2, sizeof(cl_mem),
+			&seg_offsets);
+	error |= clSetKernelArg(seg->seg_pack, 3, sizeof(cl_uint), &segs_arg);
+	error |= opencl_set_kernel_arg_idx(seg->seg_pack, 4, elems);
+	error |= clSetKernelArg(seg->seg_unpack, 0, sizeof(cl_mem),
+			&r->seg_keys);
+	error |= clSetKernelArg(seg->seg_unpack, 1, sizeof(cl_mem), &keys);
+	error |= opencl_set_kernel_arg_idx(seg->seg_unpack, 2, elems);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "One of the arguments could not be set: %d.\n",
+				error);
+		return -1;
+	}
+
+	if (radix_sort_enqueue(q, seg->seg_pack, items, seg->wg_size,
+			time_ns))
+		return -1;
+
+	if (radix_sort_run(seg, q, r->seg_keys, values, elems,
+			32 + seg_bits, time_ns))
+		return -1;
+
+	r->seg_items = items;
+
+	return radix_sort_enqueue(q, seg->seg_unpack, items, seg->wg_size,
+			time_ns);
+}
+
+void
+radix_sort_measure(struct radix_sort *r, cl_command_queue q)
+{
+	size_t ldims[] = {r->wg_size};
+
+	/* The scan turns the digit counts into offsets in place and can't be
+	 * repeated. The scatter goes first, while the offsets still match
+	 * its input. */
+	if (r->run_items) {
+		if (r->scatter_intact)
+			opencl_kernel_measure(q, r->scatter, 1, NULL,
+					&r->run_items, ldims);
+		opencl_kernel_measure(q, r->count, 1, NULL, &r->run_items,
+				ldims);
+	}
+
+	/* Measure the inner sort before pack overwrites its keys */
+	if (r->seg_items) {
+		radix_sort_measure(r->seg, q);
+		ldims[0] = r->seg->wg_size;
+		opencl_kernel_measure(q, r->seg->seg_pack, 1, NULL,
+				&r->seg_items, ldims);
+		opencl_kernel_measure(q, r->seg->seg_unpack, 1, NULL,
+				&r->seg_items, ldims);
+	}
+}
+
+void
+radix_sort_release(struct radix_sort *r)
+{
+	if (r->seg)
+		radix_sort_release(r->seg);
+	if (r->seg_keys)
+		opencl_release_buffer(r->seg_keys);
+	if (r->counts)
+		opencl_release_buffer(r->counts);
+	if (r->keys_tmp)
+		opencl_release_buffer(r->keys_tmp);
+	if (r->vals_tmp)
+		opencl_release_buffer(r->vals_tmp);
+	if (r->count)
+		clReleaseKernel(r->count);
+	if (r->scan)
+		clReleaseKernel(r->scan);
+	if (r->scatter)
+		clReleaseKernel(r->scatter);
+	if (r->seg_pack)
+		clReleaseKernel(r->seg_pack);
+	if (r->seg_unpack)
+		clReleaseKernel(r->seg_unpack);
+	if (r->prg)
+		clReleaseProgram(r->prg);
+
+	free(r);
+}
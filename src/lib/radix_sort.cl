@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * LSD radix sort, four bits per pass. Every pass counts the digits of a
+ * contiguous chunk of keys per work-group, scans the counts in digit-major
+ * order and scatters the keys. Within a work-group keys are ranked with a
+ * stable local split sort, so every pass preserves the order of equal digits.
+ *
+ * Built per key width and payload:
+ * - RADIX_KEY64 for 64-bit keys, 32-bit otherwise,
+ * - RADIX_VALUES to move a 32-bit value along with each key.
+ */
+
+#define RADIX_BITS	4
+#define RADIX		(1 << RADIX_BITS)
+#define RADIX_MASK	(RADIX - 1)
+
+#ifdef RADIX_KEY64
+typedef ulong key_t;
+#else
+typedef uint key_t;
+#endif
+
+/* Inclusive scan across the work-group. l holds local size entries. */
+inline uint scan_incl(uint v, uint __local *l)
+{
+	uint lx = get_local_id(0);
+	uint off, t;
+
+	l[lx] = v;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (off = 1; off < get_local_size(0); off <<= 1) {
+		t = lx >= off ? l[lx - off] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		l[lx] += t;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	t = l[lx];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return t;
+}
+
+/* Launch in 1D, local size of at least RADIX. Work-group g counts the digits
+ * of keys [g * chunk, (g + 1) * chunk) into counts[digit][g]. */
+__kernel void radix_count(key_t __global *keys, idx_t elems, idx_t chunk,
+		uint shift, uint __global *counts)
+{
+	__local uint hist[RADIX];
+	uint lx = get_local_id(0);
+	uint g = get_group_id(0);
+	idx_t i, end;
+
+	if (lx < RADIX)
+		hist[lx] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	end = min((idx_t) (g + 1) * chunk, elems);
+	for (i = g * chunk + lx; i < end; i += get_local_size(0))
+		atomic_inc(&hist[(keys[i] >> shift) & RADIX_MASK]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lx < RADIX)
+		counts[lx * get_num_groups(0) + g] = hist[lx];
+}
+
+/* Launch a single work-group. Exclusive scan of n counts in place. */
+__kernel void radix_scan(uint __global *counts, uint n, uint __local *l)
+{
+	__local uint carry;
+	uint lx = get_local_id(0);
+	uint base, v, s;
+
+	if (lx == 0)
+		carry = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (base = 0; base < n; base += get_local_size(0)) {
+		v = base + lx < n ? counts[base + lx] : 0;
+		s = scan_incl(v, l);
+
+		if (base + lx < n)
+			counts[base + lx] = carry + s - v;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (lx == get_local_size(0) - 1)
+			carry += s;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+/* Launch with the same work-groups as radix_count. l_keys and l_vals hold
+ * local size entries, l holds 3 * local size entries. */
+__kernel void radix_scatter(key_t __global *keys_in, key_t __global *keys_out,
+		uint __global *vals_in, uint __global *vals_out, idx_t elems,
+		idx_t chunk, uint shift, uint __global *offsets,
+		key_t __local *l_keys, uint __local *l_vals, uint __local *l)
+{
+	__local uint base[RADIX];
+	__local uint tile_cnt[RADIX];
+	__local uint tile_start[RADIX];
+	uint __local *l_digit = &l[get_local_size(0)];
+	uint __local *l_lane = &l[2 * get_local_size(0)];
+	uint lx = get_local_id(0);
+	uint ls = get_local_size(0);
+	uint g = get_group_id(0);
+	uint d, lane, bit, ones, e, b, np;
+	idx_t t, end, valid;
+	key_t key;
+
+	if (lx < RADIX)
+		base[lx] = offsets[lx * get_num_groups(0) + g];
+
+	end = min((idx_t) (g + 1) * chunk, elems);
+	for (t = g * chunk; t < end; t += ls) {
+		valid = end - t;
+
+		if (lx < RADIX)
+			tile_cnt[lx] = 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		/* Out-of-range lanes are at the tail, sorting them behind
+		 * the last digit keeps the valid lanes in place */
+		if (lx < valid) {
+			key = keys_in[t + lx];
+			l_keys[lx] = key;
+#ifdef RADIX_VALUES
+			l_vals[lx] = vals_in[t + lx];
+#endif
+			d = (key >> shift) & RADIX_MASK;
+			atomic_inc(&tile_cnt[d]);
+		} else {
+			d = RADIX_MASK;
+		}
+		lane = lx;
+
+		/* Stable split on each digit bit */
+		for (b = 0; b < RADIX_BITS; b++) {
+			bit = (d >> b) & 1;
+			e = scan_incl(bit, l);
+			ones = l[ls - 1];
+			e -= bit;
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			np = bit ? (ls - ones) + e : lx - e;
+			l_digit[np] = d;
+			l_lane[np] = lane;
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			d = l_digit[lx];
+			lane = l_lane[lx];
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		/* Position lx now holds the lx-th key in digit order */
+		l_digit[lx] = d;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lx == 0 || l_digit[lx - 1] != d)
+			tile_start[d] = lx;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (lane < valid) {
+			np = base[d] + lx - tile_start[d];
+			keys_out[np] = l_keys[lane];
+#ifdef RADIX_VALUES
+			vals_out[np] = l_vals[lane];
+#endif
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (lx < RADIX)
+			base[lx] += tile_cnt[lx];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+#ifdef RADIX_KEY64
+/* Launch in 1D, one work-item per element. Prepend the segment index to
+ * 32-bit keys, segment s spanning [seg_offsets[s], seg_offsets[s + 1]). */
+__kernel void radix_seg_pack(uint __global *keys, ulong __global *out,
+		uint __global *seg_offsets, uint segs, idx_t elems)
+{
+	idx_t n = get_global_id(0);
+	uint lo = 0, hi = segs, mid;
+
+	if (n >= elems)
+		return;
+
+	/* Last segment starting at or before n */
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (seg_offsets[mid] <= n)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	out[n] = ((ulong) lo << 32) | keys[n];
+}
+
+/* Launch in 1D, one work-item per element. Strip the segment index again. */
+__kernel void radix_seg_unpack(ulong __global *in, uint __global *keys,
+		idx_t elems)
+{
+	idx_t n = get_global_id(0);
+
+	if (n < elems)
+		keys[n] = (uint) in[n];
+}
+#endif
@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "lib/reduce.h"
+
+/* Work-groups per segment in the first pass, per compute unit */
+#define REDUCE_GROUPS_PER_CU 4
+
+static const char *reduce_op_defs[REDUCE_OPS] = {
+	[REDUCE_SUM] = "-D REDUCE_SUM",
+	[REDUCE_MIN] = "-D REDUCE_MIN",
+	[REDUCE_MAX] = "-D REDUCE_MAX",
+	[REDUCE_ARGMAX] = "-D REDUCE_ARGMAX",
+};
+
+static const char *reduce_type_defs[REDUCE_TYPES] = {
+	[REDUCE_FLOAT] = "-D REDUCE_FLOAT",
+	[REDUCE_INT] = "-D REDUCE_INT",
+};
+
+struct reduce {
+	cl_context ctx;
+	cl_program prg;
+	cl_kernel first;
+	cl_kernel partial;
+
+	clReduceOp op;
+	size_t res_size;
+	size_t wg_size;
+	size_t groups;
+
+	/* Partial results and scalar output, grown on demand */
+	cl_mem scratch;
+	size_t scratch_size;
+	cl_mem scalar;
+
+	/* First pass work-groups per segment and segments of the last run,
+	 * 0 if none */
+	size_t run_groups;
+	size_t run_segs;
+};
+
+struct reduce *
+reduce_create(cl_context ctx, clReduceOp op, clReduceType type,
+		bool subgroups)
+{
+	struct reduce *r;
+	char opts[128];
+	cl_uint cus;
+	cl_int error;
+
+	r = calloc(1, sizeof(struct reduce));
+	if (!r) {
+		fprintf(stderr, "Could not allocate reduction\n");
+		return NULL;
+	}
+
+	r->ctx = ctx;
+	r->op = op;
+	r->res_size = (op == REDUCE_ARGMAX) ? 2 * sizeof(cl_uint) :
+			sizeof(cl_uint);
+
+	/* Sub-group functions are part of OpenCL C 2.0 */
+	subgroups &= opencl_device_has_extension("cl_khr_subgroups");
+	snprintf(opts, sizeof(opts), "%s %s%s", reduce_op_defs[op],
+			reduce_type_defs[type],
+			subgroups ? " -D REDUCE_SUBGROUPS -cl-std=CL2.0" : "");
+
+	const char *programs = {
+		"src/lib/reduce.cl"
+	};
+	r->prg = opencl_compile_program_opts(ctx, 1, &programs, opts);
+	if (!r->prg)
+		goto error;
+
+	r->first = clCreateKernel(r->prg, "reduce_first", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel reduce_first\n");
+		goto error;
+	}
+
+	r->partial = clCreateKernel(r->prg, "reduce_partial", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel reduce_partial\n");
+		goto error;
+	}
+
+	/* The local tree needs a power-of-two work-group size */
+	r->wg_size = 1;
+	while (r->wg_size * 2 <= opencl_max_workgroup_size() &&
+	       r->wg_size < 256)
+		r->wg_size *= 2;
+
+	error = clGetDeviceInfo(opencl_get_device(),
+			CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &cus,
+			NULL);
+	if (error != CL_SUCCESS)
+		cus = 1;
+	r->groups = cus * REDUCE_GROUPS_PER_CU;
+
+	r->scalar = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			r->res_size, NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create reduction out buffer\n");
+		r->scalar = NULL;
+		goto error;
+	}
+
+	return r;
+
+error:
+	reduce_release(r);
+	return NULL;
+}
+
+size_t
+reduce_result_size(struct reduce *r)
+{
+	return r->res_size;
+}
+
+static int
+reduce_enqueue(struct reduce *r, cl_command_queue q, cl_kernel k,
+		cl_mem in, size_t seg_elems, size_t segs, size_t groups,
+		cl_mem out, cl_ulong *time_ns)
+{
+	cl_int error;
+	cl_event time;
+
+	error =  clSetKernelArg(k, 0, sizeof(cl_mem), &in);
+	error |= opencl_set_kernel_arg_idx(k, 1, seg_elems);
+	error |= clSetKernelArg(k, 2, sizeof(cl_mem), &out);
+	error |= clSetKernelArg(k, 3, r->wg_size * r->res_size, NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "One of the arguments could not be set: %d.\n",
+				error);
+		return -1;
+	}
+
+	const size_t dims[] = {groups * r->wg_size, segs};
+	const size_t ldims[] = {r->wg_size, 1};
+	error = clEnqueueNDRangeKernel(q, k, 2, NULL, dims, ldims, 0, NULL,
+			time_ns ? &time : NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
+				error);
+		return -1;
+	}
+
+	if (time_ns) {
+		clFinish(q);
+		*time_ns += opencl_exec_time(time);
+		clReleaseEvent(time);
+	}
+
+	return 0;
+}
+
+int
+reduce_segments(struct reduce *r, cl_command_queue q, cl_mem in,
+		size_t seg_elems, size_t segs, cl_mem out, cl_ulong *time_ns)
+{
+	size_t groups, size;
+	cl_int error;
+
+	/* Spread each segment over enough work-groups to fill the device,
+	 * but no more than there are elements to go round */
+	groups = (r->groups + segs - 1) / segs;
+	if (groups > (seg_elems + r->wg_size - 1) / r->wg_size)
+		groups = (seg_elems + r->wg_size - 1) / r->wg_size;
+	if (groups < 1)
+		groups = 1;
+
+	r->run_groups = groups;
+	r->run_segs = segs;
+
+	if (groups == 1)
+		return reduce_enqueue(r, q, r->first, in, seg_elems, segs, 1,
+				out, time_ns);
+
+	size = groups * segs * r->res_size;
+	if (size > r->scratch_size) {
+		if (r->scratch)
+			opencl_release_buffer(r->scratch);
+
+		r->scratch = opencl_create_buffer(r->ctx,
+				CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+				size, NULL, &error);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not create reduction scratch "
+					"buffer\n");
+			r->scratch = NULL;
+			r->scratch_size = 0;
+			return -1;
+		}
+		r->scratch_size = size;
+	}
+
+	if (reduce_enqueue(r, q, r->first, in, seg_elems, segs, groups,
+			r->scratch, time_ns))
+		return -1;
+
+	return reduce_enqueue(r, q, r->partial, r->scratch, groups, segs, 1,
+			out, time_ns);
+}
+
+int
+reduce_run(struct reduce *r, cl_command_queue q, cl_mem in,
+		size_t elems, struct reduce_result *res, cl_ulong *time_ns)
+{
+	cl_int error;
+
+	if (reduce_segments(r, q, in, elems, 1, r->scalar, time_ns))
+		return -1;
+
+	res->idx = 0;
+	error = clEnqueueReadBuffer(q, r->scalar, CL_TRUE, 0, r->res_size,
+			res, 0, NULL, NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not read reduction result\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+reduce_measure(struct reduce *r, cl_command_queue q)
+{
+	size_t dims[] = {r->run_groups * r->wg_size, r->run_segs};
+	const size_t ldims[] = {r->wg_size, 1};
+
+	if (!r->run_segs)
+		return;
+
+	opencl_kernel_measure(q, r->first, 2, NULL, dims, ldims);
+	if (r->run_groups == 1)
+		return;
+
+	dims[0] = r->wg_size;
+	opencl_kernel_measure(q, r->partial, 2, NULL, dims, ldims);
+}
+
+void
+reduce_release(struct reduce *r)
+{
+	if (r->scratch)
+		opencl_release_buffer(r->scratch);
+	if (r->scalar)
+		opencl_release_buffer(r->scalar);
+	if (r->first)
+		clReleaseKernel(r->first);
+	if (r->partial)
+		clReleaseKernel(r->partial);
+	if (r->prg)
+		clReleaseProgram(r->prg);
+
+	free(r);
+}
@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Work-group reductions, specialised at compile time for one operator and one
+ * element type:
+ * - REDUCE_SUM, REDUCE_MIN, REDUCE_MAX or REDUCE_ARGMAX,
+ * - REDUCE_FLOAT or REDUCE_INT,
+ * - REDUCE_SUBGROUPS to reduce within sub-groups before going through local
+ *   memory, requires cl_khr_subgroups.
+ *
+ * Argmax carries (value, index) pairs, ties resolve to the lowest index.
+ */
+
+#if defined(REDUCE_INT)
+typedef int red_t;
+#define RED_T_MAX INT_MAX
+#define RED_T_MIN INT_MIN
+#else
+typedef float red_t;
+#define RED_T_MAX FLT_MAX
+#define RED_T_MIN (-FLT_MAX)
+#endif
+
+#if defined(REDUCE_SUBGROUPS) && defined(cl_khr_subgroups)
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#define RED_SUBGROUPS
+#endif
+
+#if defined(REDUCE_ARGMAX)
+typedef struct {
+	red_t v;
+	uint i;
+} elem_t;
+
+inline elem_t red_ident(void)
+{
+	elem_t e = {RED_T_MIN, UINT_MAX};
+
+	return e;
+}
+
+inline elem_t red_elem(red_t v, uint i)
+{
+	elem_t e = {v, i};
+
+	return e;
+}
+
+inline elem_t red_combine(elem_t a, elem_t b)
+{
+	if (b.v > a.v || (b.v == a.v && b.i < a.i))
+		return b;
+
+	return a;
+}
+
+#ifdef RED_SUBGROUPS
+inline elem_t red_subgroup(elem_t a)
+{
+	elem_t r;
+
+	r.v = sub_group_reduce_max(a.v);
+	r.i = sub_group_reduce_min(a.v == r.v ? a.i : UINT_MAX);
+
+	return r;
+}
+#endif
+
+#else
+typedef red_t elem_t;
+
+#if defined(REDUCE_MIN)
+#define RED_IDENT RED_T_MAX
+#define red_combine(a, b) min(a, b)
+#define red_subgroup(a) sub_group_reduce_min(a)
+#elif defined(REDUCE_MAX)
+#define RED_IDENT RED_T_MIN
+#define red_combine(a, b) max(a, b)
+#define red_subgroup(a) sub_group_reduce_max(a)
+#else
+#define RED_IDENT 0
+#define red_combine(a, b) ((a) + (b))
+#define red_subgroup(a) sub_group_reduce_add(a)
+#endif
+
+#define red_ident() ((elem_t) RED_IDENT)
+#define red_elem(v, i) (v)
+#endif
+
+/* Reduce acc across the work-group. l holds local size entries. The result
+ * is valid on work-item 0. Local size must be a power of two. */
+inline elem_t reduce_group(elem_t acc, elem_t __local *l)
+{
+	uint lx = get_local_id(0);
+	uint s;
+
+#ifdef RED_SUBGROUPS
+	acc = red_subgroup(acc);
+	if (get_sub_group_local_id() == 0)
+		l[get_sub_group_id()] = acc;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* Few enough sub-groups to combine their results serially */
+	if (lx == 0) {
+		for (s = 1; s < get_num_sub_groups(); s++)
+			acc = red_combine(acc, l[s]);
+	}
+#else
+	l[lx] = acc;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (s = get_local_size(0) >> 1; s > 0; s >>= 1) {
+		if (lx < s)
+			l[lx] = red_combine(l[lx], l[lx + s]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	acc = l[0];
+#endif
+
+	return acc;
+}
+
+/* Launch in 2D, dimension 1 selects the segment of seg_elems elements,
+ * dimension 0 spans the work-groups that share a segment. Every work-item
+ * first accumulates a grid-stride loop over its segment, then the
+ * work-group result is written to out[segment][group]. */
+__kernel void reduce_first(red_t __global *in, idx_t seg_elems,
+		elem_t __global *out, elem_t __local *l)
+{
+	uint lx = get_local_id(0);
+	idx_t seg = get_global_id(1);
+	idx_t stride = get_global_size(0);
+	idx_t i;
+	elem_t acc = red_ident();
+
+	in += seg * seg_elems;
+	for (i = get_global_id(0); i < seg_elems; i += stride)
+		acc = red_combine(acc, red_elem(in[i], i));
+
+	acc = reduce_group(acc, l);
+
+	if (lx == 0)
+		out[seg * get_num_groups(0) + get_group_id(0)] = acc;
+}
+
+/* As reduce_first, for partial results of a previous pass */
+__kernel void reduce_partial(elem_t __global *in, idx_t seg_elems,
+		elem_t __global *out, elem_t __local *l)
+{
+	uint lx = get_local_id(0);
+	idx_t seg = get_global_id(1);
+	idx_t stride = get_global_size(0);
+	idx_t i;
+	elem_t acc = red_ident();
+
+	in += seg * seg_elems;
+	for (i = get_global_id(0); i < seg_elems; i += stride)
+		acc = red_combine(acc, in[i]);
+
+	acc = reduce_group(acc, l);
+
+	if (lx == 0)
+		out[seg * get_num_groups(0) + get_group_id(0)] = acc;
+}
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+#include "lib/roofline.h"
+
+#define ROOFLINE_KERNELS_MAX 32
+
+/* Peak measurement parameters */
+#define ROOFLINE_RUNS 3
+#define ROOFLINE_MAD_ITEMS (1 << 20)
+#define ROOFLINE_MAD_ITERS 1024
+#define ROOFLINE_MAD_CHAINS 8 /* Must match ROOFLINE_CHAINS in roofline.cl */
+#define ROOFLINE_COPY_BYTES (256ul << 20)
+
+struct roofline_kernel {
+	const char *name;
+	unsigned int launches;
+	double flops;
+	double bytes;
+	cl_ulong time;
+};
+
+static struct {
+	bool enabled;
+	const char *csv;
+
+	struct roofline_kernel kernels[ROOFLINE_KERNELS_MAX];
+	unsigned int kernel_cnt;
+} roofline = {
+	.enabled = false,
+	.csv = NULL,
+	.kernel_cnt = 0,
+};
+
+void
+opencl_roofline_enable(const char *csv)
+{
+	roofline.enabled = true;
+	roofline.csv = csv;
+}
+
+bool
+opencl_roofline_enabled(void)
+{
+	return roofline.enabled;
+}
+
+void
+opencl_roofline_kernel(const char *name, double flops, double bytes,
+		cl_ulong time_ns)
+{
+	struct roofline_kernel *k;
+	unsigned int i;
+
+	if (!roofline.enabled)
+		return;
+
+	for (i = 0; i < roofline.kernel_cnt; i++) {
+		if (!strcmp(roofline.kernels[i].name, name))
+			break;
+	}
+
+	if (i == roofline.kernel_cnt) {
+		if (i == ROOFLINE_KERNELS_MAX) {
+			fprintf(stderr, "Too many roofline kernels, ignoring "
+					"%s\n", name);
+			return;
+		}
+		roofline.kernels[i].name = name;
+		roofline.kernel_cnt++;
+	}
+
+	k = &roofline.kernels[i];
+	k->launches++;
+	k->flops += flops;
+	k->bytes += bytes;
+	k->time += time_ns;
+}
+
+/* Best of ROOFLINE_RUNS launches, in ns */
+static cl_ulong
+roofline_time(cl_command_queue q, cl_kernel k, size_t items)
+{
+	cl_ulong start, end, best = 0ul;
+	cl_event time;
+	cl_int error;
+	unsigned int i;
+
+	const size_t dims[] = {items};
+	for (i = 0; i < ROOFLINE_RUNS; i++) {
+		error = clEnqueueNDRangeKernel(q, k, 1, NULL, dims, NULL, 0,
+				NULL, &time);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not enqueue roofline kernel: "
+					"%d\n", error);
+			return 0ul;
+		}
+		clFinish(q);
+
+		/* Not through opencl_exec_time, which would count towards the
+		 * benchmark's total execution time */
+		clGetEventProfilingInfo(time, CL_PROFILING_COMMAND_START,
+				sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(time, CL_PROFILING_COMMAND_END,
+				sizeof(cl_ulong), &end, NULL);
+		clReleaseEvent(time);
+
+		if (i == 0 || end - start < best)
+			best = end - start;
+	}
+
+	return best;
+}
+
+static int
+roofline_peaks(cl_context ctx, cl_command_queue q, double *gflops,
+		double *gbps)
+{
+	cl_program prg;
+	cl_kernel mad = NULL, copy = NULL;
+	cl_mem in = NULL, out = NULL;
+	cl_ulong max_alloc, t;
+	size_t bytes;
+	const cl_uint iters = ROOFLINE_MAD_ITERS;
+	cl_int error;
+	int ret = -1;
+
+	const char *programs = {
+		"src/lib/roofline.cl"
+	};
+	prg = opencl_compile_program(ctx, 1, &programs);
+	if (!prg)
+		return -1;
+
+	mad = clCreateKernel(prg, "roofline_mad", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel roofline_mad\n");
+		mad = NULL;
+		goto error;
+	}
+
+	copy = clCreateKernel(prg, "roofline_copy", &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create kernel roofline_copy\n");
+		copy = NULL;
+		goto error;
+	}
+
+	error = clGetDeviceInfo(opencl_get_device(),
+			CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong),
+			&max_alloc, NULL);
+	if (error != CL_SUCCESS)
+		max_alloc = ROOFLINE_COPY_BYTES;
+	bytes = ROOFLINE_COPY_BYTES;
+	if (bytes > max_alloc)
+		bytes = max_alloc & ~15ul;
+
+	/* Not through opencl_create_buffer, such that the memory statistics
+	 * remain those of the benchmark */
+	out = clCreateBuffer(ctx, CL_MEM_READ_WRITE, bytes, NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create roofline out buffer\n");
+		out = NULL;
+		goto error;
+	}
+
+	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY, bytes, NULL, &error);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not create roofline in buffer\n");
+		in = NULL;
+		goto error;
+	}
+
+	/* The out buffer is large enough for both kernels. Multiplier and
+	 * addend keep the chains finite */
+	error =  clSetKernelArg(mad, 0, sizeof(cl_mem), &out);
+	error |= opencl_set_kernel_arg_real(mad, 1, 0.999f);
+	error |= opencl_set_kernel_arg_real(mad, 2, 0.001f);
+	error |= clSetKernelArg(mad, 3, sizeof(cl_uint), &iters);
+	error |= clSetKernelArg(copy, 0, sizeof(cl_mem), &in);
+	error |= clSetKernelArg(copy, 1, sizeof(cl_mem), &out);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "One of the arguments could not be set: %d.\n",
+				error);
+		goto error;
+	}
+
+	t = roofline_time(q, mad, ROOFLINE_MAD_ITEMS);
+	if (!t)
+		goto error;
+	*gflops = 2. * ROOFLINE_MAD_CHAINS * ROOFLINE_MAD_ITERS *
+			ROOFLINE_MAD_ITEMS / t;
+
+	t = roofline_time(q, copy, bytes / 16);
+	if (!t)
+		goto error;
+	*gbps = 2. * bytes / t;
+
+	ret = 0;
+
+error:
+	if (in)
+		clReleaseMemObject(in);
+	if (out)
+		clReleaseMemObject(out);
+	if (mad)
+		clReleaseKernel(mad);
+	if (copy)
+		clReleaseKernel(copy);
+	clReleaseProgram(prg);
+
+	return ret;
+}
+
+void
+opencl_roofline_report(cl_context ctx, cl_command_queue q)
+{
+	struct roofline_kernel *k;
+	double peak_gflops, peak_gbps, gflops, gbps, ai, roof;
+	unsigned int i;
+	FILE *csv = NULL;
+
+	if (!roofline.enabled || !roofline.kernel_cnt)
+		return;
+
+	if (roofline_peaks(ctx, q, &peak_gflops, &peak_gbps)) {
+		fprintf(stderr, "Could not measure roofline peaks\n");
+		return;
+	}
+
+	if (roofline.csv) {
+		csv = fopen(roofline.csv, "w");
+		if (!csv)
+			fprintf(stderr, "Could not open %s for writing\n",
+					roofline.csv);
+		else
+			fprintf(csv, "kernel,launches,time_ns,flops,bytes,"
+					"gflops,gbps,intensity,roof_gflops,"
+					"peak_gflops,peak_gbps\n");
+	}
+
+	printf("Roofline: peak %.1f GFLOP/s, %.1f GB/s, ridge point "
+			"%.2f FLOP/B\n", peak_gflops, peak_gbps,
+			peak_gflops / peak_gbps);
+	printf("%-22s %9s %6s %9s %6s %8s %7s %6s\n", "Kernel", "GFLOP/s",
+			"%peak", "GB/s", "%peak", "FLOP/B", "Bound", "%roof");
+
+	for (i = 0; i < roofline.kernel_cnt; i++) {
+		k = &roofline.kernels[i];
+		if (!k->time)
+			continue;
+
+		gflops = k->flops / k->time;
+		gbps = k->bytes / k->time;
+		ai = k->bytes > 0. ? k->flops / k->bytes : 0.;
+		roof = ai * peak_gbps;
+		if (roof > peak_gflops)
+			roof = peak_gflops;
+
+		printf("%-22s %9.2f %5.1f%% %9.2f %5.1f%% %8.3f %7s %5.1f%%\n",
+				k->name, gflops, 100. * gflops / peak_gflops,
+				gbps, 100. * gbps / peak_gbps, ai,
+				ai < peak_gflops / peak_gbps ? "memory" :
+				"compute", roof > 0. ? 100. * gflops / roof :
+				0.);
+
+		if (csv)
+			fprintf(csv, "%s,%u,%lu,%.0f,%.0f,%f,%f,%f,%f,%f,%f\n",
+					k->name, k->launches, k->time,
+					k->flops, k->bytes, gflops, gbps, ai,
+					roof, peak_gflops, peak_gbps);
+	}
+
+	if (csv)
+		fclose(csv);
+}
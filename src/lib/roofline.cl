@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Micro-benchmarks measuring the peak arithmetic throughput and memory
+ * bandwidth that bound the roofline.
+ */
+
+/* Independent multiply-add chains per work-item, enough to hide the
+ * pipeline latency of most devices */
+#define ROOFLINE_CHAINS 8
+
+/* Launch in 1D, arbitrary size. Performs 2 * ROOFLINE_CHAINS * iters
+ * floating point operations per work-item. */
+__kernel void
+roofline_mad(__global real *out, real a, real b, uint iters)
+{
+	real x[ROOFLINE_CHAINS];
+	real sum = 0;
+	uint i, c;
+
+	#pragma unroll
+	for (c = 0; c < ROOFLINE_CHAINS; c++)
+		x[c] = (real) (get_global_id(0) + c);
+
+	for (i = 0; i < iters; i++) {
+		#pragma unroll
+		for (c = 0; c < ROOFLINE_CHAINS; c++)
+			x[c] = mad(x[c], a, b);
+	}
+
+	/* Consume the results, such that none of the chains is eliminated */
+	#pragma unroll
+	for (c = 0; c < ROOFLINE_CHAINS; c++)
+		sum += x[c];
+
+	out[get_global_id(0)] = sum;
+}
+
+/* Launch in 1D, one thread per vector */
+__kernel void
+roofline_copy(__global const uint4 *in, __global uint4 *out)
+{
+	out[get_global_id(0)] = in[get_global_id(0)];
+}
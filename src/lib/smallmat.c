@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "lib/opencl.h"
+#include "lib/smallmat.h"
+
+/* Small enough to keep plenty of work-groups resident despite the register
+ * pressure of the 6x6 solve */
+#define SMALLMAT_WG_SIZE 64
+
+enum smallmat_kernel {
+	SMALLMAT_INV3 = 0,
+	SMALLMAT_INV3_SYM,
+	SMALLMAT_SOLVE6,
+	SMALLMAT_EIG3,
+	SMALLMAT_KERNELS,
+};
+
+static const char *smallmat_kernel_names[SMALLMAT_KERNELS] = {
+	[SMALLMAT_INV3] = "smallmat_inv3",
+	[SMALLMAT_INV3_SYM] = "smallmat_inv3_sym",
+	[SMALLMAT_SOLVE6] = "smallmat_solve6",
+	[SMALLMAT_EIG3] = "smallmat_eig3",
+};
+
+struct smallmat {
+	cl_program prg;
+	cl_kernel kernel[SMALLMAT_KERNELS];
+	size_t wg_size;
+
+	/* Global size of the last launch of each kernel, 0 if none */
+	size_t items[SMALLMAT_KERNELS];
+};
+
+struct smallmat *
+smallmat_create(cl_context ctx)
+{
+	struct smallmat *s;
+	cl_int error;
+	int i;
+
+	s = calloc(1, sizeof(struct smallmat));
+	if (!s) {
+		fprintf(stderr, "Could not allocate small matrix handle\n");
+		return NULL;
+	}
+
+	const char *programs = {
+		"src/lib/smallmat.cl"
+	};
+	s->prg = opencl_compile_program(ctx, 1, &programs);
+	if (!s->prg)
+		goto error;
+
+	for (i = 0; i < SMALLMAT_KERNELS; i++) {
+		s->kernel[i] = clCreateKernel(s->prg,
+				smallmat_kernel_names[i], &error);
+		if (error != CL_SUCCESS) {
+			fprintf(stderr, "Could not create kernel %s\n",
+					smallmat_kernel_names[i]);
+			s->kernel[i] = NULL;
+			goto error;
+		}
+	}
+
+	s->wg_size = SMALLMAT_WG_SIZE;
+	if (s->wg_size > opencl_max_workgroup_size())
+		s->wg_size = opencl_max_workgroup_size();
+
+	return s;
+
+error:
+	smallmat_release(s);
+	return NULL;
+}
+
+/* Set the buffer arguments and trailing batch size, then launch one
+ * work-item per matrix */
+static int
+smallmat_enqueue(struct smallmat *s, cl_command_queue q,
+		enum smallmat_kernel k, size_t batch, unsigned int bufs,
+		cl_mem *buf, cl_ulong *time_ns)
+{
+	cl_kernel kernel = s->kernel[k];
+	cl_int error = CL_SUCCESS;
+	cl_event time;
+	unsigned int i;
+
+	for (i = 0; i < bufs; i++)
+		error |= clSetKernelArg(kernel, i, sizeof(cl_mem), &buf[i]);
+	error |= opencl_set_kernel_arg_idx(kernel, bufs, batch);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "One of the arguments could not be set: %d.\n",
+				error);
+		return -1;
+	}
+
+	const size_t dims[] = {((batch + s->wg_size - 1) / s->wg_size) *
+			s->wg_size};
+	const size_t ldims[] = {s->wg_size};
+	error = clEnqueueNDRangeKernel(q, kernel, 1, NULL, dims, ldims, 0,
+			NULL, time_ns ? &time : NULL);
+	if (error != CL_SUCCESS) {
+		fprintf(stderr, "Could not enqueue %s: %d\n",
+				smallmat_kernel_names[k], error);
+		return -1;
+	}
+	s->items[k] = dims[0];
+
+	if (time_ns) {
+		clFinish(q);
+		*time_ns += opencl_exec_time(time);
+		clReleaseEvent(time);
+	}
+
+	return 0;
+}
+
+int
+smallmat_inv3(struct smallmat *s, cl_command_queue q, size_t batch,
+		cl_mem in, cl_mem out, bool sym, cl_ulong *time_ns)
+{
+	cl_mem buf[] = {in, out};
+
+	return smallmat_enqueue(s, q, sym ? SMALLMAT_INV3_SYM : SMALLMAT_INV3,
+			batch, 2, buf, time_ns);
+}
+
+int
+smallmat_solve6(struct smallmat *s, cl_command_queue q, size_t batch,
+		cl_mem a, cl_mem b, cl_mem x, cl_ulong *time_ns)
+{
+	cl_mem buf[] = {a, b, x};
+
+	return smallmat_enqueue(s, q, SMALLMAT_SOLVE6, batch, 3, buf,
+			time_ns);
+}
+
+int
+smallmat_eig3(struct smallmat *s, cl_command_queue q, size_t batch,
+		cl_mem a, cl_mem w, cl_mem v, cl_ulong *time_ns)
+{
+	cl_mem buf[] = {a, w, v};
+
+	return smallmat_enqueue(s, q, SMALLMAT_EIG3, batch, 3, buf, time_ns);
+}
+
+void
+smallmat_measure(struct smallmat *s, cl_command_queue q)
+{
+	const size_t ldims[] = {s->wg_size};
+	int i;
+
+	for (i = 0; i < SMALLMAT_KERNELS; i++) {
+		if (s->items[i])
+			opencl_kernel_measure(q, s->kernel[i], 1, NULL,
+					&s->items[i], ldims);
+	}
+}
+
+void
+smallmat_release(struct smallmat *s)
+{
+	int i;
+
+	for (i = 0; i < SMALLMAT_KERNELS; i++) {
+		if (s->kernel[i])
+			clReleaseKernel(s->kernel[i]);
+	}
+	if (s->prg)
+		clReleaseProgram(s->prg);
+
+	free(s);
+}
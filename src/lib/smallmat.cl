@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Batched small dense matrix kernels, one work-item per matrix. Batches are
+ * stored as struct of arrays: element k of matrix n lives at in[k * batch + n],
+ * such that neighbouring work-items load consecutive words. Symmetric
+ * matrices are packed, see SM_UP.
+ */
+
+#include "src/lib/smallmat_device.h"
+
+/* Launch in 1D, one thread per 3x3 matrix, 9 elements each */
+__kernel void
+smallmat_inv3(__global const float *in, __global float *out, idx_t batch)
+{
+	idx_t n = get_global_id(0);
+	float a[9], r[9];
+	int k;
+
+	if (n >= batch)
+		return;
+
+	#pragma unroll
+	for (k = 0; k < 9; k++)
+		a[k] = in[k * batch + n];
+
+	if (!sm_inv3(a, r)) {
+		#pragma unroll
+		for (k = 0; k < 9; k++)
+			r[k] = NAN;
+	}
+
+	#pragma unroll
+	for (k = 0; k < 9; k++)
+		out[k * batch + n] = r[k];
+}
+
+/* Launch in 1D, one thread per packed symmetric 3x3 matrix, 6 elements in,
+ * 9 elements out */
+__kernel void
+smallmat_inv3_sym(__global const float *in, __global float *out, idx_t batch)
+{
+	idx_t n = get_global_id(0);
+	float a[9], r[9];
+	int i, j, k;
+
+	if (n >= batch)
+		return;
+
+	k = 0;
+	#pragma unroll
+	for (i = 0; i < 3; i++) {
+		#pragma unroll
+		for (j = i; j < 3; j++, k++)
+			a[i * 3 + j] = in[k * batch + n];
+	}
+
+	if (!sm_inv3_sym(a, r)) {
+		#pragma unroll
+		for (k = 0; k < 9; k++)
+			r[k] = NAN;
+	}
+
+	#pragma unroll
+	for (k = 0; k < 9; k++)
+		out[k * batch + n] = r[k];
+}
+
+/* Launch in 1D, one thread per packed symmetric positive-definite 6x6
+ * system. a holds 21 elements, b and x 6 each. Systems that are not
+ * positive-definite produce NaN. */
+__kernel void
+smallmat_solve6(__global const float *a, __global const float *b,
+		__global float *x, idx_t batch)
+{
+	idx_t n = get_global_id(0);
+	float m[21], v[6], r[6];
+	int k;
+
+	if (n >= batch)
+		return;
+
+	#pragma unroll
+	for (k = 0; k < 21; k++)
+		m[k] = a[k * batch + n];
+
+	#pragma unroll
+	for (k = 0; k < 6; k++)
+		v[k] = b[k * batch + n];
+
+	if (!sm_chol6_solve(m, v, r)) {
+		#pragma unroll
+		for (k = 0; k < 6; k++)
+			r[k] = NAN;
+	}
+
+	#pragma unroll
+	for (k = 0; k < 6; k++)
+		x[k * batch + n] = r[k];
+}
+
+/* Launch in 1D, one thread per packed symmetric 3x3 matrix. Produces 3
+ * ascending eigenvalues in w and the matching eigenvectors as the columns of
+ * the row-major 3x3 matrices in v. */
+__kernel void
+smallmat_eig3(__global const float *a, __global float *w, __global float *v,
+		idx_t batch)
+{
+	idx_t n = get_global_id(0);
+	float m[6], ew[3], ev[9];
+	int k;
+
+	if (n >= batch)
+		return;
+
+	#pragma unroll
+	for (k = 0; k < 6; k++)
+		m[k] = a[k * batch + n];
+
+	sm_eig3_sym(m, ew, ev);
+
+	#pragma unroll
+	for (k = 0; k < 3; k++)
+		w[k * batch + n] = ew[k];
+
+	#pragma unroll
+	for (k = 0; k < 9; k++)
+		v[k * batch + n] = ev[k];
+}
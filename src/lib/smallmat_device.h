@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Small dense matrix routines for OpenCL C, operating on private arrays such
+ * that a work-item keeps its matrix in registers. Include from a kernel with
+ * #include "src/lib/smallmat_device.h".
+ *
+ * Symmetric matrices are either kept in full storage, of which only the upper
+ * triangle is read, or packed: the upper triangle row by row, see SM_UP.
+ */
+
+#ifndef SMALLMAT_DEVICE_H
+#define SMALLMAT_DEVICE_H
+
+/* Index of element (i, j), i <= j, of a packed symmetric n x n matrix */
+#define SM_UP(i, j, n) ((i) * (n) - (((i) * ((i) - 1)) / 2) + (j) - (i))
+
+/* Symmetric element (i, j) of a packed matrix, any order of i and j */
+#define SM_SYM(a, i, j, n) \
+	((i) <= (j) ? (a)[SM_UP(i, j, n)] : (a)[SM_UP(j, i, n)])
+
+/* Jacobi sweeps for the 3x3 eigendecomposition, converges in 4-5 */
+#define SM_JACOBI_SWEEPS 8
+
+inline float
+sm_det3(const float a[9])
+{
+	return	a[0] * (a[4] * a[8] - a[5] * a[7]) -
+		a[1] * (a[3] * a[8] - a[5] * a[6]) +
+		a[2] * (a[3] * a[7] - a[4] * a[6]);
+}
+
+/* Adjugate inverse of a general 3x3 matrix. Returns false, leaving out
+ * untouched, if the matrix is singular. */
+inline bool
+sm_inv3(const float a[9], float out[9])
+{
+	float det = sm_det3(a);
+	float r;
+
+	if (det == 0.0f)
+		return false;
+
+	r = 1.0f / det;
+	out[0] =  (a[4] * a[8] - a[5] * a[7]) * r;
+	out[1] = -(a[1] * a[8] - a[2] * a[7]) * r;
+	out[2] =  (a[1] * a[5] - a[2] * a[4]) * r;
+	out[3] = -(a[3] * a[8] - a[5] * a[6]) * r;
+	out[4] =  (a[0] * a[8] - a[2] * a[6]) * r;
+	out[5] = -(a[0] * a[5] - a[2] * a[3]) * r;
+	out[6] =  (a[3] * a[7] - a[4] * a[6]) * r;
+	out[7] = -(a[0] * a[7] - a[1] * a[6]) * r;
+	out[8] =  (a[0] * a[4] - a[1] * a[3]) * r;
+
+	return true;
+}
+
+/* As sm_inv3 for a symmetric matrix in full storage, such as a covariance
+ * matrix. Only the upper triangle is read, which saves instructions and
+ * registers over the general case. */
+inline bool
+sm_inv3_sym(const float a[9], float out[9])
+{
+	float c0, c1, c2, det, r;
+
+	c0 = a[4] * a[8] - a[5] * a[5];
+	c1 = a[1] * a[8] - a[5] * a[2];
+	c2 = a[1] * a[5] - a[4] * a[2];
+	det = a[0] * c0 - a[1] * c1 + a[2] * c2;
+
+	if (det == 0.0f)
+		return false;
+
+	r = 1.0f / det;
+	out[0] = c0 * r;
+	out[1] = -c1 * r;
+	out[2] = c2 * r;
+	out[4] = (a[0] * a[8] - a[2] * a[2]) * r;
+	out[5] = -(a[0] * a[5] - a[2] * a[1]) * r;
+	out[8] = (a[0] * a[4] - a[1] * a[1]) * r;
+	out[3] = out[1];
+	out[6] = out[2];
+	out[7] = out[5];
+
+	return true;
+}
+
+/* Solve a x = b for a packed symmetric positive-definite 6x6 matrix through
+ * its Cholesky factorisation. Returns false if a is not positive-definite. */
+inline bool
+sm_chol6_solve(const float a[21], const float b[6], float x[6])
+{
+	float l[21]; /* Lower triangle, row by row */
+	float s;
+	int i, j, k;
+
+	for (j = 0; j < 6; j++) {
+		s = a[SM_UP(j, j, 6)];
+		for (k = 0; k < j; k++)
+			s -= l[SM_UP(k, j, 6)] * l[SM_UP(k, j, 6)];
+		if (s <= 0.0f)
+			return false;
+		l[SM_UP(j, j, 6)] = sqrt(s);
+
+		for (i = j + 1; i < 6; i++) {
+			s = a[SM_UP(j, i, 6)];
+			for (k = 0; k < j; k++)
+				s -= l[SM_UP(k, i, 6)] * l[SM_UP(k, j, 6)];
+			l[SM_UP(j, i, 6)] = s / l[SM_UP(j, j, 6)];
+		}
+	}
+
+	/* Forward substitution, L y = b */
+	for (i = 0; i < 6; i++) {
+		s = b[i];
+		for (k = 0; k < i; k++)
+			s -= l[SM_UP(k, i, 6)] * x[k];
+		x[i] = s / l[SM_UP(i, i, 6)];
+	}
+
+	/* Back substitution, L^T x = y */
+	for (i = 5; i >= 0; i--) {
+		s = x[i];
+		for (k = i + 1; k < 6; k++)
+			s -= l[SM_UP(i, k, 6)] * x[k];
+		x[i] = s / l[SM_UP(i, i, 6)];
+	}
+
+	return true;
+}
+
+/* Jacobi rotation zeroing m[p][q], accumulated into the eigenvectors v */
+inline void
+sm_jacobi_rotate(float m[3][3], float v[3][3], int p, int q)
+{
+	float theta, t, c, s, mkp, mkq;
+	int k;
+
+	if (m[p][q] == 0.0f)
+		return;
+
+	theta = (m[q][q] - m[p][p]) / (2.0f * m[p][q]);
+	t = sign(theta) / (fabs(theta) + sqrt(theta * theta + 1.0f));
+	if (theta == 0.0f)
+		t = 1.0f;
+	c = rsqrt(t * t + 1.0f);
+	s = t * c;
+
+	for (k = 0; k < 3; k++) {
+		mkp = m[k][p];
+		mkq = m[k][q];
+		m[k][p] = c * mkp - s * mkq;
+		m[k][q] = s * mkp + c * mkq;
+	}
+
+	for (k = 0; k < 3; k++) {
+		mkp = m[p][k];
+		mkq = m[q][k];
+		m[p][k] = c * mkp - s * mkq;
+		m[q][k] = s * mkp + c * mkq;
+	}
+
+	for (k = 0; k < 3; k++) {
+		mkp = v[k][p];
+		mkq = v[k][q];
+		v[k][p] = c * mkp - s * mkq;
+		v[k][q] = s * mkp + c * mkq;
+	}
+}
+
+/* Eigendecomposition of a packed symmetric 3x3 matrix with cyclic Jacobi
+ * rotations. Eigenvalues w are sorted ascending, eigenvector i is column i
+ * of the row-major matrix vec. */
+inline void
+sm_eig3_sym(const float a[6], float w[3], float vec[9])
+{
+	float m[3][3], v[3][3];
+	float off, tmp;
+	int i, j, k, sweep;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			m[i][j] = SM_SYM(a, i, j, 3);
+			v[i][j] = (i == j) ? 1.0f : 0.0f;
+		}
+	}
+
+	for (sweep = 0; sweep < SM_JACOBI_SWEEPS; sweep++) {
+		off = m[0][1] * m[0][1] + m[0][2] * m[0][2] +
+				m[1][2] * m[1][2];
+		if (off <= FLT_MIN)
+			break;
+
+		sm_jacobi_rotate(m, v, 0, 1);
+		sm_jacobi_rotate(m, v, 0, 2);
+		sm_jacobi_rotate(m, v, 1, 2);
+	}
+
+	for (i = 0; i < 3; i++)
+		w[i] = m[i][i];
+
+	/* Selection sort, carrying the eigenvectors along */
+	for (i = 0; i < 2; i++) {
+		k = i;
+		for (j = i + 1; j < 3; j++) {
+			if (w[j] < w[k])
+				k = j;
+		}
+
+		if (k == i)
+			continue;
+
+		tmp = w[i];
+		w[i] = w[k];
+		w[k] = tmp;
+		for (j = 0; j < 3; j++) {
+			tmp = v[j][i];
+			v[j][i] = v[j][k];
+			v[j][k] = tmp;
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++)
+			vec[i * 3 + j] = v[i][j];
+	}
+}
+
+#endif /* SMALLMAT_DEVICE_H */
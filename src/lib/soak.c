@@ -0,0 +1,339 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <math.h>
+#include <time.h>
+
+#include "lib/soak.h"
+
+#define SOAK_NAME_MAX 128
+
+/* Launches enqueued between synchronisations */
+#define SOAK_BATCH 32
+/* Relative drop below the best window that counts as throttling */
+#define SOAK_THROTTLE 0.05
+
+#define SOAK_CPUFREQ \
+	"/sys/devices/system/cpu/cpu[0-9]*/cpufreq/scaling_cur_freq"
+#define SOAK_THERMAL "/sys/class/thermal/thermal_zone[0-9]*/temp"
+
+struct soak_window {
+	/** Start of the window, seconds since the soak started */
+	double t;
+	unsigned int launches;
+	/** Kernels per second */
+	double rate;
+	/** Mean execution time in ns */
+	double exec;
+	/** Mean CPU frequency in MHz, NAN if unknown */
+	double mhz;
+	/** Hottest thermal zone in degrees Celsius, NAN if unknown */
+	double temp;
+};
+
+static struct {
+	uint64_t duration;
+	uint64_t window;
+	const char *csv_file;
+	FILE *csv;
+} soak = {
+	.duration = 0ul,
+	.window = 1000000000ul,
+	.csv_file = NULL,
+	.csv = NULL,
+};
+
+int
+opencl_soak_enable(char *spec)
+{
+	double duration, window = 1.;
+	char *sep;
+	int ret;
+
+	/* <seconds>[:<window>[:<file>]] */
+	ret = sscanf(spec, "%lf:%lf", &duration, &window);
+	if (ret < 1 || duration <= 0. || window <= 0.)
+		return -EINVAL;
+
+	sep = strchr(spec, ':');
+	if (sep)
+		sep = strchr(sep + 1, ':');
+	soak.csv_file = sep ? sep + 1 : NULL;
+
+	soak.duration = duration * 1e9;
+	soak.window = window * 1e9;
+	return 0;
+}
+
+bool
+opencl_soak_enabled(void)
+{
+	return soak.duration > 0ul;
+}
+
+static uint64_t
+soak_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+/* Mean, or with max the maximum, of the integers in all files matching a
+ * pattern. NAN if none could be read. */
+static double
+soak_sysfs(const char *pattern, bool max)
+{
+	glob_t g;
+	FILE *f;
+	double val = 0.;
+	long v;
+	size_t i, n = 0;
+
+	if (glob(pattern, 0, NULL, &g))
+		return NAN;
+
+	for (i = 0; i < g.gl_pathc; i++) {
+		f = fopen(g.gl_pathv[i], "r");
+		if (!f)
+			continue;
+
+		if (fscanf(f, "%ld", &v) == 1) {
+			if (!max)
+				val += v;
+			else if (!n || v > val)
+				val = v;
+			n++;
+		}
+		fclose(f);
+	}
+	globfree(&g);
+
+	if (!n)
+		return NAN;
+
+	return max ? val : val / n;
+}
+
+/* Wait for and release a batch of launches, adding their execution time */
+static cl_int
+soak_batch(cl_command_queue q, cl_event *events, unsigned int n,
+		cl_ulong *busy)
+{
+	cl_ulong start, end;
+	cl_int error, ret = CL_SUCCESS;
+	unsigned int i;
+
+	ret = clFinish(q);
+	for (i = 0; i < n; i++) {
+		error = clGetEventProfilingInfo(events[i],
+				CL_PROFILING_COMMAND_START, sizeof(cl_ulong),
+				&start, NULL);
+		if (error == CL_SUCCESS)
+			error = clGetEventProfilingInfo(events[i],
+					CL_PROFILING_COMMAND_END,
+					sizeof(cl_ulong), &end, NULL);
+		if (error == CL_SUCCESS)
+			*busy += end - start;
+		else
+			ret = error;
+		clReleaseEvent(events[i]);
+	}
+
+	return ret;
+}
+
+static void
+soak_export(const char *name, struct soak_window *w, unsigned int n)
+{
+	unsigned int i;
+
+	if (!soak.csv && soak.csv_file) {
+		soak.csv = fopen(soak.csv_file, "w");
+		if (!soak.csv) {
+			fprintf(stderr, "Could not open %s for writing\n",
+					soak.csv_file);
+			soak.csv_file = NULL;
+			return;
+		}
+		fprintf(soak.csv, "kernel,window,t_s,launches,kernels_per_s,"
+				"exec_ns,cpu_mhz,temp_c\n");
+	}
+
+	if (!soak.csv)
+		return;
+
+	for (i = 0; i < n; i++)
+		fprintf(soak.csv, "%s,%u,%f,%u,%f,%f,%f,%f\n", name, i, w[i].t,
+				w[i].launches, w[i].rate, w[i].exec,
+				w[i].mhz, w[i].temp);
+}
+
+static void
+soak_summary(const char *name, struct soak_window *w, unsigned int n)
+{
+	double peak = 0., steady = 0., mhz = 0., temp = NAN;
+	double throttled = -1.;
+	unsigned int i, first, mhz_n = 0;
+
+	/* Steady state over the last quarter of the run */
+	first = n - (n + 3) / 4;
+
+	for (i = 0; i < n; i++) {
+		if (throttled < 0. && w[i].rate < (1. - SOAK_THROTTLE) * peak)
+			throttled = w[i].t;
+		if (w[i].rate > peak)
+			peak = w[i].rate;
+		if (!isnan(w[i].temp) && (isnan(temp) || w[i].temp > temp))
+			temp = w[i].temp;
+		if (i < first)
+			continue;
+
+		steady += w[i].rate;
+		if (!isnan(w[i].mhz)) {
+			mhz += w[i].mhz;
+			mhz_n++;
+		}
+	}
+	steady /= n - first;
+
+	printf("Soak %s: %u windows of %.1f s\n", name, n,
+			soak.window * 1e-9);
+	printf("  Throughput: initial %.1f, peak %.1f, steady %.1f "
+			"kernels/s, drift %+.1f%%\n", w[0].rate, peak, steady,
+			100. * (steady / w[0].rate - 1.));
+	if (throttled < 0.)
+		printf("  Not throttled\n");
+	else
+		printf("  Throttled after %.1f s\n", throttled);
+
+	if (isnan(w[0].mhz) || !mhz_n)
+		printf("  CPU frequency: n/a\n");
+	else
+		printf("  CPU frequency: initial %.0f, steady %.0f MHz\n",
+				w[0].mhz, mhz / mhz_n);
+
+	if (isnan(w[0].temp) || isnan(w[n - 1].temp))
+		printf("  Temperature: n/a\n");
+	else
+		printf("  Temperature: initial %.1f, peak %.1f, final %.1f "
+				"C\n", w[0].temp, temp, w[n - 1].temp);
+}
+
+void
+opencl_soak_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local)
+{
+	struct soak_window *windows = NULL, *w;
+	cl_event events[SOAK_BATCH];
+	char name[SOAK_NAME_MAX];
+	cl_ulong busy;
+	cl_int error = CL_SUCCESS;
+	uint64_t t_begin, t_win, t;
+	unsigned int i, n = 0, size = 0;
+
+	if (!opencl_soak_enabled())
+		return;
+
+	if (clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS)
+		snprintf(name, sizeof(name), "kernel");
+
+	clFinish(q);
+	t_begin = soak_time_ns();
+	t = t_begin;
+	while (error == CL_SUCCESS && t - t_begin < soak.duration) {
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			w = realloc(windows, size * sizeof(struct soak_window));
+			if (!w) {
+				fprintf(stderr, "Soak: could not allocate "
+						"windows\n");
+				goto error;
+			}
+			windows = w;
+		}
+
+		w = &windows[n];
+		w->t = (t - t_begin) * 1e-9;
+		w->launches = 0;
+		busy = 0l;
+
+		t_win = t;
+		do {
+			for (i = 0; i < SOAK_BATCH; i++) {
+				error = clEnqueueNDRangeKernel(q, kernel, dim,
+						offset, global, local, 0, NULL,
+						&events[i]);
+				if (error != CL_SUCCESS)
+					break;
+			}
+			if (soak_batch(q, events, i, &busy) != CL_SUCCESS &&
+			    error == CL_SUCCESS)
+				error = CL_INVALID_EVENT;
+			w->launches += i;
+			t = soak_time_ns();
+		} while (error == CL_SUCCESS && t - t_win < soak.window);
+
+		if (!w->launches)
+			break;
+
+		w->rate = w->launches / ((t - t_win) * 1e-9);
+		w->exec = (double) busy / w->launches;
+		w->mhz = soak_sysfs(SOAK_CPUFREQ, false) * 1e-3;
+		w->temp = soak_sysfs(SOAK_THERMAL, true) * 1e-3;
+		n++;
+	}
+
+	if (error != CL_SUCCESS)
+		fprintf(stderr, "Soak %s: launch failed after %.1f s: %d\n",
+				name, (t - t_begin) * 1e-9, error);
+
+	if (n) {
+		soak_summary(name, windows, n);
+		soak_export(name, windows, n);
+	}
+
+error:
+	free(windows);
+}
+
+void
+opencl_soak_report(void)
+{
+	if (!soak.csv)
+		return;
+
+	fclose(soak.csv);
+	soak.csv = NULL;
+	printf("Soak samples written to %s\n", soak.csv_file);
+}
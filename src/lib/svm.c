@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* SVM entry points require OpenCL 2.0 headers */
+#define CL_TARGET_OPENCL_VERSION 200
+#include "lib/svm.h"
+#include "lib/mem.h"
+
+static const char *svm_granularity_names[] = {
+	[OPENCL_SVM_NONE] = "none",
+	[OPENCL_SVM_COARSE] = "coarse-grained",
+	[OPENCL_SVM_FINE] = "fine-grained",
+};
+
+clSvmGranularity
+opencl_svm_caps()
+{
+	cl_device_svm_capabilities caps = 0;
+	cl_device_id dev;
+	char version[64];
+	int major = 0, minor = 0;
+	cl_int error;
+
+	dev = opencl_get_device();
+	if (!dev)
+		return OPENCL_SVM_NONE;
+
+	/* Querying SVM caps is invalid on 1.x devices */
+	error = clGetDeviceInfo(dev, CL_DEVICE_VERSION, sizeof(version),
+			version, NULL);
+	if (error != CL_SUCCESS ||
+	    sscanf(version, "OpenCL %i.%i", &major, &minor) != 2 ||
+	    major < 2)
+		return OPENCL_SVM_NONE;
+
+	error = clGetDeviceInfo(dev, CL_DEVICE_SVM_CAPABILITIES,
+			sizeof(caps), &caps, NULL);
+	if (error != CL_SUCCESS)
+		return OPENCL_SVM_NONE;
+
+	if (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+		return OPENCL_SVM_FINE;
+	else if (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER)
+		return OPENCL_SVM_COARSE;
+
+	return OPENCL_SVM_NONE;
+}
+
+void *
+opencl_svm_alloc(cl_context ctx, size_t size, clSvmGranularity gran)
+{
+	cl_svm_mem_flags flags = CL_MEM_READ_WRITE;
+	void *ptr;
+
+	if (gran == OPENCL_SVM_NONE) {
+		fprintf(stderr, "Error: SVM not supported by device\n");
+		return NULL;
+	}
+
+	if (gran == OPENCL_SVM_FINE)
+		flags |= CL_MEM_SVM_FINE_GRAIN_BUFFER;
+
+	ptr = clSVMAlloc(ctx, flags, size, 0);
+	if (!ptr)
+		fprintf(stderr, "Error: could not allocate %zu bytes of %s "
+				"SVM\n", size, svm_granularity_names[gran]);
+	else
+		opencl_mem_track(ptr, size);
+
+	return ptr;
+}
+
+void
+opencl_svm_free(cl_context ctx, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	opencl_mem_untrack(ptr);
+	clSVMFree(ctx, ptr);
+}
+
+cl_int
+opencl_svm_set_kernel_arg(cl_kernel kernel, cl_uint idx, const void *ptr)
+{
+	return clSetKernelArgSVMPointer(kernel, idx, ptr);
+}
+
+cl_int
+opencl_svm_map(cl_command_queue q, void *ptr, size_t size, bool write)
+{
+	cl_map_flags flags = CL_MAP_READ;
+
+	if (write)
+		flags |= CL_MAP_WRITE;
+
+	return clEnqueueSVMMap(q, CL_TRUE, flags, ptr, size, 0, NULL, NULL);
+}
+
+cl_int
+opencl_svm_unmap(cl_command_queue q, void *ptr)
+{
+	cl_int error;
+
+	error = clEnqueueSVMUnmap(q, ptr, 0, NULL, NULL);
+	if (error != CL_SUCCESS)
+		return error;
+
+	return clFinish(q);
+}
@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lib/fanout.h"
+#include "lib/sweep.h"
+
+#define SWEEP_FLAGS_MAX 8
+#define SWEEP_ALTS_MAX 8
+#define SWEEP_OPTS_MAX 512
+
+static const char *sweep_default[] = {
+	"-cl-fast-relaxed-math",
+	"-cl-mad-enable",
+	"-cl-no-signed-zeros",
+	"-cl-denorms-are-zero",
+};
+
+static struct {
+	const char *flags[SWEEP_FLAGS_MAX];
+	unsigned int n_flags;
+	const char *alts[SWEEP_ALTS_MAX];
+	unsigned int n_alts;
+	bool pending;
+
+	/* Options of the combination this process runs */
+	char opts[SWEEP_OPTS_MAX];
+} sweep = {
+	.n_flags = 0,
+	.n_alts = 0,
+	.pending = false,
+	.opts = "",
+};
+
+/* Split a comma separated list in place */
+static int
+sweep_split(char *list, const char **out, unsigned int max,
+		unsigned int *n)
+{
+	char *tok;
+
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		if (*n == max) {
+			fprintf(stderr, "Error: at most %u build options can "
+					"be swept\n", max);
+			return -EINVAL;
+		}
+		out[(*n)++] = tok;
+	}
+
+	return 0;
+}
+
+int
+opencl_sweep_flags(char *list)
+{
+	unsigned int i;
+
+	sweep.pending = true;
+
+	if (strcmp(list, "default") == 0) {
+		for (i = 0; i < sizeof(sweep_default) / sizeof(char *); i++)
+			sweep.flags[i] = sweep_default[i];
+		sweep.n_flags = i;
+		return 0;
+	}
+
+	sweep.n_flags = 0;
+	return sweep_split(list, sweep.flags, SWEEP_FLAGS_MAX, &sweep.n_flags);
+}
+
+int
+opencl_sweep_alternatives(char *list)
+{
+	sweep.pending = true;
+	sweep.n_alts = 0;
+
+	return sweep_split(list, sweep.alts, SWEEP_ALTS_MAX, &sweep.n_alts);
+}
+
+bool
+opencl_sweep_pending(void)
+{
+	return sweep.pending;
+}
+
+/* Options of a variant: the flags set in the low bits, followed by the
+ * alternative selected by the remaining bits, if any */
+static void
+sweep_variant_opts(unsigned int variant, char *opts, size_t size)
+{
+	unsigned int f, alt;
+	size_t len = 0;
+
+	opts[0] = '\0';
+	for (f = 0; f < sweep.n_flags; f++) {
+		if (variant & (1u << f))
+			len += snprintf(&opts[len], size - len, " %s",
+					sweep.flags[f]);
+		if (len >= size)
+			return;
+	}
+
+	alt = variant >> sweep.n_flags;
+	if (alt)
+		snprintf(&opts[len], size - len, " %s", sweep.alts[alt - 1]);
+}
+
+static void
+sweep_select(unsigned int variant)
+{
+	sweep_variant_opts(variant, sweep.opts, SWEEP_OPTS_MAX);
+}
+
+void
+opencl_sweep_run(void)
+{
+	unsigned int variants, v;
+	const char **labels = NULL, **descs = NULL;
+	char *strs = NULL;
+	char *label, *desc;
+
+	sweep.pending = false;
+	variants = (1u << sweep.n_flags) * (sweep.n_alts + 1);
+
+	labels = calloc(variants, sizeof(char *));
+	descs = calloc(variants, sizeof(char *));
+	strs = calloc(variants, 16 + SWEEP_OPTS_MAX);
+	if (!labels || !descs || !strs) {
+		fprintf(stderr, "Could not allocate build option sweep\n");
+		exit(-1);
+	}
+
+	for (v = 0; v < variants; v++) {
+		label = &strs[v * (16 + SWEEP_OPTS_MAX)];
+		desc = label + 16;
+
+		snprintf(label, 16, "o%u", v);
+		sweep_variant_opts(v, desc, SWEEP_OPTS_MAX);
+		labels[v] = label;
+		/* Skip the leading space */
+		descs[v] = desc[0] ? &desc[1] : "(none)";
+	}
+
+	/* Strings are not freed, they live on in the children */
+	fanout_run_pareto("Options", variants, labels, descs, sweep_select);
+}
+
+const char *
+opencl_sweep_options(void)
+{
+	return sweep.opts;
+}
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lib/throughput.h"
+
+#define THROUGHPUT_NAME_MAX 128
+
+/** Launch times of one measurement, updated from event callbacks */
+struct throughput_run {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int done;
+	bool failed;
+
+	cl_ulong first_start;
+	cl_ulong last_end;
+	/** Sum of the execution times of all launches */
+	cl_ulong busy;
+};
+
+static struct {
+	unsigned int launches;
+	bool callback;
+} throughput = {
+	.launches = 0,
+	.callback = false,
+};
+
+void
+opencl_throughput_enable(unsigned int launches, bool callback)
+{
+	throughput.launches = launches;
+	throughput.callback = callback;
+}
+
+bool
+opencl_throughput_enabled(void)
+{
+	return throughput.launches > 0;
+}
+
+static uint64_t
+throughput_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ul) + ts.tv_nsec;
+}
+
+/* Account a completed launch and release its event */
+static void
+throughput_account(struct throughput_run *run, cl_event event, bool ok)
+{
+	cl_ulong start = 0l, end = 0l;
+
+	if (ok) {
+		ok = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+				sizeof(cl_ulong), &start, NULL) == CL_SUCCESS &&
+		     clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,
+				sizeof(cl_ulong), &end, NULL) == CL_SUCCESS;
+	}
+	clReleaseEvent(event);
+
+	pthread_mutex_lock(&run->lock);
+	if (ok) {
+		if (!run->done || start < run->first_start)
+			run->first_start = start;
+		if (end > run->last_end)
+			run->last_end = end;
+		run->busy += end - start;
+	} else {
+		run->failed = true;
+	}
+	run->done++;
+	pthread_cond_broadcast(&run->cond);
+	pthread_mutex_unlock(&run->lock);
+}
+
+static void CL_CALLBACK
+throughput_complete(cl_event event, cl_int status, void *data)
+{
+	throughput_account(data, event, status == CL_COMPLETE);
+}
+
+void
+opencl_throughput_kernel(cl_command_queue q, cl_kernel kernel,
+		cl_uint dim, const size_t *offset, const size_t *global,
+		const size_t *local)
+{
+	struct throughput_run run = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.done = 0,
+		.failed = false,
+		.first_start = 0l,
+		.last_end = 0l,
+		.busy = 0l,
+	};
+	char name[THROUGHPUT_NAME_MAX];
+	cl_event *events = NULL;
+	cl_event event;
+	cl_int error = CL_SUCCESS;
+	uint64_t t_host;
+	double items = 1., span;
+	unsigned int i, n;
+
+	if (!opencl_throughput_enabled())
+		return;
+
+	if (clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name,
+			NULL) != CL_SUCCESS)
+		snprintf(name, sizeof(name), "kernel");
+
+	for (i = 0; i < dim; i++)
+		items *= global[i];
+
+	if (!throughput.callback) {
+		events = calloc(throughput.launches, sizeof(cl_event));
+		if (!events) {
+			fprintf(stderr, "Throughput: could not allocate "
+					"events\n");
+			return;
+		}
+	}
+
+	clFinish(q);
+	t_host = throughput_time_ns();
+	for (n = 0; n < throughput.launches; n++) {
+		error = clEnqueueNDRangeKernel(q, kernel, dim, offset, global,
+				local, 0, NULL, &event);
+		if (error != CL_SUCCESS)
+			break;
+
+		if (events) {
+			events[n] = event;
+			continue;
+		}
+
+		error = clSetEventCallback(event, CL_COMPLETE,
+				throughput_complete, &run);
+		if (error != CL_SUCCESS) {
+			clReleaseEvent(event);
+			break;
+		}
+	}
+	clFinish(q);
+	t_host = throughput_time_ns() - t_host;
+
+	if (events) {
+		for (i = 0; i < n; i++)
+			throughput_account(&run, events[i], true);
+		free(events);
+	}
+
+	/* Callbacks may still be running after clFinish returns */
+	pthread_mutex_lock(&run.lock);
+	while (run.done < n)
+		pthread_cond_wait(&run.cond, &run.lock);
+	pthread_mutex_unlock(&run.lock);
+
+	if (error != CL_SUCCESS || run.failed || n == 0 ||
+	    run.last_end <= run.first_start) {
+		fprintf(stderr, "Throughput %s: measurement failed after %u "
+				"launches: %d\n", name, n, error);
+		return;
+	}
+
+	span = (run.last_end - run.first_start) * 1e-9;
+	printf("Throughput %s: %u launches in %.1f us (host %.1f us), "
+			"%.1f kernels/s, %.4g items/s, %lu ns per launch, "
+			"%.0f%% busy\n", name, n, span * 1e6, t_host * 1e-3,
+			n / span, n * items / span,
+			(run.last_end - run.first_start) / n,
+			(100. * run.busy * 1e-9) / span);
+}
@@ -36,25 +36,25 @@
 #include "src/mriq/macros.h"
 
 __kernel void
-ComputePhiMag_GPU(__global float* phiR, __global float* phiI, __global float* phiMag, int numK) {
+ComputePhiMag_GPU(__global real* phiR, __global real* phiI, __global real* phiMag, int numK) {
   int indexK = get_global_id(0);
   if (indexK < numK) {
-    float real = phiR[indexK];
-    float imag = phiI[indexK];
-    phiMag[indexK] = real*real + imag*imag;
+    real re = phiR[indexK];
+    real im = phiI[indexK];
+    phiMag[indexK] = re*re + im*im;
   }
 }
 
 __kernel void
 ComputeQ_GPU(int numK, int kGlobalIndex,
-	     __global float* x, __global float* y, __global float* z,
-	     __global float* Qr, __global float* Qi, __constant struct kValues* ck) 
+	     __global real* x, __global real* y, __global real* z,
+	     __global real* Qr, __global real* Qi, __constant struct kValues* ck) 
 {
-  float sX;
-  float sY;
-  float sZ;
-  float sQr;
-  float sQi;
+  real sX;
+  real sY;
+  real sZ;
+  real sQr;
+  real sQi;
 
   // Determine the element of the X arrays computed by this thread
   int xIndex = get_group_id(0)*KERNEL_Q_THREADS_PER_BLOCK + get_local_id(0);
@@ -70,27 +70,27 @@ ComputeQ_GPU(int numK, int kGlobalIndex,
   // for X.
   int kIndex = 0;
   if (numK % 2) {
-    float expArg = PIx2 * (ck[0].Kx * sX + ck[0].Ky * sY + ck[0].Kz * sZ);
-    sQr += ck[0].PhiMag * native_cos(expArg);
-    sQi += ck[0].PhiMag * native_sin(expArg);
+    real expArg = PIx2 * (ck[0].Kx * sX + ck[0].Ky * sY + ck[0].Kz * sZ);
+    sQr += ck[0].PhiMag * real_cos(expArg);
+    sQi += ck[0].PhiMag * real_sin(expArg);
     kIndex++;
     kGlobalIndex++;
   }
 
   for (; (kIndex < KERNEL_Q_K_ELEMS_PER_GRID) && (kGlobalIndex < numK);
        kIndex += 2, kGlobalIndex += 2) {
-    float expArg = PIx2 * (ck[kIndex].Kx * sX +
-			   ck[kIndex].Ky * sY +
-			   ck[kIndex].Kz * sZ);
-    sQr += ck[kIndex].PhiMag * native_cos(expArg);
-    sQi += ck[kIndex].PhiMag * native_sin(expArg);
+    real expArg = PIx2 * (ck[kIndex].Kx * sX +
+			  ck[kIndex].Ky * sY +
+			  ck[kIndex].Kz * sZ);
+    sQr += ck[kIndex].PhiMag * real_cos(expArg);
+    sQi += ck[kIndex].PhiMag * real_sin(expArg);
 
     int kIndex1 = kIndex + 1;
-    float expArg1 = PIx2 * (ck[kIndex1].Kx * sX +
-			    ck[kIndex1].Ky * sY +
-			    ck[kIndex1].Kz * sZ);
-    sQr += ck[kIndex1].PhiMag * native_cos(expArg1);
-    sQi += ck[kIndex1].PhiMag * native_sin(expArg1);
+    real expArg1 = PIx2 * (ck[kIndex1].Kx * sX +
+			   ck[kIndex1].Ky * sY +
+			   ck[kIndex1].Kz * sZ);
+    sQr += ck[kIndex1].PhiMag * real_cos(expArg1);
+    sQi += ck[kIndex1].PhiMag * real_sin(expArg1);
   }
 
   Qr[xIndex] = sQr;
@@ -43,11 +43,19 @@
 
 #define KERNEL_Q_K_ELEMS_PER_GRID 1024
 
+/* The host provides single precision K values, converted to the kernel's
+ * real type upon upload */
+#ifdef __OPENCL_VERSION__
+typedef real kValue_t;
+#else
+typedef float kValue_t;
+#endif
+
 struct kValues {
-  float Kx;
-  float Ky;
-  float Kz;
-  float PhiMag;
+  kValue_t Kx;
+  kValue_t Ky;
+  kValue_t Kz;
+  kValue_t PhiMag;
 };
 
 #endif
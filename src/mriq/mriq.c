@@ -30,7 +30,11 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
+#include "lib/cmdbuf.h"
 #include "macros.h"
 
 void usage(char *prg)
@@ -54,20 +58,31 @@ int main(int argc, char **argv)
 	struct kValues *inKValues;
 	unsigned int QGrid;
 	int QGridBase;
-	const float zero = 0.f;
+	/* All-zero bit pattern, valid for any size of real */
+	const cl_double zero = 0.;
+	struct dataset *ds[6];
 
 	cl_context ctx;
 	cl_command_queue q;
 	cl_program prg;
 	cl_kernel computePhiMag, computeQ;
 	cl_mem clInPhiR, clInPhiI, clInX, clInY, clInZ, clInKValues;
+	cl_mem clInKValuesAll;
 	cl_mem clOutPhiMag, clOutQr, clOutQi;
 	cl_int error;
 	cl_event time;
 	cl_ulong time_diff = 0l;
 	cl_ulong time_avg[2] = {0l,0l};
+	cl_ulong t;
+	cl_ulong time_seq = 0l;
+	int seq;
+	unsigned int direct = 0, replays = 0;
+	struct opencl_cmdbuf *cb;
 	unsigned int i;
 	const cl_int numK = 2048;
+	double flops[2], bytes[2];
+
+	opencl_real_enable();
 
 	while ((c = getopt (argc, argv, "?"OPENCL_OPTS)) != -1)
 	{
@@ -84,16 +99,18 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Load the inputs while the platform is brought up */
 	phi_entries = 2048;
 	data_entries = 262144;
-	bin_file_read("data/mriq/phiR.bin", phi_entries, (void **) &inPhiR);
-	bin_file_read("data/mriq/phiI.bin", phi_entries, (void **) &inPhiI);
-	csv_file_read_float("data/mriq/x.csv", &inX);
-	csv_file_read_float("data/mriq/y.csv", &inY);
-	csv_file_read_float("data/mriq/z.csv", &inZ);
-	csv_file_read_float("data/mriq/kvalues.csv", (float **) &inKValues);
-
-	printf("Read %"PRIi64" entries\n", phi_entries);
+	ds[0] = dataset_load_bin("data/mriq/phiR.bin", phi_entries,
+			(void **) &inPhiR);
+	ds[1] = dataset_load_bin("data/mriq/phiI.bin", phi_entries,
+			(void **) &inPhiI);
+	ds[2] = dataset_load_csv_float("data/mriq/x.csv", &inX);
+	ds[3] = dataset_load_csv_float("data/mriq/y.csv", &inY);
+	ds[4] = dataset_load_csv_float("data/mriq/z.csv", &inZ);
+	ds[5] = dataset_load_csv_float("data/mriq/kvalues.csv",
+			(float **) &inKValues);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -112,6 +129,18 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	ret = 0;
+	for (i = 0; i < 2; i++)
+		ret |= (dataset_wait(ds[i]) != 0);
+	for (; i < 6; i++)
+		ret |= (dataset_wait(ds[i]) < 0);
+	if (ret) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", phi_entries);
+
 	computePhiMag = clCreateKernel(prg, "ComputePhiMag_GPU", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel ComputePhiMag_GPU\n");
@@ -124,77 +153,84 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	clInPhiR = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			phi_entries * sizeof(float), NULL, &error);
+	opencl_mem_stage("input");
+	clInPhiR = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			phi_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clInPhiI = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			phi_entries * sizeof(float), NULL, &error);
+	clInPhiI = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			phi_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clInX = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clInX = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clInY = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clInY = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInZ = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clInZ = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInKValues = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			KERNEL_Q_K_ELEMS_PER_GRID * sizeof(struct kValues),
+	clInKValues = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			KERNEL_Q_K_ELEMS_PER_GRID * 4 * opencl_real_size(),
 			NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clOutPhiMag = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
-			phi_entries * sizeof(float), NULL, &error);
+	/* All K values, tiles are copied to clInKValues on the device */
+	clInKValuesAll = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			numK * 4 * opencl_real_size(), NULL, &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create in buffer\n");
+		return -1;
+	}
+
+	opencl_mem_stage("output");
+	clOutPhiMag = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
+			phi_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	clOutQr = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	clOutQr = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	clOutQi = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	clOutQi = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	error = clEnqueueWriteBuffer(q, clInPhiR, CL_FALSE, 0,
-			phi_entries * sizeof(float), inPhiR, 0, NULL, NULL);
-	error |= clEnqueueWriteBuffer(q, clInPhiI, CL_FALSE, 0,
-			phi_entries * sizeof(float), inPhiI, 0, NULL, NULL);
-	error |= clEnqueueWriteBuffer(q, clInX, CL_FALSE, 0,
-			data_entries * sizeof(float), inX, 0, NULL, NULL);
-	error |= clEnqueueWriteBuffer(q, clInY, CL_FALSE, 0,
-			data_entries * sizeof(float), inY, 0, NULL, NULL);
-	error |= clEnqueueWriteBuffer(q, clInZ, CL_FALSE, 0,
-			data_entries * sizeof(float), inZ, 0, NULL, NULL);
+	error = opencl_write_real(q, clInPhiR, phi_entries, inPhiR);
+	error |= opencl_write_real(q, clInPhiI, phi_entries, inPhiI);
+	error |= opencl_write_real(q, clInX, data_entries, inX);
+	error |= opencl_write_real(q, clInY, data_entries, inY);
+	error |= opencl_write_real(q, clInZ, data_entries, inZ);
+	error |= opencl_write_real(q, clInKValuesAll, numK * 4,
+			(float *) inKValues);
 	if (error != CL_SUCCESS) {
 		printf("Could not enqueue buffer write\n");
 		return -1;
@@ -226,9 +262,35 @@ int main(int argc, char **argv)
 	const size_t dims[] = {2048};
 	const size_t Qdims[] = {data_entries};
 	const size_t ldims[] = {KERNEL_PHI_MAG_THREADS_PER_BLOCK};
+
+	/* computePhiMag: two multiplies and an add per K sample.
+	 * computeQ: per X and K sample pair 6 operations for the phase and 4
+	 * to accumulate, excluding sine and cosine. Each launch streams X and
+	 * updates Q for one grid of K samples. */
+	flops[0] = 3. * numK;
+	bytes[0] = 3. * numK * opencl_real_size();
+	flops[1] = 10. * data_entries * KERNEL_Q_K_ELEMS_PER_GRID;
+	bytes[1] = (7. * data_entries + 4. * KERNEL_Q_K_ELEMS_PER_GRID) *
+			opencl_real_size();
+
+	/* With -B, the launches for all K tiles are recorded in the first
+	 * iteration and replayed in later ones */
+	cb = opencl_cmdbuf_create(q, "mriq");
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
-		error = clEnqueueNDRangeKernel(q, computePhiMag, 1, NULL, dims,
-				ldims, 0, NULL, &time);
+		seq = opencl_cmdbuf_replay(cb, &time_diff);
+		if (seq < 0)
+			return -1;
+		if (seq) {
+			time_seq += time_diff;
+			replays++;
+			printf("Sequence Time: %lu ns\n", time_diff);
+			continue;
+		}
+		direct++;
+
+		error = opencl_cmdbuf_kernel(cb, q, computePhiMag, 1, NULL,
+				dims, ldims, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue kernel execution: %d\n",
 					error);
@@ -238,14 +300,15 @@ int main(int argc, char **argv)
 
 		time_diff = opencl_exec_time(time);
 		time_avg[0] += time_diff;
+		opencl_roofline_kernel("ComputePhiMag_GPU", flops[0], bytes[0],
+				time_diff);
 		printf("computePhiMag Time: %lu ns\n", time_diff);
 
 		time_diff = 0l;
-		clEnqueueFillBuffer(q, clOutQi, &zero, sizeof(float), 0,
-				data_entries * sizeof(float), 0, NULL, NULL);
-		clEnqueueFillBuffer(q, clOutQr, &zero, sizeof(float), 0,
-					data_entries * sizeof(float), 0, NULL,
-					NULL);
+		opencl_cmdbuf_fill(cb, q, clOutQi, &zero, opencl_real_size(),
+				0, data_entries * opencl_real_size());
+		opencl_cmdbuf_fill(cb, q, clOutQr, &zero, opencl_real_size(),
+				0, data_entries * opencl_real_size());
 		for (QGrid = 0; QGrid < (numK / KERNEL_Q_K_ELEMS_PER_GRID);
 				QGrid++) {
 			/* Put the tile of K values into constant mem. Seems
@@ -261,18 +324,19 @@ int main(int argc, char **argv)
 				return -1;
 			}
 
-			error = clEnqueueWriteBuffer(q, clInKValues, CL_TRUE, 0,
-					KERNEL_Q_K_ELEMS_PER_GRID *
-							sizeof(struct kValues),
-					&inKValues[QGridBase], 0, NULL, NULL);
+			error = opencl_cmdbuf_copy(cb, q, clInKValuesAll,
+					clInKValues,
+					QGridBase * 4 * opencl_real_size(), 0,
+					KERNEL_Q_K_ELEMS_PER_GRID * 4 *
+					opencl_real_size());
 			if (error != CL_SUCCESS) {
-				printf("Could not enqueue buffer write\n");
+				printf("Could not enqueue buffer copy\n");
 				return -1;
 			}
 			clFinish(q);
 
-			error = clEnqueueNDRangeKernel(q, computeQ, 1, NULL,
-					Qdims, ldims, 0, NULL, &time);
+			error = opencl_cmdbuf_kernel(cb, q, computeQ, 1, NULL,
+					Qdims, ldims, &time);
 			if (error != CL_SUCCESS) {
 				printf("Could not enqueue kernel execution: "
 						"%d\n", error);
@@ -280,10 +344,15 @@ int main(int argc, char **argv)
 			}
 			clFinish(q);
 
-			time_diff += opencl_exec_time(time);
+			t = opencl_exec_time(time);
+			time_diff += t;
+			opencl_roofline_kernel("ComputeQ_GPU", flops[1],
+					bytes[1], t);
 		}
 		time_avg[1] += time_diff;
 		printf("computeQ Time: %lu ns\n", time_diff);
+
+		opencl_cmdbuf_end(cb);
 	}
 
 	/* Validate outputs. */
@@ -304,19 +373,26 @@ int main(int argc, char **argv)
 			printf("Output invalid\n");
 	}
 
-	printf("computePhiMag Time (avg of %u): %lu ns\n",
-			opencl_get_iterations(),
-			time_avg[0] / opencl_get_iterations());
-	printf("computeQ Time (avg of %u): %lu ns\n",
-			opencl_get_iterations(),
-			time_avg[1] / opencl_get_iterations());
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, computePhiMag, 1, NULL, dims, ldims);
+	opencl_kernel_measure(q, computeQ, 1, NULL, Qdims, ldims);
+
+	printf("computePhiMag Time (avg of %u): %lu ns\n", direct,
+			time_avg[0] / direct);
+	printf("computeQ Time (avg of %u): %lu ns\n", direct,
+			time_avg[1] / direct);
+	if (replays)
+		printf("Sequence Time (avg of %u replays): %lu ns\n",
+				replays, time_seq / replays);
 
 	/* Tear down */
+	opencl_cmdbuf_release(cb);
 	clReleaseEvent(time);
-	clReleaseMemObject(clInX);
-	clReleaseMemObject(clInY);
-	clReleaseMemObject(clInZ);
-	clReleaseMemObject(clOutPhiMag);
+	opencl_release_buffer(clInKValuesAll);
+	opencl_release_buffer(clInX);
+	opencl_release_buffer(clInY);
+	opencl_release_buffer(clInZ);
+	opencl_release_buffer(clOutPhiMag);
 	clReleaseKernel(computePhiMag);
 	clReleaseKernel(computeQ);
 
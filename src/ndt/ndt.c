@@ -30,8 +30,12 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
 #include "frnn/prefix_sum.h"
+#include "frnn/grid.h"
+#include "lib/instr.h"
 
 #define FILE_1 "data/ndt/room_scan1.txt"
 #define FILE_2 "data/ndt/room_scan2.txt"
@@ -73,162 +77,30 @@ calc_translation(float x, float y, float z, float rz, float target[12])
 	target[10] = 1.f;
 }
 
-unsigned int
-sorted_entries(cl_command_queue q, cl_mem bin_elems, cl_mem bin_prefix)
-{
-	unsigned int last_bin;
-	unsigned int prefix;
-	unsigned int count;
-
-	last_bin = (bins_dim * bins_dim * bins_dim) - 1;
-	clEnqueueReadBuffer(q, bin_prefix, CL_FALSE, sizeof(cl_uint) * last_bin,
-			sizeof(cl_uint), &prefix, 0, NULL, NULL);
-	clEnqueueReadBuffer(q, bin_elems, CL_TRUE, sizeof(cl_uint) * last_bin,
-				sizeof(cl_uint), &count, 0, NULL, NULL);
-
-	return prefix + count;
-}
-
+/* Points are in cell units, drop the ones outside the grid */
 cl_mem
-ndt_sort(cl_context ctx, cl_command_queue q, cl_program prg,
-		unsigned int elems, cl_mem in, unsigned int *sorted_elems,
-		cl_mem *bin_elems, cl_mem *bin_prefix, cl_ulong *time_ns)
+ndt_sort(cl_context ctx, cl_command_queue q, size_t elems, cl_mem in,
+		size_t *sorted_elems, cl_mem *bin_elems, cl_mem *bin_prefix,
+		cl_ulong *time_ns)
 {
+	struct grid g;
 	cl_mem out;
-	cl_mem in_bin, bin_idx;
-	cl_kernel kernel_ins_cnt, kernel_reindex;
-	cl_int error;
-	size_t bins;
-	const int zero = 0;
-	cl_event time;
-	cl_ulong t = 0ul;
-
-	/* Determine grid point */
-	kernel_ins_cnt = clCreateKernel(prg, "kernel_ins_cnt", &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create kernel\n");
-		return NULL;
-	}
-
-	in_bin = clCreateBuffer(ctx, CL_MEM_READ_WRITE, elems * sizeof(int),
-			NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create out buffer\n");
-		return NULL;
-	}
-
-	bins = prefix_sum_elems_ceil(ctx, bins_dim * bins_dim * bins_dim, NULL);
-	*bin_elems = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			bins * sizeof(int), NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create out buffer\n");
-		return NULL;
-	}
-	clEnqueueFillBuffer(q, *bin_elems, &zero, sizeof(int), 0,
-			bins * sizeof(int), 0, NULL, NULL);
 
-	error =  clSetKernelArg(kernel_ins_cnt, 0, sizeof(cl_mem), &in);
-	error |= clSetKernelArg(kernel_ins_cnt, 1, sizeof(cl_uint), &elems);
-	error |= clSetKernelArg(kernel_ins_cnt, 2, sizeof(cl_float), &bins_dim);
-	error |= clSetKernelArg(kernel_ins_cnt, 3, sizeof(cl_mem), &in_bin);
-	error |= clSetKernelArg(kernel_ins_cnt, 4, sizeof(cl_mem), bin_elems);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "One of the arguments could not be set: %d.\n",
-				error);
+	grid_init(&g, bins_dim, 1.f, false);
+	out = grid_build(ctx, q, &g, elems, in, time_ns);
+	if (!out)
 		return NULL;
-	}
 
-	const size_t dims[] = {elems};
-	error = clEnqueueNDRangeKernel(q, kernel_ins_cnt, 1, NULL, dims, NULL,
-			0, NULL, &time);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not enqueue kernel execution: %d\n",
-				error);
-		return NULL;
-	}
-
-	clFinish(q);
-	if (time_ns) {
-		t = opencl_exec_time(time);
-		printf("Time determining bins: %lins\n", t);
-		*time_ns += t;
-		t = 0ul;
-	}
-
-	clReleaseEvent(time);
-
-	/* Prefix sum to determine grid offsets */
-	*bin_prefix = prefix_sum(ctx, q, *bin_elems, bins, &t);
-	if (time_ns) {
-		printf("Time prefix-sum: %lins\n", t);
-		*time_ns += t;
-	}
-
-	*sorted_elems = sorted_entries(q, *bin_elems, *bin_prefix);
-
-	/* Reorder elements into new buffers */
-	kernel_reindex = clCreateKernel(prg, "kernel_reindex", &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create kernel\n");
-		return NULL;
-	}
-
-	bin_idx = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
-			bins * sizeof(int), NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create out buffer\n");
-		return NULL;
-	}
-	clEnqueueFillBuffer(q, bin_idx, &zero, sizeof(int), 0,
-			bins * sizeof(int), 0, NULL, NULL);
-
-	out = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
-			3 * *sorted_elems * sizeof(float), NULL, &error);
-	if (error != CL_SUCCESS) {
-		fprintf(stderr, "Could not create reordered data buffer\n");
-		return NULL;
-	}
-
-	error =  clSetKernelArg(kernel_reindex, 0, sizeof(cl_mem), &in);
-	error |= clSetKernelArg(kernel_reindex, 1, sizeof(cl_uint), &elems);
-	error |= clSetKernelArg(kernel_reindex, 2, sizeof(cl_mem), &out);
-	error |= clSetKernelArg(kernel_reindex, 3, sizeof(cl_uint), sorted_elems);
-	error |= clSetKernelArg(kernel_reindex, 4, sizeof(cl_mem), &in_bin);
-	error |= clSetKernelArg(kernel_reindex, 5, sizeof(cl_mem), bin_prefix);
-	error |= clSetKernelArg(kernel_reindex, 6, sizeof(cl_mem), &bin_idx);
-	if (error != CL_SUCCESS) {
-		printf("One of the arguments could not be set: %d.\n", error);
-		return NULL;
-	}
-
-	error = clEnqueueNDRangeKernel(q, kernel_reindex, 1, NULL, dims, NULL,
-			0, NULL, &time);
-	if (error != CL_SUCCESS) {
-		printf("Could not enqueue kernel execution: %d\n", error);
-		return NULL;
-	}
-
-	clFinish(q);
-	if (time_ns) {
-		t = opencl_exec_time(time);
-		printf("Time reindexing: %lins\n", t);
-		*time_ns += t;
-	}
-
-	clReleaseEvent(time);
-
-	/* Tear-down */
-	clReleaseMemObject(bin_idx);
-	clReleaseMemObject(in_bin);
-	clReleaseKernel(kernel_ins_cnt);
-	clReleaseKernel(kernel_reindex);
+	*sorted_elems = g.elems;
+	*bin_elems = g.cell_elems;
+	*bin_prefix = g.cell_start;
 
 	return out;
 }
 
 int
 ndt_cell_qC(cl_context ctx, cl_command_queue q, cl_program prg,
-		cl_mem data, unsigned int elems, cl_mem bin_elems,
+		cl_mem data, size_t elems, cl_mem bin_elems,
 		cl_mem bin_prefix, cl_ulong *time_ns)
 {
 	cl_kernel kernel;
@@ -243,14 +115,14 @@ ndt_cell_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 		return -1;
 	}
 
-	out_q = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+	out_q = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
 			elems * 3 * sizeof(float), NULL, &error); /* XXX */
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	out_C = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+	out_C = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
 			elems * 9 * sizeof(float), NULL, &error); /* XXX */
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -258,7 +130,7 @@ ndt_cell_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	}
 
 	error =  clSetKernelArg(kernel, 0, sizeof(cl_mem), &data);
-	error |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &elems);
+	error |= opencl_set_kernel_arg_idx(kernel, 1, elems);
 	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &bin_elems);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &bin_prefix);
 	error |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &out_q);
@@ -285,6 +157,9 @@ ndt_cell_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 		printf("*Per-cell mean/covariant: %lu ns\n", *time_ns);
 	}
 
+	/* Optional extra measurements */
+	opencl_kernel_measure(q, kernel, 1, NULL, dims, NULL);
+
 	printf("---------------------------------\n");
 
 	return 0;
@@ -292,7 +167,7 @@ ndt_cell_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 
 int
 ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
-		cl_mem data, unsigned int elems)
+		cl_mem data, size_t elems)
 {
 	cl_kernel kernel = 0;
 	cl_int error;
@@ -305,23 +180,26 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	const int zero = 0;
 	const cl_float fzero = 0.f;
 	int ret = -1;
-	unsigned int y;
+	size_t y;
+	struct instr *instr = NULL;
 
 	kernel = clCreateKernel(prg, "ndt_elem_q", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
+	opencl_kernel_resources(kernel);
 
-	cell = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
-				elems * sizeof(float), NULL, &error); /* XXX */
+	cell = opencl_create_buffer(ctx,
+			CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+			elems * sizeof(float), NULL, &error); /* XXX */
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
 	bins = prefix_sum_elems_ceil(ctx, bins_dim * bins_dim * bins_dim, NULL);
-	bin_elems = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+	bin_elems = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
 			bins * sizeof(int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		fprintf(stderr, "Could not create out buffer\n");
@@ -330,7 +208,7 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	clEnqueueFillBuffer(q, bin_elems, &zero, sizeof(int), 0,
 			bins * sizeof(int), 0, NULL, NULL);
 
-	out_q = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+	out_q = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
 			elems * 3 * sizeof(float), NULL, &error); /* XXX */
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -339,7 +217,7 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	clEnqueueFillBuffer(q, out_q, &fzero, sizeof(float), 0,
 			elems * 3  * sizeof(float), 0, NULL, NULL);
 
-	out_C = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+	out_C = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
 			elems * 9 * sizeof(float), NULL, &error); /* XXX */
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -350,7 +228,7 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	clFinish(q);
 
 	error =  clSetKernelArg(kernel, 0, sizeof(cl_mem), &data);
-	error |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &elems);
+	error |= opencl_set_kernel_arg_idx(kernel, 1, elems);
 	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &cell);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &bin_elems);
 	error |= clSetKernelArg(kernel, 4, sizeof(cl_float), &bins_dim);
@@ -366,6 +244,13 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 
 	const size_t dims[] = {1024, y};
 
+	instr = instr_create(ctx, "ndt_elem_q", "cas retries", 1024 * y);
+	error = instr_set_arg(instr, q, kernel, 6);
+	if (error != CL_SUCCESS) {
+		printf("Could not bind instrumentation counters: %d.\n", error);
+		goto error;
+	}
+
 	error = clEnqueueNDRangeKernel(q, kernel, 2, NULL, dims, NULL, 0, NULL,
 			&time);
 	if (error != CL_SUCCESS) {
@@ -377,6 +262,9 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	time_diff = opencl_exec_time(time);
 	time_total += time_diff;
 	printf("NDT mean: %lu ns\n", time_diff);
+	instr_report(instr, q, 1);
+	instr_release(instr);
+	instr = NULL;
 
 	clReleaseKernel(kernel);
 	kernel = 0;
@@ -386,13 +274,16 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 		printf("Could not create kernel\n");
 		goto error;
 	}
+	opencl_kernel_resources(kernel);
 	error =  clSetKernelArg(kernel, 0, sizeof(cl_mem), &data);
-	error |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &elems);
+	error |= opencl_set_kernel_arg_idx(kernel, 1, elems);
 	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &cell);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &bin_elems);
 	error |= clSetKernelArg(kernel, 4, sizeof(cl_float), &bins_dim);
 	error |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &out_q);
 	error |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &out_C);
+	instr = instr_create(ctx, "ndt_elem_C", "cas retries", 1024 * y);
+	error |= instr_set_arg(instr, q, kernel, 7);
 	if (error != CL_SUCCESS) {
 		printf("One of the arguments could not be set: %d.\n", error);
 		goto error;
@@ -410,6 +301,9 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	time_total += time_diff;
 
 	printf("NDT covariant: %lu ns\n", time_diff);
+	instr_report(instr, q, 1);
+	instr_release(instr);
+	instr = NULL;
 	clReleaseKernel(kernel);
 	kernel = 0;
 
@@ -419,7 +313,7 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 		return -1;
 	}
 	error =  clSetKernelArg(kernel, 0, sizeof(cl_mem), &data);
-	error |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &elems);
+	error |= opencl_set_kernel_arg_idx(kernel, 1, elems);
 	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &bin_elems);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_float), &bins_dim);
 	error |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &out_q);
@@ -443,10 +337,15 @@ ndt_elem_qC(cl_context ctx, cl_command_queue q, cl_program prg,
 	printf("NDT post: %lu ns\n", time_diff);
 	printf("* Per-elem mean/covariant: %lu ns\n", time_total);
 	printf("---------------------------------\n");
+
+	/* No extra measurements: the element passes add to the cell sums and
+	 * the post pass divides them in place, repeating either changes the
+	 * input of the next launch */
 	ret = 0;
 
 error:
-	clReleaseMemObject(cell);
+	instr_release(instr);
+	opencl_release_buffer(cell);
 	if (kernel)
 		clReleaseKernel(kernel);
 	clReleaseEvent(time);
@@ -456,7 +355,7 @@ error:
 
 int
 ndt_elem_transform(cl_context ctx, cl_command_queue q, cl_program prg,
-		float *in, unsigned int elems, cl_mem *out)
+		float *in, size_t elems, cl_mem *out)
 {
 	cl_kernel kernel;
 	cl_int error;
@@ -465,7 +364,7 @@ ndt_elem_transform(cl_context ctx, cl_command_queue q, cl_program prg,
 	cl_ulong time_diff;
 	float bias[12];
 	int ret = -1;
-	unsigned int y;
+	size_t y;
 
 	kernel = clCreateKernel(prg, "ndt_vec_transform", &error);
 	if (error != CL_SUCCESS) {
@@ -473,20 +372,20 @@ ndt_elem_transform(cl_context ctx, cl_command_queue q, cl_program prg,
 		return -1;
 	}
 
-	cl_in = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	cl_in = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			elems * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	trans = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	trans = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			12 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create biases buffer\n");
 		return -1;
 	}
 
-	*out = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
+	*out = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
 			elems * 3 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
@@ -506,7 +405,7 @@ ndt_elem_transform(cl_context ctx, cl_command_queue q, cl_program prg,
 	calc_translation(1.79387f, 0.720047f, 0.f, 0.f, bias);
 
 	error =  clSetKernelArg(kernel, 0, sizeof(cl_mem), &cl_in);
-	error |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &elems);
+	error |= opencl_set_kernel_arg_idx(kernel, 1, elems);
 	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &trans);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), out);
 	if (error != CL_SUCCESS) {
@@ -530,89 +429,21 @@ ndt_elem_transform(cl_context ctx, cl_command_queue q, cl_program prg,
 
 	time_diff = opencl_exec_time(time);
 	printf("* NDT data transform: %lu ns\n", time_diff);
+
+	/* Optional extra measurements */
+	opencl_kernel_measure(q, kernel, 2, NULL, dims, NULL);
+
 	ret = 0;
 
 error:
-	clReleaseMemObject(cl_in);
-	clReleaseMemObject(trans);
+	opencl_release_buffer(cl_in);
+	opencl_release_buffer(trans);
 	clReleaseKernel(kernel);
 	clReleaseEvent(time);
 
 	return ret;
 }
 
-int test_3x3_inv(cl_context ctx, cl_command_queue q, cl_program prg)
-{
-/* XXX: Academic code... */
-//	//float mat_in[9] = {1.0, 2.0, 3.0, 0.0, 1.0, 4.0, 5.0, 6.0, 0.0};
-//	float mat_in[9] = {1.0, 1.0, 1.0, 1.0, 2.0, 1.0, 0.0, 1.0, 2.0};
-//	float mat_mul[9];
-
-//	kernel = clCreateKernel(prg, "invert_3x3", &error);
-//	if (error != CL_SUCCESS) {
-//		printf("Could not create kernel\n");
-//		return -1;
-//	}
-//
-//	in = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-//				9 * sizeof(float), NULL, &error);
-//	if (error != CL_SUCCESS) {
-//		printf("Could not create in buffer\n");
-//		return -1;
-//	}
-//	out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
-//			9 * sizeof(float), NULL, &error); /* XXX */
-//	if (error != CL_SUCCESS) {
-//		printf("Could not create out buffer\n");
-//		return -1;
-//	}
-//
-//	error =  clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
-//	error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
-//	if (error != CL_SUCCESS) {
-//		printf("One of the arguments could not be set: %d.\n", error);
-//		return -1;
-//	}
-//
-//	error = clEnqueueWriteBuffer(q, in, CL_FALSE, 0,
-//			9 * sizeof(cl_float), mat_in, 0, NULL, NULL);
-//
-//	const size_t dims2[] = {1};
-//	error = clEnqueueNDRangeKernel(q, kernel, 1, NULL, dims2, NULL, 0, NULL,
-//			&time);
-//	if (error != CL_SUCCESS) {
-//		printf("Could not enqueue kernel execution: %d\n", error);
-//		return -1;
-//	}
-//	clFinish(q);
-//
-//
-//	clEnqueueReadBuffer(q, out, CL_TRUE, 0, sizeof(float) * 9, result, 0,
-//			NULL, NULL);
-//	printf("result:\n");
-//	printf("%f, %f, %f\n", result[0], result[1], result[2]);
-//	printf("%f, %f, %f\n", result[3], result[4], result[5]);
-//	printf("%f, %f, %f\n", result[6], result[7], result[8]);
-//
-//	/* Verify */
-//	mat_mul[0] = mat_in[0] * result[0] + mat_in[1] * result[3] + mat_in[2] * result[6];
-//	mat_mul[1] = mat_in[0] * result[1] + mat_in[1] * result[4] + mat_in[2] * result[7];
-//	mat_mul[2] = mat_in[0] * result[2] + mat_in[1] * result[5] + mat_in[2] * result[8];
-//	mat_mul[3] = mat_in[3] * result[0] + mat_in[4] * result[3] + mat_in[5] * result[6];
-//	mat_mul[4] = mat_in[3] * result[1] + mat_in[4] * result[4] + mat_in[5] * result[7];
-//	mat_mul[5] = mat_in[3] * result[2] + mat_in[4] * result[5] + mat_in[5] * result[8];
-//	mat_mul[6] = mat_in[6] * result[0] + mat_in[7] * result[3] + mat_in[8] * result[6];
-//	mat_mul[7] = mat_in[6] * result[1] + mat_in[7] * result[4] + mat_in[8] * result[7];
-//	mat_mul[8] = mat_in[6] * result[2] + mat_in[7] * result[5] + mat_in[8] * result[8];
-//
-//	printf("in * result:\n");
-//	printf("%f, %f, %f\n", mat_mul[0], mat_mul[1], mat_mul[2]);
-//	printf("%f, %f, %f\n", mat_mul[3], mat_mul[4], mat_mul[5]);
-//	printf("%f, %f, %f\n", mat_mul[6], mat_mul[7], mat_mul[8]);
-
-	return 0;
-}
-
 
 int main(int argc, char **argv)
 {
@@ -622,9 +453,10 @@ int main(int argc, char **argv)
 	char *file_2 = FILE_2;
 	int64_t data_entries;
 	int64_t source_entries;
-	uint32_t elems;
+	size_t elems;
 	float **data, **source;
-	/*unsigned int sorted_elems;*/
+	struct dataset *ds_source, *ds_data;
+	/*size_t sorted_elems;*/
 
 	cl_context ctx;
 	cl_command_queue q;
@@ -653,12 +485,11 @@ int main(int argc, char **argv)
 		}
 	}
 
-	source_entries = csv_file_read_float_n(file_1, 3, &source);
-	printf("Read %"PRIi64" entries\n", source_entries);
-	data_entries = csv_file_read_float_n(file_2, 3, &data);
-	printf("Read %"PRIi64" entries\n", data_entries);
-	elems = data_entries;
+	/* Load the inputs while the platform is brought up */
+	ds_source = dataset_load_csv_float_n(file_1, 3, &source);
+	ds_data = dataset_load_csv_float_n(file_2, 3, &data);
 
+	opencl_index_enable();
 	ctx = opencl_create_context();
 	if (!ctx) {
 		usage();
@@ -676,10 +507,34 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	source_entries = dataset_wait(ds_source);
+	data_entries = dataset_wait(ds_data);
+	if (source_entries < 0 || data_entries < 0) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", source_entries);
+	printf("Read %"PRIi64" entries\n", data_entries);
+	elems = data_entries;
+
+	ret = opencl_index_select(source_entries > data_entries ?
+			source_entries : data_entries);
+	if (ret < 0)
+		return -1;
+	if (ret > 0) {
+		clReleaseProgram(prg);
+		prg = opencl_compile_program(ctx, 1, &programs);
+		if (!prg)
+			return -1;
+	}
+
+	opencl_mem_stage("transform");
 	ndt_elem_transform(ctx, q, prg, data[0], elems,
 			&cl_data);
 
-	src_unsorted = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	opencl_mem_stage("input");
+	src_unsorted = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			source_entries * 3 * sizeof(cl_float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
@@ -696,15 +551,13 @@ int main(int argc, char **argv)
 	clFinish(q);
 
 	/*
-	src_sorted = ndt_sort(ctx, q, prg, (unsigned int) source_entries,
-			src_unsorted, &sorted_elems, &bin_elems, &bin_prefix,
-			&time_sort);
+	src_sorted = ndt_sort(ctx, q, source_entries, src_unsorted,
+			&sorted_elems, &bin_elems, &bin_prefix, &time_sort);
 	ndt_cell_qC(ctx, q, prg, src_sorted, sorted_elems, bin_elems,
 			bin_prefix, &time_sort);
 	 */
-	ndt_elem_qC(ctx, q, prg, src_unsorted, (unsigned int) source_entries);
-
-	/* test_inv_3x3() */
+	opencl_mem_stage("elem_qC");
+	ndt_elem_qC(ctx, q, prg, src_unsorted, source_entries);
 
 	/* Tear down */
 	opencl_teardown(&ctx, &q, &prg);
@@ -22,6 +22,8 @@
  * SOFTWARE.
  */
 
+#include "src/lib/smallmat_device.h"
+
 /* Data structured as "struct of arrays" for locality reasons.
  * in[dim][pt_idx]
  * q[dim][cell_idx]
@@ -43,96 +45,15 @@ inline int coord_to_bin(float x, float y, float z, float bins_dim)
 	return bin;
 }
 
-/* Launch in 1D */
-__kernel void kernel_ins_cnt(float __global *data_x, unsigned int elems,
-		float bins_dim, int __global *data_bin,
-		volatile int __global *bin_size) {
-
-	int bin;
-	unsigned int n = get_global_id(0);
-
-	bin = coord_to_bin(data_x[n], data_x[n + elems], data_x[n + (2*elems)],
-			bins_dim);
-	data_bin[n] = bin;
-
-	if (bin < 0)
-		return;
-
-	atomic_inc(&bin_size[bin]);
-}
-
-/* Launch in 1D */
-__kernel void kernel_reindex(float __global *in_x, unsigned int in_elems,
-		float __global *out_x, unsigned int out_elems,
-		int __global *data_bin, volatile int __global *bin_prefix,
-		volatile __global int *bin_idx) {
-
-	int bin, elem;
-	size_t n = get_global_id(0);
-
-	bin = data_bin[n];
-	if (bin < 0)
-		return;
-
-	elem = bin_prefix[bin] + atomic_inc(&bin_idx[bin]);
-
-	out_x[elem] = in_x[n];
-	out_x[elem+out_elems] = in_x[n+in_elems];
-	out_x[elem+(2*out_elems)] = in_x[n+(2*in_elems)];
-
-	return;
-}
-
-/* Cofactor expansion over first row
- *
- * WARNING! We optimise assuming the following equalities that result from
- * covariant matrix construction - these are not generic methods!
- * in[1] == in[3]
- * in[2] == in[6]
- * in[5] == in[7]
- * Saves 36 instructions on GK107 and reduces register pressure to below 30.
- */
-float
-determinant_3x3(float in[9])
-{
-	return 	in[0] * (in[4] * in[8] - in[5] * in[5]) -
-		in[1] * (in[1] * in[8] - in[5] * in[2]) +
-		in[2] * (in[1] * in[5] - in[4] * in[2]);
-}
-
-/* Cramers rule for matrix inversion */
-void
-invert_3x3(float in[9], float out[9])
-{
-	float det = determinant_3x3(in);
-
-	if (det == 0.0f) {
-		/* Cannot be inverted */
-		return;
-	}
-
-	out[0] =  (in[4] * in[8] - in[5] * in[5]) / det;
-	out[1] = -(in[1] * in[8] - in[2] * in[5]) / det;
-	out[2] =  (in[1] * in[5] - in[2] * in[4]) / det;
-	out[3] = -(in[1] * in[8] - in[5] * in[2]) / det;
-	out[4] =  (in[0] * in[8] - in[2] * in[2]) / det;
-	out[5] = -(in[0] * in[5] - in[2] * in[1]) / det;
-	out[6] =  (in[1] * in[5] - in[4] * in[2]) / det;
-	out[7] = -(in[0] * in[5] - in[1] * in[2]) / det;
-	out[8] =  (in[0] * in[4] - in[1] * in[1]) / det;
-
-	return;
-}
-
 /* Launch in 2D, one thread per item
  * Transformation matrix is pre-calculated on the host
  * XXX: transform mat in const or local mem? */
 __kernel void
-ndt_vec_transform(float __global *in, unsigned int elems,
+ndt_vec_transform(float __global *in, idx_t elems,
 		__constant float transform_mat[12],
 		float __global *out)
 {
-	unsigned int elem_idx =
+	idx_t elem_idx =
 		get_global_id(1) * get_global_size(0) +
 		get_global_id(0);
 
@@ -144,7 +65,7 @@ ndt_vec_transform(float __global *in, unsigned int elems,
 
 	in_tmp[0] = in[elem_idx];
 	in_tmp[1] = in[elems + elem_idx];
-	in_tmp[2] = in[mad24(elems, (unsigned int) 2, elem_idx)];
+	in_tmp[2] = in[(2 * elems) + elem_idx];
 
 	out_tmp[0] = in_tmp[0] * transform_mat[0] + transform_mat[3];
 	out_tmp[0] += in_tmp[1] * transform_mat[1];
@@ -160,13 +81,14 @@ ndt_vec_transform(float __global *in, unsigned int elems,
 
 	out[elem_idx] = out_tmp[0];
 	out[elems + elem_idx] = out_tmp[1];
-	out[mad24(elems, (unsigned int) 2, elem_idx)] = out_tmp[2];
+	out[(2 * elems) + elem_idx] = out_tmp[2];
 }
 
 /* Launch in 1D - all cells */
 __kernel void
-ndt_cell_qC(float __global *in, unsigned int in_elems, int __global *bin_elems,
-		int __global *bin_prefix, float __global *q, float __global *C)
+ndt_cell_qC(float __global *in, idx_t in_elems, int __global *bin_elems,
+		idx_t __global *bin_prefix, float __global *q,
+		float __global *C)
 {
 	unsigned int cell_idx = get_global_id(0);
 	unsigned int cells = get_global_size(0);
@@ -192,7 +114,7 @@ ndt_cell_qC(float __global *in, unsigned int in_elems, int __global *bin_elems,
 
 		q_tmp[i] = 0.f;
 
-		unsigned int off = (i * in_elems) + bin_prefix[cell_idx];
+		idx_t off = (i * in_elems) + bin_prefix[cell_idx];
 		for (j = 0; j < bin_elems[cell_idx]; j++, off++) {
 			q_tmp[i] += in[off];
 		}
@@ -206,7 +128,7 @@ ndt_cell_qC(float __global *in, unsigned int in_elems, int __global *bin_elems,
 	float c_inv[9];
 
 	{
-		unsigned int off = bin_prefix[cell_idx];
+		idx_t off = bin_prefix[cell_idx];
 
 		for (i = 0; i < bin_elems[cell_idx]; i++, off++) {
 			float in_tmp[3];
@@ -232,7 +154,7 @@ ndt_cell_qC(float __global *in, unsigned int in_elems, int __global *bin_elems,
 	for (i = 0; i < 9; i++)
 		c_tmp[i] /= (bin_elems[cell_idx] - 1);
 
-	invert_3x3(c_tmp, c_inv);
+	sm_inv3_sym(c_tmp, c_inv);
 
 	#pragma unroll
 	for (i = 0; i < 9; i++)
@@ -241,7 +163,8 @@ ndt_cell_qC(float __global *in, unsigned int in_elems, int __global *bin_elems,
 }
 
 
-inline void
+/* Returns the number of CAS retries, for instrumentation */
+inline uint
 atomic_add_fp(volatile float __global *ptr, float val)
 {
 #ifdef NV_SM_20
@@ -251,28 +174,36 @@ atomic_add_fp(volatile float __global *ptr, float val)
 
 	asm volatile ("atom.global.add.f32 %0, [%1], %2;" :
 			"=f"(oldval) : "l"(ptr), "f"(val));
+
+	return 0;
 #else
 	volatile int __global *iptr = (volatile int __global *) ptr;
 	union {
 		int i;
 		float f;
 	} oldval, newval;
+	uint retries = 0;
 
-	do {
+	oldval.i = *iptr;
+	newval.f = oldval.f + val;
+	while (atomic_cmpxchg(iptr, oldval.i, newval.i) != oldval.i) {
 		oldval.i = *iptr;
 		newval.f = oldval.f + val;
-	} while (atomic_cmpxchg(iptr,
-			oldval.i, newval.i) != oldval.i);
+		retries++;
+	}
+
+	return retries;
 #endif
 }
 
-/* Launch in 1D - elems */
+/* Launch in 1D - elems
+ * Instrumented: 0 = CAS retries */
 __kernel void
-ndt_elem_q(float __global *in_x, unsigned int in_elems, int __global *cell,
+ndt_elem_q(float __global *in_x, idx_t in_elems, int __global *cell,
 		volatile int __global *bin_elems,
-		const float bins_dim, volatile float __global *q)
+		const float bins_dim, volatile float __global *q INSTR_PARAM)
 {
-	unsigned int elem_idx =
+	idx_t elem_idx =
 		get_global_id(1) * get_global_size(0) +
 		get_global_id(0);
 
@@ -295,19 +226,21 @@ ndt_elem_q(float __global *in_x, unsigned int in_elems, int __global *cell,
 		return;
 
 	for (i = 0; i < 3; i++)
-		atomic_add_fp(&q[cell_idx + (i* cells)], q_tmp[i]);
+		INSTR_ADD(0, atomic_add_fp(&q[cell_idx + (i* cells)],
+				q_tmp[i]));
 
 	atomic_inc(&bin_elems[cell_idx]);
 }
 
-/* Launch in 1D - elems */
+/* Launch in 1D - elems
+ * Instrumented: 0 = CAS retries */
 __kernel void
-ndt_elem_C(float __global *in_x, unsigned int in_elems, int __global *cell,
+ndt_elem_C(float __global *in_x, idx_t in_elems, int __global *cell,
 		volatile int __global *bin_elems,
 		const float bins_dim, volatile float __global *q,
-		volatile float __global *C)
+		volatile float __global *C INSTR_PARAM)
 {
-	unsigned int elem_idx =
+	idx_t elem_idx =
 		get_global_id(1) * get_global_size(0) +
 		get_global_id(0);
 
@@ -319,6 +252,7 @@ ndt_elem_C(float __global *in_x, unsigned int in_elems, int __global *cell,
 	int cell_elems;
 	int i;
 	float q_tmp[3];
+	uint retries;
 
 	cell_idx = cell[elem_idx];
 	if (cell_idx < 0)
@@ -337,20 +271,28 @@ ndt_elem_C(float __global *in_x, unsigned int in_elems, int __global *cell,
 	for (i = 0; i < 3; i++)
 		in_tmp[i] = in_x[(i * in_elems) + elem_idx] - q_tmp[i];
 
-	atomic_add_fp(&C[cell_idx], in_tmp[0] * in_tmp[0]);
-	atomic_add_fp(&C[cell_idx + cells], in_tmp[0] * in_tmp[1]);
-	atomic_add_fp(&C[cell_idx + (2 * cells)], in_tmp[0] * in_tmp[2]);
-	atomic_add_fp(&C[cell_idx + (3 * cells)], in_tmp[0] * in_tmp[1]);
-	atomic_add_fp(&C[cell_idx + (4 * cells)], in_tmp[1] * in_tmp[1]);
-	atomic_add_fp(&C[cell_idx + (5 * cells)], in_tmp[1] * in_tmp[2]);
-	atomic_add_fp(&C[cell_idx + (6 * cells)], in_tmp[0] * in_tmp[2]);
-	atomic_add_fp(&C[cell_idx + (7 * cells)], in_tmp[1] * in_tmp[2]);
-	atomic_add_fp(&C[cell_idx + (8 * cells)], in_tmp[2] * in_tmp[2]);
+	retries =  atomic_add_fp(&C[cell_idx], in_tmp[0] * in_tmp[0]);
+	retries += atomic_add_fp(&C[cell_idx + cells], in_tmp[0] * in_tmp[1]);
+	retries += atomic_add_fp(&C[cell_idx + (2 * cells)],
+			in_tmp[0] * in_tmp[2]);
+	retries += atomic_add_fp(&C[cell_idx + (3 * cells)],
+			in_tmp[0] * in_tmp[1]);
+	retries += atomic_add_fp(&C[cell_idx + (4 * cells)],
+			in_tmp[1] * in_tmp[1]);
+	retries += atomic_add_fp(&C[cell_idx + (5 * cells)],
+			in_tmp[1] * in_tmp[2]);
+	retries += atomic_add_fp(&C[cell_idx + (6 * cells)],
+			in_tmp[0] * in_tmp[2]);
+	retries += atomic_add_fp(&C[cell_idx + (7 * cells)],
+			in_tmp[1] * in_tmp[2]);
+	retries += atomic_add_fp(&C[cell_idx + (8 * cells)],
+			in_tmp[2] * in_tmp[2]);
+	INSTR_ADD(0, retries);
 }
 
 /* Launch 1D - cells*/
 __kernel void
-ndt_elem_qC_post(float __global *in_x, unsigned int in_elems,
+ndt_elem_qC_post(float __global *in_x, idx_t in_elems,
 		int __global *bin_elems,
 		const float bins_dim, float __global *q, float __global *C)
 {
@@ -373,7 +315,7 @@ ndt_elem_qC_post(float __global *in_x, unsigned int in_elems,
 	for (i = 0; i < 9; i++)
 		c_tmp[i] = C[cell_idx + (i* cells)] / (bin_elems[cell_idx] - 1);
 
-	invert_3x3(c_tmp, c_inv);
+	sm_inv3_sym(c_tmp, c_inv);
 
 	for (i = 0; i < 9; i++)
 		C[(i * cells) + cell_idx] = c_inv[i];
@@ -0,0 +1,643 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "frnn/prefix_sum.h"
+
+enum scan_variant {
+	SCAN_BLELLOCH = 0,
+	SCAN_CONFLICT_FREE,
+	SCAN_KOGGE_STONE,
+	SCAN_SUBGROUP,
+	SCAN_LOOKBACK,
+	SCAN_VARIANTS,
+};
+
+static const char *variant_names[SCAN_VARIANTS] = {
+	[SCAN_BLELLOCH] = "Blelloch",
+	[SCAN_CONFLICT_FREE] = "Conflict-free",
+	[SCAN_KOGGE_STONE] = "Kogge-Stone",
+	[SCAN_SUBGROUP] = "Subgroup",
+	[SCAN_LOOKBACK] = "Look-back",
+};
+
+/* Blelloch is the library scan, built from src/frnn/prefix_sum.cl */
+static const char *variant_kernels[SCAN_VARIANTS] = {
+	[SCAN_BLELLOCH] = NULL,
+	[SCAN_CONFLICT_FREE] = "scan_cf",
+	[SCAN_KOGGE_STONE] = "scan_ks",
+	[SCAN_SUBGROUP] = "scan_sg",
+	[SCAN_LOOKBACK] = "scan_lookback",
+};
+
+/* Elements scanned per work-item */
+static const unsigned int variant_epi[SCAN_VARIANTS] = {
+	[SCAN_BLELLOCH] = 2,
+	[SCAN_CONFLICT_FREE] = 2,
+	[SCAN_KOGGE_STONE] = 1,
+	[SCAN_SUBGROUP] = 1,
+	[SCAN_LOOKBACK] = 2,
+};
+
+#define SCAN_MAX_STEPS 32
+
+/* Must match prefix_sum.cl */
+#define CF_OFF(n) ((n) >> 5)
+
+/* Kernels for the first level (uint input) and the levels above (idx_t) */
+static cl_kernel kernels[SCAN_VARIANTS][2];
+static cl_kernel kernel_add;
+static size_t wg_size;
+/* Library scan program, built once */
+static cl_program prg_blelloch;
+
+void usage(char *prg)
+{
+	printf("%s\n", prg);
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-n <elems>\t Largest number of elements to scan, "
+			"default 16777216\n");
+	printf("\t-v\t\t Verbose: print the time of every pass\n");
+	opencl_usage();
+}
+
+static size_t
+scan_local_size(enum scan_variant v)
+{
+	switch (v) {
+	case SCAN_CONFLICT_FREE:
+	case SCAN_LOOKBACK:
+		return (2 * wg_size + CF_OFF(2 * wg_size)) *
+				opencl_index_size();
+	case SCAN_KOGGE_STONE:
+		return 2 * wg_size * opencl_index_size();
+	case SCAN_SUBGROUP:
+		return (wg_size + 1) * opencl_index_size();
+	default:
+		return 0;
+	}
+}
+
+static int
+scan_enqueue(cl_command_queue q, cl_kernel k, size_t items, cl_ulong *time)
+{
+	cl_int error;
+	cl_event e_time;
+
+	const size_t dims_g[] = {items};
+	const size_t dims_l[] = {wg_size};
+	error = clEnqueueNDRangeKernel(q, k, 1, NULL, dims_g, dims_l, 0, NULL,
+			&e_time);
+	if (error != CL_SUCCESS) {
+		printf("Could not enqueue kernel execution: %d\n", error);
+		return -1;
+	}
+
+	clFinish(q);
+	*time += opencl_exec_time(e_time);
+	clReleaseEvent(e_time);
+
+	return 0;
+}
+
+/* Arguments of the block scan kernels, at every level */
+static int
+scan_set_args(cl_kernel k, enum scan_variant v, cl_mem in, cl_mem out,
+		size_t elems, cl_mem incr)
+{
+	cl_int error;
+
+	error =  clSetKernelArg(k, 0, sizeof(cl_mem), &in);
+	error |= clSetKernelArg(k, 1, sizeof(cl_mem), &out);
+	error |= opencl_set_kernel_arg_idx(k, 2, elems);
+	error |= clSetKernelArg(k, 3, sizeof(cl_mem), &incr);
+	error |= clSetKernelArg(k, 4, scan_local_size(v), NULL);
+	if (error != CL_SUCCESS) {
+		printf("One of the arguments could not be set: %d.\n", error);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* One level of a multi-pass scan: scan blocks, scan the block totals
+ * recursively, add them back in. */
+static int
+scan_level(cl_context ctx, cl_command_queue q, enum scan_variant v,
+		int level, cl_mem in, cl_mem out, size_t elems,
+		cl_ulong *time)
+{
+	cl_kernel k = kernels[v][level > 0];
+	size_t block, groups;
+	cl_uint block_arg;
+	cl_mem incr = 0;
+	cl_int error;
+	int ret = -1;
+
+	block = wg_size * variant_epi[v];
+	groups = (elems + block - 1) / block;
+
+	if (groups > 1) {
+		incr = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+				groups * opencl_index_size(), NULL, &error);
+		if (error != CL_SUCCESS) {
+			printf("Could not create increment buffer\n");
+			return -1;
+		}
+	}
+
+	if (scan_set_args(k, v, in, out, elems, incr))
+		goto error;
+
+	if (scan_enqueue(q, k, groups * wg_size, time))
+		goto error;
+
+	if (groups == 1) {
+		ret = 0;
+		goto error;
+	}
+
+	if (scan_level(ctx, q, v, level + 1, incr, incr, groups, time))
+		goto error;
+
+	block_arg = block;
+	error =  clSetKernelArg(kernel_add, 0, sizeof(cl_mem), &out);
+	error |= opencl_set_kernel_arg_idx(kernel_add, 1, elems);
+	error |= clSetKernelArg(kernel_add, 2, sizeof(cl_mem), &incr);
+	error |= clSetKernelArg(kernel_add, 3, sizeof(cl_uint), &block_arg);
+	if (error != CL_SUCCESS) {
+		printf("One of the arguments could not be set: %d.\n", error);
+		goto error;
+	}
+
+	if (scan_enqueue(q, kernel_add,
+			((elems + wg_size - 1) / wg_size) * wg_size, time))
+		goto error;
+
+	ret = 0;
+
+error:
+	if (incr)
+		opencl_release_buffer(incr);
+
+	return ret;
+}
+
+/* Re-launch the block scans of the first level for the optional extra
+ * measurements. The levels above and the block adds update their buffers
+ * in place, and are left out. */
+static void
+scan_measure(cl_context ctx, cl_command_queue q, enum scan_variant v,
+		cl_mem in, cl_mem out, size_t elems)
+{
+	cl_kernel k = kernels[v][0];
+	size_t block, groups;
+	cl_mem incr = 0;
+	cl_int error;
+
+	block = wg_size * variant_epi[v];
+	groups = (elems + block - 1) / block;
+
+	if (groups > 1) {
+		incr = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+				groups * opencl_index_size(), NULL, &error);
+		if (error != CL_SUCCESS) {
+			printf("Could not create increment buffer\n");
+			return;
+		}
+	}
+
+	if (!scan_set_args(k, v, in, out, elems, incr)) {
+		const size_t dims_g[] = {groups * wg_size};
+		const size_t dims_l[] = {wg_size};
+		opencl_kernel_measure(q, k, 1, NULL, dims_g, dims_l);
+	}
+
+	if (incr)
+		opencl_release_buffer(incr);
+}
+
+/* Single-pass scan. The tile status must be reset before every launch,
+ * which is left out of the measurement. */
+static int
+scan_lookback(cl_context ctx, cl_command_queue q, cl_mem in, cl_mem out,
+		size_t elems, cl_ulong *time)
+{
+	cl_kernel k = kernels[SCAN_LOOKBACK][0];
+	size_t tiles;
+	cl_mem flags, agg, incl, tile_ctr;
+	cl_int error;
+	const cl_uint zero = 0;
+	int ret = -1;
+
+	tiles = (elems + 2 * wg_size - 1) / (2 * wg_size);
+
+	flags = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			tiles * sizeof(cl_uint), NULL, &error);
+	agg = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			tiles * opencl_index_size(), NULL, &error);
+	incl = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			tiles * opencl_index_size(), NULL, &error);
+	tile_ctr = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			sizeof(cl_uint), NULL, &error);
+	if (!flags || !agg || !incl || !tile_ctr) {
+		printf("Could not create tile status buffers\n");
+		goto error;
+	}
+
+	clEnqueueFillBuffer(q, flags, &zero, sizeof(cl_uint), 0,
+			tiles * sizeof(cl_uint), 0, NULL, NULL);
+	clEnqueueFillBuffer(q, tile_ctr, &zero, sizeof(cl_uint), 0,
+			sizeof(cl_uint), 0, NULL, NULL);
+	clFinish(q);
+
+	error =  clSetKernelArg(k, 0, sizeof(cl_mem), &in);
+	error |= clSetKernelArg(k, 1, sizeof(cl_mem), &out);
+	error |= opencl_set_kernel_arg_idx(k, 2, elems);
+	error |= clSetKernelArg(k, 3, sizeof(cl_mem), &flags);
+	error |= clSetKernelArg(k, 4, sizeof(cl_mem), &agg);
+	error |= clSetKernelArg(k, 5, sizeof(cl_mem), &incl);
+	error |= clSetKernelArg(k, 6, sizeof(cl_mem), &tile_ctr);
+	error |= clSetKernelArg(k, 7, scan_local_size(SCAN_LOOKBACK), NULL);
+	if (error != CL_SUCCESS) {
+		printf("One of the arguments could not be set: %d.\n", error);
+		goto error;
+	}
+
+	ret = scan_enqueue(q, k, tiles * wg_size, time);
+
+error:
+	if (flags)
+		opencl_release_buffer(flags);
+	if (agg)
+		opencl_release_buffer(agg);
+	if (incl)
+		opencl_release_buffer(incl);
+	if (tile_ctr)
+		opencl_release_buffer(tile_ctr);
+
+	return ret;
+}
+
+/* Compare an idx_t scan result against the reference */
+static bool
+scan_validate(cl_command_queue q, cl_mem out, size_t elems,
+		const uint64_t *ref, enum scan_variant v)
+{
+	void *res;
+	size_t i;
+	bool valid = true;
+
+	res = malloc(elems * opencl_index_size());
+	if (!res) {
+		printf("Could not allocate validation buffer\n");
+		return false;
+	}
+
+	clEnqueueReadBuffer(q, out, CL_TRUE, 0, elems * opencl_index_size(),
+			res, 0, NULL, NULL);
+
+	for (i = 0; i < elems; i++) {
+		if ((uint64_t) opencl_index_get(res, i) != ref[i]) {
+			printf("%s, %zu elements: mismatch at %zu, %"PRIi64
+					" != %"PRIu64"\n", variant_names[v],
+					elems, i, opencl_index_get(res, i),
+					ref[i]);
+			valid = false;
+			break;
+		}
+	}
+	free(res);
+
+	return valid;
+}
+
+/**
+ * Scan elems elements with one variant.
+ * @param extra Run the optional extra measurements on the kernels.
+ * @param valid Cleared if output validation is enabled and fails.
+ * @return Average execution time in ns, 0 on failure.
+ */
+static cl_ulong
+scan_run(cl_context ctx, cl_command_queue q, enum scan_variant v,
+		cl_mem in, cl_mem out, size_t elems, const uint64_t *ref,
+		bool extra, bool *valid)
+{
+	cl_ulong time_total = 0ul;
+	cl_mem res = out;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < opencl_get_iterations(); i++) {
+		if (res != out)
+			opencl_release_buffer(res);
+
+		switch (v) {
+		case SCAN_BLELLOCH:
+			res = prefix_sum_prg(ctx, q, prg_blelloch, in, elems,
+					&time_total);
+			ret = (res == (cl_mem) -1);
+			if (ret)
+				res = out;
+			break;
+		case SCAN_LOOKBACK:
+			ret = scan_lookback(ctx, q, in, out, elems,
+					&time_total);
+			break;
+		default:
+			ret = scan_level(ctx, q, v, 0, in, out, elems,
+					&time_total);
+			break;
+		}
+
+		if (ret)
+			return 0;
+	}
+
+	if (opencl_compare_output() && !scan_validate(q, res, elems, ref, v))
+		*valid = false;
+
+	/* Optional extra measurements, after the outputs were validated. The
+	 * library scan frees its kernels before returning, and the look-back
+	 * scan must reset its tile status before every launch. */
+	if (extra && v != SCAN_BLELLOCH && v != SCAN_LOOKBACK)
+		scan_measure(ctx, q, v, in, out, elems);
+
+	if (res != out)
+		opencl_release_buffer(res);
+
+	return time_total / opencl_get_iterations();
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	size_t max_elems = 1 << 24;
+	size_t elems, in_elems, i;
+	unsigned int steps, s;
+	enum scan_variant v;
+	cl_uint *data;
+	uint64_t *ref;
+	size_t step_elems[SCAN_MAX_STEPS];
+	double gbps[SCAN_MAX_STEPS][SCAN_VARIANTS];
+	cl_ulong t;
+	bool valid = true;
+	bool verbose = false;
+	char opts[64];
+	const char *std = "";
+	const cl_uint zero = 0;
+
+	cl_context ctx;
+	cl_command_queue q;
+	cl_program prg, prg_idx;
+	cl_mem in, out;
+	cl_int error;
+
+	while ((c = getopt (argc, argv, "?n:v"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case 'n':
+			max_elems = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case '?':
+			usage(argv[0]);
+			return 0;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (max_elems == 0) {
+		printf("Error: need at least one element\n");
+		usage(argv[0]);
+		return -1;
+	}
+
+	opencl_index_enable();
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (opencl_index_select(max_elems) < 0)
+		return -1;
+
+	/* Sub-group functions are part of OpenCL C 2.0 */
+	if (opencl_device_has_extension("cl_khr_subgroups"))
+		std = " -cl-std=CL2.0";
+
+	const char *programs = {
+		"src/prefix_sum/prefix_sum.cl"
+	};
+	snprintf(opts, sizeof(opts), "-D SCAN_IN=uint%s", std);
+	prg = opencl_compile_program_opts(ctx, 1, &programs, opts);
+	snprintf(opts, sizeof(opts), "-D SCAN_IN=idx_t%s", std);
+	prg_idx = opencl_compile_program_opts(ctx, 1, &programs, opts);
+	prg_blelloch = prefix_sum_compile(ctx);
+	if (!prg || !prg_idx || !prg_blelloch)
+		return -1;
+	prefix_sum_verbose(verbose);
+
+	for (v = 0; v < SCAN_VARIANTS; v++) {
+		kernels[v][0] = NULL;
+		kernels[v][1] = NULL;
+		if (!variant_kernels[v])
+			continue;
+
+		kernels[v][0] = clCreateKernel(prg, variant_kernels[v],
+				&error);
+		if (error != CL_SUCCESS) {
+			printf("Kernel %s not available, skipping\n",
+					variant_kernels[v]);
+			kernels[v][0] = NULL;
+			continue;
+		}
+
+		kernels[v][1] = clCreateKernel(prg_idx, variant_kernels[v],
+				&error);
+		if (error != CL_SUCCESS) {
+			printf("Kernel %s not available, skipping\n",
+					variant_kernels[v]);
+			clReleaseKernel(kernels[v][0]);
+			kernels[v][0] = NULL;
+			kernels[v][1] = NULL;
+		}
+	}
+
+	kernel_add = clCreateKernel(prg_idx, "scan_add", &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create kernel scan_add\n");
+		return -1;
+	}
+
+	/* The Blelloch block scans need a power-of-two work-group size */
+	wg_size = 1;
+	while (wg_size * 2 <= opencl_max_workgroup_size() && wg_size < 256)
+		wg_size *= 2;
+
+	steps = 0;
+	for (elems = 1 << 12; elems < max_elems && steps < SCAN_MAX_STEPS - 1;
+			elems <<= 2)
+		step_elems[steps++] = elems;
+	step_elems[steps++] = max_elems;
+
+	/* Small counts, such that the total fits a 32-bit index */
+	data = malloc(max_elems * sizeof(cl_uint));
+	ref = malloc(max_elems * sizeof(uint64_t));
+	if (!data || !ref) {
+		printf("Could not allocate input data\n");
+		return -1;
+	}
+
+	srand(1);
+	ref[0] = 0;
+	for (i = 0; i < max_elems; i++) {
+		data[i] = rand() & 0x3;
+		if (i > 0)
+			ref[i] = ref[i - 1] + data[i - 1];
+	}
+
+	printf("Work-group size %zu, %zu-byte output\n", wg_size,
+			opencl_index_size());
+
+	opencl_mem_stage("scan");
+	ret = 0;
+	for (s = 0; s < steps; s++) {
+		elems = step_elems[s];
+
+		/* The library scan reads up to its padded size */
+		in_elems = prefix_sum_elems_ceil(ctx, elems, NULL);
+		if (in_elems < elems)
+			in_elems = elems;
+
+		in = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+				in_elems * sizeof(cl_uint), NULL, &error);
+		if (error != CL_SUCCESS) {
+			printf("Could not create in buffer\n");
+			return -1;
+		}
+
+		out = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+				elems * opencl_index_size(), NULL, &error);
+		if (error != CL_SUCCESS) {
+			printf("Could not create out buffer\n");
+			return -1;
+		}
+
+		clEnqueueFillBuffer(q, in, &zero, sizeof(cl_uint), 0,
+				in_elems * sizeof(cl_uint), 0, NULL, NULL);
+		error = clEnqueueWriteBuffer(q, in, CL_TRUE, 0,
+				elems * sizeof(cl_uint), data, 0, NULL, NULL);
+		if (error != CL_SUCCESS) {
+			printf("Could not enqueue buffer write\n");
+			return -1;
+		}
+
+		for (v = 0; v < SCAN_VARIANTS; v++) {
+			gbps[s][v] = 0.;
+
+			if (v != SCAN_BLELLOCH && !kernels[v][0])
+				continue;
+
+			t = scan_run(ctx, q, v, in, out, elems, ref,
+					s == steps - 1, &valid);
+			if (t == 0) {
+				ret = -1;
+				continue;
+			}
+
+			/* Read the input once, write the output once */
+			gbps[s][v] = (double) elems * (sizeof(cl_uint) +
+					opencl_index_size()) / t;
+		}
+
+		opencl_release_buffer(in);
+		opencl_release_buffer(out);
+	}
+
+	if (opencl_compare_output()) {
+		if (valid) {
+			printf("Output valid\n");
+		} else {
+			printf("Output invalid\n");
+			ret = -1;
+		}
+	}
+
+	printf("%10s", "Elements");
+	for (v = 0; v < SCAN_VARIANTS; v++)
+		printf(" %13s", variant_names[v]);
+	printf("  (GB/s)\n");
+
+	for (s = 0; s < steps; s++) {
+		printf("%10zu", step_elems[s]);
+		for (v = 0; v < SCAN_VARIANTS; v++) {
+			if (gbps[s][v] == 0.)
+				printf(" %13s", "-");
+			else
+				printf(" %13.2f", gbps[s][v]);
+		}
+		printf("\n");
+	}
+
+	/* Tear down */
+	for (v = 0; v < SCAN_VARIANTS; v++) {
+		if (kernels[v][0])
+			clReleaseKernel(kernels[v][0]);
+		if (kernels[v][1])
+			clReleaseKernel(kernels[v][1]);
+	}
+	clReleaseKernel(kernel_add);
+	clReleaseProgram(prg_idx);
+	clReleaseProgram(prg_blelloch);
+
+	opencl_teardown(&ctx, &q, &prg);
+	free(data);
+	free(ref);
+
+	return ret;
+}
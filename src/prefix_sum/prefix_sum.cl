@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Alternative scan algorithms, for comparison against the Blelloch scan in
+ * src/frnn/prefix_sum.cl. All are exclusive scans of SCAN_IN elements into
+ * idx_t, SCAN_IN is set by the host to uint for the first level of the
+ * hierarchy and to idx_t for the levels above. Block kernels write the block
+ * total to incr[group] if incr is non-NULL.
+ */
+
+#ifndef SCAN_IN
+#define SCAN_IN uint
+#endif
+
+#define SCAN_LOAD(in, i, elems) ((i) < (elems) ? (idx_t) (in)[i] : 0)
+
+/* Pad local memory by one word every NUM_BANKS words */
+#define LOG_NUM_BANKS 5
+#define CF_OFF(n) ((n) >> LOG_NUM_BANKS)
+
+/* Blelloch scan of (2 * local size) elements, with the local memory layout
+ * padded to avoid bank conflicts. Returns the block total on work-item 0. */
+inline idx_t scan_block_cf(idx_t __local *l)
+{
+	uint lx = get_local_id(0);
+	uint n = get_local_size(0) * 2;
+	uint offset = 1;
+	uint d, ai, bi;
+	idx_t tmp;
+	idx_t total = 0;
+
+	/* Up-sweep */
+	for (d = n >> 1; d > 0; d >>= 1) {
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lx < d) {
+			ai = offset * (2 * lx + 1) - 1;
+			bi = offset * (2 * lx + 2) - 1;
+			ai += CF_OFF(ai);
+			bi += CF_OFF(bi);
+			l[bi] += l[ai];
+		}
+		offset <<= 1;
+	}
+
+	if (lx == 0) {
+		total = l[n - 1 + CF_OFF(n - 1)];
+		l[n - 1 + CF_OFF(n - 1)] = 0;
+	}
+
+	/* Down-sweep */
+	for (d = 1; d < n; d <<= 1) {
+		offset >>= 1;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lx < d) {
+			ai = offset * (2 * lx + 1) - 1;
+			bi = offset * (2 * lx + 2) - 1;
+			ai += CF_OFF(ai);
+			bi += CF_OFF(bi);
+			tmp = l[ai];
+			l[ai] = l[bi];
+			l[bi] += tmp;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return total;
+}
+
+/* Launch in 1D, two elements per work-item. l holds
+ * (2 * local size) + CF_OFF(2 * local size) entries. */
+__kernel void scan_cf(SCAN_IN __global *in, idx_t __global *out,
+		idx_t elems, idx_t __global *incr, idx_t __local *l)
+{
+	uint lx = get_local_id(0);
+	uint ls = get_local_size(0);
+	idx_t base = (idx_t) get_group_id(0) * ls * 2;
+	uint ai = lx;
+	uint bi = lx + ls;
+	idx_t total;
+
+	l[ai + CF_OFF(ai)] = SCAN_LOAD(in, base + ai, elems);
+	l[bi + CF_OFF(bi)] = SCAN_LOAD(in, base + bi, elems);
+
+	total = scan_block_cf(l);
+	if (lx == 0 && incr)
+		incr[get_group_id(0)] = total;
+
+	if (base + ai < elems)
+		out[base + ai] = l[ai + CF_OFF(ai)];
+	if (base + bi < elems)
+		out[base + bi] = l[bi + CF_OFF(bi)];
+}
+
+/* Kogge-Stone scan, one element per work-item. Not work-efficient, but
+ * needs only log2(local size) steps. l holds (2 * local size) entries. */
+__kernel void scan_ks(SCAN_IN __global *in, idx_t __global *out,
+		idx_t elems, idx_t __global *incr, idx_t __local *l)
+{
+	uint lx = get_local_id(0);
+	uint ls = get_local_size(0);
+	idx_t n = get_global_id(0);
+	uint pin = 1, pout = 0;
+	uint off;
+
+	/* Shift right by one to turn the inclusive scan exclusive */
+	l[lx] = lx > 0 ? SCAN_LOAD(in, n - 1, elems) : 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (off = 1; off < ls; off <<= 1) {
+		pout = 1 - pout;
+		pin = 1 - pout;
+		if (lx >= off)
+			l[pout * ls + lx] = l[pin * ls + lx] +
+					l[pin * ls + lx - off];
+		else
+			l[pout * ls + lx] = l[pin * ls + lx];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lx == ls - 1 && incr)
+		incr[get_group_id(0)] = l[pout * ls + lx] +
+				SCAN_LOAD(in, n, elems);
+
+	if (n < elems)
+		out[n] = l[pout * ls + lx];
+}
+
+#ifdef cl_khr_subgroups
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+
+/* Scan within each sub-group, then across the sub-group totals. One element
+ * per work-item. l holds (local size + 1) entries. */
+__kernel void scan_sg(SCAN_IN __global *in, idx_t __global *out,
+		idx_t elems, idx_t __global *incr, idx_t __local *l)
+{
+	uint lx = get_local_id(0);
+	idx_t n = get_global_id(0);
+	uint sg = get_sub_group_id();
+	uint i;
+	idx_t v, x, tmp, acc;
+
+	v = SCAN_LOAD(in, n, elems);
+	x = sub_group_scan_exclusive_add(v);
+	acc = sub_group_reduce_add(v);
+
+	if (get_sub_group_local_id() == 0)
+		l[sg] = acc;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* Few enough sub-groups to scan their totals serially */
+	if (lx == 0) {
+		acc = 0;
+		for (i = 0; i < get_num_sub_groups(); i++) {
+			tmp = l[i];
+			l[i] = acc;
+			acc += tmp;
+		}
+
+		if (incr)
+			incr[get_group_id(0)] = acc;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (n < elems)
+		out[n] = x + l[sg];
+}
+#endif
+
+/* Launch in 1D, one work-item per element. Adds the scanned block totals of
+ * blocks of block elements. */
+__kernel void scan_add(idx_t __global *data, idx_t elems,
+		idx_t __global *incr, uint block)
+{
+	idx_t n = get_global_id(0);
+
+	if (n < elems)
+		data[n] += incr[n / block];
+}
+
+/* Single-pass scan with decoupled look-back, two elements per work-item.
+ *
+ * Tiles are handed out in order through tile_ctr, such that every tile a
+ * work-group waits on has been picked up by a running work-group. Each tile
+ * publishes its aggregate as soon as it is known, and its inclusive prefix
+ * once the look-back has completed. flags[] and tile_ctr must be zero at
+ * launch. l holds (2 * local size) + CF_OFF(2 * local size) entries. */
+#define TILE_INVALID	0
+#define TILE_AGGREGATE	1
+#define TILE_PREFIX	2
+
+__kernel void scan_lookback(SCAN_IN __global *in, idx_t __global *out,
+		idx_t elems, volatile uint __global *flags,
+		volatile idx_t __global *agg, volatile idx_t __global *incl,
+		volatile uint __global *tile_ctr, idx_t __local *l)
+{
+	__local uint l_tile;
+	__local idx_t l_prefix;
+	uint lx = get_local_id(0);
+	uint ls = get_local_size(0);
+	uint ai = lx;
+	uint bi = lx + ls;
+	uint tile, f;
+	int p;
+	idx_t base, total, prefix;
+
+	if (lx == 0)
+		l_tile = atomic_inc(tile_ctr);
+	barrier(CLK_LOCAL_MEM_FENCE);
+	tile = l_tile;
+	base = (idx_t) tile * ls * 2;
+
+	l[ai + CF_OFF(ai)] = SCAN_LOAD(in, base + ai, elems);
+	l[bi + CF_OFF(bi)] = SCAN_LOAD(in, base + bi, elems);
+
+	total = scan_block_cf(l);
+
+	if (lx == 0) {
+		prefix = 0;
+
+		if (tile == 0) {
+			incl[0] = total;
+			write_mem_fence(CLK_GLOBAL_MEM_FENCE);
+			atomic_xchg(&flags[0], TILE_PREFIX);
+		} else {
+			agg[tile] = total;
+			write_mem_fence(CLK_GLOBAL_MEM_FENCE);
+			atomic_xchg(&flags[tile], TILE_AGGREGATE);
+
+			for (p = tile - 1; p >= 0; p--) {
+				do {
+					f = atomic_add(&flags[p], 0);
+				} while (f == TILE_INVALID);
+				read_mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+				if (f == TILE_PREFIX) {
+					prefix += incl[p];
+					break;
+				}
+				prefix += agg[p];
+			}
+
+			incl[tile] = prefix + total;
+			write_mem_fence(CLK_GLOBAL_MEM_FENCE);
+			atomic_xchg(&flags[tile], TILE_PREFIX);
+		}
+
+		l_prefix = prefix;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	prefix = l_prefix;
+
+	if (base + ai < elems)
+		out[base + ai] = l[ai + CF_OFF(ai)] + prefix;
+	if (base + bi < elems)
+		out[base + bi] = l[bi + CF_OFF(bi)] + prefix;
+}
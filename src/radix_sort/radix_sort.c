@@ -0,0 +1,379 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "lib/radix_sort.h"
+
+enum sort_mode {
+	SORT_KEY32 = 0,
+	SORT_KV32,
+	SORT_KEY64,
+	SORT_KV64,
+	SORT_SEG32,
+	SORT_MODES,
+};
+
+static const char *mode_names[SORT_MODES] = {
+	[SORT_KEY32] = "32-bit",
+	[SORT_KV32] = "32-bit kv",
+	[SORT_KEY64] = "64-bit",
+	[SORT_KV64] = "64-bit kv",
+	[SORT_SEG32] = "Segmented",
+};
+
+#define SORT_MAX_STEPS 32
+
+void usage(char *prg)
+{
+	printf("%s\n", prg);
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-n <elems>\t Largest number of keys to sort, "
+			"default 4194304\n");
+	printf("\t-g <segs>\t Number of segments for the segmented sort, "
+			"default 1024\n");
+	opencl_usage();
+}
+
+/* Check order, stability and that every value still belongs to its key.
+ * Values are initialised to the original index of their key. */
+static bool
+sort_validate(enum sort_mode m, const void *in, const void *out,
+		const cl_uint *vals, size_t elems, size_t seg_elems)
+{
+	const cl_uint *in32 = in, *out32 = out;
+	const cl_ulong *in64 = in, *out64 = out;
+	bool key64 = (m == SORT_KEY64 || m == SORT_KV64);
+	bool kv = (m == SORT_KV32 || m == SORT_KV64 || m == SORT_SEG32);
+	cl_ulong prev, cur;
+	size_t i;
+
+	for (i = 0; i < elems; i++) {
+		cur = key64 ? out64[i] : out32[i];
+
+		if (kv && vals[i] >= elems) {
+			printf("%s: value %zu out of range\n", mode_names[m],
+					i);
+			return false;
+		}
+
+		if (kv && cur != (key64 ? in64[vals[i]] : in32[vals[i]])) {
+			printf("%s: key %zu does not match its value\n",
+					mode_names[m], i);
+			return false;
+		}
+
+		/* Segments restart the order */
+		if (i == 0 || (m == SORT_SEG32 && i % seg_elems == 0)) {
+			prev = cur;
+			continue;
+		}
+
+		if (cur < prev ||
+		    (kv && cur == prev && vals[i] < vals[i - 1])) {
+			printf("%s: order violated at %zu\n", mode_names[m],
+					i);
+			return false;
+		}
+
+		if (m == SORT_SEG32 && vals[i] / seg_elems != i / seg_elems) {
+			printf("%s: key %zu left its segment\n", mode_names[m],
+					i);
+			return false;
+		}
+
+		prev = cur;
+	}
+
+	return true;
+}
+
+/**
+ * Sort elems keys in one mode.
+ * @param extra Run the optional extra measurements on the kernels.
+ * @param valid Cleared if output validation is enabled and fails.
+ * @return Average execution time in ns, 0 on failure.
+ */
+static cl_ulong
+sort_bench(cl_context ctx, cl_command_queue q, struct radix_sort *r,
+		enum sort_mode m, const void *keys, const cl_uint *vals,
+		size_t elems, size_t segs, bool extra, bool *valid)
+{
+	bool key64 = (m == SORT_KEY64 || m == SORT_KV64);
+	size_t key_size = key64 ? sizeof(cl_ulong) : sizeof(cl_uint);
+	size_t seg_elems = (elems + segs - 1) / segs;
+	cl_ulong time_total = 0ul;
+	cl_mem cl_keys, cl_vals, cl_segs = NULL;
+	cl_uint *offsets = NULL;
+	void *out = NULL;
+	cl_uint *out_vals = NULL;
+	unsigned int i;
+	size_t s;
+	cl_int error;
+	int ret;
+
+	if (m == SORT_SEG32) {
+		segs = (elems + seg_elems - 1) / seg_elems;
+		offsets = malloc(segs * sizeof(cl_uint));
+		if (!offsets) {
+			printf("Could not allocate segment offsets\n");
+			return 0;
+		}
+		for (s = 0; s < segs; s++)
+			offsets[s] = s * seg_elems;
+	}
+
+	cl_keys = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			elems * key_size, NULL, &error);
+	cl_vals = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			elems * sizeof(cl_uint), NULL, &error);
+	if (m == SORT_SEG32)
+		cl_segs = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+				segs * sizeof(cl_uint), NULL, &error);
+	if (!cl_keys || !cl_vals || (m == SORT_SEG32 && !cl_segs)) {
+		printf("Could not create sort buffers\n");
+		goto out;
+	}
+
+	if (cl_segs)
+		clEnqueueWriteBuffer(q, cl_segs, CL_TRUE, 0,
+				segs * sizeof(cl_uint), offsets, 0, NULL,
+				NULL);
+
+	for (i = 0; i < opencl_get_iterations(); i++) {
+		/* Sorting is in place, restore the input every iteration */
+		clEnqueueWriteBuffer(q, cl_keys, CL_FALSE, 0,
+				elems * key_size, keys, 0, NULL, NULL);
+		clEnqueueWriteBuffer(q, cl_vals, CL_TRUE, 0,
+				elems * sizeof(cl_uint), vals, 0, NULL, NULL);
+
+		if (m == SORT_SEG32)
+			ret = radix_sort_segments(r, q, cl_keys, cl_vals,
+					cl_segs, segs, elems, &time_total);
+		else
+			ret = radix_sort_run(r, q, cl_keys, cl_vals, elems, 0,
+					&time_total);
+
+		if (ret) {
+			time_total = 0;
+			goto out;
+		}
+	}
+
+	if (!opencl_compare_output())
+		goto measure;
+
+	out = malloc(elems * key_size);
+	out_vals = malloc(elems * sizeof(cl_uint));
+	if (!out || !out_vals) {
+		printf("Could not allocate validation buffer\n");
+		*valid = false;
+		goto out;
+	}
+
+	clEnqueueReadBuffer(q, cl_keys, CL_FALSE, 0, elems * key_size, out, 0,
+			NULL, NULL);
+	clEnqueueReadBuffer(q, cl_vals, CL_TRUE, 0, elems * sizeof(cl_uint),
+			out_vals, 0, NULL, NULL);
+
+	if (!sort_validate(m, keys, out, out_vals, elems, seg_elems))
+		*valid = false;
+
+measure:
+	/* Optional extra measurements, after the outputs were validated */
+	if (extra)
+		radix_sort_measure(r, q);
+
+out:
+	if (cl_keys)
+		opencl_release_buffer(cl_keys);
+	if (cl_vals)
+		opencl_release_buffer(cl_vals);
+	if (cl_segs)
+		opencl_release_buffer(cl_segs);
+	free(offsets);
+	free(out);
+	free(out_vals);
+
+	return time_total / opencl_get_iterations();
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	size_t max_elems = 1 << 22;
+	size_t segs = 1024;
+	size_t elems, i;
+	unsigned int steps, s;
+	enum sort_mode m;
+	struct radix_sort *sorts[SORT_MODES];
+	size_t step_elems[SORT_MAX_STEPS];
+	double mkeys[SORT_MAX_STEPS][SORT_MODES];
+	cl_uint *keys32, *vals;
+	cl_ulong *keys64;
+	cl_ulong t;
+	bool valid = true;
+
+	cl_context ctx;
+	cl_command_queue q;
+	cl_program prg = NULL;
+
+	while ((c = getopt (argc, argv, "?n:g:"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case 'n':
+			max_elems = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			segs = strtoul(optarg, NULL, 0);
+			break;
+		case '?':
+			usage(argv[0]);
+			return 0;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (max_elems < 2 || max_elems > UINT32_MAX || segs == 0) {
+		printf("Error: number of keys must be in [2, 2^32)\n");
+		usage(argv[0]);
+		return -1;
+	}
+
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	sorts[SORT_KEY32] = radix_sort_create(ctx, false, false);
+	sorts[SORT_KV32] = radix_sort_create(ctx, false, true);
+	sorts[SORT_KEY64] = radix_sort_create(ctx, true, false);
+	sorts[SORT_KV64] = radix_sort_create(ctx, true, true);
+	sorts[SORT_SEG32] = sorts[SORT_KV32];
+	for (m = 0; m < SORT_MODES; m++) {
+		if (!sorts[m])
+			return -1;
+	}
+
+	keys32 = malloc(max_elems * sizeof(cl_uint));
+	keys64 = malloc(max_elems * sizeof(cl_ulong));
+	vals = malloc(max_elems * sizeof(cl_uint));
+	if (!keys32 || !keys64 || !vals) {
+		printf("Could not allocate input data\n");
+		return -1;
+	}
+
+	/* Random keys over the full range. The 64-bit keys only have 2^16
+	 * distinct upper halves, so their order relies on the stability of
+	 * the passes over the lower half. */
+	srand(1);
+	for (i = 0; i < max_elems; i++) {
+		keys32[i] = ((cl_uint) rand() << 16) ^ rand();
+		keys64[i] = ((cl_ulong) (keys32[i] & 0xffff0000u) << 32) |
+				(cl_uint) rand();
+		vals[i] = i;
+	}
+
+	steps = 0;
+	for (elems = 1 << 12; elems < max_elems && steps < SORT_MAX_STEPS - 1;
+			elems <<= 2)
+		step_elems[steps++] = elems;
+	step_elems[steps++] = max_elems;
+
+	opencl_mem_stage("sort");
+	ret = 0;
+	for (s = 0; s < steps; s++) {
+		for (m = 0; m < SORT_MODES; m++) {
+			mkeys[s][m] = 0.;
+
+			t = sort_bench(ctx, q, sorts[m], m,
+					(m == SORT_KEY64 || m == SORT_KV64) ?
+					(void *) keys64 : keys32, vals,
+					step_elems[s], segs, s == steps - 1,
+					&valid);
+			if (t == 0) {
+				ret = -1;
+				continue;
+			}
+
+			mkeys[s][m] = (double) step_elems[s] * 1e3 / t;
+		}
+	}
+
+	if (opencl_compare_output()) {
+		if (valid) {
+			printf("Output valid\n");
+		} else {
+			printf("Output invalid\n");
+			ret = -1;
+		}
+	}
+
+	printf("%10s", "Keys");
+	for (m = 0; m < SORT_MODES; m++)
+		printf(" %10s", mode_names[m]);
+	printf("  (Mkeys/s, %zu segments)\n", segs);
+
+	for (s = 0; s < steps; s++) {
+		printf("%10zu", step_elems[s]);
+		for (m = 0; m < SORT_MODES; m++) {
+			if (mkeys[s][m] == 0.)
+				printf(" %10s", "-");
+			else
+				printf(" %10.1f", mkeys[s][m]);
+		}
+		printf("\n");
+	}
+
+	/* Tear down */
+	for (m = 0; m < SORT_SEG32; m++)
+		radix_sort_release(sorts[m]);
+
+	opencl_teardown(&ctx, &q, &prg);
+	free(keys32);
+	free(keys64);
+	free(vals);
+
+	return ret;
+}
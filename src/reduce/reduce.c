@@ -0,0 +1,359 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "lib/reduce.h"
+
+static const char *op_names[REDUCE_OPS] = {
+	[REDUCE_SUM] = "sum",
+	[REDUCE_MIN] = "min",
+	[REDUCE_MAX] = "max",
+	[REDUCE_ARGMAX] = "argmax",
+};
+
+static const char *type_names[REDUCE_TYPES] = {
+	[REDUCE_FLOAT] = "float",
+	[REDUCE_INT] = "int",
+};
+
+void usage(char *prg)
+{
+	printf("%s\n", prg);
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-n <elems>\t Number of elements, default 16777216\n");
+	printf("\t-g <segs>\t Number of segments to reduce independently, "
+			"default 1\n");
+	opencl_usage();
+}
+
+/* Host reference for one segment */
+static void
+reduce_ref(clReduceOp op, clReduceType type, const void *data,
+		size_t elems, struct reduce_result *res)
+{
+	const cl_float *f = data;
+	const cl_int *in = data;
+	double sum = 0.;
+	int64_t isum = 0;
+	size_t i;
+
+	res->idx = 0;
+	if (type == REDUCE_FLOAT)
+		res->val.f = f[0];
+	else
+		res->val.i = in[0];
+
+	for (i = 0; i < elems; i++) {
+		if (type == REDUCE_FLOAT) {
+			sum += f[i];
+			if ((op == REDUCE_MIN && f[i] < res->val.f) ||
+			    (op != REDUCE_MIN && f[i] > res->val.f)) {
+				res->val.f = f[i];
+				res->idx = i;
+			}
+		} else {
+			isum += in[i];
+			if ((op == REDUCE_MIN && in[i] < res->val.i) ||
+			    (op != REDUCE_MIN && in[i] > res->val.i)) {
+				res->val.i = in[i];
+				res->idx = i;
+			}
+		}
+	}
+
+	if (op != REDUCE_SUM)
+		return;
+
+	if (type == REDUCE_FLOAT)
+		res->val.f = sum;
+	else
+		res->val.i = isum;
+}
+
+static bool
+reduce_check(clReduceOp op, clReduceType type, struct reduce_result *ref,
+		struct reduce_result *res)
+{
+	if (op == REDUCE_ARGMAX && ref->idx != res->idx)
+		return false;
+
+	if (type == REDUCE_INT)
+		return ref->val.i == res->val.i;
+
+	/* Summation order differs from the host */
+	if (op == REDUCE_SUM)
+		return fabsf(ref->val.f - res->val.f) <=
+				1e-3f * fmaxf(1.f, fabsf(ref->val.f));
+
+	return ref->val.f == res->val.f;
+}
+
+/**
+ * Run one reduction over all segments.
+ * @param valid Cleared if output validation is enabled and fails.
+ * @return Average execution time in ns, 0 on failure.
+ */
+static cl_ulong
+reduce_bench(cl_context ctx, cl_command_queue q, clReduceOp op,
+		clReduceType type, bool subgroups, cl_mem in, const void *data,
+		size_t seg_elems, size_t segs, bool *valid)
+{
+	struct reduce *r;
+	struct reduce_result ref, res;
+	cl_ulong time_total = 0ul;
+	unsigned int i;
+	size_t s;
+	cl_mem out;
+	cl_int error;
+	char *host;
+
+	r = reduce_create(ctx, op, type, subgroups);
+	if (!r)
+		return 0;
+
+	out = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			segs * reduce_result_size(r), NULL, &error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create out buffer\n");
+		reduce_release(r);
+		return 0;
+	}
+
+	for (i = 0; i < opencl_get_iterations(); i++) {
+		if (reduce_segments(r, q, in, seg_elems, segs, out,
+				&time_total)) {
+			time_total = 0;
+			goto out;
+		}
+	}
+
+	if (!opencl_compare_output())
+		goto measure;
+
+	host = malloc(segs * reduce_result_size(r));
+	if (!host) {
+		printf("Could not allocate validation buffer\n");
+		*valid = false;
+		goto out;
+	}
+
+	clEnqueueReadBuffer(q, out, CL_TRUE, 0, segs * reduce_result_size(r),
+			host, 0, NULL, NULL);
+
+	for (s = 0; s < segs; s++) {
+		res.idx = 0;
+		memcpy(&res, &host[s * reduce_result_size(r)],
+				reduce_result_size(r));
+		reduce_ref(op, type, (const char *) data +
+				(s * seg_elems * sizeof(cl_int)), seg_elems,
+				&ref);
+
+		if (!reduce_check(op, type, &ref, &res)) {
+			printf("%s %s: segment %zu mismatch\n", op_names[op],
+					type_names[type], s);
+			*valid = false;
+			break;
+		}
+	}
+	free(host);
+
+measure:
+	/* Optional extra measurements, after the outputs were validated */
+	reduce_measure(r, q);
+
+out:
+	opencl_release_buffer(out);
+	reduce_release(r);
+
+	return time_total / opencl_get_iterations();
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	size_t elems = 1 << 24;
+	size_t segs = 1;
+	size_t i;
+	clReduceOp op;
+	clReduceType type;
+	cl_float *fdata;
+	cl_int *idata;
+	cl_ulong t;
+	double gbps[2];
+	unsigned int sg;
+	bool valid = true;
+
+	cl_context ctx;
+	cl_command_queue q;
+	cl_program prg = NULL;
+	cl_mem in[REDUCE_TYPES];
+	cl_int error;
+
+	while ((c = getopt (argc, argv, "?n:g:"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case 'n':
+			elems = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			segs = strtoul(optarg, NULL, 0);
+			break;
+		case '?':
+			usage(argv[0]);
+			return 0;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (segs == 0 || elems < segs) {
+		printf("Error: need at least one element per segment\n");
+		usage(argv[0]);
+		return -1;
+	}
+	elems -= elems % segs;
+
+	opencl_index_enable();
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (opencl_index_select(elems) < 0)
+		return -1;
+
+	/* Small values, such that integer sums cannot overflow */
+	fdata = malloc(elems * sizeof(cl_float));
+	idata = malloc(elems * sizeof(cl_int));
+	if (!fdata || !idata) {
+		printf("Could not allocate input data\n");
+		return -1;
+	}
+
+	srand(1);
+	for (i = 0; i < elems; i++) {
+		idata[i] = (rand() % 101) - 50;
+		fdata[i] = idata[i] / 50.f;
+	}
+
+	opencl_mem_stage("input");
+	for (type = 0; type < REDUCE_TYPES; type++) {
+		in[type] = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+				elems * sizeof(cl_int), NULL, &error);
+		if (error != CL_SUCCESS) {
+			printf("Could not create in buffer\n");
+			return -1;
+		}
+
+		error = clEnqueueWriteBuffer(q, in[type], CL_TRUE, 0,
+				elems * sizeof(cl_int),
+				type == REDUCE_FLOAT ? (void *) fdata : idata,
+				0, NULL, NULL);
+		if (error != CL_SUCCESS) {
+			printf("Could not enqueue buffer write\n");
+			return -1;
+		}
+	}
+
+	if (!opencl_device_has_extension("cl_khr_subgroups"))
+		printf("cl_khr_subgroups not supported, skipping sub-group "
+				"reductions\n");
+
+	opencl_mem_stage("reduce");
+	printf("%zu elements in %zu segments\n", elems, segs);
+	printf("%-14s %10s %10s  (GB/s)\n", "Reduction", "Tree", "Subgroup");
+
+	ret = 0;
+	for (type = 0; type < REDUCE_TYPES; type++) {
+		for (op = 0; op < REDUCE_OPS; op++) {
+			for (sg = 0; sg < 2; sg++) {
+				gbps[sg] = 0.;
+				if (sg &&
+				    !opencl_device_has_extension(
+						"cl_khr_subgroups"))
+					continue;
+
+				t = reduce_bench(ctx, q, op, type, sg, in[type],
+						type == REDUCE_FLOAT ?
+						(void *) fdata : idata,
+						elems / segs, segs, &valid);
+				if (t == 0) {
+					ret = -1;
+					continue;
+				}
+
+				gbps[sg] = (double) elems * sizeof(cl_int) / t;
+			}
+
+			printf("%-6s %-7s", op_names[op], type_names[type]);
+			for (sg = 0; sg < 2; sg++) {
+				if (gbps[sg] == 0.)
+					printf(" %10s", "-");
+				else
+					printf(" %10.2f", gbps[sg]);
+			}
+			printf("\n");
+		}
+	}
+
+	if (opencl_compare_output()) {
+		if (valid) {
+			printf("Output valid\n");
+		} else {
+			printf("Output invalid\n");
+			ret = -1;
+		}
+	}
+
+	/* Tear down */
+	for (type = 0; type < REDUCE_TYPES; type++)
+		opencl_release_buffer(in[type]);
+
+	opencl_teardown(&ctx, &q, &prg);
+	free(fdata);
+	free(idata);
+
+	return ret;
+}
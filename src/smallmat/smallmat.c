@@ -0,0 +1,455 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2020 Roy Spliet, University of Cambridge
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "lib/opencl.h"
+#include "lib/mem.h"
+#include "lib/smallmat.h"
+
+/* Relative residual tolerated by validation */
+#define SMALLMAT_TOL 1e-3f
+
+enum smallmat_op {
+	OP_INV3 = 0,
+	OP_INV3_SYM,
+	OP_SOLVE6,
+	OP_EIG3,
+	OPS,
+};
+
+static const struct {
+	const char *name;
+	unsigned int words; /* Floats read and written per matrix */
+} ops[OPS] = {
+	[OP_INV3] = {"inv3", 9 + 9},
+	[OP_INV3_SYM] = {"inv3 sym", 6 + 9},
+	[OP_SOLVE6] = {"solve6", 21 + 6 + 6},
+	[OP_EIG3] = {"eig3", 6 + 3 + 9},
+};
+
+/* Packed upper triangle index, as SM_UP in src/lib/smallmat_device.h */
+static unsigned int
+up(unsigned int i, unsigned int j, unsigned int n)
+{
+	unsigned int t;
+
+	if (i > j) {
+		t = i;
+		i = j;
+		j = t;
+	}
+
+	return i * n - (i * (i - 1)) / 2 + j - i;
+}
+
+void usage(char *prg)
+{
+	printf("%s\n", prg);
+	printf("Options:\n");
+	printf("\t-?\t\t This help\n");
+	printf("\t-n <batch>\t Number of matrices per batch, "
+			"default 1048576\n");
+	opencl_usage();
+}
+
+/* Random symmetric positive-definite matrix M M^T + dim * I, packed */
+static void
+spd_generate(float *a, unsigned int dim)
+{
+	float m[36];
+	float s;
+	unsigned int i, j, k;
+
+	for (i = 0; i < dim * dim; i++)
+		m[i] = ((float) rand() / RAND_MAX) * 2.f - 1.f;
+
+	for (i = 0; i < dim; i++) {
+		for (j = i; j < dim; j++) {
+			s = (i == j) ? dim : 0.f;
+			for (k = 0; k < dim; k++)
+				s += m[i * dim + k] * m[j * dim + k];
+			a[up(i, j, dim)] = s;
+		}
+	}
+}
+
+/* Element k of matrix n in a struct of arrays batch */
+#define SOA(buf, k, n, batch) ((buf)[(size_t) (k) * (batch) + (n)])
+
+static bool
+inv3_check(const float *a, const float *r, size_t batch)
+{
+	float s;
+	size_t n;
+	unsigned int i, j, k;
+
+	for (n = 0; n < batch; n++) {
+		for (i = 0; i < 3; i++) {
+			for (j = 0; j < 3; j++) {
+				s = (i == j) ? -1.f : 0.f;
+				for (k = 0; k < 3; k++)
+					s += SOA(a, up(i, k, 3), n, batch) *
+						SOA(r, k * 3 + j, n, batch);
+				if (!(fabsf(s) <= SMALLMAT_TOL)) {
+					printf("inv3: matrix %zu mismatch\n",
+							n);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool
+solve6_check(const float *a, const float *b, const float *x, size_t batch)
+{
+	float s, scale;
+	size_t n;
+	unsigned int i, k;
+
+	for (n = 0; n < batch; n++) {
+		for (i = 0; i < 6; i++) {
+			s = -SOA(b, i, n, batch);
+			scale = fmaxf(1.f, fabsf(SOA(b, i, n, batch)));
+			for (k = 0; k < 6; k++)
+				s += SOA(a, up(i, k, 6), n, batch) *
+					SOA(x, k, n, batch);
+			if (!(fabsf(s) <= SMALLMAT_TOL * scale)) {
+				printf("solve6: system %zu mismatch\n", n);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool
+eig3_check(const float *a, const float *w, const float *v, size_t batch)
+{
+	float s, scale;
+	size_t n;
+	unsigned int i, j, k;
+
+	for (n = 0; n < batch; n++) {
+		if (SOA(w, 0, n, batch) > SOA(w, 1, n, batch) ||
+		    SOA(w, 1, n, batch) > SOA(w, 2, n, batch)) {
+			printf("eig3: matrix %zu eigenvalues out of order\n",
+					n);
+			return false;
+		}
+
+		scale = fmaxf(1.f, fabsf(SOA(w, 2, n, batch)));
+
+		/* A v_j == w_j v_j for each eigenvector column j */
+		for (j = 0; j < 3; j++) {
+			for (i = 0; i < 3; i++) {
+				s = -SOA(w, j, n, batch) *
+						SOA(v, i * 3 + j, n, batch);
+				for (k = 0; k < 3; k++)
+					s += SOA(a, up(i, k, 3), n, batch) *
+						SOA(v, k * 3 + j, n, batch);
+				if (!(fabsf(s) <= SMALLMAT_TOL * scale)) {
+					printf("eig3: matrix %zu mismatch\n",
+							n);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static int
+buffer_write(cl_context ctx, cl_command_queue q, cl_mem *buf,
+		const float *data, size_t words)
+{
+	cl_int error;
+
+	*buf = opencl_create_buffer(ctx, data ? CL_MEM_READ_ONLY :
+			CL_MEM_READ_WRITE, words * sizeof(cl_float), NULL,
+			&error);
+	if (error != CL_SUCCESS) {
+		printf("Could not create buffer\n");
+		*buf = NULL;
+		return -1;
+	}
+
+	if (!data)
+		return 0;
+
+	error = clEnqueueWriteBuffer(q, *buf, CL_TRUE, 0,
+			words * sizeof(cl_float), data, 0, NULL, NULL);
+	if (error != CL_SUCCESS) {
+		printf("Could not enqueue buffer write\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+buffer_read(cl_command_queue q, cl_mem buf, float **data, size_t words)
+{
+	cl_int error;
+
+	*data = malloc(words * sizeof(cl_float));
+	if (!*data) {
+		printf("Could not allocate validation buffer\n");
+		return -1;
+	}
+
+	error = clEnqueueReadBuffer(q, buf, CL_TRUE, 0,
+			words * sizeof(cl_float), *data, 0, NULL, NULL);
+	if (error != CL_SUCCESS) {
+		printf("Could not read buffer\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int ret;
+	size_t batch = 1 << 20;
+	size_t n;
+	unsigned int i, k, it;
+	enum smallmat_op op;
+	float a[21];
+	float *a3, *a3p, *a6, *b6;
+	float *r0 = NULL, *r1 = NULL;
+	cl_ulong t;
+	bool valid = true;
+
+	cl_context ctx;
+	cl_command_queue q;
+	cl_program prg = NULL;
+	struct smallmat *s;
+	cl_mem cl_a3, cl_a3p, cl_a6, cl_b6, cl_out9, cl_out6, cl_out3;
+
+	while ((c = getopt (argc, argv, "?n:"OPENCL_OPTS)) != -1)
+	{
+		switch (c) {
+		case 'n':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case '?':
+			usage(argv[0]);
+			return 0;
+		default:
+			ret = opencl_parse_option(c, optarg);
+			if (ret != 0) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+	}
+
+	if (batch == 0) {
+		printf("Error: batch must hold at least one matrix\n");
+		usage(argv[0]);
+		return -1;
+	}
+
+	opencl_index_enable();
+	ctx = opencl_create_context();
+	if (!ctx) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	q = opencl_create_cmdqueue(ctx);
+	if (!q) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	/* The largest index into a batch is that of the 21st 6x6 element */
+	if (opencl_index_select(21 * batch) < 0)
+		return -1;
+
+	s = smallmat_create(ctx);
+	if (!s)
+		return -1;
+
+	a3 = malloc(9 * batch * sizeof(float));
+	a3p = malloc(6 * batch * sizeof(float));
+	a6 = malloc(21 * batch * sizeof(float));
+	b6 = malloc(6 * batch * sizeof(float));
+	if (!a3 || !a3p || !a6 || !b6) {
+		printf("Could not allocate input data\n");
+		return -1;
+	}
+
+	srand(1);
+	for (n = 0; n < batch; n++) {
+		spd_generate(a, 3);
+		for (k = 0; k < 6; k++)
+			SOA(a3p, k, n, batch) = a[k];
+		for (i = 0; i < 3; i++) {
+			for (k = 0; k < 3; k++)
+				SOA(a3, i * 3 + k, n, batch) = a[up(i, k, 3)];
+		}
+
+		spd_generate(a, 6);
+		for (k = 0; k < 21; k++)
+			SOA(a6, k, n, batch) = a[k];
+		for (k = 0; k < 6; k++)
+			SOA(b6, k, n, batch) =
+					((float) rand() / RAND_MAX) * 2.f - 1.f;
+	}
+
+	opencl_mem_stage("input");
+	if (buffer_write(ctx, q, &cl_a3, a3, 9 * batch) ||
+	    buffer_write(ctx, q, &cl_a3p, a3p, 6 * batch) ||
+	    buffer_write(ctx, q, &cl_a6, a6, 21 * batch) ||
+	    buffer_write(ctx, q, &cl_b6, b6, 6 * batch))
+		return -1;
+
+	opencl_mem_stage("output");
+	if (buffer_write(ctx, q, &cl_out9, NULL, 9 * batch) ||
+	    buffer_write(ctx, q, &cl_out6, NULL, 6 * batch) ||
+	    buffer_write(ctx, q, &cl_out3, NULL, 3 * batch))
+		return -1;
+
+	opencl_mem_stage("smallmat");
+	printf("%zu matrices per batch\n", batch);
+	printf("%-10s %12s %10s %10s\n", "Operation", "Time (ns)", "Mmat/s",
+			"GB/s");
+
+	ret = 0;
+	for (op = 0; op < OPS; op++) {
+		t = 0ul;
+		for (it = 0; it < opencl_get_iterations(); it++) {
+			switch (op) {
+			case OP_INV3:
+				ret = smallmat_inv3(s, q, batch, cl_a3,
+						cl_out9, false, &t);
+				break;
+			case OP_INV3_SYM:
+				ret = smallmat_inv3(s, q, batch, cl_a3p,
+						cl_out9, true, &t);
+				break;
+			case OP_SOLVE6:
+				ret = smallmat_solve6(s, q, batch, cl_a6,
+						cl_b6, cl_out6, &t);
+				break;
+			case OP_EIG3:
+				ret = smallmat_eig3(s, q, batch, cl_a3p,
+						cl_out3, cl_out9, &t);
+				break;
+			default:
+				break;
+			}
+
+			if (ret)
+				goto error;
+		}
+		t /= opencl_get_iterations();
+
+		printf("%-10s %12lu %10.2f %10.2f\n", ops[op].name, t,
+				t ? (double) batch * 1000. / t : 0.,
+				t ? (double) batch * ops[op].words *
+				sizeof(cl_float) / t : 0.);
+
+		if (!opencl_compare_output())
+			continue;
+
+		switch (op) {
+		case OP_INV3:
+		case OP_INV3_SYM:
+			if (buffer_read(q, cl_out9, &r0, 9 * batch)) {
+				ret = -1;
+				goto error;
+			}
+			valid &= inv3_check(a3p, r0, batch);
+			break;
+		case OP_SOLVE6:
+			if (buffer_read(q, cl_out6, &r0, 6 * batch)) {
+				ret = -1;
+				goto error;
+			}
+			valid &= solve6_check(a6, b6, r0, batch);
+			break;
+		case OP_EIG3:
+			if (buffer_read(q, cl_out3, &r0, 3 * batch) ||
+			    buffer_read(q, cl_out9, &r1, 9 * batch)) {
+				ret = -1;
+				goto error;
+			}
+			valid &= eig3_check(a3p, r0, r1, batch);
+			break;
+		default:
+			break;
+		}
+
+		free(r0);
+		free(r1);
+		r0 = NULL;
+		r1 = NULL;
+	}
+
+	if (opencl_compare_output()) {
+		if (valid) {
+			printf("Output valid\n");
+		} else {
+			printf("Output invalid\n");
+			ret = -1;
+		}
+	}
+
+	/* Optional extra measurements, after the outputs were validated */
+	smallmat_measure(s, q);
+
+error:
+	/* Tear down */
+	free(r0);
+	free(r1);
+	opencl_release_buffer(cl_a3);
+	opencl_release_buffer(cl_a3p);
+	opencl_release_buffer(cl_a6);
+	opencl_release_buffer(cl_b6);
+	opencl_release_buffer(cl_out9);
+	opencl_release_buffer(cl_out6);
+	opencl_release_buffer(cl_out3);
+	smallmat_release(s);
+
+	opencl_teardown(&ctx, &q, &prg);
+	free(a3);
+	free(a3p);
+	free(a6);
+	free(b6);
+
+	return ret;
+}
@@ -9,27 +9,30 @@
 
 __kernel void spmv_jds_naive(__global float *dst_vector, __global float *d_data,
 		       	     __global int *d_index, __global int *d_perm,
-		             __global float *x_vec, const int dim, 
-		             __constant int *jds_ptr_int,
-		             __constant int *sh_zcnt_int)
+		             __global float *x_vec, const idx_t dim, 
+		             __constant idx_t *jds_ptr,
+		             __constant int *sh_zcnt_int INSTR_PARAM)
 {
-  	int ix = get_global_id(0);
+  	idx_t ix = get_global_id(0);
 
   	if (ix < dim) {
     		float sum = 0.0f;
     		// 32 is warp size
     		int bound=sh_zcnt_int[ix/32];
+		uint nnz = 0;
 
 	    	for(int k=0;k<bound;k++)
     		{	  
-      			int j = jds_ptr_int[k] + ix;    
+      			idx_t j = jds_ptr[k] + ix;    
       			int in = d_index[j]; 
   
       			float d = d_data[j];
+			nnz += (d != 0.0f); /* warp padding is zero */
       			float t = x_vec[in];
 
       			sum += d*t; 
     		}  
+		INSTR_ADD(0, nnz); /* nonzeros processed */
   
     		dst_vector[d_perm[ix]] = sum; 
   	}
@@ -30,7 +30,11 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/instr.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -51,6 +55,7 @@ int main(int argc, char **argv)
 	float *inXVec;
 	int *inJdsPtr;
 	int *inShZcnt;
+	struct dataset *ds[6];
 
 	cl_context ctx;
 	cl_command_queue q;
@@ -64,6 +69,8 @@ int main(int argc, char **argv)
 	cl_ulong time_avg = 0l;
 	unsigned int i;
 	const int xvec_sz = 11948;
+	struct instr *instr;
+	double flops, bytes;
 
 	while ((c = getopt (argc, argv, "?"OPENCL_OPTS)) != -1)
 	{
@@ -80,16 +87,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Load the inputs while the platform is brought up */
 	data_entries = 150144;
-	bin_file_read("data/spmv/data.bin", data_entries, (void **) &inData);
-	bin_file_read("data/spmv/indices.bin", data_entries, (void **) &inIndex);
-	bin_file_read("data/spmv/perm.bin", xvec_sz, (void **) &inPerm);
-	bin_file_read("data/spmv/x_vector.bin", xvec_sz, (void **) &inXVec);
-	bin_file_read("data/spmv/jds_ptr_int.bin", 50, (void **) &inJdsPtr);
-	bin_file_read("data/spmv/sh_zcnt_int.bin", 374, (void **) &inShZcnt);
-
-	printf("Read %"PRIi64" entries\n", data_entries);
+	ds[0] = dataset_load_bin("data/spmv/data.bin", data_entries,
+			(void **) &inData);
+	ds[1] = dataset_load_bin("data/spmv/indices.bin", data_entries,
+			(void **) &inIndex);
+	ds[2] = dataset_load_bin("data/spmv/perm.bin", xvec_sz,
+			(void **) &inPerm);
+	ds[3] = dataset_load_bin("data/spmv/x_vector.bin", xvec_sz,
+			(void **) &inXVec);
+	ds[4] = dataset_load_bin("data/spmv/jds_ptr_int.bin", 50,
+			(void **) &inJdsPtr);
+	ds[5] = dataset_load_bin("data/spmv/sh_zcnt_int.bin", 374,
+			(void **) &inShZcnt);
 
+	opencl_index_enable();
 	ctx = opencl_create_context();
 	if (!ctx) {
 		usage(argv[0]);
@@ -107,56 +120,77 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	error = 0;
+	for (i = 0; i < 6; i++)
+		error |= dataset_wait(ds[i]);
+	if (error) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+
+	ret = opencl_index_select(data_entries);
+	if (ret < 0)
+		return -1;
+	if (ret > 0) {
+		clReleaseProgram(prg);
+		prg = opencl_compile_program(ctx, 1, &programs);
+		if (!prg)
+			return -1;
+	}
+
 	kernel = clCreateKernel(prg, "spmv_jds_naive", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
+	opencl_kernel_resources(kernel);
 
-	clInData = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clInData = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInIndex = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clInIndex = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInPerm = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clInPerm = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			11948 * sizeof(int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInXVec = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clInXVec = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			11948 * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInJdsPtr = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			50 * sizeof(int), NULL, &error);
+	clInJdsPtr = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			50 * opencl_index_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clInShZcnt = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	clInShZcnt = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			374 * sizeof(int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clOutVec = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clOutVec = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
+			xvec_sz * sizeof(float), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
@@ -170,8 +204,7 @@ int main(int argc, char **argv)
 			xvec_sz * sizeof(cl_int), inPerm, 0, NULL, NULL);
 	error |= clEnqueueWriteBuffer(q, clInXVec, CL_FALSE, 0,
 			xvec_sz * sizeof(float), inXVec, 0, NULL, NULL);
-	error |= clEnqueueWriteBuffer(q, clInJdsPtr, CL_FALSE, 0,
-			50 * sizeof(cl_int), inJdsPtr, 0, NULL, NULL);
+	error |= opencl_write_idx(q, clInJdsPtr, 50, inJdsPtr);
 	error |= clEnqueueWriteBuffer(q, clInShZcnt, CL_FALSE, 0,
 			374 * sizeof(float), inShZcnt, 0, NULL, NULL);
 	if (error != CL_SUCCESS) {
@@ -184,7 +217,7 @@ int main(int argc, char **argv)
 	error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &clInIndex);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &clInPerm);
 	error |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &clInXVec);
-	error |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &xvec_sz);
+	error |= opencl_set_kernel_arg_idx(kernel, 5, xvec_sz);
 	error |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &clInJdsPtr);
 	error |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &clInShZcnt);
 	if (error != CL_SUCCESS) {
@@ -196,6 +229,20 @@ int main(int argc, char **argv)
 			(xvec_sz & ~255) + 256 : xvec_sz)};
 	const size_t ldims[] = {256};
 
+	instr = instr_create(ctx, "spmv_jds_naive", "nnz", dims[0]);
+	error = instr_set_arg(instr, q, kernel, 8);
+	if (error != CL_SUCCESS) {
+		printf("Could not bind instrumentation counters: %d.\n", error);
+		return -1;
+	}
+
+	/* A multiply-add per stored non-zero, including JDS padding. Matrix
+	 * values and column indices are streamed, the vector, permutation and
+	 * result are touched once. */
+	flops = 2. * data_entries;
+	bytes = data_entries * (sizeof(float) + sizeof(int)) +
+			xvec_sz * (2 * sizeof(float) + sizeof(int));
+
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		error = clEnqueueNDRangeKernel(q, kernel, 1, NULL, dims, ldims,
 				0, NULL, &time);
@@ -208,6 +255,8 @@ int main(int argc, char **argv)
 
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("spmv_jds_naive", flops, bytes,
+				time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -222,18 +271,26 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Output comparison error: %i\n", ret);
 	}
 
+	/* Counters only cover the iterations, report them before the
+	 * extra measurement launches add to them */
+	instr_report(instr, q, opencl_get_iterations());
+
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 1, NULL, dims, ldims);
+
 	printf("Time (avg of %u): %lu ns\n", opencl_get_iterations(),
 			time_avg / opencl_get_iterations());
 
 	/* Tear down */
+	instr_release(instr);
 	clReleaseEvent(time);
-	clReleaseMemObject(clInData);
-	clReleaseMemObject(clInIndex);
-	clReleaseMemObject(clInJdsPtr);
-	clReleaseMemObject(clInPerm);
-	clReleaseMemObject(clInShZcnt);
-	clReleaseMemObject(clInXVec);
-	clReleaseMemObject(clOutVec);
+	opencl_release_buffer(clInData);
+	opencl_release_buffer(clInIndex);
+	opencl_release_buffer(clInJdsPtr);
+	opencl_release_buffer(clInPerm);
+	opencl_release_buffer(clInShZcnt);
+	opencl_release_buffer(clInXVec);
+	opencl_release_buffer(clOutVec);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);
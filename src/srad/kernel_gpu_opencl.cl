@@ -49,6 +49,8 @@
 #define __local
 #define CLK_LOCAL_MEM_FENCE 0
 #define CLK_GLOBAL_MEM_FENCE 0
+#define CLAXON_REAL_SIZE 4
+typedef float real;
 #endif
 
 #include "src/srad/main.h"
@@ -124,6 +126,8 @@ reduce_kernel(	long d_Ne,													// number of elements in array
 }
 
 
+/* Float atomics only exist for single precision */
+#if CLAXON_REAL_SIZE == 4
 inline void
 atomic_add_fp(volatile float __global *ptr, float val)
 {
@@ -159,7 +163,7 @@ reduce_kernel_fpatom(	long d_Ne,													// number of elements in array
 
 	// indexes											// get current horizontal thread index
 	int ei = get_global_id(0) + 1;
-	float sums_acc[2] = {0,0};
+	fp sums_acc[2] = {0,0};
 
 	//volatile __local fp d_psum[1];										// data for block calculations allocated by every block in its shared memory
 	//volatile __local fp d_psum2[1];// unique thread id, more threads than actual elements !!!
@@ -180,6 +184,7 @@ reduce_kernel_fpatom(	long d_Ne,													// number of elements in array
 		atomic_add_fp(&d_sums2[0], sums_acc[1]);
 	}
 }
+#endif
 
 //========================================================================================================================================================================================================200
 //	SRAD KERNEL
@@ -249,7 +254,7 @@ srad_kernel(fp d_lambda,
 	 
 		// diffusion coefficent (equ 33) (every element of IMAGE)
 		d_den = (d_qsqr-d_q0sqr) / (d_q0sqr * (1.f+d_q0sqr)) ;				// den (based on qsqr and q0sqr)
-		d_c_loc = clamp(1.f / (1.f+d_den),0.f,1.f);	// diffusion coefficient (based on den)
+		d_c_loc = clamp((fp)(1.f / (1.f+d_den)),(fp)0.f,(fp)1.f);	// diffusion coefficient (based on den)
 								// Clamped to [0.f,1.f]
 
 		// save data to global memory
@@ -38,7 +38,11 @@
 //	DEFINE
 //====================================================================================================100
 
+#ifdef __OPENCL_VERSION__
+#define fp real
+#else
 #define fp float
+#endif
 
 #ifdef RD_WG_SIZE_0_0
         #define NUMBER_THREADS RD_WG_SIZE_0_0
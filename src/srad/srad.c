@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/cmdbuf.h"
 #include "main.h"
 
 void usage(char *prg)
@@ -58,6 +61,7 @@ int main(int argc, char **argv)
 	size_t blocks_x;
 	int blocks_work_size;
 	size_t rdims[1];
+	struct dataset *ds[7];
 
 	cl_context ctx;
 	cl_command_queue q;
@@ -69,6 +73,12 @@ int main(int argc, char **argv)
 	cl_event time;
 	cl_ulong time_diff = 0l;
 	cl_ulong time_avg[3] = {0l,0l,0l};
+	cl_ulong time_seq = 0l;
+	int seq;
+	unsigned int direct = 0, replays = 0;
+	struct opencl_cmdbuf *cb;
+
+	opencl_real_enable();
 
 	while ((c = getopt (argc, argv, "?"OPENCL_OPTS)) != -1)
 	{
@@ -85,17 +95,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Load the inputs while the platform is brought up */
 	data_entries = 502*458;
-	bin_file_read("data/srad/d_I.bin", data_entries, (void **) &dI);
-	bin_file_read("data/srad/d_iN.bin", data_entries, (void **) &diN);
-	bin_file_read("data/srad/d_iS.bin", data_entries, (void **) &diS);
-	bin_file_read("data/srad/d_jE.bin", data_entries, (void **) &djE);
-	bin_file_read("data/srad/d_jW.bin", data_entries, (void **) &djW);
-	bin_file_read("data/srad/d_I_out.bin", data_entries,
+	ds[0] = dataset_load_bin("data/srad/d_I.bin", data_entries,
+			(void **) &dI);
+	ds[1] = dataset_load_bin("data/srad/d_iN.bin", data_entries,
+			(void **) &diN);
+	ds[2] = dataset_load_bin("data/srad/d_iS.bin", data_entries,
+			(void **) &diS);
+	ds[3] = dataset_load_bin("data/srad/d_jE.bin", data_entries,
+			(void **) &djE);
+	ds[4] = dataset_load_bin("data/srad/d_jW.bin", data_entries,
+			(void **) &djW);
+	ds[5] = dataset_load_bin("data/srad/d_I_out.bin", data_entries,
 			(void **) &dIReduce);
-	bin_file_read("data/srad/d_sums2.bin", data_entries, (void **) &dSums2);
-
-	printf("Read %"PRIi64" entries\n", data_entries);
+	ds[6] = dataset_load_bin("data/srad/d_sums2.bin", data_entries,
+			(void **) &dSums2);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -114,6 +129,16 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	ret = 0;
+	for (i = 0; i < 7; i++)
+		ret |= dataset_wait(ds[i]);
+	if (ret) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+
 	/** Create kernels */
 	kSRAD = clCreateKernel(prg, "srad_kernel", &error);
 	if (error != CL_SUCCESS) {
@@ -134,84 +159,87 @@ int main(int argc, char **argv)
 	}
 
 	/** Create buffers */
-	cldiN = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	opencl_mem_stage("indices");
+	cldiN = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(cl_int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	cldiS = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	cldiS = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(cl_int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	cldjE = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	cldjE = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(cl_int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	cldjW = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
+	cldjW = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
 			data_entries * sizeof(cl_int), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clddN = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	opencl_mem_stage("diffusion");
+	clddN = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clddS = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	clddS = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clddE = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	clddE = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	clddW = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	clddW = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	cldc = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	cldc = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	cldI = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	cldI = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
 
-	cldIReduce = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	opencl_mem_stage("reduce");
+	cldIReduce = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	cldSums2 = clCreateBuffer(ctx, CL_MEM_READ_WRITE,
-			data_entries * sizeof(float), NULL, &error);
+	cldSums2 = opencl_create_buffer(ctx, CL_MEM_READ_WRITE,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
@@ -225,14 +253,13 @@ int main(int argc, char **argv)
 			data_entries * sizeof(float), djE, 0, NULL, NULL);
 	error |= clEnqueueWriteBuffer(q, cldjW, CL_FALSE, 0,
 			data_entries * sizeof(float), djW, 0, NULL, NULL);
-	error |= clEnqueueWriteBuffer(q, cldI, CL_FALSE, 0,
-			data_entries * sizeof(float), dI, 0, NULL, NULL);
+	error |= opencl_write_real(q, cldI, data_entries, dI);
 	if (error != CL_SUCCESS) {
 		printf("Could not enqueue one-off buffer write.\n");
 		return -1;
 	}
 
-	error  = clSetKernelArg(kSRAD, 0, sizeof(float), &d_lambda);
+	error  = opencl_set_kernel_arg_real(kSRAD, 0, d_lambda);
 	error |= clSetKernelArg(kSRAD, 1, sizeof(cl_int), &Nr);
 	error |= clSetKernelArg(kSRAD, 2, sizeof(cl_int), &Nc);
 	error |= clSetKernelArg(kSRAD, 3, sizeof(cl_long), &Ne);
@@ -244,7 +271,7 @@ int main(int argc, char **argv)
 	error |= clSetKernelArg(kSRAD, 9, sizeof(cl_mem), &clddS);
 	error |= clSetKernelArg(kSRAD, 10, sizeof(cl_mem), &clddE);
 	error |= clSetKernelArg(kSRAD, 11, sizeof(cl_mem), &clddW);
-	error |= clSetKernelArg(kSRAD, 12, sizeof(float), &d_q0sqr);
+	error |= opencl_set_kernel_arg_real(kSRAD, 12, d_q0sqr);
 	error |= clSetKernelArg(kSRAD, 13, sizeof(cl_mem), &cldc);
 	error |= clSetKernelArg(kSRAD, 14, sizeof(cl_mem), &cldI);
 	if (error != CL_SUCCESS) {
@@ -252,7 +279,7 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	error  = clSetKernelArg(kSRAD2, 0, sizeof(float), &d_lambda);
+	error  = opencl_set_kernel_arg_real(kSRAD2, 0, d_lambda);
 	error |= clSetKernelArg(kSRAD2, 1, sizeof(cl_int), &Nr);
 	error |= clSetKernelArg(kSRAD2, 2, sizeof(cl_int), &Nc);
 	error |= clSetKernelArg(kSRAD2, 3, sizeof(cl_long), &Ne);
@@ -282,6 +309,9 @@ int main(int argc, char **argv)
 	const size_t dims[] = {230144};
 	const size_t ldims[1] = {NUMBER_THREADS};
 
+	/* With -B, the reduction and SRAD kernels are recorded in the first
+	 * iteration and replayed in later ones */
+	cb = opencl_cmdbuf_create(q, "srad");
 
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		mul = 1;
@@ -295,20 +325,25 @@ int main(int argc, char **argv)
 		rdims[0] = blocks_work_size * (int)ldims[0];
 		time_diff = 0l;
 
-		error  = clEnqueueWriteBuffer(q, cldIReduce, CL_FALSE, 0,
-				data_entries * sizeof(float), dIReduce, 0, NULL,
-				NULL);
-		error  = clEnqueueWriteBuffer(q, cldIReduce, CL_FALSE, 0,
-				data_entries * sizeof(float), dIReduce, 0, NULL,
-				NULL);
-		error |= clEnqueueWriteBuffer(q, cldI, CL_TRUE, 0,
-				data_entries * sizeof(float), dI, 0, NULL,
-				NULL);
+		error  = opencl_write_real(q, cldIReduce, data_entries,
+				dIReduce);
+		error |= opencl_write_real(q, cldI, data_entries, dI);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue buffer write\n");
 			return -1;
 		}
 
+		seq = opencl_cmdbuf_replay(cb, &time_diff);
+		if (seq < 0)
+			return -1;
+		if (seq) {
+			time_seq += time_diff;
+			replays++;
+			printf("Sequence Time: %lu ns\n", time_diff);
+			continue;
+		}
+		direct++;
+
 		while (blocks_work_size != 0) {
 			// set arguments that were updated in this loop
 			error  = clSetKernelArg(kSRADReduce, 1, sizeof(long),
@@ -325,8 +360,8 @@ int main(int argc, char **argv)
 			clFinish(q);
 
 			// launch kernel
-			error = clEnqueueNDRangeKernel(q, kSRADReduce, 1, NULL,
-					rdims, ldims, 0, NULL, &time);
+			error = opencl_cmdbuf_kernel(cb, q, kSRADReduce, 1,
+					NULL, rdims, ldims, &time);
 			if (error != CL_SUCCESS) {
 				printf("Could not enqueue kSRADReduce "
 						"execution: %d\n", error);
@@ -355,8 +390,8 @@ int main(int argc, char **argv)
 		time_avg[0] += time_diff;
 		printf("Reduce Time: %lu ns\n", time_diff);
 
-		error = clEnqueueNDRangeKernel(q, kSRAD, 1, NULL, dims, ldims,
-				0, NULL, &time);
+		error = opencl_cmdbuf_kernel(cb, q, kSRAD, 1, NULL, dims,
+				ldims, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue kSRAD execution: %d\n",
 					error);
@@ -368,8 +403,8 @@ int main(int argc, char **argv)
 		time_avg[1] += time_diff;
 		printf("kSRAD Time: %lu ns\n", time_diff);
 
-		error = clEnqueueNDRangeKernel(q, kSRAD2, 1, NULL, dims, ldims,
-				0, NULL, &time);
+		error = opencl_cmdbuf_kernel(cb, q, kSRAD2, 1, NULL, dims,
+				ldims, &time);
 		if (error != CL_SUCCESS) {
 			printf("Could not enqueue kSRAD2 execution: %d\n",
 					error);
@@ -380,6 +415,8 @@ int main(int argc, char **argv)
 		time_diff = opencl_exec_time(time);
 		time_avg[2] += time_diff;
 		printf("kSRAD2 Time: %lu ns\n", time_diff);
+
+		opencl_cmdbuf_end(cb);
 	}
 
 	if (opencl_compare_output()) {
@@ -423,25 +460,33 @@ int main(int argc, char **argv)
 					ret);
 	}
 
-	printf("SRAD2 time (avg of %u): %lu ns\n", opencl_get_iterations(),
-			time_avg[2] / opencl_get_iterations());
-	printf("Reduce time (avg of %u): %lu ns\n", opencl_get_iterations(),
-			time_avg[0] / opencl_get_iterations());
-	printf("SRAD time (avg of %u): %lu ns\n", opencl_get_iterations(),
-			time_avg[1] / opencl_get_iterations());
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kSRAD, 1, NULL, dims, ldims);
+	opencl_kernel_measure(q, kSRAD2, 1, NULL, dims, ldims);
+
+	printf("SRAD2 time (avg of %u): %lu ns\n", direct,
+			time_avg[2] / direct);
+	printf("Reduce time (avg of %u): %lu ns\n", direct,
+			time_avg[0] / direct);
+	printf("SRAD time (avg of %u): %lu ns\n", direct,
+			time_avg[1] / direct);
+	if (replays)
+		printf("Sequence time (avg of %u replays): %lu ns\n",
+				replays, time_seq / replays);
 
 	/* Tear down */
+	opencl_cmdbuf_release(cb);
 	clReleaseEvent(time);
-	clReleaseMemObject(cldI);
-	clReleaseMemObject(cldc);
-	clReleaseMemObject(clddE);
-	clReleaseMemObject(clddN);
-	clReleaseMemObject(clddS);
-	clReleaseMemObject(clddW);
-	clReleaseMemObject(cldjE);
-	clReleaseMemObject(cldiN);
-	clReleaseMemObject(cldiS);
-	clReleaseMemObject(cldjW);
+	opencl_release_buffer(cldI);
+	opencl_release_buffer(cldc);
+	opencl_release_buffer(clddE);
+	opencl_release_buffer(clddN);
+	opencl_release_buffer(clddS);
+	opencl_release_buffer(clddW);
+	opencl_release_buffer(cldjE);
+	opencl_release_buffer(cldiN);
+	opencl_release_buffer(cldiS);
+	opencl_release_buffer(cldjW);
 
 	clReleaseKernel(kSRAD);
 	clReleaseKernel(kSRAD2);
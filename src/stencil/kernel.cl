@@ -9,7 +9,7 @@
 
 #define Index3D(_nx,_ny,_i,_j,_k) ((_i)+_nx*((_j)+_ny*(_k)))
 
-__kernel void naive_kernel(float c0,float c1,__global float* A0,__global float *Anext,int nx,int ny,int nz)
+__kernel void naive_kernel(real c0,real c1,__global real* A0,__global real *Anext,int nx,int ny,int nz)
 {
     	int i = get_global_id(0)+1;
     	int j = get_global_id(1)+1;
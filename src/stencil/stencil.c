@@ -30,7 +30,10 @@
 #include <inttypes.h>
 
 #include "lib/opencl.h"
+#include "lib/mem.h"
 #include "lib/csv.h"
+#include "lib/dataset.h"
+#include "lib/roofline.h"
 
 void usage(char *prg)
 {
@@ -61,6 +64,10 @@ int main(int argc, char **argv)
 	const float c1 = 0.0277778;
 
 	const int d[3] = {128, 128, 32};
+	struct dataset *ds;
+	double flops, bytes;
+
+	opencl_real_enable();
 
 	while ((c = getopt (argc, argv, "?"OPENCL_OPTS)) != -1)
 	{
@@ -77,9 +84,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Load the input while the platform is brought up */
 	data_entries = 128*128*32;
-	bin_file_read("data/stencil/A0.bin", data_entries, (void **)&in);
-	printf("Read %"PRIi64" entries\n", data_entries);
+	ds = dataset_load_bin("data/stencil/A0.bin", data_entries, (void **)&in);
 
 	ctx = opencl_create_context();
 	if (!ctx) {
@@ -98,41 +105,46 @@ int main(int argc, char **argv)
 	};
 	prg = opencl_compile_program(ctx, 1, &programs);
 
+	if (dataset_wait(ds)) {
+		fprintf(stderr, "Could not read input data\n");
+		return -1;
+	}
+	dataset_report();
+	printf("Read %"PRIi64" entries\n", data_entries);
+
 	kernel = clCreateKernel(prg, "naive_kernel", &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create kernel\n");
 		return -1;
 	}
 
-	clIn = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clIn = opencl_create_buffer(ctx, CL_MEM_READ_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create in buffer\n");
 		return -1;
 	}
-	clOut = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
-			data_entries * sizeof(float), NULL, &error);
+	clOut = opencl_create_buffer(ctx, CL_MEM_WRITE_ONLY,
+			data_entries * opencl_real_size(), NULL, &error);
 	if (error != CL_SUCCESS) {
 		printf("Could not create out buffer\n");
 		return -1;
 	}
 
-	error = clEnqueueWriteBuffer(q, clIn, CL_FALSE, 0,
-			data_entries * sizeof(cl_int), in, 0, NULL, NULL);
+	error = opencl_write_real(q, clIn, data_entries, in);
 	if (error != CL_SUCCESS) {
 		printf("Could not enqueue buffer write\n");
 		return -1;
 	}
 
-	error = clEnqueueWriteBuffer(q, clOut, CL_FALSE, 0,
-			data_entries * sizeof(cl_int), in, 0, NULL, NULL);
+	error = opencl_write_real(q, clOut, data_entries, in);
 	if (error != CL_SUCCESS) {
 		printf("Could not enqueue buffer write\n");
 		return -1;
 	}
 
-	error =  clSetKernelArg(kernel, 0, sizeof(float), &c0);
-	error =  clSetKernelArg(kernel, 1, sizeof(float), &c1);
+	error =  opencl_set_kernel_arg_real(kernel, 0, c0);
+	error |= opencl_set_kernel_arg_real(kernel, 1, c1);
 	error =  clSetKernelArg(kernel, 2, sizeof(cl_mem), &clIn);
 	error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &clOut);
 	error |= clSetKernelArg(kernel, 4, sizeof(cl_int), &d[0]);
@@ -143,6 +155,12 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	/* Per interior point 5 adds, 2 multiplies and a subtract. Every point
+	 * is read once, every interior point written once. */
+	flops = 8. * (d[0] - 2) * (d[1] - 2) * (d[2] - 2);
+	bytes = (data_entries + (d[0] - 2) * (d[1] - 2) * (d[2] - 2)) *
+			opencl_real_size();
+
 	const size_t dims[] = {128, 128, 32};
 	for (i = 0; i < opencl_get_iterations(); i++) {
 		error = clEnqueueNDRangeKernel(q, kernel, 3, NULL, dims, NULL,
@@ -155,6 +173,7 @@ int main(int argc, char **argv)
 
 		time_diff = opencl_exec_time(time);
 		time_avg += time_diff;
+		opencl_roofline_kernel("naive_kernel", flops, bytes, time_diff);
 		printf("Time: %lu ns\n", time_diff);
 	}
 
@@ -169,13 +188,16 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Output comparison error: %i\n", ret);
 	}
 
+	/* Optional extra measurements, after the outputs were validated */
+	opencl_kernel_measure(q, kernel, 3, NULL, dims, NULL);
+
 	printf("Time (avg over %u): %lu ns\n", opencl_get_iterations(),
 			time_avg / opencl_get_iterations());
 
 	/* Tear down */
 	clReleaseEvent(time);
-	clReleaseMemObject(clIn);
-	clReleaseMemObject(clOut);
+	opencl_release_buffer(clIn);
+	opencl_release_buffer(clOut);
 	clReleaseKernel(kernel);
 
 	opencl_teardown(&ctx, &q, &prg);